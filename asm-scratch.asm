@@ -1,25 +1,33 @@
-
     ; expr_codegen(e->left);
     ; expr_codegen(e->right);
 
-	; x ^ y
+	; x ^ y, by squaring: one step per bit of y
+
+	mov	x	%r11	; Base, squared every step
+	mov	y	%rdx	; Exponent, shifted down every step
+	mov	0x1	%rax	; Result
 
-	cmp	0x0	y	; Check if y is negative
-	js	.return_zero
-	
-	mov 0x0 %rdx
-	mov	0x1	%rax
- 
 .loop
-	dec	y
-	jz .exit
-	mul	y
-	jmp loop
+	test	%rdx	%rdx	; Stop once no bits are left, which also gives 1
+	jle	.exit		; for a negative y
+	test	0x1	%dl	; Multiply in the base for each set bit
+	je	.square
+	imul	%r11	%rax
+.square
+	imul	%r11	%r11
+	sar	0x1	%rdx
+	jmp	.loop
 
-.return_zero
-	mov	0x0	%rax
 .exit
 	; e->reg = e->left->reg
 	mov	%rax	x
 
-	; scratch_free(e->righ->reg)
\ No newline at end of file
+	; A constant y unrolls into a fixed chain of imul, squaring for each bit
+	; and multiplying for each set bit. A constant x of 2 becomes 1 << y:
+	;
+	;	mov	0x0	%rax
+	;	bts	y	%rax	; 1 << (y & 63)
+	;	cmp	0x3f	y	; y above 63, or negative, gives 0
+	;	cmova	0x0	%rax
+	;	cmp	0x0	y	; y of zero or less gives 1
+	;	cmovle	0x1	%rax
@@ -0,0 +1,82 @@
+#!/bin/sh
+
+# How to use this benchmark script:
+
+# Give run-benchmarks.sh the location of the compiler executable, a
+# directory of programs, and the option sets to compare, each as a single
+# argument. Every program is compiled with each set of options, linked
+# against the runtime library and run. The registers spilled, counted from
+# the compiler's verbose output, and the time taken to run are reported
+# for each, and every build of a program must print the same output. Each
+# build is run several times, RUNS or 5, and the fastest run is reported,
+# since slower ones only measure whatever else the machine was doing.
+
+# For example:
+#     run-benchmarks.sh ./bminor tests/benchmarks -O1 -O2
+
+if [ $# -lt 3 ]
+then
+	echo "Usage: $0 <compiler> <benchmark-dir> <options>..."
+	exit 1
+fi
+
+COMPILER=$1
+BENCHDIR=$2
+shift 2
+
+LIBRARY=$(dirname $0)/src/library.c
+RUNS=${RUNS:-5}
+
+RET=0
+
+for benchfile in ${BENCHDIR}/*.bminor
+do
+	name=${benchfile%.bminor}
+	reference=
+
+	for options in "$@"
+	do
+		if ! ${COMPILER} --codegen --verbose ${options} -o $name.s $benchfile > $name.log 2>&1 \
+			|| ! gcc $name.s ${LIBRARY} -o $name.exe
+		then
+			RET=1
+			echo "$benchfile ${options} failed to build"
+			cat $name.log
+			continue
+		fi
+
+		spilled=$(sed -n 's/^Allocated registers in .*: \([0-9]*\) spilled.*/\1/p' $name.log | awk '{ total += $1 } END { print total + 0 }')
+
+		fastest=
+
+		for run in $(seq ${RUNS})
+		do
+			start=$(date +%s%N)
+			$name.exe > $name.out
+			end=$(date +%s%N)
+
+			elapsed=$(( (end - start) / 1000000 ))
+
+			if [ -z "$fastest" ] || [ $elapsed -lt $fastest ]
+			then
+				fastest=$elapsed
+			fi
+		done
+
+		if [ -z "$reference" ]
+		then
+			reference=$name.expected
+			cp $name.out $reference
+		elif ! cmp -s $reference $name.out
+		then
+			RET=1
+			echo "$benchfile ${options} printed different output (INCORRECT)"
+		fi
+
+		echo "$benchfile ${options}: $spilled spilled, $fastest ms (fastest of ${RUNS})"
+	done
+
+	rm -f $name.s $name.exe $name.log $name.out $name.expected
+done
+
+return $RET
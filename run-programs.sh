@@ -0,0 +1,53 @@
+#!/bin/sh
+
+# How to use this test script:
+
+# Put programs into a directory like "tests/programs", each next to a
+# NAME.expected file holding exactly what it should print. Then give
+# run-programs.sh the location of the compiler executable, the test
+# directory, and any extra options to compile with. Each program is
+# compiled, linked against the runtime library and run, and its output
+# compared with what was expected.
+
+# For example:
+#     run-programs.sh $HOME/mycompiler/bminor tests/programs
+
+if [ $# -lt 2 ]
+then
+	echo "Usage: $0 <compiler> <test-dir> [options...]"
+	exit 1
+fi
+
+COMPILER=$1
+TESTDIR=$2
+shift 2
+
+LIBRARY=$(dirname $0)/src/library.c
+
+LINES=-------------------------------------------
+
+RET=0
+
+for testfile in ${TESTDIR}/*.bminor
+do
+	name=${testfile%.bminor}
+
+	if ${COMPILER} --codegen "$@" -o $name.s $testfile > $name.out 2>&1 \
+		&& gcc $name.s ${LIBRARY} -o $name.exe >> $name.out 2>&1 \
+		&& $name.exe > $name.out 2>&1 \
+		&& diff -u $name.expected $name.out > $name.diff
+	then
+		echo "$testfile success (as expected)"
+	else
+		RET=1
+		echo "$testfile failure (INCORRECT)"
+		echo ${LINES}
+		echo Your Output:
+		echo ${LINES}
+		cat $name.out
+		test -s $name.diff && cat $name.diff
+		echo ${LINES}
+	fi
+done
+
+return $RET
@@ -0,0 +1,52 @@
+#include "alias.h"
+
+#include <stdbool.h>
+
+#include "ir.h"
+
+struct object object_of(struct ir_value v)
+{
+    struct object o = {OBJECT_ANY, v};
+
+    if (v.kind == IR_VALUE_GLOBAL)
+        o.kind = OBJECT_GLOBAL;
+    else if (v.kind == IR_VALUE_SLOT)
+        o.kind = OBJECT_SLOT;
+
+    return o;
+}
+
+struct object base_object(struct ir_instr **defs, struct ir_value address)
+{
+    while (address.kind == IR_VALUE_TEMP && defs[address.number])
+    {
+        struct ir_instr *def = defs[address.number];
+
+        if (def->op == IR_ADDRESS_OF)
+            return object_of(def->a);
+
+        if (def->op == IR_PARAM)
+            return (struct object){OBJECT_PARAM, ir_none()};
+
+        if (def->op != IR_COPY)
+            break;
+
+        address = def->a;
+    }
+
+    return (struct object){OBJECT_ANY, ir_none()};
+}
+
+bool may_alias(struct object a, struct object b)
+{
+    if (a.kind == OBJECT_ANY || b.kind == OBJECT_ANY)
+        return true;
+
+    if (a.kind == OBJECT_SLOT || b.kind == OBJECT_SLOT)
+        return a.kind == b.kind && ir_value_equals(a.value, b.value);
+
+    if (a.kind == OBJECT_PARAM || b.kind == OBJECT_PARAM)
+        return true;
+
+    return ir_value_equals(a.value, b.value);
+}
@@ -0,0 +1,37 @@
+#ifndef ALIAS_H
+#define ALIAS_H
+
+#include <stdbool.h>
+
+#include "ir.h"
+
+// Memory is told apart by the object an access reaches. Arrays passed in as
+// parameters may be any global array or one another, but never an array in
+// this function's frame, which did not exist when they were passed
+typedef enum
+{
+    OBJECT_GLOBAL,
+    OBJECT_SLOT,
+    OBJECT_PARAM,
+    OBJECT_ANY
+} object_t;
+
+struct object
+{
+    object_t kind;
+
+    // The global or slot accessed
+    struct ir_value value;
+};
+
+// The object a load or store of a slot or global reaches
+struct object object_of(struct ir_value v);
+
+// Follows an array address back to where it came from through the
+// instruction defining each temporary, indexed by temporary number. Addresses
+// merged by a phi could be from anywhere
+struct object base_object(struct ir_instr **defs, struct ir_value address);
+
+bool may_alias(struct object a, struct object b);
+
+#endif
@@ -0,0 +1,59 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+struct arena_chunk
+{
+    struct arena_chunk *next;
+    max_align_t data[];
+};
+
+struct arena *arena_create()
+{
+    struct arena *a = malloc(sizeof(struct arena));
+
+    a->chunks = NULL;
+    a->used = 0;
+    a->capacity = 0;
+
+    return a;
+}
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+    // Keep every allocation aligned for any type
+    size = (size + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t);
+
+    if (a->used + size > a->capacity)
+    {
+        // Oversized requests get a chunk of their own
+        size_t capacity = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        struct arena_chunk *c = malloc(sizeof(struct arena_chunk) + capacity);
+
+        c->next = a->chunks;
+        a->chunks = c;
+        a->used = 0;
+        a->capacity = capacity;
+    }
+
+    void *p = (char *)a->chunks->data + a->used;
+    a->used += size;
+
+    memset(p, 0, size);
+    return p;
+}
+
+void arena_delete(struct arena *a)
+{
+    while (a->chunks)
+    {
+        struct arena_chunk *next = a->chunks->next;
+        free(a->chunks);
+        a->chunks = next;
+    }
+
+    free(a);
+}
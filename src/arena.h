@@ -0,0 +1,25 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+struct arena_chunk;
+
+// A bump allocator. Everything allocated from an arena is freed at once when
+// the arena is deleted, which suits data that lives exactly as long as a
+// compiler phase, like the IR.
+struct arena
+{
+    struct arena_chunk *chunks;
+    size_t used;
+    size_t capacity;
+};
+
+struct arena *arena_create();
+
+// Returns zeroed memory that lives until the arena is deleted
+void *arena_alloc(struct arena *a, size_t size);
+
+void arena_delete(struct arena *a);
+
+#endif
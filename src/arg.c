@@ -2,23 +2,99 @@
 #include <argp.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "arg.h"
 
 // Used by main to communicate with parse_opt
-struct arguments input_arguments = {"", "a.out", false, false, false, false, false, false};
+struct arguments input_arguments = {"",   NULL, false, false, false, false, false, false, false, false, 1,
+                                    NULL, 0,    true,  6,     false, 30,    4,     true,  false, true,  false};
 
 // The options we understand
 static struct argp_option options[] = {
     {"scan", 's', 0, 0, "Validates that the file scans correctly", 0},
     {"parse", 'p', 0, 0, "Validates that the input file parses correctly", 0},
     {"typecheck", 't', 0, 0, "Validates that the input file typechecks correctly", 0},
-    {"format", 'f', 0, 0, "Outputs a formatted version of the input source", 1},
+    {"codegen", 'c', 0, 0, "Generates x86-64 assembly for the input source", 0},
+    {"emit-ir", 'i', 0, 0, "Outputs the intermediate representation of the input source", 0},
+    {"format", 'f', "FLAG", OPTION_ARG_OPTIONAL,
+     "Outputs a formatted version of the input source. Written as -fFLAG, sets a code generation flag instead: "
+     "no-peephole, peephole-window=N, bounds-check, inline-limit=N, unroll-factor=N, no-vectorize, avx2, "
+     "no-reorder-blocks, or opt-info",
+     1},
     {"graph", 'g', 0, 0, "Outputs a Graphviz .dot file of the AST of the input source", 1},
     {"output", 'o', "FILE", 0, "Output to FILE instead of standard output", 2},
     {"verbose", 'v', 0, 0, "Produce verbose output", 2},
+    {"optimize", 'O', "LEVEL", 0, "Optimize at LEVEL, from 0 for none to 2 (default 1)", 2},
+    {"export", 'e', "NAME", 0, "Keep function NAME and everything it calls as an entry point", 3},
     {0}};
 
+// Code generation flags are given like gcc's, such as -fno-peephole
+static void parse_flag(struct argp_state *state, struct arguments *arguments, char *flag)
+{
+    char *end;
+
+    if (strcmp(flag, "no-peephole") == 0)
+    {
+        arguments->peephole = false;
+    }
+    else if (strcmp(flag, "peephole") == 0)
+    {
+        arguments->peephole = true;
+    }
+    else if (strncmp(flag, "peephole-window=", 16) == 0)
+    {
+        arguments->peephole_window = strtol(flag + 16, &end, 10);
+        if (*end || flag[16] == '\0' || arguments->peephole_window < 1)
+            argp_error(state, "peephole window must be a positive number");
+    }
+    else if (strcmp(flag, "bounds-check") == 0)
+    {
+        arguments->bounds_check = true;
+    }
+    else if (strncmp(flag, "inline-limit=", 13) == 0)
+    {
+        arguments->inline_limit = strtol(flag + 13, &end, 10);
+        if (*end || flag[13] == '\0' || arguments->inline_limit < 0)
+            argp_error(state, "inline limit must be a number of at least 0");
+    }
+    else if (strncmp(flag, "unroll-factor=", 14) == 0)
+    {
+        arguments->unroll_factor = strtol(flag + 14, &end, 10);
+        if (*end || flag[14] == '\0' || arguments->unroll_factor < 1)
+            argp_error(state, "unroll factor must be a positive number");
+    }
+    else if (strcmp(flag, "no-vectorize") == 0)
+    {
+        arguments->vectorize = false;
+    }
+    else if (strcmp(flag, "vectorize") == 0)
+    {
+        arguments->vectorize = true;
+    }
+    else if (strcmp(flag, "avx2") == 0)
+    {
+        arguments->avx2 = true;
+    }
+    else if (strcmp(flag, "no-reorder-blocks") == 0)
+    {
+        arguments->reorder_blocks = false;
+    }
+    else if (strcmp(flag, "reorder-blocks") == 0)
+    {
+        arguments->reorder_blocks = true;
+    }
+    else if (strcmp(flag, "opt-info") == 0)
+    {
+        arguments->opt_info = true;
+    }
+    else
+    {
+        argp_error(state, "unknown flag '-f%s'", flag);
+    }
+}
+
 static error_t parse_opt(int key, char *arg, struct argp_state *state)
 {
     // Get the input argument from argp_parse, which we know is a pointer to our
@@ -43,11 +119,31 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
         arguments->typecheck = true;
         break;
     case 'f':
-        arguments->format = true;
+        if (!arg)
+            arguments->format = true;
+        else
+            parse_flag(state, arguments, arg);
+        break;
+    case 'c':
+        arguments->codegen = true;
+        break;
+    case 'i':
+        arguments->emit_ir = true;
         break;
     case 'o':
         arguments->output_file = arg;
         break;
+    case 'O': {
+        char *end;
+        arguments->optimize = strtol(arg, &end, 10);
+        if (*end || arguments->optimize < 0 || arguments->optimize > 2)
+            argp_error(state, "optimization level must be 0, 1 or 2");
+        break;
+    }
+    case 'e':
+        arguments->exports = realloc(arguments->exports, sizeof(char *) * (arguments->export_count + 1));
+        arguments->exports[arguments->export_count++] = arg;
+        break;
     case ARGP_KEY_ARG:
         if (state->arg_num >= 1)
             argp_usage(state); // Too many arguments
@@ -66,8 +162,11 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
 // The arg parser
 static struct argp argp = {options, parse_opt, "INPUT_SOURCE", NULL, NULL, NULL, NULL};
 
-// Helper function so we don't have to jugle as many input arguments
+// Helper function so we don't have to jugle as many input arguments. Long
+// options may also be written with a single dash, such as -scan or -emit-ir.
+// Anything that doesn't start a long option's name, such as -O1 or
+// -fno-peephole, is read as short options
 void parse_input_arguments(int argc, char *argv[])
 {
-    argp_parse(&argp, argc, argv, 0, 0, &input_arguments);
+    argp_parse(&argp, argc, argv, ARGP_LONG_ONLY, 0, &input_arguments);
 }
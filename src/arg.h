@@ -15,6 +15,33 @@ struct arguments
     bool format;
     bool graph;
     bool typecheck;
+    bool codegen;
+    bool emit_ir;
+    int optimize;
+
+    // Functions kept during dead function elimination even if main never
+    // calls them
+    char **exports;
+    int export_count;
+
+    // Code generation flags, each given as -fFLAG
+    bool peephole;
+    int peephole_window;
+    bool bounds_check;
+    int inline_limit;
+    int unroll_factor;
+
+    // Vectorize loops over arrays, with AVX2 instead of SSE2 when avx2 is set
+    bool vectorize;
+    bool avx2;
+
+    // Lay out blocks so likely paths fall through, and move cold ones out of
+    // line
+    bool reorder_blocks;
+
+    // Report what the optimizations did to the code, as remarks on standard
+    // output
+    bool opt_info;
 };
 
 extern struct arguments input_arguments;
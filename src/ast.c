@@ -41,7 +41,7 @@ struct decl *decl_create(char *name, struct type *type, struct expr *value, stru
 
 struct expr *expr_create(expr_t kind, struct expr *left, struct expr *right)
 {
-    struct expr *e = malloc(sizeof(struct expr));
+    struct expr *e = calloc(1, sizeof(struct expr));
 
     e->kind = kind;
     e->left = left;
@@ -52,7 +52,7 @@ struct expr *expr_create(expr_t kind, struct expr *left, struct expr *right)
 
 struct expr *expr_create_name(const char *n)
 {
-    struct expr *e = malloc(sizeof(struct expr));
+    struct expr *e = calloc(1, sizeof(struct expr));
 
     e->kind = EXPR_NAME;
     e->name = n;
@@ -62,7 +62,7 @@ struct expr *expr_create_name(const char *n)
 
 struct expr *expr_create_integer_literal(int c)
 {
-    struct expr *e = malloc(sizeof(struct expr));
+    struct expr *e = calloc(1, sizeof(struct expr));
 
     e->kind = EXPR_INTEGERLITERAL;
     e->literal_value = c;
@@ -72,7 +72,7 @@ struct expr *expr_create_integer_literal(int c)
 
 struct expr *expr_create_boolean_literal(int c)
 {
-    struct expr *e = malloc(sizeof(struct expr));
+    struct expr *e = calloc(1, sizeof(struct expr));
 
     e->kind = EXPR_BOOLEANLITERAL;
     e->literal_value = c;
@@ -82,7 +82,7 @@ struct expr *expr_create_boolean_literal(int c)
 
 struct expr *expr_create_char_literal(char c)
 {
-    struct expr *e = malloc(sizeof(struct expr));
+    struct expr *e = calloc(1, sizeof(struct expr));
 
     e->kind = EXPR_CHARLITERAL;
     e->literal_value = c;
@@ -92,7 +92,7 @@ struct expr *expr_create_char_literal(char c)
 
 struct expr *expr_create_string_literal(const char *str)
 {
-    struct expr *e = malloc(sizeof(struct expr));
+    struct expr *e = calloc(1, sizeof(struct expr));
 
     e->kind = EXPR_STRINGLITERAL;
     e->string_literal = str;
@@ -100,51 +100,137 @@ struct expr *expr_create_string_literal(const char *str)
     return e;
 }
 
-struct param_list *param_list_create(const char *name, struct type *type, struct param_list *next)
+// Builds a call expression, flattening the parser's EXPR_ARG chain into a
+// counted array of arguments
+struct expr *expr_create_call(struct expr *function, struct expr *args)
+{
+    struct expr *e = expr_create(EXPR_CALL, function, NULL);
+
+    for (struct expr *a = args; a; a = a->right)
+        e->arg_count++;
+
+    e->args = malloc(sizeof(struct expr *) * e->arg_count);
+
+    int i = 0;
+
+    while (args)
+    {
+        struct expr *next = args->right;
+        e->args[i++] = args->left;
+        free(args);
+        args = next;
+    }
+
+    return e;
+}
+
+// Reverses a chain of expressions linked through their right pointers, such as
+// an EXPR_ARG list, returning the new head of the chain
+struct expr *expr_list_reverse(struct expr *e)
+{
+    struct expr *reversed = NULL;
+
+    while (e)
+    {
+        struct expr *next = e->right;
+        e->right = reversed;
+        reversed = e;
+        e = next;
+    }
+
+    return reversed;
+}
+
+// Initializers hold either a chain of EXPR_ARG nodes wrapping each value, or a
+// chain of nested EXPR_INITIALIZER nodes linked through their right pointers.
+// Returns the value a link of either chain holds
+struct expr *initializer_element(struct expr *n)
+{
+    return n->kind == EXPR_ARG ? n->left : n;
+}
+
+// The expression inside any parentheses around it
+struct expr *expr_ungroup(struct expr *e)
+{
+    while (e && e->kind == EXPR_GROUP)
+        e = e->left;
+
+    return e;
+}
+
+// Whether the expression, once ungrouped, names the given symbol
+bool expr_is_name_of(struct expr *e, struct symbol *s)
+{
+    e = expr_ungroup(e);
+    return e && e->kind == EXPR_NAME && e->symbol == s;
+}
+
+struct param_list *param_list_create()
 {
     struct param_list *p = malloc(sizeof(struct param_list));
 
-    p->name = name;
-    p->next = next;
-    p->type = type;
+    p->items = NULL;
+    p->count = 0;
+    p->capacity = 0;
 
     return p;
 }
 
+void param_list_append(struct param_list *p, const char *name, struct type *type)
+{
+    if (p->count == p->capacity)
+    {
+        p->capacity = p->capacity ? p->capacity * 2 : 4;
+        p->items = realloc(p->items, sizeof(struct param) * p->capacity);
+    }
+
+    struct param *item = &p->items[p->count++];
+
+    item->name = name;
+    item->type = type;
+    item->symbol = NULL;
+}
+
+int param_list_count(struct param_list *p)
+{
+    return p ? p->count : 0;
+}
+
 struct param_list *param_list_copy(struct param_list *p)
 {
     if (!p)
         return NULL;
 
-    struct param_list *pl = (struct param_list *)malloc(sizeof(struct param_list));
+    struct param_list *pl = malloc(sizeof(struct param_list));
 
-    pl->name = p->name;
-    pl->symbol = p->symbol;
-    pl->type = type_copy(p->type);
+    pl->count = p->count;
+    pl->capacity = p->count;
+    pl->items = malloc(sizeof(struct param) * p->count);
 
-    pl->next = param_list_copy(p->next);
+    for (int i = 0; i < p->count; i++)
+    {
+        pl->items[i].name = p->items[i].name;
+        pl->items[i].symbol = p->items[i].symbol;
+        pl->items[i].type = type_copy(p->items[i].type);
+    }
 
     return pl;
 }
 
 bool param_list_equals(struct param_list *a, struct param_list *b)
 {
-    // Symbols don't have to match, just the types
-
-    // Both NULL means they're equal
-    if (!a && !b)
-        return true;
-
-    // One or the other null? Not equal
-    if (!a || !b)
+    // Symbols don't have to match, just the types. A missing list is the same
+    // as an empty one
+    if (param_list_count(a) != param_list_count(b))
         return false;
 
-    // Make sure types match
-    if (!type_equals(a->type, b->type))
-        return false;
+    for (int i = 0; i < param_list_count(a); i++)
+    {
+        if (!type_equals(a->items[i].type, b->items[i].type))
+            return false;
+    }
 
-    // And recurse to the next parameter
-    return param_list_equals(a->next, b->next);
+    return true;
 }
 
 void param_list_delete(struct param_list *p)
@@ -152,11 +238,11 @@ void param_list_delete(struct param_list *p)
     if (!p)
         return;
 
-    p->name = NULL;
-    p->symbol = NULL;
-    p->type = NULL;
+    for (int i = 0; i < p->count; i++)
+        type_delete(p->items[i].type);
 
-    param_list_delete(p->next);
+    free(p->items);
+    free(p);
 }
 
 struct stmt *stmt_create(stmt_t kind, struct decl *decl, struct expr *init_expr, struct expr *expr,
@@ -252,3 +338,11 @@ void type_delete(struct type *t)
     free(t);
     t = NULL;
 }
+
+int type_cells(struct type *t)
+{
+    if (t->kind == TYPE_ARRAY)
+        return t->size * type_cells(t->subtype);
+
+    return 1;
+}
@@ -6,6 +6,7 @@
 
 struct expr;
 struct stmt;
+struct symbol;
 struct type;
 
 // === decl ===
@@ -77,8 +78,13 @@ struct expr
     const char *string_literal;
     struct symbol *symbol;
 
-    // Used during code generation
-    int reg;
+    // Used by function calls
+    struct expr **args;
+    int arg_count;
+
+    // Set during typechecking. Literals created by later passes leave it
+    // empty, since their kind already determines their type
+    struct type *type;
 };
 
 struct expr *expr_create(expr_t kind, struct expr *left, struct expr *right);
@@ -93,17 +99,39 @@ struct expr *expr_create_char_literal(char c);
 
 struct expr *expr_create_string_literal(const char *str);
 
+struct expr *expr_create_call(struct expr *function, struct expr *args);
+
+struct expr *expr_list_reverse(struct expr *e);
+
+struct expr *initializer_element(struct expr *n);
+
+struct expr *expr_ungroup(struct expr *e);
+
+bool expr_is_name_of(struct expr *e, struct symbol *s);
+
 // == param_list ===
 
-struct param_list
+struct param
 {
     const char *name;
     struct type *type;
     struct symbol *symbol;
-    struct param_list *next;
 };
 
-struct param_list *param_list_create(const char *name, struct type *type, struct param_list *next);
+// Parameters are kept in a counted, contiguous array so that arity checks are
+// constant time and comparing two lists is a single loop
+struct param_list
+{
+    struct param *items;
+    int count;
+    int capacity;
+};
+
+struct param_list *param_list_create();
+
+void param_list_append(struct param_list *p, const char *name, struct type *type);
+
+int param_list_count(struct param_list *p);
 
 struct param_list *param_list_copy(struct param_list *p);
 
@@ -185,4 +213,8 @@ struct type *type_copy(struct type *t);
 
 void type_delete(struct type *t);
 
+// The number of 8 byte cells a value of the type occupies at runtime. Arrays of
+// arrays are laid out contiguously one row after another
+int type_cells(struct type *t);
+
 #endif
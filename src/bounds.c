@@ -0,0 +1,708 @@
+#include "bounds.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dominance.h"
+#include "ir.h"
+
+// Every temporary is given the interval of values it may hold. The intervals
+// start out empty and grow as blocks are visited in reverse postorder until
+// nothing changes. A value entering a phi over an edge that leaves a branch
+// is narrowed by the branch's condition first, which is what bounds a loop's
+// counter by its exit test. Counters would otherwise take as many rounds to
+// settle as the loop has iterations, so a phi that keeps growing is widened in
+// a few steps, first to a bound far enough from the edge of the integers that
+// adding to it can't wrap around, then to the edge itself. Going over the
+// function again a couple of times afterwards wins back some of what widening
+// gave away.
+//
+// Checks are then removed walking down the dominator tree, where the branches
+// taken to reach a block and the checks already passed on the way bound the
+// values further.
+
+struct range
+{
+    int64_t lo;
+    int64_t hi;
+};
+
+// A phi is widened after growing this many times
+#define WIDEN_AFTER 3
+
+#define WIDE_BOUND ((int64_t)1 << 62)
+
+#define NARROWING_PASSES 2
+
+// How far back a value entering a phi is followed through blocks with a single
+// predecessor, looking for branches that bound it
+#define EDGE_HOPS 4
+
+// How many definitions back a check's index is followed to find a tighter
+// bound from what is known about their operands
+#define REFINE_DEPTH 3
+
+// A bound known to hold on a temporary in the part of the dominator tree
+// being visited
+struct fact
+{
+    int64_t temp;
+    struct range range;
+};
+
+// The state of the function being analysed
+static struct ir_instr **defs = NULL;
+static struct range *ranges = NULL;
+static int *growth = NULL;
+
+// What ranges can't grow past while they are being worked out again
+static struct range *limits = NULL;
+
+static struct fact *facts = NULL;
+static int fact_count = 0;
+static int fact_capacity = 0;
+
+static int checks_removed = 0;
+
+// ======
+// Ranges
+// ======
+
+static const struct range full = {INT64_MIN, INT64_MAX};
+static const struct range empty = {1, 0};
+
+static bool range_is_empty(struct range r)
+{
+    return r.lo > r.hi;
+}
+
+static struct range range_single(int64_t n)
+{
+    struct range r = {n, n};
+    return r;
+}
+
+static struct range range_join(struct range a, struct range b)
+{
+    if (range_is_empty(a))
+        return b;
+
+    if (range_is_empty(b))
+        return a;
+
+    struct range r = {a.lo < b.lo ? a.lo : b.lo, a.hi > b.hi ? a.hi : b.hi};
+    return r;
+}
+
+static struct range range_intersect(struct range a, struct range b)
+{
+    struct range r = {a.lo > b.lo ? a.lo : b.lo, a.hi < b.hi ? a.hi : b.hi};
+    return range_is_empty(r) ? empty : r;
+}
+
+static bool range_equals(struct range a, struct range b)
+{
+    if (range_is_empty(a) || range_is_empty(b))
+        return range_is_empty(a) && range_is_empty(b);
+
+    return a.lo == b.lo && a.hi == b.hi;
+}
+
+static struct range range_of(struct ir_value v)
+{
+    if (v.kind == IR_VALUE_CONSTANT)
+        return range_single(v.number);
+
+    if (v.kind == IR_VALUE_TEMP)
+        return ranges[v.number];
+
+    return full;
+}
+
+// Arithmetic wraps around at 64 bits, so a bound that would overflow means
+// the result could be anything
+static struct range range_add(struct range a, struct range b)
+{
+    struct range r;
+
+    if (__builtin_add_overflow(a.lo, b.lo, &r.lo) || __builtin_add_overflow(a.hi, b.hi, &r.hi))
+        return full;
+
+    return r;
+}
+
+static struct range range_sub(struct range a, struct range b)
+{
+    struct range r;
+
+    if (__builtin_sub_overflow(a.lo, b.hi, &r.lo) || __builtin_sub_overflow(a.hi, b.lo, &r.hi))
+        return full;
+
+    return r;
+}
+
+static struct range range_mul(struct range a, struct range b)
+{
+    int64_t products[4];
+
+    if (__builtin_mul_overflow(a.lo, b.lo, &products[0]) || __builtin_mul_overflow(a.lo, b.hi, &products[1]) ||
+        __builtin_mul_overflow(a.hi, b.lo, &products[2]) || __builtin_mul_overflow(a.hi, b.hi, &products[3]))
+        return full;
+
+    struct range r = range_single(products[0]);
+
+    for (int p = 1; p < 4; p++)
+        r = range_join(r, range_single(products[p]));
+
+    return r;
+}
+
+// Division rounds towards zero, which keeps the order of the values divided
+// by a positive divisor. The remainder takes the sign of the dividend
+static struct range range_div(struct range a, struct range b)
+{
+    if (b.lo != b.hi || b.lo <= 0)
+        return full;
+
+    struct range r = {a.lo / b.lo, a.hi / b.lo};
+    return r;
+}
+
+static struct range range_mod(struct range a, struct range b)
+{
+    if (b.lo != b.hi || b.lo <= 0)
+        return full;
+
+    struct range r = {a.lo >= 0 ? 0 : -(b.lo - 1), b.lo - 1};
+
+    if (a.lo >= 0 && a.hi < r.hi)
+        r.hi = a.hi;
+
+    return r;
+}
+
+static struct range range_neg(struct range a)
+{
+    if (a.lo == INT64_MIN)
+        return full;
+
+    struct range r = {-a.hi, -a.lo};
+    return r;
+}
+
+// The range of an instruction's result from the ranges of its operands, which
+// is empty while any of them is still unknown
+static struct range transfer(struct ir_instr *i, struct range a, struct range b)
+{
+    switch (i->op)
+    {
+    case IR_COPY:
+    case IR_NEG:
+        if (range_is_empty(a))
+            return empty;
+
+        return i->op == IR_COPY ? a : range_neg(a);
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_DIV:
+    case IR_MOD:
+        if (range_is_empty(a) || range_is_empty(b))
+            return empty;
+
+        if (i->op == IR_ADD)
+            return range_add(a, b);
+        else if (i->op == IR_SUB)
+            return range_sub(a, b);
+        else if (i->op == IR_MUL)
+            return range_mul(a, b);
+        else if (i->op == IR_DIV)
+            return range_div(a, b);
+        else
+            return range_mod(a, b);
+    case IR_NOT:
+    case IR_AND:
+    case IR_OR:
+    case IR_LT:
+    case IR_LTE:
+    case IR_GT:
+    case IR_GTE:
+    case IR_EQ:
+    case IR_NE: {
+        struct range boolean = {0, 1};
+        return boolean;
+    }
+    default:
+        return full;
+    }
+}
+
+// ==========
+// Conditions
+// ==========
+
+static ir_op_t comparison_negate(ir_op_t op)
+{
+    switch (op)
+    {
+    case IR_LT:
+        return IR_GTE;
+    case IR_LTE:
+        return IR_GT;
+    case IR_GT:
+        return IR_LTE;
+    case IR_GTE:
+        return IR_LT;
+    case IR_EQ:
+        return IR_NE;
+    default:
+        return IR_EQ;
+    }
+}
+
+// The same comparison with its operands the other way around
+static ir_op_t comparison_swap(ir_op_t op)
+{
+    switch (op)
+    {
+    case IR_LT:
+        return IR_GT;
+    case IR_LTE:
+        return IR_GTE;
+    case IR_GT:
+        return IR_LT;
+    case IR_GTE:
+        return IR_LTE;
+    default:
+        return op;
+    }
+}
+
+// Narrows r, the range of a value known to compare with a value in other as
+// op says
+static struct range range_compare(struct range r, ir_op_t op, struct range other)
+{
+    if (range_is_empty(r) || range_is_empty(other))
+        return r;
+
+    switch (op)
+    {
+    case IR_LT:
+        if (other.hi == INT64_MIN)
+            return empty;
+
+        other.hi--;
+        // fall through
+    case IR_LTE:
+        if (other.hi < r.hi)
+            r.hi = other.hi;
+        break;
+    case IR_GT:
+        if (other.lo == INT64_MAX)
+            return empty;
+
+        other.lo++;
+        // fall through
+    case IR_GTE:
+        if (other.lo > r.lo)
+            r.lo = other.lo;
+        break;
+    case IR_EQ:
+        r = range_intersect(r, other);
+        break;
+    case IR_NE:
+        if (other.lo != other.hi)
+            break;
+
+        if (r.lo == r.hi && r.lo == other.lo)
+            return empty;
+
+        if (r.lo == other.lo)
+            r.lo++;
+        else if (r.hi == other.lo)
+            r.hi--;
+        break;
+    default:
+        break;
+    }
+
+    return range_is_empty(r) ? empty : r;
+}
+
+// The comparison a branch out of from makes true on the way to the block to,
+// or NULL if the branch doesn't compare anything. Sets taken to whether the
+// comparison holds along the edge
+static struct ir_instr *edge_condition(struct ir_block *from, struct ir_block *to, bool *taken)
+{
+    struct ir_instr *branch = from->last;
+
+    if (!branch || branch->op != IR_BRANCH || branch->target == branch->target_false ||
+        branch->a.kind != IR_VALUE_TEMP)
+        return NULL;
+
+    struct ir_instr *condition = defs[branch->a.number];
+
+    if (!condition || !ir_op_is_comparison(condition->op))
+        return NULL;
+
+    *taken = branch->target == to;
+    return condition;
+}
+
+// Narrows the range of v by what the comparison says about it, given whether
+// it held
+static struct range range_assume(struct range r, struct ir_value v, struct ir_instr *condition, bool taken)
+{
+    ir_op_t op = taken ? condition->op : comparison_negate(condition->op);
+
+    if (ir_value_equals(condition->a, v))
+        r = range_compare(r, op, range_of(condition->b));
+
+    if (ir_value_equals(condition->b, v))
+        r = range_compare(r, comparison_swap(op), range_of(condition->a));
+
+    return r;
+}
+
+// ========
+// Analysis
+// ========
+
+static struct range phi_evaluate(struct ir_instr *phi)
+{
+    struct range r = empty;
+
+    for (int n = 0; n < phi->arg_count; n++)
+    {
+        struct range arg = range_of(phi->args[n]);
+        struct ir_instr *condition;
+        bool taken;
+
+        if (phi->args[n].kind != IR_VALUE_TEMP)
+        {
+            r = range_join(r, arg);
+            continue;
+        }
+
+        if ((condition = edge_condition(phi->sources[n], phi->block, &taken)))
+            arg = range_assume(arg, phi->args[n], condition, taken);
+
+        // A loop is entered through its preheader after the test of whether
+        // it runs at all, which is as good as a condition on the edge
+        struct ir_block *b = phi->sources[n];
+
+        for (int hops = 0; hops < EDGE_HOPS && b->pred_count == 1; hops++, b = b->preds[0])
+        {
+            if ((condition = edge_condition(b->preds[0], b, &taken)))
+                arg = range_assume(arg, phi->args[n], condition, taken);
+        }
+
+        r = range_join(r, arg);
+    }
+
+    return r;
+}
+
+static struct range evaluate(struct ir_instr *i)
+{
+    if (i->op == IR_PHI)
+        return phi_evaluate(i);
+
+    return transfer(i, range_of(i->a), range_of(i->b));
+}
+
+static const int64_t thresholds[] = {WIDE_BOUND, INT64_MAX - 1, INT64_MAX};
+
+#define THRESHOLD_COUNT (int)(sizeof(thresholds) / sizeof(thresholds[0]))
+
+// Widens a phi that keeps growing to the next of the thresholds past it. A
+// counter tested against an unknown bound stops one short of the largest
+// integer, where adding one to it can't wrap around yet
+static struct range widen(struct range old, struct range r)
+{
+    int t;
+
+    if (r.lo < old.lo)
+    {
+        for (t = 0; -thresholds[t] > r.lo && t < THRESHOLD_COUNT - 1; t++)
+            ;
+
+        r.lo = t == THRESHOLD_COUNT - 1 ? INT64_MIN : -thresholds[t];
+    }
+
+    if (r.hi > old.hi)
+    {
+        for (t = 0; thresholds[t] < r.hi; t++)
+            ;
+
+        r.hi = thresholds[t];
+    }
+
+    return r;
+}
+
+static bool is_threshold(int64_t bound)
+{
+    if (bound == INT64_MIN)
+        return true;
+
+    for (int t = 0; t < THRESHOLD_COUNT; t++)
+    {
+        if (bound == thresholds[t] || bound == -thresholds[t])
+            return true;
+    }
+
+    return false;
+}
+
+static bool block_propagate(struct ir_block *b)
+{
+    bool changed = false;
+
+    for (struct ir_instr *i = b->first; i; i = i->next)
+    {
+        if (i->dest.kind != IR_VALUE_TEMP)
+            continue;
+
+        if (growth[i->dest.number] < 0)
+            continue;
+
+        struct range old = ranges[i->dest.number];
+        struct range r = range_join(old, evaluate(i));
+
+        if (limits)
+            r = range_intersect(r, limits[i->dest.number]);
+
+        if (range_equals(old, r))
+            continue;
+
+        if (i->op == IR_PHI && !range_is_empty(old) && ++growth[i->dest.number] > WIDEN_AFTER)
+            r = widen(old, r);
+
+        ranges[i->dest.number] = r;
+        changed = true;
+    }
+
+    return changed;
+}
+
+// Evaluating again from the widened ranges can only give something at least
+// as tight, since each result was computed from ranges at least as wide
+static void block_narrow(struct ir_block *b)
+{
+    for (struct ir_instr *i = b->first; i; i = i->next)
+    {
+        if (i->dest.kind == IR_VALUE_TEMP)
+            ranges[i->dest.number] = range_intersect(ranges[i->dest.number], evaluate(i));
+    }
+}
+
+static void ranges_compute(struct ir_function *f)
+{
+    bool changed = true;
+
+    while (changed)
+    {
+        changed = false;
+
+        for (int n = 0; n < f->rpo_count; n++)
+            changed |= block_propagate(f->rpo[n]);
+    }
+
+    for (int pass = 0; pass < NARROWING_PASSES; pass++)
+    {
+        for (int n = 0; n < f->rpo_count; n++)
+            block_narrow(f->rpo[n]);
+    }
+}
+
+// Narrowing can't win back anything from values that only grew along with a
+// widened phi in a cycle of phis, each keeping the other wide, or that were
+// computed from a widened bound which overflowed. So the widened phis that
+// narrowing brought back from every threshold are held where it left them,
+// marked by a growth of -1, and everything else is worked out again from
+// nothing, never growing past the ranges it had before
+static void ranges_recompute(struct ir_function *f)
+{
+    limits = malloc(sizeof(struct range) * (f->temp_count ? f->temp_count : 1));
+
+    for (int t = 0; t < f->temp_count; t++)
+    {
+        limits[t] = ranges[t];
+
+        if (growth[t] > WIDEN_AFTER && !is_threshold(ranges[t].lo) && !is_threshold(ranges[t].hi))
+        {
+            growth[t] = -1;
+        }
+        else
+        {
+            growth[t] = 0;
+            ranges[t] = empty;
+        }
+    }
+
+    ranges_compute(f);
+
+    free(limits);
+    limits = NULL;
+}
+
+// ===========
+// Elimination
+// ===========
+
+static void fact_push(struct ir_value v, struct range r)
+{
+    if (v.kind != IR_VALUE_TEMP)
+        return;
+
+    if (fact_count == fact_capacity)
+    {
+        fact_capacity = fact_capacity ? fact_capacity * 2 : 64;
+        facts = realloc(facts, sizeof(struct fact) * fact_capacity);
+    }
+
+    facts[fact_count].temp = v.number;
+    facts[fact_count].range = r;
+    fact_count++;
+}
+
+static bool is_arithmetic(ir_op_t op)
+{
+    return op == IR_COPY || op == IR_ADD || op == IR_SUB || op == IR_MUL || op == IR_DIV || op == IR_MOD ||
+           op == IR_NEG;
+}
+
+// The range of v where the facts gathered so far hold. A value computed from
+// others is also bounded by what is known about them
+static struct range range_at(struct ir_value v, int depth)
+{
+    if (v.kind != IR_VALUE_TEMP)
+        return range_of(v);
+
+    struct range r = ranges[v.number];
+
+    for (int n = 0; n < fact_count; n++)
+    {
+        if (facts[n].temp == v.number)
+            r = range_intersect(r, facts[n].range);
+    }
+
+    struct ir_instr *def = defs[v.number];
+
+    if (depth > 0 && def && is_arithmetic(def->op))
+        r = range_intersect(r, transfer(def, range_at(def->a, depth - 1), range_at(def->b, depth - 1)));
+
+    return r;
+}
+
+// Entering a block from its only predecessor means the branch there went its
+// way, so its condition holds everywhere the block dominates
+static void condition_assume(struct ir_block *b)
+{
+    struct ir_instr *condition;
+    bool taken;
+
+    if (b->pred_count != 1 || !(condition = edge_condition(b->preds[0], b, &taken)))
+        return;
+
+    struct ir_value a = condition->a;
+    struct ir_value c = condition->b;
+
+    fact_push(a, range_assume(range_at(a, 0), a, condition, taken));
+    fact_push(c, range_assume(range_at(c, 0), c, condition, taken));
+}
+
+static void block_eliminate(struct ir_block *b)
+{
+    int saved = fact_count;
+    struct ir_instr *next;
+
+    condition_assume(b);
+
+    for (struct ir_instr *i = b->first; i; i = next)
+    {
+        next = i->next;
+
+        if (i->op != IR_CHECK)
+            continue;
+
+        struct range bounds = {0, i->b.number ? i->b.number - 1 : INT64_MAX};
+        struct range index = range_at(i->a, REFINE_DEPTH);
+
+        if (!range_is_empty(index) && index.lo >= bounds.lo && index.hi <= bounds.hi)
+        {
+            ir_remove(i);
+            checks_removed++;
+            continue;
+        }
+
+        // Once a check has been passed, the index is in bounds after it
+        fact_push(i->a, bounds);
+    }
+
+    for (int c = 0; c < b->child_count; c++)
+        block_eliminate(b->children[c]);
+
+    fact_count = saved;
+}
+
+int ir_function_bounds_eliminate(struct ir_function *f, bool remarks)
+{
+    int checks = 0;
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            if (i->op == IR_CHECK)
+                checks++;
+        }
+    }
+
+    if (!checks)
+        return 0;
+
+    ir_function_link(f);
+    ir_function_dominators(f);
+
+    defs = calloc(f->temp_count ? f->temp_count : 1, sizeof(struct ir_instr *));
+    ranges = malloc(sizeof(struct range) * (f->temp_count ? f->temp_count : 1));
+    growth = calloc(f->temp_count ? f->temp_count : 1, sizeof(int));
+
+    for (int t = 0; t < f->temp_count; t++)
+        ranges[t] = empty;
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            if (i->dest.kind == IR_VALUE_TEMP)
+                defs[i->dest.number] = i;
+        }
+    }
+
+    ranges_compute(f);
+    ranges_recompute(f);
+
+    checks_removed = 0;
+    block_eliminate(f->entry);
+
+    if (remarks)
+        printf("remark: %s: removed %d of %d bounds checks\n", f->name, checks_removed, checks);
+
+    free(defs);
+    free(ranges);
+    free(growth);
+    free(facts);
+    defs = NULL;
+    ranges = NULL;
+    growth = NULL;
+    facts = NULL;
+    fact_count = 0;
+    fact_capacity = 0;
+
+    return checks_removed;
+}
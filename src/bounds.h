@@ -0,0 +1,15 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <stdbool.h>
+
+struct ir_function;
+
+// Removes the array bounds checks of a function in SSA form that range
+// analysis proves can never fail, such as those on a loop counter kept in
+// bounds by the loop's condition, or on an index already checked against an
+// array at least as small. A summary is reported when remarks is set. Returns
+// how many checks were removed
+int ir_function_bounds_eliminate(struct ir_function *f, bool remarks);
+
+#endif
@@ -0,0 +1,244 @@
+#include "callgraph.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "arg.h"
+#include "ast.h"
+#include "hash_table.h"
+#include "stack.h"
+#include "symbol.h"
+
+// =======================
+// Call graph construction
+// =======================
+
+static struct callgraph_node *callgraph_node_get(struct callgraph *cg, const char *name)
+{
+    struct callgraph_node *n = hash_table_lookup(cg->nodes, name);
+
+    if (n)
+        return n;
+
+    n = malloc(sizeof(struct callgraph_node));
+
+    n->name = name;
+    n->definition = NULL;
+    n->callees = NULL;
+    n->callee_count = 0;
+    n->callee_capacity = 0;
+    n->reachable = false;
+
+    hash_table_insert(cg->nodes, name, n);
+
+    return n;
+}
+
+static void callgraph_edge(struct callgraph_node *caller, struct callgraph_node *callee)
+{
+    if (caller->callee_count == caller->callee_capacity)
+    {
+        caller->callee_capacity = caller->callee_capacity ? caller->callee_capacity * 2 : 4;
+        caller->callees = realloc(caller->callees, sizeof(struct callgraph_node *) * caller->callee_capacity);
+    }
+
+    caller->callees[caller->callee_count++] = callee;
+}
+
+// Adds an edge from caller for every function named in e. Calls are the only
+// way bminor refers to a function, so each name of function type is a callee
+static void expr_callgraph(struct callgraph *cg, struct callgraph_node *caller, struct expr *e)
+{
+    // Argument chains are walked iteratively, since they can be very long
+    while (e && e->kind == EXPR_ARG)
+    {
+        expr_callgraph(cg, caller, e->left);
+        e = e->right;
+    }
+
+    if (!e)
+        return;
+
+    if (e->kind == EXPR_NAME && e->symbol->type->kind == TYPE_FUNCTION)
+        callgraph_edge(caller, callgraph_node_get(cg, e->symbol->name));
+
+    expr_callgraph(cg, caller, e->left);
+    expr_callgraph(cg, caller, e->right);
+
+    for (int i = 0; i < e->arg_count; i++)
+        expr_callgraph(cg, caller, e->args[i]);
+}
+
+static void stmt_callgraph(struct callgraph *cg, struct callgraph_node *caller, struct stmt *s)
+{
+    for (; s; s = s->next)
+    {
+        if (s->decl)
+            expr_callgraph(cg, caller, s->decl->value);
+
+        expr_callgraph(cg, caller, s->init_expr);
+        expr_callgraph(cg, caller, s->expr);
+        expr_callgraph(cg, caller, s->next_expr);
+        stmt_callgraph(cg, caller, s->body);
+        stmt_callgraph(cg, caller, s->else_body);
+    }
+}
+
+// Functions are global, so prototypes and definitions are matched by name
+struct callgraph *callgraph_build(struct decl *ast)
+{
+    struct callgraph *cg = malloc(sizeof(struct callgraph));
+
+    cg->nodes = hash_table_create(0, 0);
+
+    for (struct decl *d = ast; d; d = d->next)
+    {
+        if (d->type->kind != TYPE_FUNCTION)
+            continue;
+
+        struct callgraph_node *n = callgraph_node_get(cg, d->name);
+
+        if (d->code)
+        {
+            n->definition = d;
+            stmt_callgraph(cg, n, d->code);
+        }
+    }
+
+    return cg;
+}
+
+struct callgraph_node *callgraph_lookup(struct callgraph *cg, const char *name)
+{
+    return hash_table_lookup(cg->nodes, name);
+}
+
+// ============
+// Reachability
+// ============
+
+void callgraph_mark_reachable(struct callgraph *cg, const char **roots, int root_count)
+{
+    stack worklist = stack_create();
+
+    for (int i = 0; i < root_count; i++)
+    {
+        struct callgraph_node *n = callgraph_lookup(cg, roots[i]);
+
+        if (n && !n->reachable)
+        {
+            n->reachable = true;
+            stack_push(worklist, n);
+        }
+    }
+
+    struct callgraph_node *n;
+
+    while ((n = stack_pop(worklist)))
+    {
+        for (int i = 0; i < n->callee_count; i++)
+        {
+            if (!n->callees[i]->reachable)
+            {
+                n->callees[i]->reachable = true;
+                stack_push(worklist, n->callees[i]);
+            }
+        }
+    }
+
+    stack_destroy(worklist);
+}
+
+// Removes the definitions of unreachable functions from the top level
+// declarations, returning the new head of the list
+struct decl *callgraph_prune(struct callgraph *cg, struct decl *ast, bool report)
+{
+    struct decl **link = &ast;
+    int removed = 0;
+
+    while (*link)
+    {
+        struct decl *d = *link;
+
+        if (d->type->kind == TYPE_FUNCTION && d->code && !callgraph_lookup(cg, d->name)->reachable)
+        {
+            if (report)
+                printf("Removed unreachable function '%s'\n", d->name);
+
+            *link = d->next;
+            removed++;
+            continue;
+        }
+
+        link = &d->next;
+    }
+
+    if (report)
+        printf("Removed %d unreachable function%s\n", removed, removed == 1 ? "" : "s");
+
+    return ast;
+}
+
+void callgraph_delete(struct callgraph *cg)
+{
+    char *key;
+    void *value;
+
+    hash_table_firstkey(cg->nodes);
+
+    while (hash_table_nextkey(cg->nodes, &key, &value))
+    {
+        struct callgraph_node *n = value;
+        free(n->callees);
+        free(n);
+    }
+
+    hash_table_delete(cg->nodes);
+    free(cg);
+}
+
+// =========================
+// Dead function elimination
+// =========================
+
+// Only functions reachable from main or from an exported entry point are kept.
+// A program without a main, such as a library, keeps every function unless
+// entry points are given explicitly
+struct decl *ast_prune(struct decl *ast)
+{
+    struct callgraph *cg = callgraph_build(ast);
+
+    const char **roots = malloc(sizeof(const char *) * (input_arguments.export_count + 1));
+    int root_count = 0;
+
+    for (int i = 0; i < input_arguments.export_count; i++)
+    {
+        struct callgraph_node *n = callgraph_lookup(cg, input_arguments.exports[i]);
+
+        // Exporting a name nothing defines would otherwise prune everything
+        if (!n || !n->definition)
+        {
+            printf("ERROR: Cannot export %s, as no function by that name is defined\n", input_arguments.exports[i]);
+            exit(1);
+        }
+
+        roots[root_count++] = input_arguments.exports[i];
+    }
+
+    struct callgraph_node *main_node = callgraph_lookup(cg, "main");
+
+    if (main_node && main_node->definition)
+        roots[root_count++] = "main";
+
+    if (root_count > 0)
+    {
+        callgraph_mark_reachable(cg, roots, root_count);
+        ast = callgraph_prune(cg, ast, input_arguments.verbose);
+    }
+
+    free(roots);
+    callgraph_delete(cg);
+
+    return ast;
+}
@@ -0,0 +1,38 @@
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+
+#include <stdbool.h>
+
+struct decl;
+struct hash_table;
+
+// A function in the call graph. Functions that are only ever prototyped, such
+// as those provided by the runtime library, have no definition
+struct callgraph_node
+{
+    const char *name;
+    struct decl *definition;
+    struct callgraph_node **callees;
+    int callee_count;
+    int callee_capacity;
+    bool reachable;
+};
+
+struct callgraph
+{
+    struct hash_table *nodes;
+};
+
+struct callgraph *callgraph_build(struct decl *ast);
+
+struct callgraph_node *callgraph_lookup(struct callgraph *cg, const char *name);
+
+void callgraph_mark_reachable(struct callgraph *cg, const char **roots, int root_count);
+
+struct decl *callgraph_prune(struct callgraph *cg, struct decl *ast, bool report);
+
+void callgraph_delete(struct callgraph *cg);
+
+struct decl *ast_prune(struct decl *ast);
+
+#endif
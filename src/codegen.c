@@ -1,455 +1,1686 @@
 
+#include <stdarg.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "arg.h"
 #include "ast.h"
 #include "codegen.h"
+#include "ir.h"
+#include "liveness.h"
+#include "peephole.h"
+#include "regalloc.h"
+#include "ssa.h"
 #include "symbol.h"
 
-// ========================
-// Scratch register control
-// ========================
+// Where generated assembly is written, standard output unless set otherwise
+FILE *codegen_output;
 
-static uint8_t registers = 0;
+// ===================
+// Labelling functions
+// ===================
+
+static int label_counter = 0;
+
+int label_create()
+{
+    return label_counter++;
+}
+
+const char *label_name(int label)
+{
+    // Neat trick to find out how large your buffer should be. snprintf will
+    // return the number of characters that would be written to a buffer if its
+    // writing to null
+    int buffer_size = snprintf(NULL, 0, ".L%d", label);
+    char *str = malloc(sizeof(char) * (buffer_size + 1));
+    sprintf(str, ".L%d", label);
+    return str;
+}
+
+// =======
+// Helpers
+// =======
+
+// Formats an operand into a new string, sized using snprintf's count of the
+// characters it would have written
+static const char *operand(const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    int buffer_size = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    char *str = malloc(sizeof(char) * (buffer_size + 1));
+
+    va_start(args, format);
+    vsprintf(str, format, args);
+    va_end(args);
+
+    return str;
+}
+
+// Globals and string literals are addressed relative to the instruction
+// pointer, so the program can be linked as a position independent executable
+static const char *rip_relative(const char *label)
+{
+    return operand("%s(%%rip)", label);
+}
+
+// The System V ABI registers used to pass the first six integer arguments
+const char *arg_register_name(int i)
+{
+    static const char *names[] = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
+
+    return names[i];
+}
+
+// Instructions in function bodies are collected until the function is
+// finished, so the peephole optimizer can improve them before they are written
+static struct asm_stream function_asm;
+
+static void print_asm(const char *command, const char *operand_1, const char *operand_2, const char *operand_3)
+{
+    asm_append(&function_asm, command, operand_1, operand_2, operand_3);
+}
+
+static void print_label(const char *label)
+{
+    asm_append_label(&function_asm, label);
+}
+
+// ===============
+// String literals
+// ===============
+
+// String literals are collected as they are used and emitted together into
+// .rodata once the rest of the program has been generated
+struct string_literal
+{
+    int label;
+    const char *text;
+};
+
+static struct string_literal *strings = NULL;
+static int string_count = 0;
+static int string_capacity = 0;
+
+static const char *string_label(const char *text)
+{
+    if (string_count == string_capacity)
+    {
+        string_capacity = string_capacity ? string_capacity * 2 : 16;
+        strings = realloc(strings, sizeof(struct string_literal) * string_capacity);
+    }
+
+    strings[string_count].label = label_create();
+    strings[string_count].text = text;
+
+    return label_name(strings[string_count++].label);
+}
+
+static void strings_codegen()
+{
+    if (!string_count)
+        return;
+
+    fprintf(codegen_output, "\t.section\t.rodata\n");
+
+    for (int i = 0; i < string_count; i++)
+        fprintf(codegen_output, "%s:\n\t.string\t\"%s\"\n", label_name(strings[i].label), strings[i].text);
+}
+
+// ====================
+// Global data emission
+// ====================
+
+// Globals with constant initializers are written directly into the data
+// sections of the executable, so nothing is computed at program startup and
+// large tables are only paged in as they are touched. Every value, including
+// each array element, takes an 8 byte cell, and arrays of arrays are laid out
+// contiguously one row after another.
+
+// Checks that a global's value is made only of constants, noting whether every
+// cell is zero and whether any cell holds a pointer to a string literal
+static bool data_scan(struct expr *e, bool *zero, bool *pointers)
+{
+    switch (e->kind)
+    {
+    case EXPR_INTEGERLITERAL:
+    case EXPR_BOOLEANLITERAL:
+    case EXPR_CHARLITERAL:
+        if (e->literal_value != 0)
+            *zero = false;
+        return true;
+    case EXPR_STRINGLITERAL:
+        *zero = false;
+        *pointers = true;
+        return true;
+    case EXPR_INITIALIZER:
+        for (struct expr *n = e->left; n; n = n->right)
+        {
+            if (!data_scan(initializer_element(n), zero, pointers))
+                return false;
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Values are written sixteen cells to a line to keep large tables compact
+static int data_column = 0;
+
+static void data_codegen(struct expr *e)
+{
+    if (e->kind == EXPR_INITIALIZER)
+    {
+        for (struct expr *n = e->left; n; n = n->right)
+            data_codegen(initializer_element(n));
+
+        return;
+    }
+
+    fprintf(codegen_output, data_column == 0 ? "\t.quad\t" : ", ");
+
+    if (e->kind == EXPR_STRINGLITERAL)
+        fprintf(codegen_output, "%s", string_label(e->string_literal));
+    else
+        fprintf(codegen_output, "%d", e->literal_value);
+
+    if (++data_column == 16)
+    {
+        fprintf(codegen_output, "\n");
+        data_column = 0;
+    }
+}
+
+static void global_codegen(struct decl *d)
+{
+    bool zero = true;
+    bool pointers = false;
+
+    if (d->value && !data_scan(d->value, &zero, &pointers))
+    {
+        printf("ERROR: Global '%s' must be initialized with a constant value\n", d->name);
+        exit(1);
+    }
+
+    int size = type_cells(d->type) * 8;
+
+    if (size == 0)
+    {
+        printf("ERROR: Global array '%s' must be declared with a size or an initializer\n", d->name);
+        exit(1);
+    }
+
+    // Zeroed storage takes no space in the executable. Globals that are never
+    // modified are read only, although data holding pointers still needs
+    // relocating when the program is loaded
+    if (zero)
+        fprintf(codegen_output, "\t.bss\n");
+    else if (d->symbol->reassigned)
+        fprintf(codegen_output, "\t.data\n");
+    else if (pointers)
+        fprintf(codegen_output, "\t.section\t.data.rel.ro,\"aw\"\n");
+    else
+        fprintf(codegen_output, "\t.section\t.rodata\n");
+
+    fprintf(codegen_output, "\t.globl\t%s\n", d->name);
+    fprintf(codegen_output, "\t.type\t%s, @object\n", d->name);
+    fprintf(codegen_output, "\t.size\t%s, %d\n", d->name, size);
+    fprintf(codegen_output, "\t.align\t8\n");
+    fprintf(codegen_output, "%s:\n", d->name);
+
+    if (zero)
+    {
+        fprintf(codegen_output, "\t.zero\t%d\n", size);
+        return;
+    }
+
+    data_codegen(d->value);
+
+    if (data_column != 0)
+    {
+        fprintf(codegen_output, "\n");
+        data_column = 0;
+    }
+}
+
+// ===============
+// Code generation
+// ===============
+
+// Functions are generated from their IR. Temporaries live in the registers
+// given to them by register allocation, and any left without one, which is
+// all of them at -O0, live in a home in the frame. %rax, %rdx and %r11 are
+// never allocated, so they are always free to load operands into.
+
+// The function currently being generated
+static struct ir_function *function = NULL;
+
+// The first frame cell of each slot, and the home of each temporary kept in
+// memory, or -1 for those in registers
+static int *slot_cells = NULL;
+static int *temp_homes = NULL;
+
+static int epilogue_label = 0;
+
+// Leaf functions that fit their frame in the 128 byte red zone below %rsp
+// don't set up %rbp at all, and those with nothing to restore return
+// straight from each return instruction
+static bool frameless = false;
+static bool return_directly = false;
+
+// Whether calls in tail position jump to the callee instead
+static bool tail_calls = false;
+
+// The callee-saved registers the function uses, restored from consecutive
+// frame cells before it returns
+static int saved_registers[REGISTER_COUNT];
+static int saved_count = 0;
+static int save_cells = 0;
+
+// Failed bounds checks jump out of line to code reporting the index, which is
+// placed after the rest of the function, with its cold blocks
+struct bounds_failure
+{
+    const char *label;
+    const char *index;
+    long size;
+};
+
+static struct bounds_failure *bounds_failures = NULL;
+static int bounds_failure_count = 0;
+
+// The System V ABI keeps signal handlers out of this much stack below %rsp,
+// so functions that make no calls can use it without moving %rsp
+#define RED_ZONE_CELLS 16
+
+// The caller-saved registers holding values live across each call, as a mask
+// indexed by instruction number, and the frame cell each register is saved
+// in while a call runs
+static int *call_saves = NULL;
+static int caller_cells[REGISTER_COUNT];
+
+// Frame cells count down from the frame pointer, or from the stack pointer
+// in functions without one
+static const char *cell_address(int cell)
+{
+    return operand("%d(%s)", -8 * (cell + 1), frameless ? "%rsp" : "%rbp");
+}
+
+// Where a slot or global lives. The cells of an array run upwards from its
+// lowest address, which is where the slot is addressed from
+static const char *location_codegen(struct ir_value v)
+{
+    if (v.kind == IR_VALUE_GLOBAL)
+        return rip_relative(v.name);
+
+    return cell_address(slot_cells[v.number] + function->slots[v.number].cells - 1);
+}
+
+static bool is_register(const char *operand)
+{
+    return operand[0] == '%';
+}
+
+// The register or frame home holding a temporary
+static const char *temp_location(struct ir_value v)
+{
+    if (function->registers && function->registers[v.number] >= 0)
+        return register_names[function->registers[v.number]];
+
+    return cell_address(temp_homes[v.number]);
+}
+
+// Immediates in most instructions are sign extended from 32 bits
+static bool value_is_immediate(struct ir_value v)
+{
+    return v.kind == IR_VALUE_CONSTANT && v.number >= INT32_MIN && v.number <= INT32_MAX;
+}
+
+// Copies between two operands, going through %rax when neither is a register
+static void move(const char *from, const char *to)
+{
+    if (strcmp(from, to) == 0)
+        return;
+
+    if (!is_register(from) && !is_register(to) && from[0] != '$')
+    {
+        print_asm("mov", from, "%rax", 0);
+        from = "%rax";
+    }
+
+    print_asm(from[0] == '$' && !is_register(to) ? "movq" : "mov", from, to, 0);
+}
+
+// Moves a value into the given register
+static void value_move(struct ir_value v, const char *reg)
+{
+    switch (v.kind)
+    {
+    case IR_VALUE_CONSTANT:
+        // Zeroing with xor would change the flags, which may be waiting for a
+        // branch. The peephole optimizer makes it an xor where it is safe
+        print_asm("mov", operand("$%ld", (long)v.number), reg, 0);
+        break;
+    case IR_VALUE_STRING:
+        print_asm("lea", rip_relative(string_label(v.name)), reg, 0);
+        break;
+    case IR_VALUE_TEMP:
+        move(temp_location(v), reg);
+        break;
+    default:
+        printf("ERROR: %s cannot be used as a value\n", ir_value_t_strings[v.kind]);
+        exit(1);
+    }
+}
+
+// Gives a register holding the value, loading it into scratch if it is not
+// already in one
+static const char *value_register(struct ir_value v, const char *scratch)
+{
+    if (v.kind == IR_VALUE_TEMP && is_register(temp_location(v)))
+        return temp_location(v);
+
+    value_move(v, scratch);
+    return scratch;
+}
+
+// Gives an operand an instruction can read directly, which may be a memory
+// home or an immediate, loading the value into scratch only when it has to be
+static const char *value_source(struct ir_value v, const char *scratch)
+{
+    if (value_is_immediate(v))
+        return operand("$%ld", (long)v.number);
+
+    if (v.kind == IR_VALUE_TEMP)
+        return temp_location(v);
+
+    value_move(v, scratch);
+    return scratch;
+}
+
+// The register a result should be computed in, which is the destination's
+// own register when it has one
+static const char *dest_register(struct ir_value dest, const char *scratch)
+{
+    const char *location = temp_location(dest);
+
+    return is_register(location) ? location : scratch;
+}
+
+static void dest_write(struct ir_value dest, const char *reg)
+{
+    move(reg, temp_location(dest));
+}
+
+static const char *block_label(struct ir_block *b)
+{
+    return label_name(b->label);
+}
+
+// The block a block falls through to, which is the next one laid out unless
+// that is emitted in the other section
+static struct ir_block *block_following(struct ir_block *b)
+{
+    return b->next && b->next->cold == b->cold ? b->next : NULL;
+}
+
+// The condition code a comparison tests for, or for its opposite when negated
+static const char *condition_code(ir_op_t op, bool negated)
+{
+    switch (op)
+    {
+    case IR_LT:
+        return negated ? "ge" : "l";
+    case IR_LTE:
+        return negated ? "g" : "le";
+    case IR_GT:
+        return negated ? "le" : "g";
+    case IR_GTE:
+        return negated ? "l" : "ge";
+    case IR_EQ:
+        return negated ? "ne" : "e";
+    default:
+        return negated ? "e" : "ne";
+    }
+}
+
+static const char *arithmetic_command(ir_op_t op)
+{
+    switch (op)
+    {
+    case IR_ADD:
+        return "add";
+    case IR_SUB:
+        return "sub";
+    case IR_MUL:
+        return "imul";
+    case IR_AND:
+        return "and";
+    default:
+        return "or";
+    }
+}
+
+// ==============
+// Parallel moves
+// ==============
+
+// Arguments going into their registers before a call, and parameters coming
+// out of theirs on entry, all move at once. A register may be both written by
+// one move and read by another, so the moves are ordered to read every
+// register before it is overwritten, breaking cycles through %rax.
+struct parallel_move
+{
+    const char *from;
+    const char *to;
+
+    // Set when the source is an address to be computed with lea
+    bool address;
+};
+
+static void parallel_move_codegen(struct parallel_move *moves, int count)
+{
+    // Moves into memory cannot disturb any register, so they go first
+    for (int m = 0; m < count; m++)
+    {
+        if (is_register(moves[m].to))
+            continue;
+
+        if (moves[m].address)
+        {
+            print_asm("lea", moves[m].from, "%rax", 0);
+            move("%rax", moves[m].to);
+        }
+        else
+        {
+            move(moves[m].from, moves[m].to);
+        }
+
+        moves[m].to = NULL;
+    }
+
+    // Then moves between registers, each once nothing still needs to read its
+    // destination
+    bool progress = true;
+
+    while (progress)
+    {
+        progress = false;
+        int blocked = -1;
+
+        for (int m = 0; m < count; m++)
+        {
+            if (!moves[m].to || !is_register(moves[m].from) || moves[m].address)
+                continue;
+
+            bool needed = false;
+
+            for (int other = 0; other < count; other++)
+            {
+                if (other != m && moves[other].to && !moves[other].address && strcmp(moves[other].from, moves[m].to) == 0)
+                    needed = true;
+            }
+
+            if (needed)
+            {
+                blocked = m;
+                continue;
+            }
+
+            move(moves[m].from, moves[m].to);
+            moves[m].to = NULL;
+            progress = true;
+        }
+
+        // Every remaining register move is part of a cycle. Setting aside the
+        // value in one destination lets the rest of the cycle go ahead
+        if (!progress && blocked >= 0)
+        {
+            const char *saved = moves[blocked].to;
+
+            print_asm("mov", saved, "%rax", 0);
+
+            for (int m = 0; m < count; m++)
+            {
+                if (moves[m].to && !moves[m].address && strcmp(moves[m].from, saved) == 0)
+                    moves[m].from = "%rax";
+            }
+
+            progress = true;
+        }
+    }
+
+    // Constants, addresses and values in memory last
+    for (int m = 0; m < count; m++)
+    {
+        if (!moves[m].to)
+            continue;
+
+        print_asm(moves[m].address ? "lea" : "mov", moves[m].from, moves[m].to, 0);
+    }
+}
+
+static struct parallel_move value_parallel_move(struct ir_value v, const char *to)
+{
+    struct parallel_move m = {NULL, to, false};
+
+    if (v.kind == IR_VALUE_STRING)
+    {
+        m.from = rip_relative(string_label(v.name));
+        m.address = true;
+    }
+    else if (v.kind == IR_VALUE_CONSTANT)
+    {
+        m.from = operand("$%ld", (long)v.number);
+    }
+    else
+    {
+        m.from = temp_location(v);
+    }
+
+    return m;
+}
+
+// Parameters are all taken out of their registers and stack slots at the
+// first of the function's param instructions
+static void params_codegen(struct ir_instr *first)
+{
+    struct parallel_move *moves = malloc(sizeof(struct parallel_move) * (function->param_count + 1));
+    int count = 0;
+
+    for (struct ir_instr *i = first; i; i = i->next)
+    {
+        if (i->op != IR_PARAM)
+            continue;
+
+        // Stack arguments sit above the return address and saved %rbp
+        const char *from = i->a.number < 6 ? arg_register_name(i->a.number)
+                           : frameless     ? operand("%d(%%rsp)", 8 + 8 * (int)(i->a.number - 6))
+                                           : operand("%d(%%rbp)", 16 + 8 * (int)(i->a.number - 6));
+
+        moves[count].from = from;
+        moves[count].to = temp_location(i->dest);
+        moves[count].address = false;
+        count++;
+    }
+
+    parallel_move_codegen(moves, count);
+    free(moves);
+}
+
+// Puts back the callee-saved registers and the caller's frame, leaving the
+// return address on top of the stack
+static void frame_restore()
+{
+    for (int s = 0; s < saved_count; s++)
+        print_asm("mov", cell_address(save_cells + s), register_names[saved_registers[s]], 0);
+
+    if (!frameless)
+    {
+        print_asm("mov", "%rbp", "%rsp", 0);
+        print_asm("pop", "%rbp", 0, 0);
+    }
+}
+
+// From -O1 on, a call in tail position reuses the frame of the function
+// making it. The arguments are moved into their registers while the frame is
+// still there to read them from, then the frame is taken down and the callee
+// jumped to, so it returns straight to this function's caller. Arguments
+// passed on the stack would need the caller's stack arguments overwritten,
+// so calls with more than six are left as they are
+static bool is_tail_call(struct ir_instr *i)
+{
+    return tail_calls && i->op == IR_CALL && i->arg_count <= 6 && ir_tail_return(i);
+}
+
+static void tail_call_codegen(struct ir_instr *i)
+{
+    struct parallel_move moves[6];
+    int count = 0;
+
+    for (int a = 0; a < i->arg_count; a++)
+        moves[count++] = value_parallel_move(i->args[a], arg_register_name(a));
+
+    parallel_move_codegen(moves, count);
+    frame_restore();
+    print_asm("jmp", i->callee, 0, 0);
+}
+
+static void call_codegen(struct ir_instr *i, const char *callee, struct ir_value *args, int arg_count)
+{
+    // Only the caller-saved registers still needed after the call are saved,
+    // each to its own cell in the frame rather than pushed, so the stack keeps
+    // its alignment
+    int saves = call_saves[i->number];
+
+    for (int r = 0; r < REGISTER_COUNT; r++)
+    {
+        if (saves & 1 << r)
+            print_asm("mov", register_names[r], cell_address(caller_cells[r]), 0);
+    }
+
+    // Arguments past the sixth are pushed right to left, with padding first
+    // if needed to keep the stack 16 byte aligned at the call
+    int stack_args = arg_count > 6 ? arg_count - 6 : 0;
+    int padding = stack_args % 2;
+
+    if (padding)
+        print_asm("sub", "$8", "%rsp", 0);
+
+    for (int a = arg_count - 1; a >= 6; a--)
+        print_asm("pushq", value_source(args[a], "%rax"), 0, 0);
+
+    struct parallel_move moves[6];
+    int count = 0;
+
+    for (int a = 0; a < arg_count && a < 6; a++)
+        moves[count++] = value_parallel_move(args[a], arg_register_name(a));
+
+    parallel_move_codegen(moves, count);
+
+    print_asm("call", callee, 0, 0);
+
+    if (stack_args + padding)
+        print_asm("add", operand("$%d", 8 * (stack_args + padding)), "%rsp", 0);
+
+    for (int r = 0; r < REGISTER_COUNT; r++)
+    {
+        if (saves & 1 << r)
+            print_asm("mov", cell_address(caller_cells[r]), register_names[r], 0);
+    }
+
+    if (i->dest.kind != IR_VALUE_NONE)
+        dest_write(i->dest, "%rax");
+}
+
+// ============
+// Instructions
+// ============
+
+// How many times each temporary is read in the function being generated
+static int *temp_uses = NULL;
+
+// A comparison is fused with the branch that follows it when the branch is
+// its only use. Only copies can come between them, which were placed there
+// when leaving SSA form and don't change the flags
+static bool comparison_is_fused(struct ir_instr *i)
+{
+    if (!ir_op_is_comparison(i->op) || i->dest.kind != IR_VALUE_TEMP || temp_uses[i->dest.number] != 1)
+        return false;
+
+    struct ir_instr *next = i->next;
+
+    while (next && next->op == IR_COPY)
+        next = next->next;
+
+    return next && next->op == IR_BRANCH && ir_value_equals(next->a, i->dest);
+}
+
+// The comparison a branch jumps on directly, if it was fused with one
+static struct ir_instr *branch_comparison(struct ir_instr *branch)
+{
+    struct ir_instr *prev = branch->prev;
+
+    while (prev && prev->op == IR_COPY)
+        prev = prev->prev;
+
+    return prev && comparison_is_fused(prev) ? prev : NULL;
+}
+
+static const char *element_address(struct ir_instr *i)
+{
+    const char *base = value_register(i->a, "%rax");
+
+    if (value_is_immediate(i->b))
+        return operand("%ld(%s)", 8 * (long)i->b.number, base);
+
+    return operand("(%s,%s,8)", base, value_register(i->b, "%r11"));
+}
+
+// Constant exponents up to this are unrolled, which takes at most two
+// multiplications per bit
+#define POWER_UNROLL_LIMIT 1024
+
+// Powers are computed inline by squaring, in the scratch registers, taking a
+// step for each bit of the exponent. Exponents below one give one, and
+// products wrap around, matching integer_power in the runtime library
+static void power_codegen(struct ir_instr *i)
+{
+    if (i->b.kind == IR_VALUE_CONSTANT && i->b.number <= POWER_UNROLL_LIMIT)
+    {
+        if (i->b.number <= 0)
+        {
+            print_asm("mov", "$1", "%rax", 0);
+        }
+        else
+        {
+            // Square for each bit below the top one, multiplying in the base
+            // again for each that is set
+            const char *base = value_register(i->a, "%r11");
+
+            move(base, "%rax");
+
+            for (int bit = 62 - __builtin_clzll(i->b.number); bit >= 0; bit--)
+            {
+                print_asm("imul", "%rax", "%rax", 0);
+
+                if (i->b.number >> bit & 1)
+                    print_asm("imul", base, "%rax", 0);
+            }
+        }
+
+        dest_write(i->dest, "%rax");
+        return;
+    }
+
+    if (i->a.kind == IR_VALUE_CONSTANT && i->a.number == 2)
+    {
+        // Powers of two set a single bit. Exponents past 63 shift it out
+        // entirely, and bts only looks at the low six bits, so those and the
+        // exponents below one are picked out with conditional moves
+        value_move(i->b, "%r11");
+        print_asm("mov", "$0", "%rax", 0);
+        print_asm("bts", "%r11", "%rax", 0);
+        print_asm("mov", "$0", "%rdx", 0);
+        print_asm("cmp", "$63", "%r11", 0);
+        print_asm("cmova", "%rdx", "%rax", 0);
+        print_asm("mov", "$1", "%rdx", 0);
+        print_asm("cmp", "$0", "%r11", 0);
+        print_asm("cmovle", "%rdx", "%rax", 0);
+        dest_write(i->dest, "%rax");
+        return;
+    }
+
+    const char *loop = label_name(label_create());
+    const char *square = label_name(label_create());
+    const char *done = label_name(label_create());
+
+    value_move(i->a, "%r11");
+    value_move(i->b, "%rdx");
+    print_asm("mov", "$1", "%rax", 0);
+
+    print_label(loop);
+    print_asm("test", "%rdx", "%rdx", 0);
+    print_asm("jle", done, 0, 0);
+    print_asm("test", "$1", "%dl", 0);
+    print_asm("je", square, 0, 0);
+    print_asm("imul", "%r11", "%rax", 0);
+
+    print_label(square);
+    print_asm("imul", "%r11", "%r11", 0);
+    print_asm("sar", "$1", "%rdx", 0);
+    print_asm("jmp", loop, 0, 0);
+
+    print_label(done);
+    dest_write(i->dest, "%rax");
+}
+
+// A divisor's magic number, which the dividend is multiplied by, keeping
+// the high half of the product, before being shifted right by shift
+struct magic
+{
+    int64_t multiplier;
+    int shift;
+};
+
+// Finds the smallest magic number for a signed divisor whose magnitude is at
+// least two, as described by Granlund and Montgomery and in Hacker's Delight
+static struct magic signed_magic(int64_t d)
+{
+    const uint64_t two63 = UINT64_C(1) << 63;
+    uint64_t ad = d < 0 ? -(uint64_t)d : (uint64_t)d;
+    uint64_t t = two63 + ((uint64_t)d >> 63);
+
+    // The largest dividend whose remainder is ad - 1, bounding the error
+    uint64_t anc = t - 1 - t % ad;
+
+    uint64_t q1 = two63 / anc;
+    uint64_t r1 = two63 - q1 * anc;
+    uint64_t q2 = two63 / ad;
+    uint64_t r2 = two63 - q2 * ad;
+    uint64_t delta;
+    int p = 63;
+
+    // Raises the power of two until 2^p / ad is precise enough for every
+    // dividend, carrying the quotients and remainders of 2^p / anc and
+    // 2^p / ad along with it
+    do
+    {
+        p++;
+
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc)
+        {
+            q1++;
+            r1 -= anc;
+        }
+
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad)
+        {
+            q2++;
+            r2 -= ad;
+        }
+
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    uint64_t multiplier = q2 + 1;
+
+    return (struct magic){(int64_t)(d < 0 ? -multiplier : multiplier), p - 64};
+}
+
+// Divides %rax by a power of two, 2^k, rounding towards zero. Negative
+// dividends are biased by 2^k - 1 first, taken from the top k bits of their
+// sign. The biased dividend is left in %rax and the quotient in %rdx
+static void power_of_two_division(const char *n, int k)
+{
+    print_asm("mov", n, "%rax", 0);
+
+    if (k > 1)
+        print_asm("sar", "$63", "%rax", 0);
+
+    print_asm("shr", operand("$%d", 64 - k), "%rax", 0);
+    print_asm("add", n, "%rax", 0);
+    print_asm("mov", "%rax", "%rdx", 0);
+    print_asm("sar", operand("$%d", k), "%rdx", 0);
+}
+
+// Computes the quotient by a divisor other than a power of two in %rdx,
+// from the high half of the dividend times the divisor's magic number,
+// corrected when the multiplier has the opposite sign to the divisor and
+// rounded towards zero by adding one to negative quotients
+static void magic_division(const char *n, int64_t d)
+{
+    struct magic m = signed_magic(d);
+
+    print_asm("mov", operand("$%ld", (long)m.multiplier), "%rax", 0);
+    print_asm("imul", n, 0, 0);
+
+    if (d > 0 && m.multiplier < 0)
+        print_asm("add", n, "%rdx", 0);
+    else if (d < 0 && m.multiplier > 0)
+        print_asm("sub", n, "%rdx", 0);
+
+    if (m.shift > 0)
+        print_asm("sar", operand("$%d", m.shift), "%rdx", 0);
+
+    print_asm("mov", "%rdx", "%rax", 0);
+    print_asm("shr", "$63", "%rax", 0);
+    print_asm("add", "%rax", "%rdx", 0);
+}
+
+// Division by a constant is done with shifts and multiplications, which take
+// a few cycles where idiv takes tens. Dividing by zero, by -1 or by the most
+// negative integer still uses idiv, so the traps of the first two happen at
+// runtime as they would otherwise
+static void division_codegen(struct ir_instr *i)
+{
+    int64_t d = i->b.number;
+
+    if (i->b.kind != IR_VALUE_CONSTANT || d == 0 || d == -1 || d == INT64_MIN)
+    {
+        // The dividend is sign extended into %rdx:%rax, and idiv leaves the
+        // quotient in %rax and the remainder in %rdx
+        value_move(i->a, "%rax");
+        print_asm("cqo", 0, 0, 0);
+
+        if (i->b.kind == IR_VALUE_TEMP && !is_register(temp_location(i->b)))
+            print_asm("idivq", temp_location(i->b), 0, 0);
+        else
+            print_asm("idiv", value_register(i->b, "%r11"), 0, 0);
+
+        dest_write(i->dest, i->op == IR_DIV ? "%rax" : "%rdx");
+        return;
+    }
+
+    if (d == 1)
+    {
+        if (i->op == IR_DIV)
+            value_move(i->a, "%rax");
+        else
+            print_asm("mov", "$0", "%rax", 0);
 
-int scratch_alloc()
-{
-    uint8_t r = 1;
+        dest_write(i->dest, "%rax");
+        return;
+    }
 
-    for (int i = 0; i <= 6; i++)
+    // The dividend is read several times, so it is kept in a register
+    const char *n = value_register(i->a, "%r11");
+    uint64_t ad = d < 0 ? -(uint64_t)d : (uint64_t)d;
+
+    if ((ad & (ad - 1)) == 0)
     {
-        if ((registers & r) == 0)
+        int k = __builtin_ctzll(ad);
+
+        power_of_two_division(n, k);
+
+        if (i->op == IR_DIV)
+        {
+            if (d < 0)
+                print_asm("neg", "%rdx", 0, 0);
+
+            dest_write(i->dest, "%rdx");
+            return;
+        }
+
+        // The remainder takes the dividend's sign whatever the divisor's, so
+        // it is the dividend less its biased value with the low bits cleared
+        if (k < 32)
+        {
+            print_asm("and", operand("$%ld", -(long)ad), "%rax", 0);
+        }
+        else
         {
-            registers |= r;
-            return i;
+            print_asm("shr", operand("$%d", k), "%rax", 0);
+            print_asm("shl", operand("$%d", k), "%rax", 0);
         }
 
-        r <<= 1;
+        print_asm("mov", n, "%rdx", 0);
+        print_asm("sub", "%rax", "%rdx", 0);
+        dest_write(i->dest, "%rdx");
+        return;
     }
 
-    printf("ERROR: Register allocation requested but all registers are in use.\n");
-    exit(1);
-}
+    magic_division(n, d);
 
-void scratch_free(int r)
-{
-    if (r < 0 || r > 6)
+    if (i->op == IR_DIV)
     {
-        printf("WARNING: Attempted to free an out-of-range register\n");
+        dest_write(i->dest, "%rdx");
         return;
     }
 
-    uint8_t reg = 1;
+    // The remainder is what is left of the dividend after taking away the
+    // quotient times the divisor
+    if (d >= INT32_MIN && d <= INT32_MAX)
+    {
+        print_asm("imul", operand("$%ld", (long)d), "%rdx", "%rdx");
+    }
+    else
+    {
+        print_asm("mov", operand("$%ld", (long)d), "%rax", 0);
+        print_asm("imul", "%rax", "%rdx", 0);
+    }
 
-    reg <<= r;
+    print_asm("mov", n, "%rax", 0);
+    print_asm("sub", "%rdx", "%rax", 0);
+    dest_write(i->dest, "%rax");
+}
+
+// =======
+// Vectors
+// =======
 
-    if ((reg & registers) == 0)
-        printf("WARNING: Attempted to free already freed register '%s'\n", scratch_name(r));
+// A vector loop keeps its counter in %rax and its values in the vector
+// registers, which nothing else uses. The sum takes register 0, each scalar
+// one of its own after that, and the stack the ones after those. SSE2 only
+// has two operands and overwrites the left one, while AVX2 writes a third.
+// Array elements are only aligned to 8 bytes, so every access is unaligned
+static bool vector_avx2 = false;
+
+static const char *vector_register(int n)
+{
+    return operand(vector_avx2 ? "%%ymm%d" : "%%xmm%d", n);
+}
 
-    registers -= (reg & registers);
+static const char *vector_command(const char *command)
+{
+    return vector_avx2 ? operand("v%s", command) : command;
 }
 
-const char *scratch_name(int r)
+// Computes left op right into dest. Right is never dest, so left can be
+// copied there first
+static void vector_arithmetic(const char *command, int left, int right, int dest)
 {
-    switch (r)
+    if (vector_avx2)
     {
-    case 0:
-        return "%rbx";
-    case 1:
-        return "%r10";
-    case 2:
-        return "%r11";
-    case 3:
-        return "%r12";
-    case 4:
-        return "%r13";
-    case 5:
-        return "%r14";
-    case 6:
-        return "%r15";
-    default:
-        printf("ERROR: Name request for invalid register, %d, requested\n", r);
-        exit(1);
-        break;
+        print_asm(vector_command(command), vector_register(right), vector_register(left), vector_register(dest));
+        return;
     }
-}
 
-// ===================
-// Labelling functions
-// ===================
+    if (left != dest)
+        print_asm("movdqa", vector_register(left), vector_register(dest), 0);
 
-static int label_counter = 0;
+    print_asm(command, vector_register(right), vector_register(dest), 0);
+}
 
-int label_create()
+static const char *vector_element(struct ir_instr *i, struct ir_vector_step *step)
 {
-    return label_counter++;
+    return operand("%ld(%s,%%rax,8)", 8 * (long)step->offset, value_register(i->args[step->arg], "%r11"));
 }
 
-const char *label_name(int label)
+static void vector_codegen(struct ir_instr *i)
 {
-    // Neat trick to find out how large your buffer should be. snprintf will
-    // return the number of characters that would be written to a buffer if its
-    // writing to null
-    int buffer_size = snprintf(NULL, 0, ".L%d", label);
-    char *str = malloc(sizeof(char) * (buffer_size + 1));
-    sprintf(str, ".L%d", label);
-    return str;
-}
+    struct ir_vector *v = i->vector;
+    int *scalars = malloc(sizeof(int) * (i->arg_count ? i->arg_count : 1));
+    int *stack = malloc(sizeof(int) * (v->step_count + 1));
+    int top = 0;
+    int first = 1;
+    const char *loop = label_name(label_create());
 
-// ===============
-// Code generation
-// ===============
+    vector_avx2 = v->width == 4;
+    value_move(i->a, "%rax");
 
-// Used to offset local variables from parameter argument variables on the stack
-// This gets reset to 0 once
-static int stack_position = 0;
+    if (i->dest.kind != IR_VALUE_NONE)
+        vector_arithmetic("pxor", 0, 0, 0);
 
-const char *symbol_codegen(struct symbol *s)
-{
-    if (s->kind == SYMBOL_GLOBAL)
-        return s->name;
+    for (int n = 0; n < i->arg_count; n++)
+        scalars[n] = -1;
 
-    // Push the stack position down
-    stack_position += -8;
+    for (int n = 0; n < v->step_count; n++)
+    {
+        struct ir_vector_step *step = &v->steps[n];
 
-    // Print out the label needed
-    int buffer_size = snprintf(NULL, 0, "%d(%%rbp)", stack_position);
-    char *str = malloc(sizeof(char) * (buffer_size + 1));
-    sprintf(str, "%d(%%rbp)", stack_position);
+        if (step->kind != IR_VECTOR_SPLAT || scalars[step->arg] >= 0)
+            continue;
 
-    return str;
-}
+        const char *scalar = value_register(i->args[step->arg], "%r11");
+        int r = scalars[step->arg] = first++;
 
-static int arg_number = 0;
+        print_asm(vector_command("movq"), scalar, operand("%%xmm%d", r), 0);
 
-static void print_asm(const char* command, const char* operand_1, const char* operand_2, const char* operand_3)
-{
-    printf("\t%s", command);
+        if (vector_avx2)
+            print_asm("vpbroadcastq", operand("%%xmm%d", r), vector_register(r), 0);
+        else
+            print_asm("punpcklqdq", vector_register(r), vector_register(r), 0);
+    }
+
+    print_label(loop);
+
+    for (int n = 0; n < v->step_count; n++)
+    {
+        struct ir_vector_step *step = &v->steps[n];
+        int own = first + top;
+
+        switch (step->kind)
+        {
+        case IR_VECTOR_LOAD:
+            print_asm(vector_command("movdqu"), vector_element(i, step), vector_register(own), 0);
+            stack[top++] = own;
+            break;
+        case IR_VECTOR_SPLAT:
+            stack[top++] = scalars[step->arg];
+            break;
+        case IR_VECTOR_ADD:
+        case IR_VECTOR_SUB:
+            top--;
+            vector_arithmetic(step->kind == IR_VECTOR_ADD ? "paddq" : "psubq", stack[top - 1], stack[top], own - 2);
+            stack[top - 1] = own - 2;
+            break;
+        case IR_VECTOR_NEG:
+            // Subtracted from zero in the register above the top
+            vector_arithmetic("pxor", own, own, own);
+
+            if (vector_avx2)
+            {
+                vector_arithmetic("psubq", own, stack[top - 1], own - 1);
+            }
+            else
+            {
+                vector_arithmetic("psubq", own, stack[top - 1], own);
+                print_asm("movdqa", vector_register(own), vector_register(own - 1), 0);
+            }
+
+            stack[top - 1] = own - 1;
+            break;
+        case IR_VECTOR_STORE:
+            print_asm(vector_command("movdqu"), vector_register(stack[--top]), vector_element(i, step), 0);
+            break;
+        case IR_VECTOR_SUM:
+            vector_arithmetic("paddq", 0, stack[--top], 0);
+            break;
+        }
+    }
 
-    if(operand_1)
-        printf("\t%s", operand_1);
-    
-    if(operand_3)
-        printf("\t%s", operand_1);
-    
-    if(operand_2)
-        printf("\t%s", operand_1);
+    print_asm("add", operand("$%d", v->width), "%rax", 0);
+    print_asm("cmp", value_source(i->b, "%r11"), "%rax", 0);
+    print_asm("jl", loop, 0, 0);
 
-    printf("\n");
+    // The lanes of the sum are added together, the upper half of an AVX2
+    // register first
+    if (i->dest.kind != IR_VALUE_NONE)
+    {
+        if (vector_avx2)
+        {
+            print_asm("vextracti128", "$1", "%ymm0", "%xmm1");
+            print_asm("vpaddq", "%xmm1", "%xmm0", "%xmm0");
+        }
+
+        print_asm(vector_command("pshufd"), "$78", "%xmm0", "%xmm1");
+        print_asm(vector_command("paddq"), "%xmm1", "%xmm0", vector_avx2 ? "%xmm0" : 0);
+        print_asm(vector_command("movq"), "%xmm0", "%rax", 0);
+        dest_write(i->dest, "%rax");
+    }
+
+    // Mixing AVX and SSE code is slow unless the upper halves are cleared
+    if (vector_avx2)
+        print_asm("vzeroupper", 0, 0, 0);
+
+    free(scalars);
+    free(stack);
 }
 
-void expr_codegen(struct expr *e)
+// An index is in bounds when it is below the size compared as unsigned,
+// which also catches negative indices. Constant indices in bounds need no
+// check at all
+static void bounds_check_codegen(struct ir_instr *i)
 {
-    if (!e)
+    const char *index;
+
+    if (i->a.kind == IR_VALUE_CONSTANT && i->a.number >= 0 && (!i->b.number || i->a.number < i->b.number))
         return;
 
-    // Generate code for the left and right expressions first. EXPR_ARG and
-    // EXPR_CALL have special code generation cases
-    if (e->kind != EXPR_ARG && e->kind != EXPR_CALL)
+    bounds_failures = realloc(bounds_failures, sizeof(struct bounds_failure) * (bounds_failure_count + 1));
+    struct bounds_failure *failure = &bounds_failures[bounds_failure_count++];
+
+    failure->label = label_name(label_create());
+    failure->size = i->b.number;
+
+    if (i->a.kind == IR_VALUE_CONSTANT)
     {
-        expr_codegen(e->left);
-        expr_codegen(e->right);
+        failure->index = operand("$%ld", (long)i->a.number);
+        print_asm("jmp", failure->label, 0, 0);
+        return;
     }
 
-    // Define some useful variables for registers and their names
-    int lr = -1;
-    int rr = -1;
-    const char *lrs = "";
-    const char *rrs = "";
+    index = value_register(i->a, "%rax");
+    failure->index = index;
 
-    if (e->left)
+    // Without a size, only negative indices fail
+    if (!failure->size)
     {
-        lr = e->left->reg;
-        lrs = scratch_name(e->left->reg);
+        print_asm("test", index, index, 0);
+        print_asm("js", failure->label, 0, 0);
+        return;
     }
 
-    if (e->right)
+    print_asm("cmp", operand("$%ld", failure->size), index, 0);
+    print_asm("jae", failure->label, 0, 0);
+}
+
+// bounds_error never returns, so the frame is left as it is, only aligning
+// the stack for the call
+static void bounds_failures_codegen()
+{
+    for (int n = 0; n < bounds_failure_count; n++)
     {
-        lr = e->right->reg;
-        lrs = scratch_name(e->right->reg);
+        print_label(bounds_failures[n].label);
+        print_asm("mov", bounds_failures[n].index, "%rdi", 0);
+        print_asm("mov", operand("$%ld", bounds_failures[n].size), "%rsi", 0);
+        print_asm("and", "$-16", "%rsp", 0);
+        print_asm("call", "bounds_error", 0, 0);
     }
 
-    switch (e->kind)
+    free(bounds_failures);
+    bounds_failures = NULL;
+    bounds_failure_count = 0;
+}
+
+static void instr_codegen(struct ir_instr *i)
+{
+    switch (i->op)
     {
-        // ==========
-        // Leaf nodes
-        // ==========
-    case EXPR_NAME:
-        e->reg = scratch_alloc();
-        print_asm("mov", symbol_codegen(e->symbol), scratch_name(e->reg), 0);
+    case IR_COPY:
+        if (i->a.kind == IR_VALUE_TEMP || (value_is_immediate(i->a) && i->a.number != 0))
+            move(value_source(i->a, "%rax"), temp_location(i->dest));
+        else
+            dest_write(i->dest, value_register(i->a, dest_register(i->dest, "%rax")));
         break;
-    case EXPR_CHARLITERAL:
-    case EXPR_INTEGERLITERAL:
-    case EXPR_BOOLEANLITERAL:
-        e->reg = scratch_alloc();
-        
-        // Neat trick to find out how large your buffer should be. snprintf will
-        // return the number of characters that would be written to a buffer if its
-        // writing to null
-        int buffer_size = snprintf(NULL, 0, "%d", e->literal_value);
-        char *str = malloc(sizeof(char) * (buffer_size + 1));
-        sprintf(str, "%d", e->literal_value);
-
-        print_asm("mov", str, scratch_name(e->reg), 0);
+    case IR_PARAM:
+        if (!i->prev || i->prev->op != IR_PARAM)
+            params_codegen(i);
         break;
-    case EXPR_STRINGLITERAL:
-        // TODO:
+    case IR_LOAD: {
+        const char *d = dest_register(i->dest, "%rax");
+        print_asm("mov", location_codegen(i->a), d, 0);
+        dest_write(i->dest, d);
         break;
-
-        // ==============
-        // Interior nodes
-        // ==============
-    case EXPR_GROUP:
-        e->reg = lr;
+    }
+    case IR_STORE:
+        if (value_is_immediate(i->b))
+            print_asm("movq", operand("$%ld", (long)i->b.number), location_codegen(i->a), 0);
+        else
+            print_asm("mov", value_register(i->b, "%rax"), location_codegen(i->a), 0);
+        break;
+    case IR_ADDRESS_OF: {
+        const char *d = dest_register(i->dest, "%rax");
+        print_asm("lea", location_codegen(i->a), d, 0);
+        dest_write(i->dest, d);
         break;
-    case EXPR_ARG:
-        // Args need to push their value before propogating code generation to
-        // the next arg
-        expr_codegen(e->left);
+    }
+    case IR_LOAD_ELEMENT: {
+        const char *element = element_address(i);
+        const char *d = dest_register(i->dest, "%rax");
 
-        char *reg;
+        print_asm("mov", element, d, 0);
+        dest_write(i->dest, d);
+        break;
+    }
+    case IR_STORE_ELEMENT: {
+        const char *element = element_address(i);
 
-        switch (arg_number)
-        {
-        case 0:
-            reg = "%rdi";
-            break;
-        case 1:
-            reg = "%rsi";
-            break;
-        case 2:
-            reg = "%rdx";
-            break;
-        case 3:
-            reg = "%rcx";
-            break;
-        case 4:
-            reg = "%r8";
-            break;
-        case 5:
-            reg = "%r9";
-            break;
-        default:
-            printf("ERROR: Too many arguments in function call\n");
-            exit(1);
-        }
+        if (value_is_immediate(i->c))
+            print_asm("movq", operand("$%ld", (long)i->c.number), element, 0);
+        else
+            print_asm("mov", value_register(i->c, "%rdx"), element, 0);
+        break;
+    }
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_AND:
+    case IR_OR: {
+        const char *b = value_source(i->b, "%r11");
+        const char *d = dest_register(i->dest, "%rax");
 
-        arg_number++;
+        // Loading the first operand into the destination would overwrite the
+        // second if they share a register
+        if (strcmp(d, b) == 0 && !(i->a.kind == IR_VALUE_TEMP && strcmp(temp_location(i->a), d) == 0))
+            d = "%rax";
 
-        print_asm("mov", scratch_name(e->left->reg), reg, 0);
-        scratch_free(e->left->reg);
-        expr_codegen(e->right);
+        value_move(i->a, d);
+        print_asm(arithmetic_command(i->op), b, d, 0);
+        dest_write(i->dest, d);
         break;
-    case EXPR_INITIALIZER:
-        // TODO:
+    }
+    case IR_DIV:
+    case IR_MOD:
+        division_codegen(i);
         break;
-    case EXPR_SUBSCRIPT:
-        print_asm("imul", "0x8", rrs, 0); // Right now we only care about integers, so we multiply by 8 for 64 bit integers
-        print_asm("add", lrs, rrs, 0); // Then add to the base address
-        e->reg = lr;
-        scratch_free(rr);
+    case IR_POW:
+        power_codegen(i);
         break;
-    case EXPR_CALL:
-
-        // First push caller-save registers
-        print_asm("push", "%rax", 0, 0);
-        print_asm("push", "%rcx", 0, 0);
-        print_asm("push", "%rdx", 0, 0);
-        print_asm("push", "%rsi", 0, 0);
-        print_asm("push", "%rdi", 0, 0);
-        print_asm("push", "%r8", 0, 0);
-        print_asm("push", "%r9", 0, 0);
-        print_asm("push", "%r10", 0, 0);
-        print_asm("push", "%r11", 0, 0);
-
-        // Now generate code for the args, since this will push to the stack
-        arg_number = 0;
-        expr_codegen(e->right);
-
-        print_asm("call", lrs);
-
-        // Then pop caller save registers from the stack
-        print_asm("pop", "%r11", 0, 0);
-        print_asm("pop", "%r10", 0, 0);
-        print_asm("pop", "%r9", 0, 0);
-        print_asm("pop", "%r8", 0, 0);
-        print_asm("pop", "%rdi", 0, 0);
-        print_asm("pop", "%rsi", 0, 0);
-        print_asm("pop", "%rdx", 0, 0);
-        print_asm("pop", "%rcx", 0, 0);
-        print_asm("pop", "%rax", 0, 0);
+    case IR_NEG:
+    case IR_NOT: {
+        const char *d = dest_register(i->dest, "%rax");
 
+        value_move(i->a, d);
+
+        if (i->op == IR_NEG)
+            print_asm("neg", d, 0, 0);
+        else
+            print_asm("xor", "$1", d, 0);
+
+        dest_write(i->dest, d);
         break;
-    case EXPR_ASSIGNMENT:
-        print_asm("mov", lrs, symbol_codegen(e->right->symbol), 0);
-        e->reg = lr;
-        break;
+    }
+    case IR_LT:
+    case IR_LTE:
+    case IR_GT:
+    case IR_GTE:
+    case IR_EQ:
+    case IR_NE:
+        print_asm("cmp", value_source(i->b, "%r11"), value_register(i->a, "%rax"), 0);
+
+        // A comparison only used by the branch after it leaves its result in
+        // the flags for the branch to jump on
+        if (comparison_is_fused(i))
+            break;
 
-        // ==========
-        // Arithmatic
-        // ==========
-    case EXPR_NEGATE:
-        print_asm("neg", lrs, 0, 0);
-        e->reg = lr;
+        print_asm(operand("set%s", condition_code(i->op, false)), "%al", 0, 0);
+        print_asm("movzbq", "%al", "%rax", 0);
+        dest_write(i->dest, "%rax");
+        break;
+    case IR_CHECK:
+        bounds_check_codegen(i);
         break;
-    case EXPR_INC:
-        print_asm("inc", lrs, 0, 0);
-        e->reg = lr;
+    case IR_CALL:
+        if (is_tail_call(i))
+            tail_call_codegen(i);
+        else
+            call_codegen(i, i->callee, i->args, i->arg_count);
         break;
-    case EXPR_DEC:
-        print_asm("dec", lrs);
-        e->reg = lr;
+    case IR_JUMP:
+        if (i->target != block_following(i->block) && !(i->prev && is_tail_call(i->prev)))
+            print_asm("jmp", block_label(i->target), 0, 0);
+        break;
+    case IR_BRANCH: {
+        // Conditions that were folded to a constant always go the same way
+        if (i->a.kind == IR_VALUE_CONSTANT)
+        {
+            struct ir_block *taken = i->a.number ? i->target : i->target_false;
+
+            if (taken != block_following(i->block))
+                print_asm("jmp", block_label(taken), 0, 0);
+            break;
+        }
+
+        struct ir_instr *comparison = branch_comparison(i);
+        ir_op_t tested = comparison ? comparison->op : IR_NE;
+
+        if (!comparison && is_register(temp_location(i->a)))
+            print_asm("test", temp_location(i->a), temp_location(i->a), 0);
+        else if (!comparison)
+            print_asm("cmpq", "$0", temp_location(i->a), 0);
+
+        if (i->target_false == block_following(i->block))
+        {
+            print_asm(operand("j%s", condition_code(tested, false)), block_label(i->target), 0, 0);
+        }
+        else if (i->target == block_following(i->block))
+        {
+            print_asm(operand("j%s", condition_code(tested, true)), block_label(i->target_false), 0, 0);
+        }
+        else
+        {
+            print_asm(operand("j%s", condition_code(tested, false)), block_label(i->target), 0, 0);
+            print_asm("jmp", block_label(i->target_false), 0, 0);
+        }
         break;
-    case EXPR_POW:
-        // TODO: Finish this portion!
-        expr_codegen(e->left);
-        expr_codegen(e->right);
-        int result = scratch_alloc();
-        printf("\tmov\t0x1\t%s\n", scratch_name(result));
+    }
+    case IR_RETURN:
+        // Tail calls have already left
+        if (i->prev && is_tail_call(i->prev))
+            break;
 
-        printf("\tdec\t%s\n", rrs);
+        if (i->a.kind != IR_VALUE_NONE)
+            value_move(i->a, "%rax");
 
-        e->reg = lr;
-        scratch_free(rr);
+        // Only the last hot block falls through to the epilogue
+        if (return_directly)
+            print_asm("ret", 0, 0, 0);
+        else if (block_following(i->block) || i->block->cold)
+            print_asm("jmp", label_name(epilogue_label), 0, 0);
         break;
-    case EXPR_MUL:
-        print_asm("imul", lrs, rrs, 0);
-        e->reg = lr;
-        scratch_free(rr);
+    case IR_VECTOR:
+        vector_codegen(i);
         break;
-    case EXPR_DIV:
-        // TODO:
-        printf("\tmov\t0x0\t%%rdx\n");     // Set %rdx to 0
-        printf("\tmov\t%s\t%%rax\n", lrs); // Set %rax to divisor
-        printf("\tidiv\t%s\n", rrs);       // Perform the division
+    case IR_PHI:
+        // Phis have already been replaced with copies
+        break;
+    }
+}
+
+// =========
+// Functions
+// =========
 
-        scratch_free(lr);
-        scratch_free(rr);
+static void block_codegen(struct ir_block *b)
+{
+    // Padding up to 10 bytes is worth it to start a loop on a fresh 16 bytes
+    // of instructions to fetch
+    if (b->aligned)
+        print_asm(".p2align", "4,,10", 0, 0);
 
-        e->reg = scratch_alloc();
+    print_label(block_label(b));
 
-        printf("\tmov\t%%rax\t%s\n", scratch_name(e->reg)); // Move quotient from %rax to e's register
+    for (struct ir_instr *i = b->first; i; i = i->next)
+        instr_codegen(i);
+}
 
-        break;
-    case EXPR_MOD:
-        // TODO:
-        printf("\tmov\t0x0\t%%rdx\n");     // Set %rdx to 0
-        printf("\tmov\t%s\t%%rax\n", lrs); // Set %rax to divisor
-        printf("\tidiv\t%s\n", rrs);       // Perform the division
+// Numbers the instructions and finds the caller-saved registers that hold a
+// value across each call, returning every register that is ever saved
+static int calls_save(struct ir_function *f)
+{
+    int count = 0;
 
-        scratch_free(lr);
-        scratch_free(rr);
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+            i->number = count++;
+    }
 
-        e->reg = scratch_alloc();
+    call_saves = realloc(call_saves, sizeof(int) * (count ? count : 1));
+    memset(call_saves, 0, sizeof(int) * (count ? count : 1));
 
-        printf("\tmov\t%%rdx\t%s\n", scratch_name(e->reg)); // Move remainder from %rax to e's register
+    if (!f->registers)
+        return 0;
 
-        break;
-    case EXPR_ADD:
-        print_asm("add", lrs, rrs, 0);
-        e->reg = lr;
-        scratch_free(rr);
-        break;
-    case EXPR_SUB:
-        print_asm("sub", lrs, rrs, 0);
-        e->reg = lr;
-        scratch_free(rr);
-        break;
+    struct liveness *l = ir_function_liveness(f);
+    uint64_t *live = malloc(sizeof(uint64_t) * (l->words ? l->words : 1));
+    int all = 0;
 
-        // =================
-        // Logical Operators
-        // =================
-    case EXPR_NOT:
-        // Set zero flag by & left register against itself
-        print_asm("not", lrs, 0, 0);
-        e->reg = lr;
-        break;
-    case EXPR_LT:
-        print_asm("cmp", rrs, lrs, 0);
-        print_asm("setl", lrs, 0, 0);
-        e->reg = lr;
-        scratch_free(rr);
-    case EXPR_LTE:
-        print_asm("cmp", rrs, lrs, 0);
-        print_asm("setle", lrs, 0, 0);
-        e->reg = lr;
-        scratch_free(rr);
-        break;
-    case EXPR_GT:
-        print_asm("cmp", rrs, lrs, 0);
-        print_asm("setg", lrs, 0, 0);
-        e->reg = lr;
-        scratch_free(rr);
-        break;
-    case EXPR_GTE:
-        print_asm("cmp", rrs, lrs, 0);
-        print_asm("setge", lrs, 0, 0);
-        e->reg = lr;
-        scratch_free(rr);
-        break;
-    case EXPR_EQUALITY:
-        print_asm("cmp", rrs, lrs, 0);
-        print_asm("sete", lrs, 0, 0);
-        e->reg = lr;
-        scratch_free(rr);
-        break;
-    case EXPR_NEQUALITY:
-        print_asm("cmp", rrs, lrs, 0);
-        print_asm("setne", lrs, 0, 0);
-        e->reg = lr;
-        scratch_free(rr);
-        break;
-    case EXPR_AND:
-        print_asm("and", rrs, lrs, 0);
-        print_asm("setnz", lrs, 0, 0);
-        e->reg = lr;
-        scratch_free(rr);
-        break;
-    case EXPR_OR:
-        print_asm("or", rrs, lrs, 0);
-        print_asm("setnz", lrs, 0, 0);
-        e->reg = lr;
-        scratch_free(rr);
-        break;
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        memcpy(live, liveness_out_set(l, b), sizeof(uint64_t) * l->words);
+
+        for (struct ir_instr *i = b->last; i; i = i->prev)
+        {
+            if (i->dest.kind == IR_VALUE_TEMP)
+                live[i->dest.number / 64] &= ~((uint64_t)1 << (i->dest.number % 64));
+
+            // What is live here, without the call's operands, is needed after
+            if (ir_instr_is_call(i))
+            {
+                for (int w = 0; w < l->words; w++)
+                {
+                    for (uint64_t set = live[w]; set; set &= set - 1)
+                    {
+                        int r = f->registers[w * 64 + __builtin_ctzll(set)];
+
+                        if (r >= 0 && !register_callee_saved[r])
+                            call_saves[i->number] |= 1 << r;
+                    }
+                }
+
+                all |= call_saves[i->number];
+            }
+
+            for (int n = 0; n < ir_operand_count(i); n++)
+            {
+                struct ir_value *v = ir_operand(i, n);
+
+                if (v->kind == IR_VALUE_TEMP)
+                    live[v->number / 64] |= (uint64_t)1 << (v->number % 64);
+            }
+        }
     }
+
+    free(live);
+    liveness_delete(l);
+
+    return all;
 }
 
-void stmt_codegen(struct stmt *s)
+static void function_codegen(struct ir_function *f, int level)
 {
-    if (!s)
-        return;
-    switch (s->kind)
+    function = f;
+
+    ir_function_leave_ssa(f);
+
+    // -O1 allocates registers quickly with linear scan, while -O2 spends
+    // longer coloring an interference graph to coalesce copies and spill less
+    int spilled = 0;
+    int rematerialized = 0;
+
+    if (level >= 2)
+        spilled = ir_function_color(f, &rematerialized);
+    else if (level >= 1)
+        spilled = ir_function_linear_scan(f);
+
+    if (level >= 1 && input_arguments.verbose)
+        printf("Allocated registers in '%s': %d spilled, %d rematerialized\n", f->name, spilled, rematerialized);
+
+    int saves = calls_save(f);
+
+    // Lay out the frame with the slots first, then the homes of temporaries
+    // kept in memory, then the callee-saved registers to restore, then the
+    // caller-saved registers to keep across calls
+    slot_cells = realloc(slot_cells, sizeof(int) * (f->slot_count ? f->slot_count : 1));
+    temp_homes = realloc(temp_homes, sizeof(int) * (f->temp_count ? f->temp_count : 1));
+
+    int cells = 0;
+
+    for (int s = 0; s < f->slot_count; s++)
     {
-    case STMT_DECL:
-        decl_codegen(s->decl);
-        break;
-    case STMT_EXPR:
-        expr_codegen(s->expr);
-        scratch_free(s->expr->reg);
-        break;
-    case STMT_IF:
-        // TODO:
-        break;
-    case STMT_FOR:
-        // TODO:
-        break;
-    case STMT_PRINT:
-        // TODO:
-        break;
-    case STMT_RETURN:
-    //TODO:
-        expr_codegen(s->expr);
-        printf("MOV %s, %%rax\n", scratch_name(s->expr->reg));
-        printf("JMP .%s_epilogue\n", function_name);
-        scratch_free(s->expr->reg);
-        break;
-    case STMT_BLOCKSTART:
-        // TODO:
-        break;
-    case STMT_BLOCKEND:
-        // TODO:
-        break;
+        slot_cells[s] = cells;
+
+        if (!f->slots[s].promoted)
+            cells += f->slots[s].cells;
+    }
+
+    // Only temporaries that appear in the code need a home
+    bool leaf = true;
+
+    temp_uses = realloc(temp_uses, sizeof(int) * (f->temp_count ? f->temp_count : 1));
+
+    for (int t = 0; t < f->temp_count; t++)
+    {
+        temp_homes[t] = -1;
+        temp_uses[t] = 0;
+    }
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            if (ir_instr_is_call(i))
+                leaf = false;
+
+            if (i->dest.kind == IR_VALUE_TEMP)
+                temp_homes[i->dest.number] = 0;
+
+            for (int n = 0; n < ir_operand_count(i); n++)
+            {
+                if (ir_operand(i, n)->kind != IR_VALUE_TEMP)
+                    continue;
+
+                temp_homes[ir_operand(i, n)->number] = 0;
+                temp_uses[ir_operand(i, n)->number]++;
+            }
+        }
+    }
+
+    bool used[REGISTER_COUNT] = {0};
+
+    for (int t = 0; t < f->temp_count; t++)
+    {
+        if (temp_homes[t] < 0)
+            continue;
+
+        if (f->registers && f->registers[t] >= 0)
+        {
+            used[f->registers[t]] = true;
+            temp_homes[t] = -1;
+        }
+        else
+        {
+            temp_homes[t] = cells++;
+        }
+    }
+
+    saved_count = 0;
+
+    for (int r = 0; r < REGISTER_COUNT; r++)
+    {
+        if (used[r] && register_callee_saved[r])
+            saved_registers[saved_count++] = r;
+    }
+
+    save_cells = cells;
+    cells += saved_count;
+
+    for (int r = 0; r < REGISTER_COUNT; r++)
+    {
+        if (saves & 1 << r)
+            caller_cells[r] = cells++;
+    }
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+        b->label = label_create();
+
+    epilogue_label = label_create();
+
+    fprintf(codegen_output, "\t.text\n");
+    fprintf(codegen_output, "\t.globl\t%s\n", f->name);
+    fprintf(codegen_output, "%s:\n", f->name);
+
+    frameless = level >= 1 && leaf && cells <= RED_ZONE_CELLS;
+    tail_calls = level >= 1;
+    return_directly = frameless && saved_count == 0;
+
+    if (!frameless)
+    {
+        print_asm("push", "%rbp", 0, 0);
+        print_asm("mov", "%rsp", "%rbp", 0);
+
+        // Keep the stack 16 byte aligned for calls made from this function
+        if (cells)
+            print_asm("sub", operand("$%d", (cells * 8 + 15) / 16 * 16), "%rsp", 0);
     }
-    stmt_codegen(s->next);
+
+    for (int s = 0; s < saved_count; s++)
+        print_asm("mov", register_names[saved_registers[s]], cell_address(save_cells + s), 0);
+
+    bool cold = false;
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        if (b->cold)
+        {
+            cold = true;
+            continue;
+        }
+
+        block_codegen(b);
+    }
+
+    // Every return has already left when they return directly
+    if (!return_directly)
+    {
+        print_label(label_name(epilogue_label));
+        frame_restore();
+        print_asm("ret", 0, 0, 0);
+    }
+
+    // Once blocks have been laid out, cold ones and failed bounds checks are
+    // kept in a section of their own, so the code that runs stays together
+    if (level >= 1 && input_arguments.reorder_blocks && (cold || bounds_failure_count))
+        print_asm(".section", ".text.unlikely,\"ax\",@progbits", 0, 0);
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        if (b->cold)
+            block_codegen(b);
+    }
+
+    bounds_failures_codegen();
+
+    if (input_arguments.peephole)
+        peephole_optimize(&function_asm, input_arguments.peephole_window);
+
+    asm_stream_write(&function_asm, codegen_output);
+
+    function = NULL;
+    frameless = false;
+    return_directly = false;
+    tail_calls = false;
+}
+
+void decl_codegen(struct decl *d)
+{
+    for (; d; d = d->next)
+    {
+        if (d->type->kind != TYPE_FUNCTION)
+            global_codegen(d);
+    }
+}
+
+void ir_codegen(struct ir_program *p)
+{
+    if (!codegen_output)
+        codegen_output = stdout;
+
+    decl_codegen(p->ast);
+
+    for (struct ir_function *f = p->functions; f; f = f->next)
+        function_codegen(f, p->level);
+
+    strings_codegen();
+
+    if (input_arguments.verbose && input_arguments.peephole)
+        peephole_print_statistics(stdout);
+
+    // Nothing generated needs an executable stack
+    fprintf(codegen_output, "\t.section\t.note.GNU-stack,\"\",@progbits\n");
 }
@@ -2,18 +2,16 @@
 #ifndef SCRATCH_H
 #define SCRATCH_H
 
-struct symbol;
+#include <stdio.h>
+
 struct decl;
-struct expr;
-struct stmt;
+struct ir_program;
 
-// ========================
-// Scratch register control
-// ========================
+// =========
+// Registers
+// =========
 
-int scratch_alloc();
-void scratch_free(int r);
-const char *scratch_name(int r);
+const char *arg_register_name(int i);
 
 // ===================
 // Labelling functions
@@ -26,9 +24,9 @@ const char *label_name(int label);
 // Code generation
 // ===============
 
-const char *symbol_codegen(struct symbol *s);
-const char *decl_codegen(struct decl *d);
-void stmt_codegen(struct stmt *s);
-void expr_codegen(struct expr *e);
+extern FILE *codegen_output;
+
+void ir_codegen(struct ir_program *p);
+void decl_codegen(struct decl *d);
 
 #endif
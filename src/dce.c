@@ -0,0 +1,427 @@
+#include "dce.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alias.h"
+#include "dominance.h"
+#include "ir.h"
+
+// Stores are found dead by the liveness of the memory they write. Only memory
+// that every access can be traced to is tracked: globals written as a whole,
+// and slots whose address is never used but to reach their elements. Slots go
+// away when the function returns, while globals may still be read by whoever
+// called it, or by any call that may touch memory. A store is dead when what
+// it writes is not live after it. Storing to a global overwrites all of it,
+// so it is not live before either, but storing an element leaves the rest of
+// the array as it was.
+//
+// Computations are then found live by marking backwards from everything with
+// a side effect, so values only feeding each other around a loop go too.
+
+// The state of the function being cleaned
+static struct ir_instr **defs = NULL;
+
+// The memory tracked, and whether each is a global
+static struct object *objects = NULL;
+static bool *globals = NULL;
+static int object_count = 0;
+
+// What is live at the start of each block, indexed by block id then object
+static bool *live_in = NULL;
+
+// ======
+// Memory
+// ======
+
+static int object_find(struct object o)
+{
+    for (int n = 0; n < object_count; n++)
+    {
+        if (objects[n].kind == o.kind && ir_value_equals(objects[n].value, o.value))
+            return n;
+    }
+
+    return -1;
+}
+
+static void object_add(struct object o)
+{
+    objects = realloc(objects, sizeof(struct object) * (object_count + 1));
+    globals = realloc(globals, sizeof(bool) * (object_count + 1));
+    objects[object_count] = o;
+    globals[object_count] = o.kind == OBJECT_GLOBAL;
+    object_count++;
+}
+
+static bool is_element_access(struct ir_instr *i)
+{
+    return i->op == IR_LOAD_ELEMENT || i->op == IR_STORE_ELEMENT;
+}
+
+static void objects_find(struct ir_function *f)
+{
+    bool *escaped = calloc(f->slot_count ? f->slot_count : 1, sizeof(bool));
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            for (int n = 0; n < ir_operand_count(i); n++)
+            {
+                struct ir_value v = *ir_operand(i, n);
+                struct ir_instr *def = v.kind == IR_VALUE_TEMP ? defs[v.number] : NULL;
+
+                if (def && def->op == IR_ADDRESS_OF && def->a.kind == IR_VALUE_SLOT &&
+                    !(is_element_access(i) && n == 0))
+                {
+                    escaped[def->a.number] = true;
+                }
+            }
+        }
+    }
+
+    for (int s = 0; s < f->slot_count; s++)
+    {
+        if (!f->slots[s].promoted && !escaped[s])
+            object_add(object_of(ir_slot(f, s)));
+    }
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            if (i->op == IR_STORE && i->a.kind == IR_VALUE_GLOBAL && object_find(object_of(i->a)) < 0)
+                object_add(object_of(i->a));
+        }
+    }
+
+    free(escaped);
+}
+
+static void memory_read(bool *live, struct object o)
+{
+    for (int n = 0; n < object_count; n++)
+    {
+        if (may_alias(objects[n], o))
+            live[n] = true;
+    }
+}
+
+static void globals_read(bool *live)
+{
+    for (int n = 0; n < object_count; n++)
+    {
+        if (globals[n])
+            live[n] = true;
+    }
+}
+
+// What is live at the end of the block. Returning leaves only the globals
+static void live_out_find(struct ir_block *b, bool *live)
+{
+    memset(live, 0, sizeof(bool) * object_count);
+
+    if (!b->succ_count)
+        globals_read(live);
+
+    for (int s = 0; s < b->succ_count; s++)
+    {
+        bool *in = &live_in[b->succs[s]->id * object_count];
+
+        for (int n = 0; n < object_count; n++)
+            live[n] = live[n] || in[n];
+    }
+}
+
+// Runs backwards over the block from what is live at its end, leaving what is
+// live at its start. Dead stores are removed when remove is set, returning
+// how many were
+static int block_transfer(struct ir_block *b, bool *live, bool remove)
+{
+    int removed = 0;
+    struct ir_instr *prev;
+
+    for (struct ir_instr *i = b->last; i; i = prev)
+    {
+        int o;
+
+        prev = i->prev;
+
+        switch (i->op)
+        {
+        case IR_STORE:
+            if ((o = object_find(object_of(i->a))) < 0)
+                break;
+
+            if (!live[o] && remove)
+            {
+                ir_remove(i);
+                removed++;
+            }
+
+            live[o] = false;
+            break;
+        case IR_STORE_ELEMENT:
+            if ((o = object_find(base_object(defs, i->a))) >= 0 && !live[o] && remove)
+            {
+                ir_remove(i);
+                removed++;
+            }
+            break;
+        case IR_LOAD:
+            memory_read(live, object_of(i->a));
+            break;
+        case IR_LOAD_ELEMENT:
+            memory_read(live, base_object(defs, i->a));
+            break;
+        case IR_CALL:
+            if (ir_call_writes_memory(i))
+                globals_read(live);
+            break;
+        case IR_VECTOR:
+            memory_read(live, (struct object){OBJECT_ANY, ir_none()});
+            break;
+        default:
+            break;
+        }
+    }
+
+    return removed;
+}
+
+static int stores_remove(struct ir_function *f)
+{
+    objects_find(f);
+
+    if (!object_count)
+        return 0;
+
+    live_in = calloc(f->block_count * object_count, sizeof(bool));
+
+    bool *live = malloc(sizeof(bool) * object_count);
+    bool changed = true;
+
+    while (changed)
+    {
+        changed = false;
+
+        for (int n = f->rpo_count - 1; n >= 0; n--)
+        {
+            struct ir_block *b = f->rpo[n];
+            bool *in = &live_in[b->id * object_count];
+
+            live_out_find(b, live);
+            block_transfer(b, live, false);
+
+            if (memcmp(in, live, sizeof(bool) * object_count) != 0)
+            {
+                memcpy(in, live, sizeof(bool) * object_count);
+                changed = true;
+            }
+        }
+    }
+
+    int removed = 0;
+
+    for (int n = 0; n < f->rpo_count; n++)
+    {
+        live_out_find(f->rpo[n], live);
+        removed += block_transfer(f->rpo[n], live, true);
+    }
+
+    free(live);
+    free(live_in);
+    live_in = NULL;
+
+    return removed;
+}
+
+// ============
+// Computations
+// ============
+
+static void operands_mark(struct ir_instr *i, bool *used, int *worklist, int *count)
+{
+    for (int n = 0; n < ir_operand_count(i); n++)
+    {
+        struct ir_value v = *ir_operand(i, n);
+
+        if (v.kind == IR_VALUE_TEMP && !used[v.number])
+        {
+            used[v.number] = true;
+            worklist[(*count)++] = v.number;
+        }
+    }
+}
+
+static int unused_remove(struct ir_function *f)
+{
+    bool *used = calloc(f->temp_count ? f->temp_count : 1, sizeof(bool));
+    int *worklist = malloc(sizeof(int) * (f->temp_count ? f->temp_count : 1));
+    int count = 0;
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            if (ir_has_side_effects(i) || i->dest.kind != IR_VALUE_TEMP)
+                operands_mark(i, used, worklist, &count);
+        }
+    }
+
+    while (count)
+    {
+        struct ir_instr *def = defs[worklist[--count]];
+
+        if (def)
+            operands_mark(def, used, worklist, &count);
+    }
+
+    int removed = 0;
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        struct ir_instr *next;
+
+        for (struct ir_instr *i = b->first; i; i = next)
+        {
+            next = i->next;
+
+            if (i->dest.kind == IR_VALUE_TEMP && !used[i->dest.number] && !ir_has_side_effects(i))
+            {
+                ir_remove(i);
+                removed++;
+            }
+        }
+    }
+
+    free(used);
+    free(worklist);
+
+    return removed;
+}
+
+// ======
+// Blocks
+// ======
+
+// Where a jump to the block ends up, passing through blocks that do nothing
+// but jump. A block with phis tells its predecessors apart, so jumps to it
+// can't be moved to come from elsewhere
+static struct ir_block *jump_destination(struct ir_function *f, struct ir_block *b)
+{
+    for (int hops = 0; hops < f->block_count; hops++)
+    {
+        struct ir_instr *jump = b->first;
+
+        if (!jump || jump != b->last || jump->op != IR_JUMP || jump->target == b)
+            break;
+
+        if (jump->target->first && jump->target->first->op == IR_PHI)
+            break;
+
+        b = jump->target;
+    }
+
+    return b;
+}
+
+// Jumps are sent straight to where they end up, and the empty blocks they
+// passed through are then unreachable, along with anything else that is.
+// Returns how many blocks were removed
+static int blocks_remove(struct ir_function *f)
+{
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        struct ir_instr *last = b->last;
+
+        if (!last || (last->op != IR_JUMP && last->op != IR_BRANCH))
+            continue;
+
+        last->target = jump_destination(f, last->target);
+
+        if (last->op == IR_BRANCH)
+        {
+            last->target_false = jump_destination(f, last->target_false);
+
+            if (last->target == last->target_false)
+            {
+                last->op = IR_JUMP;
+                last->a = ir_none();
+                last->target_false = NULL;
+            }
+        }
+    }
+
+    ir_function_link(f);
+
+    return ir_function_remove_unreachable(f);
+}
+
+// Slots nothing refers to anymore need no space in the frame
+static void slots_release(struct ir_function *f)
+{
+    bool *referenced = calloc(f->slot_count ? f->slot_count : 1, sizeof(bool));
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            for (int n = 0; n < ir_operand_count(i); n++)
+            {
+                if (ir_operand(i, n)->kind == IR_VALUE_SLOT)
+                    referenced[ir_operand(i, n)->number] = true;
+            }
+        }
+    }
+
+    for (int s = 0; s < f->slot_count; s++)
+    {
+        if (!referenced[s])
+            f->slots[s].promoted = true;
+    }
+
+    free(referenced);
+}
+
+int ir_function_dce(struct ir_function *f, bool verbose)
+{
+    int blocks = blocks_remove(f);
+
+    ir_function_dominators(f);
+
+    defs = calloc(f->temp_count ? f->temp_count : 1, sizeof(struct ir_instr *));
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            if (i->dest.kind == IR_VALUE_TEMP)
+                defs[i->dest.number] = i;
+        }
+    }
+
+    int removed = stores_remove(f);
+
+    removed += unused_remove(f);
+    slots_release(f);
+
+    if (verbose)
+    {
+        printf("Removed dead code in '%s': %d instruction%s, %d block%s\n", f->name, removed, removed == 1 ? "" : "s",
+               blocks, blocks == 1 ? "" : "s");
+    }
+
+    free(defs);
+    free(objects);
+    free(globals);
+    defs = NULL;
+    objects = NULL;
+    globals = NULL;
+    object_count = 0;
+
+    return removed;
+}
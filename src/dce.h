@@ -0,0 +1,16 @@
+#ifndef DCE_H
+#define DCE_H
+
+#include <stdbool.h>
+
+struct ir_function;
+
+// Dead code elimination over a function in SSA form. Blocks that can never
+// run are removed, then stores to memory never read again before it is
+// overwritten or goes away, and finally every computation whose result
+// nothing kept reads. Calls, checks and anything else with side effects stay.
+// When verbose is set, prints how many instructions and blocks were removed.
+// Returns how many instructions were removed
+int ir_function_dce(struct ir_function *f, bool verbose);
+
+#endif
@@ -0,0 +1,309 @@
+#include "dominance.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "ir.h"
+
+// Dominators are found with the iterative algorithm of Cooper, Harvey and
+// Kennedy, which walks the blocks in reverse postorder until the immediate
+// dominators stop changing. It is simple and, for the shallow loop nests of
+// real programs, converges in two or three passes.
+
+// Postorder is computed with an explicit stack, since straight-line code
+// with many branches can nest far deeper than the C stack allows
+static void function_order(struct ir_function *f)
+{
+    struct ir_block **stack = malloc(sizeof(struct ir_block *) * (f->block_count + 1));
+    int *next_succ = calloc(f->block_count + 1, sizeof(int));
+    bool *visited = calloc(f->block_count + 1, sizeof(bool));
+    int top = 0;
+    int count = 0;
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+        b->order = -1;
+
+    f->rpo = ir_alloc(f, sizeof(struct ir_block *) * (f->block_count + 1));
+
+    stack[top++] = f->entry;
+    visited[f->entry->id] = true;
+
+    while (top)
+    {
+        struct ir_block *b = stack[top - 1];
+
+        if (next_succ[b->id] < b->succ_count)
+        {
+            struct ir_block *s = b->succs[next_succ[b->id]++];
+
+            if (!visited[s->id])
+            {
+                visited[s->id] = true;
+                stack[top++] = s;
+            }
+
+            continue;
+        }
+
+        // Every successor is finished, so the block comes next in postorder
+        top--;
+        f->rpo[count++] = b;
+    }
+
+    // Reverse the postorder in place
+    for (int i = 0; i < count / 2; i++)
+    {
+        struct ir_block *t = f->rpo[i];
+        f->rpo[i] = f->rpo[count - 1 - i];
+        f->rpo[count - 1 - i] = t;
+    }
+
+    for (int i = 0; i < count; i++)
+        f->rpo[i]->order = i;
+
+    f->rpo_count = count;
+
+    free(stack);
+    free(next_succ);
+    free(visited);
+}
+
+static struct ir_block *intersect(struct ir_block *a, struct ir_block *b)
+{
+    while (a != b)
+    {
+        while (a->order > b->order)
+            a = a->idom;
+        while (b->order > a->order)
+            b = b->idom;
+    }
+
+    return a;
+}
+
+void ir_function_dominators(struct ir_function *f)
+{
+    function_order(f);
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        b->idom = NULL;
+        b->child_count = 0;
+        b->frontier_count = 0;
+    }
+
+    f->entry->idom = f->entry;
+
+    bool changed = true;
+
+    while (changed)
+    {
+        changed = false;
+
+        for (int i = 1; i < f->rpo_count; i++)
+        {
+            struct ir_block *b = f->rpo[i];
+            struct ir_block *idom = NULL;
+
+            for (int p = 0; p < b->pred_count; p++)
+            {
+                struct ir_block *pred = b->preds[p];
+
+                if (pred->order < 0 || !pred->idom)
+                    continue;
+
+                idom = idom ? intersect(pred, idom) : pred;
+            }
+
+            if (idom != b->idom)
+            {
+                b->idom = idom;
+                changed = true;
+            }
+        }
+    }
+
+    // Build the dominator tree, sizing each block's children exactly
+    for (int i = 1; i < f->rpo_count; i++)
+        f->rpo[i]->idom->child_count++;
+
+    for (int i = 0; i < f->rpo_count; i++)
+    {
+        struct ir_block *b = f->rpo[i];
+
+        b->children = b->child_count ? ir_alloc(f, sizeof(struct ir_block *) * b->child_count) : NULL;
+        b->child_count = 0;
+    }
+
+    for (int i = 1; i < f->rpo_count; i++)
+    {
+        struct ir_block *b = f->rpo[i];
+        b->idom->children[b->idom->child_count++] = b;
+    }
+
+    // A join point is in the frontier of every block on the way up from each
+    // of its predecessors to its immediate dominator. The frontiers are
+    // counted first and then filled in the same order
+    int *last = malloc(sizeof(int) * (f->block_count + 1));
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int i = 0; i < f->block_count + 1; i++)
+            last[i] = -1;
+
+        for (int i = 0; i < f->rpo_count; i++)
+        {
+            struct ir_block *b = f->rpo[i];
+
+            if (pass == 1)
+            {
+                b->frontier = b->frontier_count ? ir_alloc(f, sizeof(struct ir_block *) * b->frontier_count) : NULL;
+                b->frontier_count = 0;
+            }
+        }
+
+        for (int i = 0; i < f->rpo_count; i++)
+        {
+            struct ir_block *b = f->rpo[i];
+
+            if (b->pred_count < 2)
+                continue;
+
+            for (int p = 0; p < b->pred_count; p++)
+            {
+                struct ir_block *runner = b->preds[p];
+
+                if (runner->order < 0)
+                    continue;
+
+                while (runner != b->idom)
+                {
+                    // Each join is added to a block's frontier only once
+                    if (last[runner->id] != b->id)
+                    {
+                        last[runner->id] = b->id;
+
+                        if (pass == 1)
+                            runner->frontier[runner->frontier_count] = b;
+
+                        runner->frontier_count++;
+                    }
+
+                    runner = runner->idom;
+                }
+            }
+        }
+    }
+
+    free(last);
+}
+
+bool ir_dominates(struct ir_block *a, struct ir_block *b)
+{
+    if (a->order < 0 || b->order < 0)
+        return false;
+
+    while (b->order > a->order)
+        b = b->idom;
+
+    return a == b;
+}
+
+int ir_function_remove_unreachable(struct ir_function *f)
+{
+    int removed = 0;
+
+    ir_function_dominators(f);
+
+    struct ir_block *next;
+
+    for (struct ir_block *b = f->entry; b; b = next)
+    {
+        next = b->next;
+
+        if (b->order >= 0)
+            continue;
+
+        // Phis in reachable blocks no longer receive values from here
+        for (int s = 0; s < b->succ_count; s++)
+        {
+            for (struct ir_instr *i = b->succs[s]->first; i && i->op == IR_PHI; i = i->next)
+                ir_phi_remove_source(i, b);
+        }
+
+        ir_block_unlink(f, b);
+        removed++;
+    }
+
+    if (removed)
+        ir_function_link(f);
+
+    return removed;
+}
+
+// =====
+// Loops
+// =====
+
+// A back edge goes to a block that dominates its source, and that block heads
+// a natural loop made of everything that reaches the edge without passing
+// through the header. Loops sharing a header are counted as one.
+void ir_function_loop_depths(struct ir_function *f)
+{
+    struct ir_block **stack = malloc(sizeof(struct ir_block *) * (f->block_count + 1));
+    int *seen = malloc(sizeof(int) * (f->block_count + 1));
+
+    for (int i = 0; i < f->block_count + 1; i++)
+        seen[i] = -1;
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+        b->loop_depth = 0;
+
+    for (int i = 0; i < f->rpo_count; i++)
+    {
+        struct ir_block *header = f->rpo[i];
+        int top = 0;
+
+        for (int p = 0; p < header->pred_count; p++)
+        {
+            struct ir_block *pred = header->preds[p];
+
+            if (pred->order >= 0 && ir_dominates(header, pred) && seen[pred->id] != header->id)
+            {
+                seen[pred->id] = header->id;
+                stack[top++] = pred;
+            }
+        }
+
+        if (!top)
+            continue;
+
+        // The header is marked first so the walk stops there
+        if (seen[header->id] != header->id)
+        {
+            seen[header->id] = header->id;
+            header->loop_depth++;
+        }
+
+        while (top)
+        {
+            struct ir_block *b = stack[--top];
+
+            b->loop_depth++;
+
+            for (int p = 0; p < b->pred_count; p++)
+            {
+                struct ir_block *pred = b->preds[p];
+
+                if (pred->order >= 0 && seen[pred->id] != header->id)
+                {
+                    seen[pred->id] = header->id;
+                    stack[top++] = pred;
+                }
+            }
+        }
+    }
+
+    free(stack);
+    free(seen);
+}
@@ -0,0 +1,25 @@
+#ifndef DOMINANCE_H
+#define DOMINANCE_H
+
+#include <stdbool.h>
+
+struct ir_block;
+struct ir_function;
+
+// Numbers the reachable blocks in reverse postorder, then computes each
+// block's immediate dominator, its children in the dominator tree, and its
+// dominance frontier. The CFG must have been linked first
+void ir_function_dominators(struct ir_function *f);
+
+// True if every path from the entry to b passes through a
+bool ir_dominates(struct ir_block *a, struct ir_block *b);
+
+// Sets the loop depth of every block from the natural loops of the CFG, each
+// found from the back edges into its header. Dominators must be up to date
+void ir_function_loop_depths(struct ir_function *f);
+
+// Removes the blocks that cannot be reached from the entry, returning how many
+// were removed. Dominators must be recomputed afterwards
+int ir_function_remove_unreachable(struct ir_function *f);
+
+#endif
@@ -0,0 +1,321 @@
+#include "fold.h"
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ast.h"
+#include "symbol.h"
+
+// ============================
+// Reassignment of local values
+// ============================
+
+// Before folding, every symbol that is assigned to, incremented or decremented
+// anywhere in the program is marked. Locals that are never marked keep the
+// value they were declared with, so that value can be propagated to each use.
+// Arrays are marked when any element is stored to, or when the array is used
+// as a value at all, since it could then be modified under another name.
+
+static void expr_mark_reassigned(struct expr *e)
+{
+    // Argument chains are walked iteratively, since they can be very long
+    while (e && e->kind == EXPR_ARG)
+    {
+        expr_mark_reassigned(e->left);
+        e = e->right;
+    }
+
+    if (!e)
+        return;
+
+    if (e->kind == EXPR_ASSIGNMENT || e->kind == EXPR_INC || e->kind == EXPR_DEC)
+    {
+        struct expr *target = e->left;
+
+        while (target->kind == EXPR_SUBSCRIPT)
+            target = target->left;
+
+        if (target->kind == EXPR_NAME)
+            target->symbol->reassigned = true;
+    }
+
+    if (e->kind == EXPR_NAME && e->symbol->type->kind == TYPE_ARRAY)
+        e->symbol->reassigned = true;
+
+    // Reading an element doesn't let the array escape
+    if (e->kind != EXPR_SUBSCRIPT || e->left->kind != EXPR_NAME)
+        expr_mark_reassigned(e->left);
+
+    expr_mark_reassigned(e->right);
+
+    for (int i = 0; i < e->arg_count; i++)
+        expr_mark_reassigned(e->args[i]);
+}
+
+static void decl_mark_reassigned(struct decl *d);
+
+static void stmt_mark_reassigned(struct stmt *s)
+{
+    for (; s; s = s->next)
+    {
+        decl_mark_reassigned(s->decl);
+        expr_mark_reassigned(s->init_expr);
+        expr_mark_reassigned(s->expr);
+        expr_mark_reassigned(s->next_expr);
+        stmt_mark_reassigned(s->body);
+        stmt_mark_reassigned(s->else_body);
+    }
+}
+
+static void decl_mark_reassigned(struct decl *d)
+{
+    for (; d; d = d->next)
+    {
+        expr_mark_reassigned(d->value);
+        stmt_mark_reassigned(d->code);
+    }
+}
+
+// =======
+// Helpers
+// =======
+
+static bool expr_is_literal(struct expr *e)
+{
+    return e && (e->kind == EXPR_INTEGERLITERAL || e->kind == EXPR_BOOLEANLITERAL || e->kind == EXPR_CHARLITERAL);
+}
+
+static struct expr *expr_copy_literal(struct expr *e)
+{
+    switch (e->kind)
+    {
+    case EXPR_INTEGERLITERAL:
+        return expr_create_integer_literal(e->literal_value);
+    case EXPR_BOOLEANLITERAL:
+        return expr_create_boolean_literal(e->literal_value);
+    default:
+        return expr_create_char_literal(e->literal_value);
+    }
+}
+
+// Replaces e with an integer literal holding value, as long as the value can be
+// represented by a literal. Integers are 64 bits at runtime, so any result
+// that fits in a literal is exactly what the generated code would compute.
+static struct expr *fold_integer(struct expr *e, int64_t value)
+{
+    if (value < INT_MIN || value > INT_MAX)
+        return e;
+
+    return expr_create_integer_literal(value);
+}
+
+// Computes x ^ y the same way integer_power in the runtime library does, where
+// any exponent less than one gives one. Returns false if the result overflows.
+static bool integer_power(int64_t x, int64_t y, int64_t *result)
+{
+    int64_t r = 1;
+
+    while (y > 0)
+    {
+        if (y & 1 && __builtin_mul_overflow(r, x, &r))
+            return false;
+
+        y >>= 1;
+
+        if (y > 0 && __builtin_mul_overflow(x, x, &x))
+            return false;
+    }
+
+    *result = r;
+    return true;
+}
+
+static struct expr *fold_binary(struct expr *e)
+{
+    int64_t l = e->left->literal_value;
+    int64_t r = e->right->literal_value;
+    int64_t result;
+
+    switch (e->kind)
+    {
+    case EXPR_ADD:
+        return fold_integer(e, l + r);
+    case EXPR_SUB:
+        return fold_integer(e, l - r);
+    case EXPR_MUL:
+        return fold_integer(e, l * r);
+    case EXPR_DIV:
+        // Division by zero is left for the program to trap on at runtime
+        if (r == 0)
+            return e;
+        return fold_integer(e, l / r);
+    case EXPR_MOD:
+        if (r == 0)
+            return e;
+        return fold_integer(e, l % r);
+    case EXPR_POW:
+        if (!integer_power(l, r, &result))
+            return e;
+        return fold_integer(e, result);
+    case EXPR_LT:
+        return expr_create_boolean_literal(l < r);
+    case EXPR_LTE:
+        return expr_create_boolean_literal(l <= r);
+    case EXPR_GT:
+        return expr_create_boolean_literal(l > r);
+    case EXPR_GTE:
+        return expr_create_boolean_literal(l >= r);
+    case EXPR_EQUALITY:
+        return expr_create_boolean_literal(l == r);
+    case EXPR_NEQUALITY:
+        return expr_create_boolean_literal(l != r);
+    case EXPR_AND:
+        return expr_create_boolean_literal(l && r);
+    case EXPR_OR:
+        return expr_create_boolean_literal(l || r);
+    default:
+        return e;
+    }
+}
+
+// ================
+// Constant folding
+// ================
+
+void ast_fold(struct decl *ast)
+{
+    // Reassignments are marked for the whole program before anything is folded
+    decl_mark_reassigned(ast);
+    decl_fold(ast);
+}
+
+void decl_fold(struct decl *d)
+{
+    for (; d; d = d->next)
+    {
+        d->value = expr_fold(d->value);
+        d->code = stmt_fold(d->code);
+
+        // Locals that are never reassigned always hold their declared value
+        if (d->symbol->kind == SYMBOL_LOCAL && !d->symbol->reassigned && expr_is_literal(d->value))
+            d->symbol->constant = d->value;
+    }
+}
+
+// Note: This function returns the folded statement list, which may begin with a
+//       different statement than s did if an if statement was simplified away
+struct stmt *stmt_fold(struct stmt *s)
+{
+    if (!s)
+        return NULL;
+
+    decl_fold(s->decl);
+    s->init_expr = expr_fold(s->init_expr);
+    s->expr = expr_fold(s->expr);
+    s->next_expr = expr_fold(s->next_expr);
+
+    if (s->kind == STMT_IF && s->expr->kind == EXPR_BOOLEANLITERAL)
+    {
+        // Only the branch that is always taken is kept, spliced in place of
+        // the if statement
+        struct stmt *taken = stmt_fold(s->expr->literal_value ? s->body : s->else_body);
+        struct stmt *next = stmt_fold(s->next);
+
+        if (!taken)
+            return next;
+
+        struct stmt *tail = taken;
+
+        while (tail->next)
+            tail = tail->next;
+
+        tail->next = next;
+        return taken;
+    }
+
+    if (s->kind == STMT_FOR && s->expr && s->expr->kind == EXPR_BOOLEANLITERAL && !s->expr->literal_value)
+    {
+        // A loop that never runs only keeps its initializer
+        struct stmt *next = stmt_fold(s->next);
+
+        if (!s->init_expr)
+            return next;
+
+        return stmt_create(STMT_EXPR, NULL, NULL, s->init_expr, NULL, NULL, NULL, next);
+    }
+
+    s->body = stmt_fold(s->body);
+    s->else_body = stmt_fold(s->else_body);
+    s->next = stmt_fold(s->next);
+
+    return s;
+}
+
+// Note: This function returns the folded expression, which is either e itself
+//       or a new literal that replaces it
+struct expr *expr_fold(struct expr *e)
+{
+    if (!e)
+        return NULL;
+
+    // Argument chains are folded iteratively, since they can be very long
+    if (e->kind == EXPR_ARG)
+    {
+        for (struct expr *a = e; a && a->kind == EXPR_ARG; a = a->right)
+            a->left = expr_fold(a->left);
+
+        return e;
+    }
+
+    if (e->kind == EXPR_NAME)
+    {
+        if (e->symbol->constant)
+            return expr_copy_literal(e->symbol->constant);
+
+        return e;
+    }
+
+    // The target of an assignment or increment has to stay a name, though the
+    // index of an array element target can still be folded
+    if ((e->kind != EXPR_ASSIGNMENT && e->kind != EXPR_INC && e->kind != EXPR_DEC) || e->left->kind != EXPR_NAME)
+        e->left = expr_fold(e->left);
+
+    // Nested initializers are chained through their right pointers
+    e->right = expr_fold(e->right);
+
+    for (int i = 0; i < e->arg_count; i++)
+        e->args[i] = expr_fold(e->args[i]);
+
+    switch (e->kind)
+    {
+    case EXPR_GROUP:
+        if (expr_is_literal(e->left))
+            return e->left;
+        break;
+    case EXPR_NEGATE:
+        if (e->left->kind == EXPR_INTEGERLITERAL)
+            return fold_integer(e, -(int64_t)e->left->literal_value);
+        break;
+    case EXPR_NOT:
+        if (e->left->kind == EXPR_BOOLEANLITERAL)
+            return expr_create_boolean_literal(!e->left->literal_value);
+        break;
+    case EXPR_AND:
+        // A constant left side decides whether the right side matters at all
+        if (e->left->kind == EXPR_BOOLEANLITERAL)
+            return e->left->literal_value ? e->right : e->left;
+        break;
+    case EXPR_OR:
+        if (e->left->kind == EXPR_BOOLEANLITERAL)
+            return e->left->literal_value ? e->left : e->right;
+        break;
+    default:
+        if (expr_is_literal(e->left) && expr_is_literal(e->right))
+            return fold_binary(e);
+        break;
+    }
+
+    return e;
+}
@@ -0,0 +1,16 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+struct decl;
+struct expr;
+struct stmt;
+
+void ast_fold(struct decl *ast);
+
+void decl_fold(struct decl *d);
+
+struct stmt *stmt_fold(struct stmt *s);
+
+struct expr *expr_fold(struct expr *e);
+
+#endif
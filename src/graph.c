@@ -128,8 +128,8 @@ int expr_graph(struct expr *e)
     }
 
     printf(
-        " | { <left> left | <right> right | <name> name: %s | <literal_value> literal_value: %d | <string_literal> string_literal: '%s' | <symbol> symbol }}\"\n",
-        e->name, e->literal_value, e->string_literal);
+        " | { <left> left | <right> right | <args> args: %d | <name> name: %s | <literal_value> literal_value: %d | <string_literal> string_literal: '%s' | <symbol> symbol }}\"\n",
+        e->arg_count, e->name, e->literal_value, e->string_literal);
     printf("\tfillcolor = \"lightblue\"\n");
     printf("\tshape = \"record\"\n");
     printf("];\n\n");
@@ -149,6 +149,9 @@ int expr_graph(struct expr *e)
     if (symbol_node_id != -1)
         printf("\"expr_%06d\":symbol -> \"symbol_%06d\" [style=\"dashed\"];\n", node_id, symbol_node_id);
 
+    for (int i = 0; i < e->arg_count; i++)
+        printf("\"expr_%06d\":args -> \"expr_%06d\";\n", node_id, expr_graph(e->args[i]));
+
     return node_id;
 }
 
@@ -279,25 +282,29 @@ int decl_graph(struct decl *d)
     return node_id;
 }
 
-int param_list_graph(struct param_list *p)
+// Graphs the parameters from index i onwards, linking each to the next so the
+// list reads the same way it is declared
+static int param_graph(struct param_list *p, int i)
 {
-    if (!p)
+    if (i >= param_list_count(p))
         return -1;
 
+    struct param *item = &p->items[i];
+
     int node_id = graph_node_id_counter;
     graph_node_id_counter++;
 
     // The definition of the node
     printf("\"param_list_%06d\"[\n", node_id);
-    printf("\tlabel = \"{ parameter: %s | { <type> type | <symbol> symbol | <next> next }}\"\n", p->name);
+    printf("\tlabel = \"{ parameter: %s | { <type> type | <symbol> symbol | <next> next }}\"\n", item->name);
     printf("\tfillcolor = \"lightyellow\"\n");
     printf("\tshape = \"record\"\n");
     printf("];\n\n");
 
     // Graph children nodes
-    int type_node_id = type_graph(p->type);
-    int symbol_node_id = symbol_graph(p->symbol);
-    int next_node_id = param_list_graph(p->next);
+    int type_node_id = type_graph(item->type);
+    int symbol_node_id = symbol_graph(item->symbol);
+    int next_node_id = param_graph(p, i + 1);
 
     // Only print edges if a corresponding node exists
     if (type_node_id != -1)
@@ -312,6 +319,11 @@ int param_list_graph(struct param_list *p)
     return node_id;
 }
 
+int param_list_graph(struct param_list *p)
+{
+    return param_graph(p, 0);
+}
+
 int symbol_graph(struct symbol *s)
 {
     if (!s)
@@ -0,0 +1,574 @@
+#include "gvn.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alias.h"
+#include "dominance.h"
+#include "ir.h"
+
+// The dominator tree is walked from the entry, keeping a table of every
+// computation made on the way down. Since a block's dominators all run before
+// it, an instruction computing something already in the table can take the
+// result from there. Entries are popped again when the walk leaves the block
+// that made them, so the table only ever holds what dominates the block being
+// visited.
+//
+// Loads also depend on memory, which the table tracks with a log of the
+// objects written on the way down. A load is only available while nothing
+// logged since it may alias what it read. A block entered from anywhere but
+// its immediate dominator may be reached after writes the walk never saw, so
+// it starts by logging a write to everything. Stores record what they wrote
+// as loaded, so reading it back takes the stored value.
+
+#define BUCKET_COUNT 4096
+
+struct expression
+{
+    ir_op_t op;
+    ir_type_t type;
+    struct ir_value a;
+    struct ir_value b;
+
+    // For loads, the object read and how long the write log was when it was
+    // read. Writes logged after that may have changed it
+    struct object object;
+    int log_position;
+
+    // The value computed
+    struct ir_value value;
+
+    // The bucket the expression is in and the entry it was put in front of
+    int bucket;
+    int next;
+};
+
+// The state of the function being numbered
+static struct ir_function *function = NULL;
+static struct ir_instr **defs = NULL;
+static struct ir_value *replacement = NULL;
+
+static struct expression *table = NULL;
+static int table_count = 0;
+static int table_capacity = 0;
+static int buckets[BUCKET_COUNT];
+
+static struct object *writes = NULL;
+static int write_count = 0;
+static int write_capacity = 0;
+
+static int computations = 0;
+static int loads = 0;
+
+// ==============
+// Replacing uses
+// ==============
+
+// Replaces every use of the instruction's result with value, and removes it
+static void instr_replace(struct ir_instr *i, struct ir_value value)
+{
+    replacement[i->dest.number] = value;
+    ir_remove(i);
+}
+
+// ===========
+// Expressions
+// ===========
+
+static bool is_pure(struct ir_instr *i)
+{
+    switch (i->op)
+    {
+    case IR_ADDRESS_OF:
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_DIV:
+    case IR_MOD:
+    case IR_POW:
+    case IR_NEG:
+    case IR_NOT:
+    case IR_AND:
+    case IR_OR:
+    case IR_LT:
+    case IR_LTE:
+    case IR_GT:
+    case IR_GTE:
+    case IR_EQ:
+    case IR_NE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool is_commutative(ir_op_t op)
+{
+    return op == IR_ADD || op == IR_MUL || op == IR_AND || op == IR_OR || op == IR_EQ || op == IR_NE;
+}
+
+static int value_compare(struct ir_value x, struct ir_value y)
+{
+    if (x.kind != y.kind)
+        return x.kind - y.kind;
+
+    if (x.kind == IR_VALUE_GLOBAL || x.kind == IR_VALUE_STRING)
+        return strcmp(x.name, y.name);
+
+    return x.number < y.number ? -1 : x.number > y.number;
+}
+
+static unsigned value_hash(struct ir_value v)
+{
+    unsigned hash = v.kind * 31;
+
+    if (v.kind == IR_VALUE_GLOBAL || v.kind == IR_VALUE_STRING)
+    {
+        for (const char *c = v.name; *c; c++)
+            hash = hash * 31 + *c;
+    }
+    else
+    {
+        hash += (unsigned)v.number;
+    }
+
+    return hash;
+}
+
+static struct expression expression_create(ir_op_t op, ir_type_t type, struct ir_value a, struct ir_value b)
+{
+    struct expression e = {op, type, a, b, {OBJECT_ANY, ir_none()}, 0, ir_none(), 0, -1};
+
+    return e;
+}
+
+// What an instruction computes, with the operands of commutative operations
+// in a fixed order, and greater-than comparisons written as less-than, so
+// that the same computation written differently is still found
+static struct expression expression_of(struct ir_instr *i)
+{
+    struct expression e = expression_create(i->op, i->dest.type, i->a, i->b);
+
+    if (e.op == IR_GT || e.op == IR_GTE)
+    {
+        e.op = e.op == IR_GT ? IR_LT : IR_LTE;
+        e.a = i->b;
+        e.b = i->a;
+    }
+    else if (is_commutative(e.op) && value_compare(e.a, e.b) > 0)
+    {
+        e.a = i->b;
+        e.b = i->a;
+    }
+
+    return e;
+}
+
+static bool expression_equals(struct expression *x, struct expression *y)
+{
+    return x->op == y->op && x->type == y->type && ir_value_equals(x->a, y->a) && ir_value_equals(x->b, y->b);
+}
+
+static int expression_bucket(struct expression *e)
+{
+    return (e->op * 131 + value_hash(e->a) * 31 + value_hash(e->b)) % BUCKET_COUNT;
+}
+
+// Whether nothing written since the expression was recorded may change it
+static bool is_available(struct expression *e)
+{
+    if (e->op != IR_LOAD && e->op != IR_LOAD_ELEMENT)
+        return true;
+
+    for (int w = e->log_position; w < write_count; w++)
+    {
+        if (may_alias(writes[w], e->object))
+            return false;
+    }
+
+    return true;
+}
+
+// The value the expression was last recorded with, or none
+static struct ir_value expression_find(struct expression *e)
+{
+    for (int n = buckets[expression_bucket(e)]; n >= 0; n = table[n].next)
+    {
+        if (expression_equals(&table[n], e))
+            return is_available(&table[n]) ? table[n].value : ir_none();
+    }
+
+    return ir_none();
+}
+
+static void expression_record(struct expression e, struct ir_value value)
+{
+    if (table_count == table_capacity)
+    {
+        table_capacity = table_capacity ? table_capacity * 2 : 64;
+        table = realloc(table, sizeof(struct expression) * table_capacity);
+    }
+
+    e.value = value;
+    e.log_position = write_count;
+    e.bucket = expression_bucket(&e);
+    e.next = buckets[e.bucket];
+    buckets[e.bucket] = table_count;
+    table[table_count++] = e;
+}
+
+static void write_log(struct object o)
+{
+    if (write_count == write_capacity)
+    {
+        write_capacity = write_capacity ? write_capacity * 2 : 64;
+        writes = realloc(writes, sizeof(struct object) * write_capacity);
+    }
+
+    writes[write_count++] = o;
+}
+
+// =========
+// Numbering
+// =========
+
+// Whether every argument of the phi is the same value, ignoring those that
+// are the phi itself, which come around loops that don't change it
+static struct ir_value phi_value(struct ir_instr *phi)
+{
+    struct ir_value value = ir_none();
+
+    for (int n = 0; n < phi->arg_count; n++)
+    {
+        if (ir_value_equals(phi->args[n], phi->dest))
+            continue;
+
+        if (value.kind != IR_VALUE_NONE && !ir_value_equals(value, phi->args[n]))
+            return ir_none();
+
+        value = phi->args[n];
+    }
+
+    return value;
+}
+
+// The constant an addition or subtraction adds to its other operand
+static bool is_offset(struct ir_instr *i, struct ir_value *base, int64_t *offset)
+{
+    if (!i || i->dest.type != IR_INTEGER)
+        return false;
+
+    if (i->op == IR_ADD && i->b.kind == IR_VALUE_CONSTANT)
+    {
+        *base = i->a;
+        *offset = i->b.number;
+        return true;
+    }
+
+    if (i->op == IR_ADD && i->a.kind == IR_VALUE_CONSTANT)
+    {
+        *base = i->b;
+        *offset = i->a.number;
+        return true;
+    }
+
+    if (i->op == IR_SUB && i->b.kind == IR_VALUE_CONSTANT && i->b.number != INT64_MIN)
+    {
+        *base = i->a;
+        *offset = -i->b.number;
+        return true;
+    }
+
+    return false;
+}
+
+// Constants added one after another, as the copies of an unrolled loop's body
+// add to its counter, are added as their sum instead. That leaves each sum
+// independent of the others, and adding nothing leaves the value as it was.
+// Returns true if the instruction was removed
+static bool offsets_combine(struct ir_instr *i)
+{
+    struct ir_value base;
+    struct ir_value inner_base;
+    int64_t offset;
+    int64_t inner;
+
+    if (!is_offset(i, &base, &offset) || base.kind != IR_VALUE_TEMP)
+        return false;
+
+    if (is_offset(defs[base.number], &inner_base, &inner) && inner_base.kind == IR_VALUE_TEMP &&
+        !__builtin_add_overflow(offset, inner, &inner))
+    {
+        base = inner_base;
+        offset = inner;
+    }
+
+    if (offset == 0)
+    {
+        instr_replace(i, base);
+        return true;
+    }
+
+    i->op = IR_ADD;
+    i->a = base;
+    i->b = ir_constant(IR_INTEGER, offset);
+
+    return false;
+}
+
+static void instr_number(struct ir_instr *i)
+{
+    if (offsets_combine(i))
+    {
+        computations++;
+        return;
+    }
+
+    struct expression e = expression_of(i);
+    struct ir_value value;
+
+    switch (i->op)
+    {
+    case IR_PHI:
+        if ((value = phi_value(i)).kind != IR_VALUE_NONE)
+        {
+            instr_replace(i, value);
+            computations++;
+        }
+        break;
+    case IR_COPY:
+        if (i->dest.kind == IR_VALUE_TEMP && (i->a.kind == IR_VALUE_TEMP || i->a.kind == IR_VALUE_CONSTANT) &&
+            i->a.type == i->dest.type)
+        {
+            instr_replace(i, i->a);
+            computations++;
+        }
+        break;
+    case IR_LOAD:
+    case IR_LOAD_ELEMENT:
+        e.object = i->op == IR_LOAD ? object_of(i->a) : base_object(defs, i->a);
+
+        if ((value = expression_find(&e)).kind != IR_VALUE_NONE)
+        {
+            instr_replace(i, value);
+            loads++;
+        }
+        else
+        {
+            expression_record(e, i->dest);
+        }
+        break;
+    case IR_STORE:
+        write_log(object_of(i->a));
+
+        e = expression_create(IR_LOAD, i->b.type, i->a, ir_none());
+        e.object = object_of(i->a);
+        expression_record(e, i->b);
+        break;
+    case IR_STORE_ELEMENT:
+        write_log(base_object(defs, i->a));
+
+        e = expression_create(IR_LOAD_ELEMENT, i->c.type, i->a, i->b);
+        e.object = base_object(defs, i->a);
+        expression_record(e, i->c);
+        break;
+    case IR_CALL:
+        if (ir_call_writes_memory(i))
+            write_log((struct object){OBJECT_ANY, ir_none()});
+        break;
+    case IR_VECTOR:
+        write_log((struct object){OBJECT_ANY, ir_none()});
+        break;
+    default:
+        if (!is_pure(i) || i->dest.kind != IR_VALUE_TEMP)
+            break;
+
+        if ((value = expression_find(&e)).kind != IR_VALUE_NONE)
+        {
+            instr_replace(i, value);
+            computations++;
+        }
+        else
+        {
+            expression_record(e, i->dest);
+        }
+        break;
+    }
+}
+
+static void block_number(struct ir_block *b)
+{
+    int saved_table = table_count;
+    int saved_writes = write_count;
+
+    if (b != function->entry && !(b->pred_count == 1 && b->preds[0] == b->idom))
+        write_log((struct object){OBJECT_ANY, ir_none()});
+
+    for (struct ir_instr *i = b->first; i;)
+    {
+        struct ir_instr *next = i->next;
+
+        ir_operands_resolve(replacement, i);
+        instr_number(i);
+        i = next;
+    }
+
+    for (int c = 0; c < b->child_count; c++)
+        block_number(b->children[c]);
+
+    while (table_count > saved_table)
+    {
+        struct expression *e = &table[--table_count];
+        buckets[e->bucket] = e->next;
+    }
+
+    write_count = saved_writes;
+}
+
+// ========
+// Hoisting
+// ========
+
+// Computations that can be made early without changing what the program
+// does, which rules out loads and anything that may trap
+static bool can_hoist(struct ir_instr *i)
+{
+    return is_pure(i) && !ir_has_side_effects(i) && i->dest.kind == IR_VALUE_TEMP;
+}
+
+static bool is_defined_in(struct ir_value v, struct ir_block *b)
+{
+    return v.kind == IR_VALUE_TEMP && defs[v.number] && defs[v.number]->block == b;
+}
+
+// The instruction in the block computing the same as i, if any
+static struct ir_instr *match_find(struct ir_block *b, struct ir_instr *i)
+{
+    struct expression e = expression_of(i);
+
+    for (struct ir_instr *j = b->first; j; j = j->next)
+    {
+        if (!can_hoist(j))
+            continue;
+
+        ir_operands_resolve(replacement, j);
+
+        struct expression other = expression_of(j);
+
+        if (expression_equals(&e, &other))
+            return j;
+    }
+
+    return NULL;
+}
+
+// When both arms of a branch make the same computation from values defined
+// before the branch, the computation is moved in front of it and the second
+// copy removed. Code placed between a comparison and the branch on it would
+// keep them from being fused, so it goes in front of the comparison instead
+static void arms_hoist(struct ir_block *b)
+{
+    struct ir_instr *branch = b->last;
+
+    if (!branch || branch->op != IR_BRANCH || branch->target == branch->target_false)
+        return;
+
+    struct ir_block *left = branch->target;
+    struct ir_block *right = branch->target_false;
+
+    if (left->pred_count != 1 || right->pred_count != 1)
+        return;
+
+    struct ir_instr *position = branch;
+
+    if (branch->prev && ir_value_equals(branch->prev->dest, branch->a))
+        position = branch->prev;
+
+    for (struct ir_instr *i = left->first; i;)
+    {
+        struct ir_instr *next = i->next;
+        bool available = can_hoist(i);
+
+        ir_operands_resolve(replacement, i);
+
+        for (int n = 0; available && n < ir_operand_count(i); n++)
+        {
+            struct ir_value v = *ir_operand(i, n);
+
+            if (is_defined_in(v, left) || (position != branch && ir_value_equals(v, position->dest)))
+                available = false;
+        }
+
+        struct ir_instr *match = available ? match_find(right, i) : NULL;
+
+        if (match)
+        {
+            ir_remove(i);
+            ir_insert_before(position, i);
+            instr_replace(match, i->dest);
+            computations++;
+        }
+
+        i = next;
+    }
+}
+
+int ir_function_gvn(struct ir_function *f, bool remarks)
+{
+    function = f;
+    defs = calloc(f->temp_count ? f->temp_count : 1, sizeof(struct ir_instr *));
+    replacement = calloc(f->temp_count ? f->temp_count : 1, sizeof(struct ir_value));
+    computations = 0;
+    loads = 0;
+
+    memset(buckets, -1, sizeof(buckets));
+
+    ir_function_link(f);
+    ir_function_dominators(f);
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            if (i->dest.kind == IR_VALUE_TEMP)
+                defs[i->dest.number] = i;
+        }
+    }
+
+    for (int n = 0; n < f->rpo_count; n++)
+        arms_hoist(f->rpo[n]);
+
+    block_number(f->entry);
+
+    // Phi arguments may come from blocks numbered after the phi
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+            ir_operands_resolve(replacement, i);
+    }
+
+    if (remarks && computations + loads)
+    {
+        printf("remark: %s: removed %d redundant computations and %d redundant loads\n", f->name, computations,
+               loads);
+    }
+
+    free(defs);
+    free(replacement);
+    free(table);
+    free(writes);
+    defs = NULL;
+    replacement = NULL;
+    table = NULL;
+    table_count = 0;
+    table_capacity = 0;
+    writes = NULL;
+    write_count = 0;
+    write_capacity = 0;
+    function = NULL;
+
+    return computations + loads;
+}
@@ -0,0 +1,16 @@
+#ifndef GVN_H
+#define GVN_H
+
+#include <stdbool.h>
+
+struct ir_function;
+
+// Global value numbering over a function in SSA form. A computation already
+// made by an instruction dominating it is replaced by that instruction's
+// result, and so is a load of memory nothing may have written since it was
+// last loaded or stored. A computation made in both arms of a branch is made
+// once before the branch instead. The number of instructions removed is
+// reported when remarks is set. Returns how many were removed
+int ir_function_gvn(struct ir_function *f, bool remarks);
+
+#endif
@@ -0,0 +1,748 @@
+#include "induction.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dominance.h"
+#include "ir.h"
+#include "loop.h"
+
+// A basic induction variable is a header phi stepped by a constant on each
+// trip around the loop. Values computed from it by adding and multiplying by
+// constants are affine in it, and each of those can be kept in a variable of
+// its own, stepped alongside, instead of being recomputed from the counter.
+//
+// Element accesses already scale their index for free in x86 addressing, so
+// a pointer only pays for itself when it saves a multiplication, when it is
+// the only one the counter would need, since then it can take over the exit
+// test and the counter goes away, or when its accesses are at enough offsets
+// from the counter that adding them costs more than stepping it. Loops are
+// visited from the innermost out.
+
+struct induction
+{
+    struct ir_instr *phi;
+    struct ir_instr *increment;
+    int64_t step;
+
+    // The value on entry, and the block the phi takes the next value from
+    struct ir_value init;
+    struct ir_block *latch;
+};
+
+// A value equal to scale times the counter plus offset, plus a value that
+// doesn't change in the loop when invariant isn't none
+struct affine
+{
+    bool valid;
+    int64_t scale;
+    int64_t offset;
+    struct ir_value invariant;
+};
+
+// Array elements reached with the same scale and invariant part of their
+// index from the same array share one pointer, which moves 8 * scale * step
+// bytes each trip
+struct pointer
+{
+    struct ir_value base;
+    int64_t scale;
+    struct ir_value invariant;
+
+    // Whether an access through the pointer happens on every trip
+    bool every_trip;
+
+    struct ir_instr *phi;
+    struct ir_instr *next;
+};
+
+struct access
+{
+    struct ir_instr *instr;
+    int pointer;
+    int64_t offset;
+};
+
+// The state of the function being optimized
+static struct ir_function *function = NULL;
+static struct ir_instr **defs = NULL;
+static int *use_counts = NULL;
+static bool print_remarks = false;
+
+static struct pointer *pointers = NULL;
+static int pointer_count = 0;
+static struct access *accesses = NULL;
+static int access_count = 0;
+
+// =======
+// Helpers
+// =======
+
+static void defs_build(struct ir_function *f)
+{
+    free(defs);
+    free(use_counts);
+    defs = calloc(f->temp_count ? f->temp_count : 1, sizeof(struct ir_instr *));
+    use_counts = calloc(f->temp_count ? f->temp_count : 1, sizeof(int));
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            if (i->dest.kind == IR_VALUE_TEMP)
+                defs[i->dest.number] = i;
+
+            for (int n = 0; n < ir_operand_count(i); n++)
+            {
+                struct ir_value *v = ir_operand(i, n);
+
+                if (v->kind == IR_VALUE_TEMP)
+                    use_counts[v->number]++;
+            }
+        }
+    }
+}
+
+static bool is_temp(struct ir_value v, struct ir_value temp)
+{
+    return v.kind == IR_VALUE_TEMP && v.number == temp.number;
+}
+
+static bool defined_outside(struct ir_loop *l, struct ir_value v)
+{
+    if (v.kind != IR_VALUE_TEMP)
+        return v.kind == IR_VALUE_CONSTANT;
+
+    return !defs[v.number] || !ir_loop_contains(l, defs[v.number]->block);
+}
+
+// Two array bases are the same if they are the same temporary or the address
+// of the same global or slot
+static bool base_equals(struct ir_value a, struct ir_value b)
+{
+    if (ir_value_equals(a, b))
+        return true;
+
+    struct ir_instr *x = a.kind == IR_VALUE_TEMP ? defs[a.number] : NULL;
+    struct ir_instr *y = b.kind == IR_VALUE_TEMP ? defs[b.number] : NULL;
+
+    return x && y && x->op == IR_ADDRESS_OF && y->op == IR_ADDRESS_OF && ir_value_equals(x->a, y->a);
+}
+
+static struct ir_instr *instr_create(ir_op_t op, struct ir_value dest, struct ir_value a, struct ir_value b)
+{
+    struct ir_instr *i = ir_instr_create(function, op);
+
+    i->dest = dest;
+    i->a = a;
+    i->b = b;
+
+    return i;
+}
+
+// Computes a op b at the end of the preheader, folding constants
+static struct ir_value preheader_compute(struct ir_loop *l, ir_op_t op, ir_type_t type, struct ir_value a,
+                                         struct ir_value b)
+{
+    if (a.kind == IR_VALUE_CONSTANT && b.kind == IR_VALUE_CONSTANT)
+    {
+        uint64_t x = a.number;
+        uint64_t y = b.number;
+
+        return ir_constant(type, (int64_t)(op == IR_ADD ? x + y : x * y));
+    }
+
+    if (b.kind == IR_VALUE_CONSTANT && b.number == (op == IR_ADD ? 0 : 1))
+        return a;
+
+    struct ir_instr *i = instr_create(op, ir_temp(function, type), a, b);
+    ir_insert_before(l->preheader->last, i);
+
+    return i->dest;
+}
+
+// A new variable starting at init and moving by step each trip, taking its
+// next value right after the counter does
+static struct ir_instr *variable_create(struct ir_loop *l, struct induction *iv, ir_type_t type,
+                                        struct ir_value init, int64_t step, struct ir_instr **next)
+{
+    struct ir_instr *phi = instr_create(IR_PHI, ir_temp(function, type), ir_none(), ir_none());
+
+    *next = instr_create(IR_ADD, ir_temp(function, type), phi->dest, ir_constant(IR_INTEGER, step));
+
+    phi->args = ir_alloc(function, sizeof(struct ir_value) * 2);
+    phi->sources = ir_alloc(function, sizeof(struct ir_block *) * 2);
+    phi->args[0] = init;
+    phi->sources[0] = l->preheader;
+    phi->args[1] = (*next)->dest;
+    phi->sources[1] = iv->latch;
+    phi->arg_count = 2;
+
+    ir_insert_before(l->header->first, phi);
+
+    if (iv->increment->next)
+        ir_insert_before(iv->increment->next, *next);
+    else
+        ir_append(iv->increment->block, *next);
+
+    return phi;
+}
+
+// ===================
+// Induction variables
+// ===================
+
+static bool induction_find(struct ir_loop *l, struct ir_instr *phi, struct induction *iv)
+{
+    if (phi->dest.type != IR_INTEGER || phi->arg_count != 2 || l->header->pred_count != 2)
+        return false;
+
+    int outside = phi->sources[0] == l->preheader ? 0 : 1;
+    struct ir_value next = phi->args[1 - outside];
+
+    if (phi->sources[outside] != l->preheader || next.kind != IR_VALUE_TEMP || !defs[next.number])
+        return false;
+
+    struct ir_instr *i = defs[next.number];
+
+    if (!ir_loop_contains(l, i->block))
+        return false;
+
+    if (i->op == IR_ADD && is_temp(i->a, phi->dest) && i->b.kind == IR_VALUE_CONSTANT)
+        iv->step = i->b.number;
+    else if (i->op == IR_ADD && is_temp(i->b, phi->dest) && i->a.kind == IR_VALUE_CONSTANT)
+        iv->step = i->a.number;
+    else if (i->op == IR_SUB && is_temp(i->a, phi->dest) && i->b.kind == IR_VALUE_CONSTANT &&
+             i->b.number != INT64_MIN)
+        iv->step = -i->b.number;
+    else
+        return false;
+
+    iv->phi = phi;
+    iv->increment = i;
+    iv->init = phi->args[outside];
+    iv->latch = phi->sources[1 - outside];
+
+    return iv->step != 0;
+}
+
+// Finds how a value is computed from the counter, through constant additions
+// and multiplications, and at most one addition of a value that doesn't
+// change in the loop. Anything that would overflow is given up on
+static struct affine affine_of(struct ir_loop *l, struct induction *iv, struct ir_value v)
+{
+    struct affine none = {false, 0, 0, {0}};
+
+    if (v.kind != IR_VALUE_TEMP)
+        return none;
+
+    if (is_temp(v, iv->phi->dest))
+        return (struct affine){true, 1, 0, ir_none()};
+
+    struct ir_instr *def = defs[v.number];
+
+    if (!def || def->dest.type != IR_INTEGER || !ir_loop_contains(l, def->block))
+        return none;
+
+    struct affine a;
+    struct ir_value c;
+
+    switch (def->op)
+    {
+    case IR_COPY:
+        return affine_of(l, iv, def->a);
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+        if (defined_outside(l, def->b))
+        {
+            a = affine_of(l, iv, def->a);
+            c = def->b;
+        }
+        else if (defined_outside(l, def->a) && def->op != IR_SUB)
+        {
+            a = affine_of(l, iv, def->b);
+            c = def->a;
+        }
+        else
+        {
+            return none;
+        }
+        break;
+    default:
+        return none;
+    }
+
+    if (!a.valid)
+        return none;
+
+    if (c.kind != IR_VALUE_CONSTANT)
+    {
+        if (def->op != IR_ADD || a.invariant.kind != IR_VALUE_NONE)
+            return none;
+
+        a.invariant = c;
+        return a;
+    }
+
+    bool overflow;
+
+    if (def->op == IR_ADD)
+        overflow = __builtin_add_overflow(a.offset, c.number, &a.offset);
+    else if (def->op == IR_SUB)
+        overflow = __builtin_sub_overflow(a.offset, c.number, &a.offset);
+    else
+        overflow = a.invariant.kind != IR_VALUE_NONE || __builtin_mul_overflow(a.scale, c.number, &a.scale) ||
+                   __builtin_mul_overflow(a.offset, c.number, &a.offset);
+
+    return overflow ? none : a;
+}
+
+// Whether the block runs on every trip around the loop that finishes
+static bool runs_every_trip(struct ir_loop *l, struct ir_block *b)
+{
+    for (int n = 0; n < l->block_count; n++)
+    {
+        if (ir_loop_is_exiting(l, l->blocks[n]) && !ir_dominates(b, l->blocks[n]))
+            return false;
+    }
+
+    return true;
+}
+
+// ================
+// Element accesses
+// ================
+
+static void access_add(struct ir_loop *l, struct induction *iv, struct ir_instr *i)
+{
+    struct affine a = affine_of(l, iv, i->b);
+    int64_t stride;
+    int64_t bytes;
+
+    // The pointer moves 8 * scale * step bytes a trip, which must not overflow
+    if (!a.valid || a.scale == 0 || iv->step > INT32_MAX || iv->step < INT32_MIN ||
+        __builtin_mul_overflow(a.scale, 8 * iv->step, &stride) || __builtin_mul_overflow(a.offset, 8, &bytes))
+        return;
+
+    int p = 0;
+
+    while (p < pointer_count && !(pointers[p].scale == a.scale && base_equals(pointers[p].base, i->a) &&
+                                  ir_value_equals(pointers[p].invariant, a.invariant)))
+        p++;
+
+    if (p == pointer_count)
+    {
+        pointers = realloc(pointers, sizeof(struct pointer) * (pointer_count + 1));
+        pointers[pointer_count++] = (struct pointer){i->a, a.scale, a.invariant, false, NULL, NULL};
+    }
+
+    pointers[p].every_trip |= runs_every_trip(l, i->block);
+
+    accesses = realloc(accesses, sizeof(struct access) * (access_count + 1));
+    accesses[access_count++] = (struct access){i, p, a.offset};
+}
+
+// The byte offset from a pointer's base of the element at index plus the
+// pointer's invariant part
+static struct ir_value element_offset(struct ir_loop *l, struct pointer *ptr, struct ir_value index)
+{
+    if (ptr->invariant.kind != IR_VALUE_NONE)
+        index = preheader_compute(l, IR_ADD, IR_INTEGER, index, ptr->invariant);
+
+    return preheader_compute(l, IR_MUL, IR_INTEGER, index, ir_constant(IR_INTEGER, 8));
+}
+
+// ==========
+// Exit tests
+// ==========
+
+// The comparison deciding whether to leave the loop from an exiting block
+static struct ir_instr *exit_test(struct ir_loop *l, struct ir_block *b)
+{
+    struct ir_instr *t = b->last;
+
+    if (!ir_loop_is_exiting(l, b) || !t || t->op != IR_BRANCH || t->a.kind != IR_VALUE_TEMP)
+        return NULL;
+
+    struct ir_instr *test = defs[t->a.number];
+
+    if (!test || !ir_op_is_comparison(test->op) || !ir_loop_contains(l, test->block))
+        return NULL;
+
+    return test;
+}
+
+// The side of an exit test comparing the counter, or its next value, with a
+// bound that doesn't change in the loop
+static struct ir_value *exit_test_counter(struct ir_loop *l, struct induction *iv, struct ir_instr *test)
+{
+    struct ir_value *sides[2] = {&test->a, &test->b};
+
+    for (int s = 0; s < 2; s++)
+    {
+        struct ir_value *counter = sides[s];
+
+        if ((is_temp(*counter, iv->phi->dest) || is_temp(*counter, iv->increment->dest)) &&
+            defined_outside(l, *sides[1 - s]))
+            return counter;
+    }
+
+    return NULL;
+}
+
+// Whether the counter would be left with nothing to do if the accesses
+// through a pointer were rewritten and the exit tests compared it instead.
+// This takes away the uses those would remove, and then the uses by anything
+// in the loop left unused
+static bool counter_replaceable(struct ir_loop *l, struct induction *iv, int pointer)
+{
+    int *counts = malloc(sizeof(int) * (function->temp_count ? function->temp_count : 1));
+    bool *removed = calloc(function->temp_count ? function->temp_count : 1, sizeof(bool));
+
+    memcpy(counts, use_counts, sizeof(int) * function->temp_count);
+
+    for (int n = 0; n < access_count; n++)
+    {
+        if (accesses[n].pointer == pointer && accesses[n].instr->b.kind == IR_VALUE_TEMP)
+            counts[accesses[n].instr->b.number]--;
+    }
+
+    for (int n = 0; n < l->block_count; n++)
+    {
+        struct ir_instr *test = exit_test(l, l->blocks[n]);
+        struct ir_value *counter = test ? exit_test_counter(l, iv, test) : NULL;
+
+        if (counter)
+            counts[counter->number]--;
+    }
+
+    bool changed = true;
+
+    while (changed)
+    {
+        changed = false;
+
+        for (int n = 0; n < l->block_count; n++)
+        {
+            for (struct ir_instr *i = l->blocks[n]->first; i; i = i->next)
+            {
+                if (i->dest.kind != IR_VALUE_TEMP || counts[i->dest.number] || removed[i->dest.number] ||
+                    ir_has_side_effects(i) || i->op == IR_PARAM)
+                    continue;
+
+                removed[i->dest.number] = true;
+                changed = true;
+
+                for (int o = 0; o < ir_operand_count(i); o++)
+                {
+                    struct ir_value *v = ir_operand(i, o);
+
+                    if (v->kind == IR_VALUE_TEMP)
+                        counts[v->number]--;
+                }
+            }
+        }
+    }
+
+    bool replaceable = counts[iv->phi->dest.number] == 1 && counts[iv->increment->dest.number] == 1;
+
+    free(counts);
+    free(removed);
+    return replaceable;
+}
+
+// The side of each exit test reading the counter becomes the pointer, and the
+// other side the address of the element it is compared with. Comparing the
+// addresses keeps the order of the indices as long as that address is in the
+// array, which it is when the loop reads the array on every trip
+static int exit_tests_replace(struct ir_loop *l, struct induction *iv, struct pointer *ptr)
+{
+    int replaced = 0;
+
+    for (int n = 0; n < l->block_count; n++)
+    {
+        struct ir_instr *test = exit_test(l, l->blocks[n]);
+        struct ir_value *counter = test ? exit_test_counter(l, iv, test) : NULL;
+
+        if (!counter)
+            continue;
+
+        struct ir_value *bound = counter == &test->a ? &test->b : &test->a;
+        *bound = preheader_compute(l, IR_ADD, IR_ADDRESS, ptr->base, element_offset(l, ptr, *bound));
+        *counter = is_temp(*counter, iv->phi->dest) ? ptr->phi->dest : ptr->next->dest;
+        replaced++;
+    }
+
+    return replaced;
+}
+
+// Removes what the loop computed only for the indices and tests that were
+// rewritten, going on until nothing more is left unused
+static void unused_remove(struct ir_loop *l)
+{
+    bool changed = true;
+
+    defs_build(function);
+
+    while (changed)
+    {
+        changed = false;
+
+        for (int n = 0; n < l->block_count; n++)
+        {
+            struct ir_instr *next;
+
+            for (struct ir_instr *i = l->blocks[n]->first; i; i = next)
+            {
+                next = i->next;
+
+                if (i->dest.kind != IR_VALUE_TEMP || use_counts[i->dest.number] || ir_has_side_effects(i) ||
+                    i->op == IR_PARAM)
+                    continue;
+
+                for (int o = 0; o < ir_operand_count(i); o++)
+                {
+                    struct ir_value *v = ir_operand(i, o);
+
+                    if (v->kind == IR_VALUE_TEMP)
+                        use_counts[v->number]--;
+                }
+
+                ir_remove(i);
+                changed = true;
+            }
+        }
+    }
+}
+
+// A counter nothing reads but its own increment is dead
+static bool counter_remove(struct ir_loop *l, struct induction *iv)
+{
+    unused_remove(l);
+
+    if (use_counts[iv->phi->dest.number] != 1 || use_counts[iv->increment->dest.number] != 1)
+        return false;
+
+    ir_remove(iv->phi);
+    ir_remove(iv->increment);
+    return true;
+}
+
+// ========
+// Pointers
+// ========
+
+// How many different offsets from the counter, other than none, the accesses
+// through a pointer are at. Each one is an addition to index with, which the
+// pointer takes into its displacement instead
+static int offsets_count(int pointer)
+{
+    int count = 0;
+
+    for (int n = 0; n < access_count; n++)
+    {
+        if (accesses[n].pointer != pointer || accesses[n].offset == 0)
+            continue;
+
+        int m = 0;
+
+        while (m < n && !(accesses[m].pointer == pointer && accesses[m].offset == accesses[n].offset))
+            m++;
+
+        if (m == n)
+            count++;
+    }
+
+    return count;
+}
+
+// Each pointer starts at the element the counter starts at, base + 8 * scale
+// * init, and each access through it is at its offset from there. A pointer
+// stepping one element at a time is only worth it if it replaces the counter,
+// and then it takes over the exit tests too, or if it saves more than the one
+// addition it costs a trip, as in unrolled loops reaching several elements
+// past the counter. Returns how many accesses were rewritten
+static int pointers_create(struct ir_loop *l, struct induction *iv)
+{
+    int reduced = 0;
+
+    for (int p = 0; p < pointer_count; p++)
+    {
+        struct pointer *ptr = &pointers[p];
+        bool replaces_counter = false;
+
+        if (ptr->scale == 1)
+        {
+            replaces_counter = pointer_count == 1 && ptr->every_trip && counter_replaceable(l, iv, p);
+
+            if (!replaces_counter && offsets_count(p) < 2)
+                continue;
+        }
+
+        struct ir_value start = preheader_compute(l, IR_MUL, IR_INTEGER, iv->init, ir_constant(IR_INTEGER, ptr->scale));
+        struct ir_value init = preheader_compute(l, IR_ADD, IR_ADDRESS, ptr->base, element_offset(l, ptr, start));
+
+        ptr->phi = variable_create(l, iv, IR_ADDRESS, init, 8 * ptr->scale * iv->step, &ptr->next);
+
+        int count = 0;
+
+        for (int n = 0; n < access_count; n++)
+        {
+            if (accesses[n].pointer != p)
+                continue;
+
+            accesses[n].instr->a = ptr->phi->dest;
+            accesses[n].instr->b = ir_constant(IR_INTEGER, accesses[n].offset);
+            count++;
+        }
+
+        if (print_remarks)
+        {
+            printf("remark: %s: stepped a pointer for %d element access%s in the loop at B%d\n", function->name,
+                   count, count == 1 ? "" : "es", l->header->id);
+        }
+
+        reduced += count;
+
+        if (replaces_counter)
+        {
+            exit_tests_replace(l, iv, ptr);
+
+            if (counter_remove(l, iv) && print_remarks)
+            {
+                printf("remark: %s: removed the counter of the loop at B%d, testing the pointer instead\n",
+                       function->name, l->header->id);
+            }
+        }
+    }
+
+    return reduced;
+}
+
+// ===============
+// Multiplications
+// ===============
+
+// Multiples of the counter are kept up to date by adding to them, so the
+// multiplication becomes a copy
+static int multiplications_reduce(struct ir_loop *l, struct induction *iv)
+{
+    int reduced = 0;
+
+    for (int n = 0; n < l->block_count; n++)
+    {
+        for (struct ir_instr *i = l->blocks[n]->first; i; i = i->next)
+        {
+            if (i->op != IR_MUL || i->dest.kind != IR_VALUE_TEMP || !use_counts[i->dest.number])
+                continue;
+
+            struct affine a = affine_of(l, iv, i->dest);
+            int64_t step;
+
+            if (!a.valid || a.scale == 0 || a.scale == 1 || __builtin_mul_overflow(a.scale, iv->step, &step))
+                continue;
+
+            if (print_remarks)
+            {
+                printf("remark: %s: replaced a multiplication by additions in the loop at B%d:", function->name,
+                       l->header->id);
+                ir_instr_print(stdout, function, i);
+            }
+
+            struct ir_value start = preheader_compute(l, IR_MUL, IR_INTEGER, iv->init,
+                                                      ir_constant(IR_INTEGER, a.scale));
+            struct ir_value init = preheader_compute(l, IR_ADD, IR_INTEGER, start,
+                                                     ir_constant(IR_INTEGER, a.offset));
+
+            if (a.invariant.kind != IR_VALUE_NONE)
+                init = preheader_compute(l, IR_ADD, IR_INTEGER, init, a.invariant);
+            struct ir_instr *next;
+            struct ir_instr *phi = variable_create(l, iv, IR_INTEGER, init, step, &next);
+
+            i->op = IR_COPY;
+            i->a = phi->dest;
+            i->b = ir_none();
+            reduced++;
+
+            // The temporaries just created are past the end of the tables,
+            // and later multiplications may be computed from them
+            defs_build(function);
+        }
+    }
+
+    return reduced;
+}
+
+// =====
+// Loops
+// =====
+
+static int loop_reduce(struct ir_loop *l)
+{
+    int reduced = 0;
+    struct ir_instr *next;
+
+    for (struct ir_instr *phi = l->header->first; phi && phi->op == IR_PHI; phi = next)
+    {
+        next = phi->next;
+
+        struct induction iv;
+
+        defs_build(function);
+
+        if (!induction_find(l, phi, &iv))
+            continue;
+
+        pointer_count = 0;
+        access_count = 0;
+
+        for (int n = 0; n < l->block_count; n++)
+        {
+            for (struct ir_instr *i = l->blocks[n]->first; i; i = i->next)
+            {
+                if ((i->op == IR_LOAD_ELEMENT || i->op == IR_STORE_ELEMENT) && defined_outside(l, i->a))
+                    access_add(l, &iv, i);
+            }
+        }
+
+        reduced += pointers_create(l, &iv);
+
+        // The counter may be gone, along with what was computed from it
+        if (!iv.phi->block)
+            continue;
+
+        // Indices only the rewritten accesses read need no new variables
+        unused_remove(l);
+        reduced += multiplications_reduce(l, &iv);
+    }
+
+    return reduced;
+}
+
+int ir_function_strength_reduce(struct ir_function *f, bool remarks)
+{
+    int count;
+    struct ir_loop **loops = ir_function_loops(f, &count);
+    int reduced = 0;
+
+    function = f;
+    print_remarks = remarks;
+
+    for (int n = 0; n < count; n++)
+        reduced += loop_reduce(loops[n]);
+
+    free(defs);
+    free(use_counts);
+    free(pointers);
+    free(accesses);
+    defs = NULL;
+    use_counts = NULL;
+    pointers = NULL;
+    accesses = NULL;
+
+    return reduced;
+}
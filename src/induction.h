@@ -0,0 +1,17 @@
+#ifndef INDUCTION_H
+#define INDUCTION_H
+
+#include <stdbool.h>
+
+struct ir_function;
+
+// Strength reduction of induction variables over a function in SSA form.
+// Array elements indexed by a loop counter are reached through a pointer
+// stepped along with it, and multiples of a counter are kept up to date by
+// addition. When a loop's exit test is the only thing still reading its
+// counter, the test is rewritten to compare the pointer, and the counter is
+// removed. Each change is reported when remarks is set. Returns how many
+// values were strength reduced
+int ir_function_strength_reduce(struct ir_function *f, bool remarks);
+
+#endif
@@ -0,0 +1,407 @@
+#include "inline.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dominance.h"
+#include "hash_table.h"
+#include "ir.h"
+
+// Functions are visited callees first, so a function has already had its own
+// calls inlined by the time it is inlined anywhere else, and each function is
+// only inlined into its callers once. Functions that can reach themselves
+// through the call graph are never inlined, which leaves every cycle of calls
+// intact. A copy of the callee's blocks replaces the call: its parameters
+// become copies of the arguments, its slots and temporaries are renumbered
+// after the caller's, and its returns store the result to a new slot and jump
+// back. Inlining happens before the caller is put into SSA form, so the slots
+// are promoted and the arguments propagated into the copy with everything else.
+
+// A call costs about this many instructions even without arguments, to save
+// and restore registers and set up the callee's frame
+#define CALL_COST 8
+
+// Each constant argument is likely to let part of the callee fold away
+#define CONSTANT_ARGUMENT_BONUS 4
+
+// Calls inside loops run more often, so every level of nesting up to this
+// doubles how large a callee may be
+#define LOOP_DEPTH_SCALING 2
+
+// A function may grow to twice its size plus the inline limit
+#define GROWTH_FACTOR 2
+
+struct node
+{
+    struct ir_function *function;
+
+    // Instructions other than jumps, which is roughly what inlining it adds
+    int size;
+
+    // Whether the function can call itself, directly or not
+    bool recursive;
+
+    // The last search that reached the node, and whether it was visited in
+    // the order functions are inlined
+    int search;
+    bool visited;
+};
+
+// A call that may be inlined
+struct site
+{
+    struct ir_instr *call;
+    struct node *callee;
+    int depth;
+};
+
+// The state of the program being inlined
+static struct hash_table *nodes = NULL;
+static int search = 0;
+static int inline_limit = 0;
+static bool inline_remarks = false;
+
+// ==========
+// Call graph
+// ==========
+
+static struct node *node_of(struct ir_instr *call)
+{
+    return hash_table_lookup(nodes, call->callee);
+}
+
+static int function_size(struct ir_function *f)
+{
+    int size = 0;
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            if (i->op != IR_JUMP)
+                size++;
+        }
+    }
+
+    return size;
+}
+
+static bool reaches(struct node *from, struct node *to)
+{
+    for (struct ir_block *b = from->function->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            struct node *callee;
+
+            if (i->op != IR_CALL || !(callee = node_of(i)))
+                continue;
+
+            if (callee == to)
+                return true;
+
+            if (callee->search != search)
+            {
+                callee->search = search;
+
+                if (reaches(callee, to))
+                    return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// ========
+// Inlining
+// ========
+
+static struct ir_value value_remap(struct ir_value v, int temp_offset, int slot_offset)
+{
+    if (v.kind == IR_VALUE_TEMP)
+        v.number += temp_offset;
+    else if (v.kind == IR_VALUE_SLOT)
+        v.number += slot_offset;
+
+    return v;
+}
+
+// Replaces the call with a copy of the callee's body
+static void call_inline(struct ir_function *f, struct ir_instr *call, struct ir_function *callee)
+{
+    struct ir_block *b = call->block;
+    struct ir_block *after = b->next ? ir_block_create_before(f, b->next) : ir_block_create(f);
+
+    while (call->next)
+    {
+        struct ir_instr *i = call->next;
+
+        ir_remove(i);
+        ir_append(after, i);
+    }
+
+    int temp_offset = f->temp_count;
+    int slot_offset = f->slot_count;
+
+    f->temp_count += callee->temp_count;
+
+    for (int s = 0; s < callee->slot_count; s++)
+    {
+        struct ir_slot *slot = &callee->slots[s];
+        ir_slot_create(f, slot->name, slot->symbol, slot->type, slot->cells, slot->array);
+    }
+
+    struct ir_value result = ir_none();
+
+    if (call->dest.kind != IR_VALUE_NONE)
+        result = ir_slot(f, ir_slot_create(f, callee->name, NULL, callee->return_type, 1, false));
+
+    struct ir_block **blocks = malloc(sizeof(struct ir_block *) * (callee->block_count ? callee->block_count : 1));
+
+    for (struct ir_block *c = callee->entry; c; c = c->next)
+        blocks[c->id] = ir_block_create_before(f, after);
+
+    for (struct ir_block *c = callee->entry; c; c = c->next)
+    {
+        struct ir_block *copy = blocks[c->id];
+
+        for (struct ir_instr *i = c->first; i; i = i->next)
+        {
+            struct ir_instr *clone = ir_instr_create(f, i->op);
+
+            memcpy(clone, i, sizeof(struct ir_instr));
+
+            if (i->arg_count)
+            {
+                clone->args = ir_alloc(f, sizeof(struct ir_value) * i->arg_count);
+                memcpy(clone->args, i->args, sizeof(struct ir_value) * i->arg_count);
+            }
+
+            if (i->sources)
+            {
+                clone->sources = ir_alloc(f, sizeof(struct ir_block *) * i->arg_count);
+
+                for (int n = 0; n < i->arg_count; n++)
+                    clone->sources[n] = blocks[i->sources[n]->id];
+            }
+
+            clone->dest = value_remap(clone->dest, temp_offset, slot_offset);
+
+            for (int n = 0; n < ir_operand_count(clone); n++)
+                *ir_operand(clone, n) = value_remap(*ir_operand(clone, n), temp_offset, slot_offset);
+
+            if (clone->target)
+                clone->target = blocks[clone->target->id];
+
+            if (clone->target_false)
+                clone->target_false = blocks[clone->target_false->id];
+
+            if (i->op == IR_PARAM)
+            {
+                clone->op = IR_COPY;
+                clone->a = call->args[i->a.number];
+            }
+            else if (i->op == IR_RETURN)
+            {
+                if (result.kind != IR_VALUE_NONE && clone->a.kind != IR_VALUE_NONE)
+                {
+                    struct ir_instr *store = ir_instr_create(f, IR_STORE);
+
+                    store->a = result;
+                    store->b = clone->a;
+                    ir_append(copy, store);
+                }
+
+                clone->op = IR_JUMP;
+                clone->a = ir_none();
+                clone->target = after;
+            }
+
+            ir_append(copy, clone);
+        }
+    }
+
+    if (result.kind != IR_VALUE_NONE)
+    {
+        struct ir_instr *load = ir_instr_create(f, IR_LOAD);
+
+        load->dest = call->dest;
+        load->a = result;
+
+        if (after->first)
+            ir_insert_before(after->first, load);
+        else
+            ir_append(after, load);
+    }
+
+    ir_remove(call);
+
+    struct ir_instr *jump = ir_instr_create(f, IR_JUMP);
+    jump->target = blocks[callee->entry->id];
+    ir_append(b, jump);
+
+    free(blocks);
+}
+
+// Whether the call is worth what inlining it adds to the caller. Besides the
+// call itself, each argument no longer has to be moved into place
+static bool worth_inlining(struct site *s)
+{
+    int budget = inline_limit + CALL_COST + s->call->arg_count;
+
+    for (int n = 0; n < s->call->arg_count; n++)
+    {
+        if (s->call->args[n].kind == IR_VALUE_CONSTANT)
+            budget += CONSTANT_ARGUMENT_BONUS;
+    }
+
+    budget <<= s->depth < LOOP_DEPTH_SCALING ? s->depth : LOOP_DEPTH_SCALING;
+
+    return s->callee->size <= budget;
+}
+
+// Calls deeper inside loops go first, then those to smaller callees, so the
+// growth budget is spent where it saves the most
+static int site_compare(const void *a, const void *b)
+{
+    const struct site *x = a;
+    const struct site *y = b;
+
+    if (x->depth != y->depth)
+        return y->depth - x->depth;
+
+    if (x->callee->size != y->callee->size)
+        return x->callee->size - y->callee->size;
+
+    return x->call->number - y->call->number;
+}
+
+static int function_inline(struct node *n)
+{
+    struct ir_function *f = n->function;
+    struct site *sites = NULL;
+    int site_count = 0;
+    int number = 0;
+
+    ir_function_link(f);
+    ir_function_dominators(f);
+    ir_function_loop_depths(f);
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            struct node *callee;
+
+            i->number = number++;
+
+            if (i->op != IR_CALL || b->order < 0 || !(callee = node_of(i)) || callee->recursive)
+                continue;
+
+            sites = realloc(sites, sizeof(struct site) * (site_count + 1));
+            sites[site_count].call = i;
+            sites[site_count].callee = callee;
+            sites[site_count].depth = b->loop_depth;
+            site_count++;
+        }
+    }
+
+    if (site_count)
+        qsort(sites, site_count, sizeof(struct site), site_compare);
+
+    int inlined = 0;
+    int max_size = n->size * GROWTH_FACTOR + inline_limit;
+
+    for (int s = 0; s < site_count; s++)
+    {
+        struct site *site = &sites[s];
+
+        if (!worth_inlining(site) || n->size + site->callee->size - 1 > max_size)
+            continue;
+
+        if (inline_remarks)
+        {
+            printf("remark: %s: inlined %s at B%d\n", f->name, site->callee->function->name,
+                   site->call->block->id);
+        }
+
+        call_inline(f, site->call, site->callee->function);
+        n->size += site->callee->size - 1;
+        inlined++;
+    }
+
+    if (inlined)
+        ir_function_link(f);
+
+    free(sites);
+
+    return inlined;
+}
+
+static int node_inline(struct node *n)
+{
+    int inlined = 0;
+
+    n->visited = true;
+
+    for (struct ir_block *b = n->function->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            struct node *callee;
+
+            if (i->op == IR_CALL && (callee = node_of(i)) && !callee->visited)
+                inlined += node_inline(callee);
+        }
+    }
+
+    return inlined + function_inline(n);
+}
+
+int ir_program_inline(struct ir_program *p, int limit, bool remarks)
+{
+    if (limit <= 0)
+        return 0;
+
+    nodes = hash_table_create(0, 0);
+    inline_limit = limit;
+    inline_remarks = remarks;
+
+    int count = 0;
+
+    for (struct ir_function *f = p->functions; f; f = f->next)
+        count++;
+
+    struct node *all = calloc(count ? count : 1, sizeof(struct node));
+    int n = 0;
+
+    for (struct ir_function *f = p->functions; f; f = f->next, n++)
+    {
+        all[n].function = f;
+        all[n].size = function_size(f);
+        hash_table_insert(nodes, f->name, &all[n]);
+    }
+
+    for (n = 0; n < count; n++)
+    {
+        search++;
+        all[n].recursive = reaches(&all[n], &all[n]);
+    }
+
+    int inlined = 0;
+
+    for (n = 0; n < count; n++)
+    {
+        if (!all[n].visited)
+            inlined += node_inline(&all[n]);
+    }
+
+    hash_table_delete(nodes);
+    free(all);
+    nodes = NULL;
+
+    return inlined;
+}
@@ -0,0 +1,16 @@
+#ifndef INLINE_H
+#define INLINE_H
+
+#include <stdbool.h>
+
+struct ir_program;
+
+// Inlines calls to small functions that never call themselves, before any
+// function is put into SSA form. A callee may be as large as limit, in
+// instructions, plus a bonus for each argument and more for constant ones,
+// which doubles for each loop around the call. Each function may grow to
+// twice its size plus limit. A limit of 0 turns inlining off. Each call
+// inlined is reported when remarks is set. Returns how many calls were inlined
+int ir_program_inline(struct ir_program *p, int limit, bool remarks);
+
+#endif
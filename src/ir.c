@@ -0,0 +1,618 @@
+#include "ir.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+const char *ir_type_t_strings[] = {
+#define X(t, name) name,
+    IR_TYPES
+#undef X
+};
+
+const char *ir_value_t_strings[] = {
+#define X(v) #v,
+    IR_VALUES
+#undef X
+};
+
+const char *ir_op_t_strings[] = {
+#define X(op, name) name,
+    IR_OPS
+#undef X
+};
+
+const char *ir_vector_step_t_strings[] = {
+#define X(step, name) name,
+    IR_VECTOR_STEPS
+#undef X
+};
+
+// ======
+// Values
+// ======
+
+struct ir_value ir_none()
+{
+    struct ir_value v = {IR_VALUE_NONE, IR_VOID, 0, NULL};
+    return v;
+}
+
+struct ir_value ir_constant(ir_type_t type, int64_t number)
+{
+    struct ir_value v = {IR_VALUE_CONSTANT, type, number, NULL};
+    return v;
+}
+
+struct ir_value ir_global(ir_type_t type, const char *name)
+{
+    struct ir_value v = {IR_VALUE_GLOBAL, type, 0, name};
+    return v;
+}
+
+struct ir_value ir_string(const char *text)
+{
+    struct ir_value v = {IR_VALUE_STRING, IR_STRING, 0, text};
+    return v;
+}
+
+bool ir_value_equals(struct ir_value a, struct ir_value b)
+{
+    if (a.kind != b.kind)
+        return false;
+
+    switch (a.kind)
+    {
+    case IR_VALUE_NONE:
+        return true;
+    case IR_VALUE_GLOBAL:
+    case IR_VALUE_STRING:
+        return a.name == b.name || strcmp(a.name, b.name) == 0;
+    default:
+        return a.number == b.number;
+    }
+}
+
+// ============
+// Construction
+// ============
+
+struct ir_program *ir_program_create(struct decl *ast)
+{
+    struct ir_program *p = malloc(sizeof(struct ir_program));
+
+    p->ast = ast;
+    p->functions = NULL;
+    p->last_function = NULL;
+    p->arena = arena_create();
+
+    return p;
+}
+
+void ir_program_delete(struct ir_program *p)
+{
+    if (!p)
+        return;
+
+    arena_delete(p->arena);
+    free(p);
+}
+
+void *ir_alloc(struct ir_function *f, size_t size)
+{
+    return arena_alloc(f->arena, size);
+}
+
+struct ir_function *ir_function_create(struct ir_program *p, const char *name, ir_type_t return_type)
+{
+    struct ir_function *f = arena_alloc(p->arena, sizeof(struct ir_function));
+
+    f->name = name;
+    f->return_type = return_type;
+    f->arena = p->arena;
+
+    if (p->last_function)
+        p->last_function->next = f;
+    else
+        p->functions = f;
+
+    p->last_function = f;
+
+    return f;
+}
+
+struct ir_block *ir_block_create(struct ir_function *f)
+{
+    struct ir_block *b = ir_alloc(f, sizeof(struct ir_block));
+
+    b->id = f->block_count++;
+    b->prev = f->last;
+
+    if (f->last)
+        f->last->next = b;
+    else
+        f->entry = b;
+
+    f->last = b;
+
+    return b;
+}
+
+struct ir_block *ir_block_create_before(struct ir_function *f, struct ir_block *position)
+{
+    struct ir_block *b = ir_block_create(f);
+
+    ir_block_unlink(f, b);
+
+    b->prev = position->prev;
+    b->next = position;
+
+    if (position->prev)
+        position->prev->next = b;
+    else
+        f->entry = b;
+
+    position->prev = b;
+
+    return b;
+}
+
+void ir_block_unlink(struct ir_function *f, struct ir_block *b)
+{
+    if (b->prev)
+        b->prev->next = b->next;
+    else
+        f->entry = b->next;
+
+    if (b->next)
+        b->next->prev = b->prev;
+    else
+        f->last = b->prev;
+
+    b->prev = NULL;
+    b->next = NULL;
+}
+
+int ir_slot_create(struct ir_function *f, const char *name, struct symbol *symbol, ir_type_t type, int cells, bool array)
+{
+    // The arena cannot resize in place, so a full table is copied into a new
+    // one twice the size
+    if (f->slot_count == f->slot_capacity)
+    {
+        int capacity = f->slot_capacity ? f->slot_capacity * 2 : 8;
+        struct ir_slot *slots = ir_alloc(f, sizeof(struct ir_slot) * capacity);
+
+        if (f->slot_count)
+            memcpy(slots, f->slots, sizeof(struct ir_slot) * f->slot_count);
+
+        f->slots = slots;
+        f->slot_capacity = capacity;
+    }
+
+    struct ir_slot *s = &f->slots[f->slot_count];
+
+    s->name = name;
+    s->symbol = symbol;
+    s->type = type;
+    s->cells = cells;
+    s->array = array;
+
+    return f->slot_count++;
+}
+
+struct ir_value ir_slot(struct ir_function *f, int slot)
+{
+    struct ir_value v = {IR_VALUE_SLOT, f->slots[slot].type, slot, NULL};
+    return v;
+}
+
+struct ir_value ir_temp(struct ir_function *f, ir_type_t type)
+{
+    struct ir_value v = {IR_VALUE_TEMP, type, f->temp_count++, NULL};
+    return v;
+}
+
+struct ir_instr *ir_instr_create(struct ir_function *f, ir_op_t op)
+{
+    struct ir_instr *i = ir_alloc(f, sizeof(struct ir_instr));
+
+    i->op = op;
+    i->dest = ir_none();
+    i->a = ir_none();
+    i->b = ir_none();
+    i->c = ir_none();
+
+    return i;
+}
+
+bool ir_is_terminator(struct ir_instr *i)
+{
+    return i && (i->op == IR_JUMP || i->op == IR_BRANCH || i->op == IR_RETURN);
+}
+
+struct ir_instr *ir_tail_return(struct ir_instr *call)
+{
+    struct ir_instr *next = call->next;
+
+    if (next && next->op == IR_JUMP && call->dest.kind == IR_VALUE_NONE)
+        next = next->target->first;
+
+    if (!next || next->op != IR_RETURN)
+        return NULL;
+
+    if (next->a.kind != IR_VALUE_NONE && !ir_value_equals(next->a, call->dest))
+        return NULL;
+
+    return next;
+}
+
+bool ir_op_is_comparison(ir_op_t op)
+{
+    return op == IR_LT || op == IR_LTE || op == IR_GT || op == IR_GTE || op == IR_EQ || op == IR_NE;
+}
+
+bool ir_has_side_effects(struct ir_instr *i)
+{
+    switch (i->op)
+    {
+    case IR_STORE:
+    case IR_STORE_ELEMENT:
+    case IR_CHECK:
+    case IR_CALL:
+    case IR_VECTOR:
+    case IR_JUMP:
+    case IR_BRANCH:
+    case IR_RETURN:
+        return true;
+    case IR_DIV:
+    case IR_MOD:
+        // Division traps on a zero divisor and on overflow
+        return i->b.kind != IR_VALUE_CONSTANT || i->b.number == 0 || i->b.number == -1;
+    default:
+        return false;
+    }
+}
+
+bool ir_call_writes_memory(struct ir_instr *call)
+{
+    static const char *runtime[] = {"print_integer", "print_string", "print_boolean", "print_character",
+                                    "integer_power"};
+
+    for (size_t r = 0; r < sizeof(runtime) / sizeof(runtime[0]); r++)
+    {
+        if (strcmp(call->callee, runtime[r]) == 0)
+            return false;
+    }
+
+    return true;
+}
+
+int ir_operand_count(struct ir_instr *i)
+{
+    return 3 + i->arg_count;
+}
+
+struct ir_value *ir_operand(struct ir_instr *i, int n)
+{
+    switch (n)
+    {
+    case 0:
+        return &i->a;
+    case 1:
+        return &i->b;
+    case 2:
+        return &i->c;
+    default:
+        return &i->args[n - 3];
+    }
+}
+
+struct ir_value ir_value_resolve(struct ir_value *replacement, struct ir_value v)
+{
+    while (v.kind == IR_VALUE_TEMP && replacement[v.number].kind != IR_VALUE_NONE)
+        v = replacement[v.number];
+
+    return v;
+}
+
+void ir_operands_resolve(struct ir_value *replacement, struct ir_instr *i)
+{
+    for (int n = 0; n < ir_operand_count(i); n++)
+        *ir_operand(i, n) = ir_value_resolve(replacement, *ir_operand(i, n));
+}
+
+void ir_append(struct ir_block *b, struct ir_instr *i)
+{
+    i->block = b;
+    i->prev = b->last;
+    i->next = NULL;
+
+    if (b->last)
+        b->last->next = i;
+    else
+        b->first = i;
+
+    b->last = i;
+}
+
+void ir_insert_before(struct ir_instr *position, struct ir_instr *i)
+{
+    struct ir_block *b = position->block;
+
+    i->block = b;
+    i->prev = position->prev;
+    i->next = position;
+
+    if (position->prev)
+        position->prev->next = i;
+    else
+        b->first = i;
+
+    position->prev = i;
+}
+
+void ir_remove(struct ir_instr *i)
+{
+    struct ir_block *b = i->block;
+
+    if (i->prev)
+        i->prev->next = i->next;
+    else
+        b->first = i->next;
+
+    if (i->next)
+        i->next->prev = i->prev;
+    else
+        b->last = i->prev;
+
+    i->prev = NULL;
+    i->next = NULL;
+    i->block = NULL;
+}
+
+void ir_phi_remove_source(struct ir_instr *phi, struct ir_block *source)
+{
+    int kept = 0;
+
+    for (int n = 0; n < phi->arg_count; n++)
+    {
+        if (phi->sources[n] == source)
+            continue;
+
+        phi->args[kept] = phi->args[n];
+        phi->sources[kept] = phi->sources[n];
+        kept++;
+    }
+
+    phi->arg_count = kept;
+}
+
+void ir_function_link(struct ir_function *f)
+{
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        b->succ_count = 0;
+        b->pred_count = 0;
+
+        struct ir_instr *t = b->last;
+
+        if (t && t->op == IR_JUMP)
+        {
+            b->succs[b->succ_count++] = t->target;
+        }
+        else if (t && t->op == IR_BRANCH)
+        {
+            b->succs[b->succ_count++] = t->target;
+
+            if (t->target_false != t->target)
+                b->succs[b->succ_count++] = t->target_false;
+        }
+    }
+
+    // Count each block's predecessors first so their arrays are sized exactly
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (int i = 0; i < b->succ_count; i++)
+            b->succs[i]->pred_count++;
+    }
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        b->preds = b->pred_count ? ir_alloc(f, sizeof(struct ir_block *) * b->pred_count) : NULL;
+        b->pred_count = 0;
+    }
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (int i = 0; i < b->succ_count; i++)
+        {
+            struct ir_block *s = b->succs[i];
+            s->preds[s->pred_count++] = b;
+        }
+    }
+}
+
+// ========
+// Printing
+// ========
+
+void ir_value_print(FILE *out, struct ir_function *f, struct ir_value v)
+{
+    switch (v.kind)
+    {
+    case IR_VALUE_NONE:
+        fprintf(out, "_");
+        break;
+    case IR_VALUE_TEMP:
+        fprintf(out, "t%ld", (long)v.number);
+        break;
+    case IR_VALUE_CONSTANT:
+        fprintf(out, "%ld", (long)v.number);
+        break;
+    case IR_VALUE_SLOT:
+        fprintf(out, "%%%s.%ld", f->slots[v.number].name, (long)v.number);
+        break;
+    case IR_VALUE_GLOBAL:
+        fprintf(out, "@%s", v.name);
+        break;
+    case IR_VALUE_STRING:
+        fprintf(out, "\"%s\"", v.name);
+        break;
+    }
+}
+
+void ir_instr_print(FILE *out, struct ir_function *f, struct ir_instr *i)
+{
+    fprintf(out, "    ");
+
+    if (i->dest.kind != IR_VALUE_NONE)
+    {
+        ir_value_print(out, f, i->dest);
+        fprintf(out, " = ");
+    }
+
+    fprintf(out, "%s", ir_op_t_strings[i->op]);
+
+    // Show the type of the value produced or stored
+    if (i->dest.kind != IR_VALUE_NONE)
+        fprintf(out, ".%s", ir_type_t_strings[i->dest.type]);
+    else if (i->op == IR_STORE)
+        fprintf(out, ".%s", ir_type_t_strings[i->b.type]);
+    else if (i->op == IR_STORE_ELEMENT)
+        fprintf(out, ".%s", ir_type_t_strings[i->c.type]);
+
+    switch (i->op)
+    {
+    case IR_CALL:
+        fprintf(out, " @%s(", i->callee);
+        for (int a = 0; a < i->arg_count; a++)
+        {
+            if (a)
+                fprintf(out, ", ");
+            ir_value_print(out, f, i->args[a]);
+        }
+        fprintf(out, ")");
+        break;
+    case IR_PHI:
+        for (int a = 0; a < i->arg_count; a++)
+        {
+            fprintf(out, a ? ", [" : " [");
+            ir_value_print(out, f, i->args[a]);
+            fprintf(out, ", B%d]", i->sources[a]->id);
+        }
+        break;
+    case IR_VECTOR:
+        fprintf(out, " x%d ", i->vector->width);
+        ir_value_print(out, f, i->a);
+        fprintf(out, " to ");
+        ir_value_print(out, f, i->b);
+        fprintf(out, " (");
+        for (int a = 0; a < i->arg_count; a++)
+        {
+            if (a)
+                fprintf(out, ", ");
+            ir_value_print(out, f, i->args[a]);
+        }
+        fprintf(out, ")");
+        for (int n = 0; n < i->vector->step_count; n++)
+        {
+            struct ir_vector_step *step = &i->vector->steps[n];
+
+            fprintf(out, n ? ", %s" : ": %s", ir_vector_step_t_strings[step->kind]);
+
+            if (step->kind == IR_VECTOR_LOAD || step->kind == IR_VECTOR_STORE)
+                fprintf(out, " %d[%+ld]", step->arg, (long)step->offset);
+            else if (step->kind == IR_VECTOR_SPLAT)
+                fprintf(out, " %d", step->arg);
+        }
+        break;
+    case IR_JUMP:
+        fprintf(out, " B%d", i->target->id);
+        break;
+    case IR_BRANCH:
+        fprintf(out, " ");
+        ir_value_print(out, f, i->a);
+        fprintf(out, ", B%d, B%d", i->target->id, i->target_false->id);
+        break;
+    case IR_LOAD_ELEMENT:
+        fprintf(out, " ");
+        ir_value_print(out, f, i->a);
+        fprintf(out, "[");
+        ir_value_print(out, f, i->b);
+        fprintf(out, "]");
+        break;
+    case IR_STORE_ELEMENT:
+        fprintf(out, " ");
+        ir_value_print(out, f, i->a);
+        fprintf(out, "[");
+        ir_value_print(out, f, i->b);
+        fprintf(out, "], ");
+        ir_value_print(out, f, i->c);
+        break;
+    default:
+        if (i->a.kind != IR_VALUE_NONE)
+        {
+            fprintf(out, " ");
+            ir_value_print(out, f, i->a);
+        }
+        if (i->b.kind != IR_VALUE_NONE)
+        {
+            fprintf(out, ", ");
+            ir_value_print(out, f, i->b);
+        }
+        break;
+    }
+
+    fprintf(out, "\n");
+}
+
+void ir_function_print(FILE *out, struct ir_function *f)
+{
+    fprintf(out, "function %s(%d): %s\n", f->name, f->param_count, ir_type_t_strings[f->return_type]);
+
+    for (int s = 0; s < f->slot_count; s++)
+    {
+        if (f->slots[s].promoted)
+            continue;
+
+        fprintf(out, "    slot ");
+        ir_value_print(out, f, ir_slot(f, s));
+
+        if (f->slots[s].array)
+            fprintf(out, " [%d]", f->slots[s].cells);
+
+        fprintf(out, "\n");
+    }
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        fprintf(out, "B%d:", b->id);
+
+        if (b->pred_count)
+        {
+            fprintf(out, "\t; preds");
+            for (int p = 0; p < b->pred_count; p++)
+                fprintf(out, " B%d", b->preds[p]->id);
+        }
+
+        fprintf(out, "\n");
+
+        for (struct ir_instr *i = b->first; i; i = i->next)
+            ir_instr_print(out, f, i);
+    }
+}
+
+void ir_program_print(FILE *out, struct ir_program *p)
+{
+    for (struct ir_function *f = p->functions; f; f = f->next)
+    {
+        ir_function_print(out, f);
+
+        if (f->next)
+            fprintf(out, "\n");
+    }
+}
@@ -0,0 +1,393 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct arena;
+struct decl;
+struct symbol;
+
+// The intermediate representation sits between the typed AST and the x86-64
+// emitter. Each function is a list of basic blocks, and each block a list of
+// three-address instructions ending in a single jump, branch or return.
+// Everything in a program's IR is allocated from one arena and freed together.
+
+// === types ===
+
+// Every value occupies an 8 byte cell at runtime, but keeping the source type
+// lets passes and the emitter tell booleans, characters and pointers apart
+#define IR_TYPES                                                                                                       \
+    X(IR_VOID, "void")                                                                                                 \
+    X(IR_INTEGER, "int")                                                                                               \
+    X(IR_BOOLEAN, "bool")                                                                                              \
+    X(IR_CHARACTER, "char")                                                                                            \
+    X(IR_STRING, "str")                                                                                                \
+    X(IR_ADDRESS, "ptr")
+
+typedef enum
+{
+#define X(t, name) t,
+    IR_TYPES
+#undef X
+} ir_type_t;
+
+extern const char *ir_type_t_strings[];
+
+// === values ===
+
+// Temporaries are virtual registers. Slots are the function's stack variables
+// and globals are named program data, which are both only accessed through
+// loads, stores and address computations. String values are the address of a
+// string literal
+#define IR_VALUES                                                                                                      \
+    X(IR_VALUE_NONE)                                                                                                   \
+    X(IR_VALUE_TEMP)                                                                                                   \
+    X(IR_VALUE_CONSTANT)                                                                                               \
+    X(IR_VALUE_SLOT)                                                                                                   \
+    X(IR_VALUE_GLOBAL)                                                                                                 \
+    X(IR_VALUE_STRING)
+
+typedef enum
+{
+#define X(v) v,
+    IR_VALUES
+#undef X
+} ir_value_t;
+
+extern const char *ir_value_t_strings[];
+
+struct ir_value
+{
+    ir_value_t kind;
+    ir_type_t type;
+
+    // The temporary or slot number, or the constant itself
+    int64_t number;
+
+    // The global's name or the string literal's text
+    const char *name;
+};
+
+struct ir_value ir_none();
+
+struct ir_value ir_constant(ir_type_t type, int64_t number);
+
+struct ir_value ir_global(ir_type_t type, const char *name);
+
+struct ir_value ir_string(const char *text);
+
+bool ir_value_equals(struct ir_value a, struct ir_value b);
+
+// === instructions ===
+
+#define IR_OPS                                                                                                         \
+    X(IR_COPY, "copy")                                                                                                 \
+    X(IR_PARAM, "param")                                                                                               \
+    X(IR_LOAD, "load")                                                                                                 \
+    X(IR_STORE, "store")                                                                                               \
+    X(IR_ADDRESS_OF, "address")                                                                                        \
+    X(IR_LOAD_ELEMENT, "load_element")                                                                                 \
+    X(IR_STORE_ELEMENT, "store_element")                                                                               \
+    X(IR_ADD, "add")                                                                                                   \
+    X(IR_SUB, "sub")                                                                                                   \
+    X(IR_MUL, "mul")                                                                                                   \
+    X(IR_DIV, "div")                                                                                                   \
+    X(IR_MOD, "mod")                                                                                                   \
+    X(IR_POW, "pow")                                                                                                   \
+    X(IR_NEG, "neg")                                                                                                   \
+    X(IR_NOT, "not")                                                                                                   \
+    X(IR_AND, "and")                                                                                                   \
+    X(IR_OR, "or")                                                                                                     \
+    X(IR_LT, "lt")                                                                                                     \
+    X(IR_LTE, "lte")                                                                                                   \
+    X(IR_GT, "gt")                                                                                                     \
+    X(IR_GTE, "gte")                                                                                                   \
+    X(IR_EQ, "eq")                                                                                                     \
+    X(IR_NE, "ne")                                                                                                     \
+    X(IR_CHECK, "check")                                                                                               \
+    X(IR_CALL, "call")                                                                                                 \
+    X(IR_JUMP, "jump")                                                                                                 \
+    X(IR_BRANCH, "branch")                                                                                             \
+    X(IR_RETURN, "return")                                                                                             \
+    X(IR_PHI, "phi")                                                                                                   \
+    X(IR_VECTOR, "vector")
+
+typedef enum
+{
+#define X(op, name) op,
+    IR_OPS
+#undef X
+} ir_op_t;
+
+extern const char *ir_op_t_strings[];
+
+// A vectorized loop is a single instruction, since its values live in vector
+// registers nothing else allocates. What it does to each group of elements is
+// a list of steps run on a stack of vectors. Arrays and scalars are named by
+// their position in the instruction's arguments
+#define IR_VECTOR_STEPS                                                                                                \
+    X(IR_VECTOR_LOAD, "load")                                                                                          \
+    X(IR_VECTOR_SPLAT, "splat")                                                                                        \
+    X(IR_VECTOR_ADD, "add")                                                                                            \
+    X(IR_VECTOR_SUB, "sub")                                                                                            \
+    X(IR_VECTOR_NEG, "neg")                                                                                            \
+    X(IR_VECTOR_STORE, "store")                                                                                        \
+    X(IR_VECTOR_SUM, "sum")
+
+typedef enum
+{
+#define X(step, name) step,
+    IR_VECTOR_STEPS
+#undef X
+} ir_vector_step_t;
+
+extern const char *ir_vector_step_t_strings[];
+
+// Step use by kind:
+//   load       push the elements of array arg from the counter plus offset
+//   splat      push scalar arg in every lane
+//   add, sub   pop two and push the result, the top being the right side
+//   neg        negate the top
+//   store      pop into the elements of array arg from the counter plus offset
+//   sum        pop and add into the sum the instruction returns
+struct ir_vector_step
+{
+    ir_vector_step_t kind;
+    int arg;
+    int64_t offset;
+};
+
+struct ir_vector
+{
+    // Elements handled at once, 2 in SSE2 registers or 4 in AVX2 ones
+    int width;
+
+    struct ir_vector_step *steps;
+    int step_count;
+};
+
+// Operand use by op:
+//   copy, neg, not               dest = a
+//   param                        dest = parameter number a
+//   load                         dest = *a, where a is a slot or global
+//   store                        *a = b, where a is a slot or global
+//   address                      dest = &a, where a is a slot or global
+//   load_element                 dest = a[b], counted in 8 byte cells
+//   store_element                a[b] = c
+//   arithmetic and comparisons   dest = a op b
+//   check                        stop the program unless 0 <= a < b, or only
+//                                unless 0 <= a when b is 0
+//   call                         dest = callee(args), dest may be none
+//   jump                         goto target
+//   branch                       a ? target : target_false
+//   return                       return a, a may be none
+//   phi                          dest = args[n] when entered from sources[n]
+//   vector                       runs vector over the elements from a up to
+//                                b, a multiple of its width apart, dest = the
+//                                sum it takes, which may be none
+struct ir_instr
+{
+    ir_op_t op;
+    struct ir_value dest;
+    struct ir_value a;
+    struct ir_value b;
+    struct ir_value c;
+
+    const char *callee;
+    struct ir_value *args;
+    int arg_count;
+
+    struct ir_block *target;
+    struct ir_block *target_false;
+
+    struct ir_block **sources;
+
+    struct ir_vector *vector;
+
+    // Position in a linear order of the function, set by passes needing one
+    int number;
+
+    struct ir_block *block;
+    struct ir_instr *prev;
+    struct ir_instr *next;
+};
+
+bool ir_is_terminator(struct ir_instr *i);
+
+// The ops comparing a with b into a boolean
+bool ir_op_is_comparison(ir_op_t op);
+
+// Calls, stores and anything that can trap must be kept even when their
+// result is unused
+bool ir_has_side_effects(struct ir_instr *i);
+
+// Whether a call may write to the program's memory. The runtime library only
+// prints, and never touches it
+bool ir_call_writes_memory(struct ir_instr *call);
+
+// The return a call is in tail position for, when the function returns what
+// the call returns straight after it, either from the same block or from a
+// block doing nothing else. NULL for calls not in tail position
+struct ir_instr *ir_tail_return(struct ir_instr *call);
+
+// Every value an instruction reads, which is a, b and c followed by the
+// arguments of calls and phis. Unused operands are none
+int ir_operand_count(struct ir_instr *i);
+struct ir_value *ir_operand(struct ir_instr *i, int n);
+
+// Passes that remove instructions record the value standing in for each
+// removed result in a table indexed by temporary, with none for those kept.
+// A value put in may have been replaced in turn, so lookups follow the chain
+struct ir_value ir_value_resolve(struct ir_value *replacement, struct ir_value v);
+void ir_operands_resolve(struct ir_value *replacement, struct ir_instr *i);
+
+// === blocks ===
+
+struct ir_block
+{
+    int id;
+    struct ir_instr *first;
+    struct ir_instr *last;
+
+    // Filled in from the terminators by ir_function_link
+    struct ir_block **preds;
+    int pred_count;
+    struct ir_block *succs[2];
+    int succ_count;
+
+    // Blocks are kept in the order they are laid out in the output
+    struct ir_block *prev;
+    struct ir_block *next;
+
+    // Filled in by ir_function_dominators. Blocks that cannot be reached from
+    // the entry have an order of -1
+    int order;
+    struct ir_block *idom;
+    struct ir_block **children;
+    int child_count;
+    struct ir_block **frontier;
+    int frontier_count;
+
+    // How many loops the block is inside, filled in by ir_function_loop_depths
+    int loop_depth;
+
+    // Filled in by ir_function_layout. Cold blocks are laid out after all the
+    // others and emitted apart from the function's hot code, while aligned
+    // blocks head loops and start at a 16 byte boundary
+    bool cold;
+    bool aligned;
+
+    // Assembly label, assigned by the emitter
+    int label;
+};
+
+// === functions ===
+
+struct ir_slot
+{
+    const char *name;
+    struct symbol *symbol;
+    ir_type_t type;
+
+    // Arrays take one cell per element
+    int cells;
+    bool array;
+
+    // Set once every access has been replaced by SSA values, so the slot no
+    // longer needs space in the frame
+    bool promoted;
+};
+
+struct ir_function
+{
+    const char *name;
+    ir_type_t return_type;
+    int param_count;
+
+    struct ir_block *entry;
+    struct ir_block *last;
+    int block_count;
+
+    // The reachable blocks in reverse postorder, filled in by
+    // ir_function_dominators
+    struct ir_block **rpo;
+    int rpo_count;
+
+    int temp_count;
+
+    struct ir_slot *slots;
+    int slot_count;
+    int slot_capacity;
+
+    // The register given to each temporary by register allocation, or -1 for
+    // temporaries kept in memory. Empty when nothing was allocated
+    int *registers;
+
+    struct arena *arena;
+    struct ir_function *next;
+};
+
+struct ir_program
+{
+    // Global data is emitted straight from the declarations
+    struct decl *ast;
+
+    struct ir_function *functions;
+    struct ir_function *last_function;
+
+    // The optimization level the program was compiled at, which also decides
+    // how registers are allocated
+    int level;
+
+    struct arena *arena;
+};
+
+struct ir_program *ir_program_create(struct decl *ast);
+
+void ir_program_delete(struct ir_program *p);
+
+struct ir_function *ir_function_create(struct ir_program *p, const char *name, ir_type_t return_type);
+
+void *ir_alloc(struct ir_function *f, size_t size);
+
+struct ir_block *ir_block_create(struct ir_function *f);
+
+// Creates a block laid out just before position
+struct ir_block *ir_block_create_before(struct ir_function *f, struct ir_block *position);
+
+// Takes a block out of the function's layout
+void ir_block_unlink(struct ir_function *f, struct ir_block *b);
+
+int ir_slot_create(struct ir_function *f, const char *name, struct symbol *symbol, ir_type_t type, int cells, bool array);
+
+struct ir_value ir_slot(struct ir_function *f, int slot);
+
+struct ir_value ir_temp(struct ir_function *f, ir_type_t type);
+
+struct ir_instr *ir_instr_create(struct ir_function *f, ir_op_t op);
+
+void ir_append(struct ir_block *b, struct ir_instr *i);
+
+void ir_insert_before(struct ir_instr *position, struct ir_instr *i);
+
+void ir_remove(struct ir_instr *i);
+
+// Drops the phi argument coming from the given block
+void ir_phi_remove_source(struct ir_instr *phi, struct ir_block *source);
+
+// Recomputes every block's successors and predecessors from the terminators
+void ir_function_link(struct ir_function *f);
+
+// === printing ===
+
+void ir_value_print(FILE *out, struct ir_function *f, struct ir_value v);
+
+void ir_instr_print(FILE *out, struct ir_function *f, struct ir_instr *i);
+
+void ir_function_print(FILE *out, struct ir_function *f);
+
+void ir_program_print(FILE *out, struct ir_program *p);
+
+#endif
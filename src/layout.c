@@ -0,0 +1,328 @@
+#include "layout.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dominance.h"
+#include "ir.h"
+
+// Nothing measures which way branches go, so they are guessed from the shape
+// of the code, trying each rule in turn. A branch back to the header of a loop
+// is taken, since loops usually run again, and one leaving a loop isn't. A
+// comparison that is only true, or only false, for negative values tests for
+// an error, which rarely happens, and returning straight away while the other
+// way goes on is taken to be an early exit for an unusual case. Blocks that
+// can only be reached through those last two are cold, along with everything
+// that only cold blocks lead to.
+//
+// Each block is then followed by the successor it most likely goes to, when
+// that isn't placed yet, so the likely way falls through. Otherwise the order
+// lowering gave is kept, which follows the source. Cold blocks come after all
+// the rest, so the code around them stays together.
+
+// The successor each block's branch is guessed not to take, indexed by block
+// id, and why the block it leads to is cold, if it is
+static struct ir_block **unlikely = NULL;
+static const char **cold_reasons = NULL;
+
+// =======
+// Guesses
+// =======
+
+static struct ir_instr *condition_of(struct ir_instr *branch)
+{
+    for (struct ir_instr *i = branch->prev; i; i = i->prev)
+    {
+        if (ir_value_equals(i->dest, branch->a))
+            return i;
+    }
+
+    return NULL;
+}
+
+// The successor a comparison against a constant takes only for negative
+// values, or NULL
+static struct ir_block *negative_successor(struct ir_instr *branch)
+{
+    struct ir_instr *c = condition_of(branch);
+
+    if (!c || c->a.type != IR_INTEGER)
+        return NULL;
+
+    ir_op_t op = c->op;
+    int64_t constant;
+
+    // With the constant on the left, the comparison is turned around
+    if (c->b.kind == IR_VALUE_CONSTANT && c->a.kind != IR_VALUE_CONSTANT)
+    {
+        constant = c->b.number;
+    }
+    else if (c->a.kind == IR_VALUE_CONSTANT && c->b.kind != IR_VALUE_CONSTANT)
+    {
+        constant = c->a.number;
+        op = op == IR_LT ? IR_GT : op == IR_GT ? IR_LT : op == IR_LTE ? IR_GTE : op == IR_GTE ? IR_LTE : op;
+    }
+    else
+    {
+        return NULL;
+    }
+
+    switch (op)
+    {
+    case IR_LT:
+        return constant <= 0 ? branch->target : NULL;
+    case IR_LTE:
+    case IR_EQ:
+        return constant < 0 ? branch->target : NULL;
+    case IR_GTE:
+        return constant <= 0 ? branch->target_false : NULL;
+    case IR_GT:
+    case IR_NE:
+        return constant < 0 ? branch->target_false : NULL;
+    default:
+        return NULL;
+    }
+}
+
+static bool returns(struct ir_block *b)
+{
+    return b->last && b->last->op == IR_RETURN;
+}
+
+// The successor the block's branch is guessed not to take, or NULL. Sets the
+// reason when the guess makes the successor cold
+static struct ir_block *guess(struct ir_block *b, const char **reason)
+{
+    struct ir_instr *branch = b->last;
+
+    *reason = NULL;
+
+    if (!branch || branch->op != IR_BRANCH || branch->target == branch->target_false)
+        return NULL;
+
+    struct ir_block *taken = branch->target;
+    struct ir_block *not_taken = branch->target_false;
+
+    if (ir_dominates(taken, b))
+        return not_taken;
+
+    if (ir_dominates(not_taken, b))
+        return taken;
+
+    if (taken->loop_depth < b->loop_depth && not_taken->loop_depth >= b->loop_depth)
+        return taken;
+
+    if (not_taken->loop_depth < b->loop_depth && taken->loop_depth >= b->loop_depth)
+        return not_taken;
+
+    struct ir_block *negative = negative_successor(branch);
+
+    if (negative)
+    {
+        *reason = "it handles a negative value";
+        return negative;
+    }
+
+    if (returns(taken) != returns(not_taken))
+    {
+        *reason = "it returns early";
+        return returns(taken) ? taken : not_taken;
+    }
+
+    return NULL;
+}
+
+static bool heads_loop(struct ir_block *b)
+{
+    for (int p = 0; p < b->pred_count; p++)
+    {
+        if (ir_dominates(b, b->preds[p]))
+            return true;
+    }
+
+    return false;
+}
+
+// Vectorized loops run inside a single block
+static bool runs_loop(struct ir_block *b)
+{
+    for (struct ir_instr *i = b->first; i; i = i->next)
+    {
+        if (i->op == IR_VECTOR)
+            return true;
+    }
+
+    return heads_loop(b);
+}
+
+// A block is cold when every way into it is, leaving out back edges, which
+// only come from blocks inside a loop it heads. Loops are guessed to run many
+// times once reached, so neither a loop nor the block entering it is cold
+static void cold_mark(struct ir_function *f)
+{
+    for (int n = 1; n < f->rpo_count; n++)
+    {
+        struct ir_block *b = f->rpo[n];
+        bool cold = true;
+
+        for (int p = 0; p < b->pred_count; p++)
+        {
+            struct ir_block *pred = b->preds[p];
+
+            if (pred->order < 0 || ir_dominates(b, pred))
+                continue;
+
+            if (!pred->cold && !(unlikely[pred->id] == b && cold_reasons[pred->id]))
+                cold = false;
+        }
+
+        b->cold = cold && !runs_loop(b) && !(b->succ_count == 1 && runs_loop(b->succs[0]));
+    }
+}
+
+// ======
+// Layout
+// ======
+
+// Whether every way into the block other than from b, leaving out back edges,
+// comes from a block already placed
+static bool entered_only_from(struct ir_block *s, struct ir_block *b, bool *placed)
+{
+    for (int p = 0; p < s->pred_count; p++)
+    {
+        struct ir_block *pred = s->preds[p];
+
+        if (pred != b && !placed[pred->id] && !ir_dominates(s, pred))
+            return false;
+    }
+
+    return true;
+}
+
+static bool is_free(struct ir_block *s, bool *placed)
+{
+    return !placed[s->id] && !s->cold;
+}
+
+// The successor to place straight after the block, if it is free to go there.
+// Without a guess, or once the likely one is placed, as it is for a branch
+// back to a loop's header, a successor is only followed when nothing else
+// still to be placed leads to it, so the other arm of an if isn't pushed away
+// from the code around it. The one that came next before is preferred
+static struct ir_block *likely_successor(struct ir_block *b, bool *placed)
+{
+    struct ir_instr *last = b->last;
+
+    if (unlikely[b->id])
+    {
+        struct ir_block *likely = last->target == unlikely[b->id] ? last->target_false : last->target;
+
+        if (is_free(likely, placed))
+            return likely;
+    }
+
+    if (b->next && is_free(b->next, placed) && entered_only_from(b->next, b, placed))
+    {
+        for (int n = 0; n < b->succ_count; n++)
+        {
+            if (b->succs[n] == b->next)
+                return b->next;
+        }
+    }
+
+    for (int n = 0; n < b->succ_count; n++)
+    {
+        if (is_free(b->succs[n], placed) && entered_only_from(b->succs[n], b, placed))
+            return b->succs[n];
+    }
+
+    return NULL;
+}
+
+int ir_function_layout(struct ir_function *f, bool remarks)
+{
+    ir_function_link(f);
+    ir_function_dominators(f);
+    ir_function_loop_depths(f);
+
+    unlikely = calloc(f->block_count + 1, sizeof(struct ir_block *));
+    cold_reasons = calloc(f->block_count + 1, sizeof(const char *));
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        b->cold = false;
+        b->aligned = false;
+
+        if (b->order >= 0)
+            unlikely[b->id] = guess(b, &cold_reasons[b->id]);
+    }
+
+    cold_mark(f);
+
+    // Hot blocks first, then the cold ones in the order they were in
+    struct ir_block **order = malloc(sizeof(struct ir_block *) * (f->block_count + 1));
+    bool *placed = calloc(f->block_count + 1, sizeof(bool));
+    struct ir_block *next = f->entry;
+    struct ir_block *scan = f->entry;
+    int count = 0;
+    int cold = 0;
+
+    while (next)
+    {
+        order[count++] = next;
+        placed[next->id] = true;
+
+        struct ir_block *likely = likely_successor(next, placed);
+
+        while (scan && (placed[scan->id] || scan->cold))
+            scan = scan->next;
+
+        next = likely ? likely : scan;
+    }
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        if (!b->cold)
+            continue;
+
+        order[count++] = b;
+        cold++;
+
+        if (!remarks)
+            continue;
+
+        const char *reason = "only cold blocks lead to it";
+
+        for (int p = 0; p < b->pred_count; p++)
+        {
+            if (unlikely[b->preds[p]->id] == b && cold_reasons[b->preds[p]->id])
+                reason = cold_reasons[b->preds[p]->id];
+        }
+
+        printf("remark: %s: moved B%d out of line, as %s\n", f->name, b->id, reason);
+    }
+
+    for (int n = 0; n < count; n++)
+    {
+        order[n]->prev = n ? order[n - 1] : NULL;
+        order[n]->next = n + 1 < count ? order[n + 1] : NULL;
+    }
+
+    f->entry = order[0];
+    f->last = order[count - 1];
+
+    // Loop headers are worth aligning when the loop isn't cold, as the
+    // branch back to them is taken on every iteration
+    for (int n = 0; n < f->rpo_count; n++)
+        f->rpo[n]->aligned = !f->rpo[n]->cold && heads_loop(f->rpo[n]);
+
+    free(order);
+    free(placed);
+    free(unlikely);
+    free(cold_reasons);
+    unlikely = NULL;
+    cold_reasons = NULL;
+
+    return cold;
+}
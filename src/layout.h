@@ -0,0 +1,16 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stdbool.h>
+
+struct ir_function;
+
+// Orders a function's blocks so each one falls through to the successor it
+// most likely goes to, guessing which way branches go from the shape of the
+// code. Blocks that should rarely run are marked cold and placed after all
+// the others, and the headers of the loops left are marked to be aligned.
+// When remarks is set, reports how many blocks were found cold. Returns how
+// many there were
+int ir_function_layout(struct ir_function *f, bool remarks);
+
+#endif
@@ -22,9 +22,14 @@ x = a ^ b;
 Is effectively this C code:
 
 x = integer_power(a,b);
+
+Programs compiled with -fbounds-check call bounds_error when an array
+index is out of range, which never returns. Array parameters have no
+known size, given as 0, and only fail on negative indices.
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 
 void print_integer(long x)
 {
@@ -48,11 +53,26 @@ void print_character(char c)
 
 long integer_power(long x, long y)
 {
-    long result = 1;
+    // Exponentiation by squaring, taking one step per bit of y. Products wrap
+    // around just like the multiplications in generated code
+    unsigned long result = 1;
+    unsigned long base = x;
+
     while (y > 0)
     {
-        result = result * x;
-        y = y - 1;
+        if (y & 1)
+            result = result * base;
+        base = base * base;
+        y = y >> 1;
     }
     return result;
 }
+
+void bounds_error(long index, long size)
+{
+    if (size == 0)
+        printf("ERROR: Array index %ld is negative\n", index);
+    else
+        printf("ERROR: Array index %ld is out of bounds for an array of %ld elements\n", index, size);
+    exit(1);
+}
@@ -0,0 +1,201 @@
+#include "licm.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "alias.h"
+#include "dominance.h"
+#include "ir.h"
+#include "loop.h"
+
+// Loops are visited from the innermost out, so code hoisted into an inner
+// loop's preheader, which is part of the loop around it, can be hoisted again
+// from there. Within a loop, blocks are visited in reverse postorder, which
+// sees every definition before its uses, so one pass finds every invariant.
+
+// The state of the function being optimized
+static struct ir_function *function = NULL;
+static struct ir_instr **defs = NULL;
+
+// What the loop being optimized writes to, and whether it makes calls that
+// may write to anything
+static struct object *writes = NULL;
+static int write_count = 0;
+static bool writes_anything = false;
+
+// ======
+// Writes
+// ======
+
+static void writes_add(struct object o)
+{
+    writes = realloc(writes, sizeof(struct object) * (write_count + 1));
+    writes[write_count++] = o;
+}
+
+static void writes_find(struct ir_loop *l)
+{
+    write_count = 0;
+    writes_anything = false;
+
+    for (int n = 0; n < l->block_count; n++)
+    {
+        for (struct ir_instr *i = l->blocks[n]->first; i; i = i->next)
+        {
+            if (i->op == IR_STORE)
+                writes_add(object_of(i->a));
+            else if (i->op == IR_STORE_ELEMENT)
+                writes_add(base_object(defs, i->a));
+            else if ((i->op == IR_CALL && ir_call_writes_memory(i)) || i->op == IR_VECTOR)
+                writes_anything = true;
+        }
+    }
+}
+
+static bool is_written(struct object o)
+{
+    if (writes_anything)
+        return true;
+
+    for (int w = 0; w < write_count; w++)
+    {
+        if (may_alias(o, writes[w]))
+            return true;
+    }
+
+    return false;
+}
+
+// ========
+// Hoisting
+// ========
+
+static bool is_invariant(struct ir_loop *l, struct ir_instr *i)
+{
+    for (int n = 0; n < ir_operand_count(i); n++)
+    {
+        struct ir_value *v = ir_operand(i, n);
+
+        if (v->kind == IR_VALUE_TEMP && defs[v->number] && ir_loop_contains(l, defs[v->number]->block))
+            return false;
+    }
+
+    return true;
+}
+
+// Whether the block runs on every iteration that finishes. An array element
+// may only be read ahead of time if it would have been read anyway, since the
+// index may only be in bounds once the loop is known to run
+static bool always_runs(struct ir_loop *l, struct ir_block *b)
+{
+    for (int n = 0; n < l->block_count; n++)
+    {
+        if (ir_loop_is_exiting(l, l->blocks[n]) && !ir_dominates(b, l->blocks[n]))
+            return false;
+    }
+
+    return true;
+}
+
+static bool can_hoist(struct ir_loop *l, struct ir_instr *i)
+{
+    switch (i->op)
+    {
+    case IR_COPY:
+        // Constants cost nothing to load where they are used, and hoisting
+        // them would only keep a register busy through the loop
+        return i->a.kind == IR_VALUE_TEMP;
+    case IR_ADDRESS_OF:
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_DIV:
+    case IR_MOD:
+    case IR_POW:
+    case IR_NEG:
+    case IR_NOT:
+    case IR_AND:
+    case IR_OR:
+    case IR_LT:
+    case IR_LTE:
+    case IR_GT:
+    case IR_GTE:
+    case IR_EQ:
+    case IR_NE:
+        // Division that may trap has to stay where it is
+        return !ir_has_side_effects(i);
+    case IR_LOAD:
+        return !is_written(object_of(i->a));
+    case IR_LOAD_ELEMENT:
+        return !is_written(base_object(defs, i->a)) && always_runs(l, i->block);
+    default:
+        return false;
+    }
+}
+
+static int loop_hoist(struct ir_loop *l, bool remarks)
+{
+    int hoisted = 0;
+
+    writes_find(l);
+
+    for (int n = 0; n < l->block_count; n++)
+    {
+        struct ir_instr *next;
+
+        for (struct ir_instr *i = l->blocks[n]->first; i; i = next)
+        {
+            next = i->next;
+
+            if (!can_hoist(l, i) || !is_invariant(l, i))
+                continue;
+
+            ir_remove(i);
+            ir_insert_before(l->preheader->last, i);
+            hoisted++;
+
+            if (remarks)
+            {
+                printf("remark: %s: hoisted out of the loop at B%d:", function->name, l->header->id);
+                ir_instr_print(stdout, function, i);
+            }
+        }
+    }
+
+    return hoisted;
+}
+
+int ir_function_licm(struct ir_function *f, bool remarks)
+{
+    int count;
+    struct ir_loop **loops = ir_function_loops(f, &count);
+
+    if (!count)
+        return 0;
+
+    function = f;
+    defs = calloc(f->temp_count ? f->temp_count : 1, sizeof(struct ir_instr *));
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            if (i->dest.kind == IR_VALUE_TEMP)
+                defs[i->dest.number] = i;
+        }
+    }
+
+    int hoisted = 0;
+
+    for (int n = 0; n < count; n++)
+        hoisted += loop_hoist(loops[n], remarks);
+
+    free(defs);
+    free(writes);
+    defs = NULL;
+    writes = NULL;
+    write_count = 0;
+
+    return hoisted;
+}
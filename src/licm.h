@@ -0,0 +1,15 @@
+#ifndef LICM_H
+#define LICM_H
+
+#include <stdbool.h>
+
+struct ir_function;
+
+// Loop-invariant code motion over a function in SSA form. Computations whose
+// operands don't change inside a loop, and loads of memory the loop never
+// writes, are moved to the loop's preheader so they run once each time it is
+// entered. Each move is reported when remarks is set. Returns how many
+// instructions were moved
+int ir_function_licm(struct ir_function *f, bool remarks);
+
+#endif
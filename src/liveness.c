@@ -0,0 +1,148 @@
+#include "liveness.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir.h"
+
+// Liveness is solved backwards over the blocks until nothing changes. A phi's
+// arguments are live out of the predecessor they come from rather than into
+// the phi's own block.
+
+static uint64_t *bits(struct liveness *l, uint64_t *sets, struct ir_block *b)
+{
+    return sets + (size_t)b->id * l->words;
+}
+
+static bool bit_test(uint64_t *set, int n)
+{
+    return (set[n / 64] >> (n % 64)) & 1;
+}
+
+static void bit_set(uint64_t *set, int n)
+{
+    set[n / 64] |= (uint64_t)1 << (n % 64);
+}
+
+struct liveness *ir_function_liveness(struct ir_function *f)
+{
+    struct liveness *l = malloc(sizeof(struct liveness));
+    size_t size = (size_t)f->block_count * ((f->temp_count + 63) / 64);
+
+    l->words = (f->temp_count + 63) / 64;
+    l->live_in = calloc(size ? size : 1, sizeof(uint64_t));
+    l->live_out = calloc(size ? size : 1, sizeof(uint64_t));
+
+    // The temporaries each block reads before writing, and those it writes
+    uint64_t *gen = calloc(size ? size : 1, sizeof(uint64_t));
+    uint64_t *kill = calloc(size ? size : 1, sizeof(uint64_t));
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        uint64_t *g = bits(l, gen, b);
+        uint64_t *k = bits(l, kill, b);
+
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            if (i->op != IR_PHI)
+            {
+                for (int n = 0; n < ir_operand_count(i); n++)
+                {
+                    struct ir_value *v = ir_operand(i, n);
+
+                    if (v->kind == IR_VALUE_TEMP && !bit_test(k, v->number))
+                        bit_set(g, v->number);
+                }
+            }
+
+            if (i->dest.kind == IR_VALUE_TEMP)
+                bit_set(k, i->dest.number);
+        }
+    }
+
+    uint64_t *out = malloc(sizeof(uint64_t) * (l->words ? l->words : 1));
+    bool changed = true;
+
+    while (changed)
+    {
+        changed = false;
+
+        // Going backwards through the layout follows most edges the right way
+        for (struct ir_block *b = f->last; b; b = b->prev)
+        {
+            memset(out, 0, sizeof(uint64_t) * l->words);
+
+            for (int s = 0; s < b->succ_count; s++)
+            {
+                struct ir_block *succ = b->succs[s];
+                uint64_t *in = bits(l, l->live_in, succ);
+
+                for (int w = 0; w < l->words; w++)
+                    out[w] |= in[w];
+
+                for (struct ir_instr *phi = succ->first; phi && phi->op == IR_PHI; phi = phi->next)
+                {
+                    for (int n = 0; n < phi->arg_count; n++)
+                    {
+                        if (phi->sources[n] == b && phi->args[n].kind == IR_VALUE_TEMP)
+                            bit_set(out, phi->args[n].number);
+                    }
+                }
+            }
+
+            uint64_t *live_out = bits(l, l->live_out, b);
+            uint64_t *live_in = bits(l, l->live_in, b);
+            uint64_t *g = bits(l, gen, b);
+            uint64_t *k = bits(l, kill, b);
+
+            for (int w = 0; w < l->words; w++)
+            {
+                uint64_t in = g[w] | (out[w] & ~k[w]);
+
+                if (out[w] != live_out[w] || in != live_in[w])
+                    changed = true;
+
+                live_out[w] = out[w];
+                live_in[w] = in;
+            }
+        }
+    }
+
+    free(out);
+    free(gen);
+    free(kill);
+
+    return l;
+}
+
+bool liveness_in(struct liveness *l, struct ir_block *b, int temp)
+{
+    return bit_test(bits(l, l->live_in, b), temp);
+}
+
+bool liveness_out(struct liveness *l, struct ir_block *b, int temp)
+{
+    return bit_test(bits(l, l->live_out, b), temp);
+}
+
+uint64_t *liveness_in_set(struct liveness *l, struct ir_block *b)
+{
+    return bits(l, l->live_in, b);
+}
+
+uint64_t *liveness_out_set(struct liveness *l, struct ir_block *b)
+{
+    return bits(l, l->live_out, b);
+}
+
+void liveness_delete(struct liveness *l)
+{
+    if (!l)
+        return;
+
+    free(l->live_in);
+    free(l->live_out);
+    free(l);
+}
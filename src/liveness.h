@@ -0,0 +1,31 @@
+#ifndef LIVENESS_H
+#define LIVENESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct ir_block;
+struct ir_function;
+
+// The temporaries live on entry to and exit from each block, kept as bitsets
+// indexed by block id
+struct liveness
+{
+    int words;
+    uint64_t *live_in;
+    uint64_t *live_out;
+};
+
+struct liveness *ir_function_liveness(struct ir_function *f);
+
+bool liveness_in(struct liveness *l, struct ir_block *b, int temp);
+
+bool liveness_out(struct liveness *l, struct ir_block *b, int temp);
+
+// The raw sets, words of 64 temporaries each, for walking every live value
+uint64_t *liveness_in_set(struct liveness *l, struct ir_block *b);
+uint64_t *liveness_out_set(struct liveness *l, struct ir_block *b);
+
+void liveness_delete(struct liveness *l);
+
+#endif
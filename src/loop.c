@@ -0,0 +1,293 @@
+#include "loop.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "dominance.h"
+#include "ir.h"
+
+// Loops are found from their back edges, which go to a block dominating their
+// source. Passes that move code out of a loop need somewhere to put it, so
+// every header is first given a preheader: a block that is its only entry
+// from outside the loop.
+
+// ==========
+// Preheaders
+// ==========
+
+static bool is_back_edge(struct ir_block *from, struct ir_block *header)
+{
+    return from->order >= 0 && ir_dominates(header, from);
+}
+
+static bool is_header(struct ir_block *b)
+{
+    for (int p = 0; p < b->pred_count; p++)
+    {
+        if (is_back_edge(b->preds[p], b))
+            return true;
+    }
+
+    return false;
+}
+
+static void retarget(struct ir_block *from, struct ir_block *old, struct ir_block *new)
+{
+    struct ir_instr *t = from->last;
+
+    if (t->target == old)
+        t->target = new;
+
+    if (t->op == IR_BRANCH && t->target_false == old)
+        t->target_false = new;
+}
+
+// Puts a new block between the header and its predecessors from outside the
+// loop. The header's phis take the values from outside through a phi in the
+// preheader, or straight from the preheader when there is only one
+static void preheader_insert(struct ir_function *f, struct ir_block *header)
+{
+    struct ir_block *preheader = ir_block_create_before(f, header);
+    int entries = 0;
+
+    for (int p = 0; p < header->pred_count; p++)
+    {
+        if (!is_back_edge(header->preds[p], header))
+        {
+            retarget(header->preds[p], header, preheader);
+            entries++;
+        }
+    }
+
+    for (struct ir_instr *phi = header->first; phi && phi->op == IR_PHI; phi = phi->next)
+    {
+        struct ir_instr *outer = NULL;
+        int kept = 0;
+
+        if (entries > 1)
+        {
+            outer = ir_instr_create(f, IR_PHI);
+            outer->dest = ir_temp(f, phi->dest.type);
+            outer->args = ir_alloc(f, sizeof(struct ir_value) * entries);
+            outer->sources = ir_alloc(f, sizeof(struct ir_block *) * entries);
+            ir_append(preheader, outer);
+        }
+
+        for (int n = 0; n < phi->arg_count; n++)
+        {
+            if (is_back_edge(phi->sources[n], header))
+            {
+                phi->args[kept] = phi->args[n];
+                phi->sources[kept] = phi->sources[n];
+                kept++;
+            }
+            else if (outer)
+            {
+                outer->args[outer->arg_count] = phi->args[n];
+                outer->sources[outer->arg_count] = phi->sources[n];
+                outer->arg_count++;
+            }
+            else
+            {
+                phi->args[kept] = phi->args[n];
+                phi->sources[kept] = preheader;
+                kept++;
+            }
+        }
+
+        if (outer)
+        {
+            phi->args[kept] = outer->dest;
+            phi->sources[kept] = preheader;
+            kept++;
+        }
+
+        phi->arg_count = kept;
+    }
+
+    struct ir_instr *jump = ir_instr_create(f, IR_JUMP);
+    jump->target = header;
+    ir_append(preheader, jump);
+}
+
+// A header already has a preheader when a single block outside the loop
+// enters it, and does nothing but jump there
+static bool has_preheader(struct ir_block *header)
+{
+    struct ir_block *entry = NULL;
+
+    for (int p = 0; p < header->pred_count; p++)
+    {
+        if (is_back_edge(header->preds[p], header))
+            continue;
+
+        if (entry)
+            return false;
+
+        entry = header->preds[p];
+    }
+
+    return entry && entry->succ_count == 1;
+}
+
+// =====
+// Loops
+// =====
+
+bool ir_loop_contains(struct ir_loop *l, struct ir_block *b)
+{
+    return l->contains[b->id];
+}
+
+bool ir_loop_is_exiting(struct ir_loop *l, struct ir_block *b)
+{
+    for (int s = 0; s < b->succ_count; s++)
+    {
+        if (!ir_loop_contains(l, b->succs[s]))
+            return true;
+    }
+
+    return false;
+}
+
+// Walks backwards from the sources of the back edges, stopping at the header
+static struct ir_loop *loop_create(struct ir_function *f, struct ir_block *header, struct ir_block **stack)
+{
+    struct ir_loop *l = ir_alloc(f, sizeof(struct ir_loop));
+    int top = 0;
+
+    l->header = header;
+    l->contains = ir_alloc(f, sizeof(bool) * f->block_count);
+    l->contains[header->id] = true;
+
+    for (int p = 0; p < header->pred_count; p++)
+    {
+        struct ir_block *pred = header->preds[p];
+
+        if (is_back_edge(pred, header))
+        {
+            if (!l->contains[pred->id])
+            {
+                l->contains[pred->id] = true;
+                stack[top++] = pred;
+            }
+        }
+        else
+        {
+            l->preheader = pred;
+        }
+    }
+
+    while (top)
+    {
+        struct ir_block *b = stack[--top];
+
+        for (int p = 0; p < b->pred_count; p++)
+        {
+            struct ir_block *pred = b->preds[p];
+
+            if (pred->order >= 0 && !l->contains[pred->id])
+            {
+                l->contains[pred->id] = true;
+                stack[top++] = pred;
+            }
+        }
+    }
+
+    for (int i = 0; i < f->rpo_count; i++)
+    {
+        if (l->contains[f->rpo[i]->id])
+            l->block_count++;
+    }
+
+    l->blocks = ir_alloc(f, sizeof(struct ir_block *) * l->block_count);
+    l->block_count = 0;
+
+    for (int i = 0; i < f->rpo_count; i++)
+    {
+        if (l->contains[f->rpo[i]->id])
+            l->blocks[l->block_count++] = f->rpo[i];
+    }
+
+    return l;
+}
+
+// Loops are nested or disjoint, so a loop inside another is smaller than it
+static int loop_compare(const void *a, const void *b)
+{
+    const struct ir_loop *x = *(struct ir_loop *const *)a;
+    const struct ir_loop *y = *(struct ir_loop *const *)b;
+
+    if (x->block_count != y->block_count)
+        return x->block_count - y->block_count;
+
+    return x->header->order - y->header->order;
+}
+
+struct ir_loop **ir_function_loops(struct ir_function *f, int *count)
+{
+    ir_function_link(f);
+    ir_function_dominators(f);
+
+    // Headers are collected before any preheader is added, since adding one
+    // changes the order of the blocks
+    struct ir_block **headers = malloc(sizeof(struct ir_block *) * (f->rpo_count + 1));
+    int header_count = 0;
+
+    for (int i = 0; i < f->rpo_count; i++)
+    {
+        if (is_header(f->rpo[i]))
+            headers[header_count++] = f->rpo[i];
+    }
+
+    bool inserted = false;
+
+    for (int h = 0; h < header_count; h++)
+    {
+        if (!has_preheader(headers[h]))
+        {
+            preheader_insert(f, headers[h]);
+            inserted = true;
+        }
+    }
+
+    if (inserted)
+    {
+        ir_function_link(f);
+        ir_function_dominators(f);
+    }
+
+    struct ir_loop **loops = ir_alloc(f, sizeof(struct ir_loop *) * (header_count ? header_count : 1));
+    struct ir_block **stack = malloc(sizeof(struct ir_block *) * (f->block_count + 1));
+
+    for (int h = 0; h < header_count; h++)
+        loops[h] = loop_create(f, headers[h], stack);
+
+    qsort(loops, header_count, sizeof(struct ir_loop *), loop_compare);
+
+    // The parent of a loop is the smallest other loop holding its header, and
+    // coming later in the order, that is the first one found
+    for (int i = 0; i < header_count; i++)
+    {
+        for (int j = i + 1; j < header_count; j++)
+        {
+            if (ir_loop_contains(loops[j], loops[i]->header))
+            {
+                loops[i]->parent = loops[j];
+                break;
+            }
+        }
+    }
+
+    for (int i = 0; i < header_count; i++)
+    {
+        for (struct ir_loop *l = loops[i]; l; l = l->parent)
+            loops[i]->depth++;
+    }
+
+    free(headers);
+    free(stack);
+
+    *count = header_count;
+    return loops;
+}
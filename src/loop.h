@@ -0,0 +1,43 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <stdbool.h>
+
+struct ir_block;
+struct ir_function;
+
+// A natural loop, made of its header and every block that reaches a back edge
+// into the header without passing through it. Loops sharing a header are
+// treated as one
+struct ir_loop
+{
+    struct ir_block *header;
+
+    // The loop's only entry from outside, which jumps straight to the header.
+    // Code placed at its end runs once each time the loop is entered
+    struct ir_block *preheader;
+
+    // The loop's blocks in reverse postorder, so the header comes first
+    struct ir_block **blocks;
+    int block_count;
+
+    // Whether each block is in the loop, indexed by block id
+    bool *contains;
+
+    // The innermost loop around this one, and how many loops that makes
+    struct ir_loop *parent;
+    int depth;
+};
+
+// Finds every loop in the function, first giving each one a preheader if it
+// has none, and leaves the CFG linked and its dominators up to date. Loops are
+// ordered so inner loops come before the loops around them. The loops are
+// allocated in the function's arena and are only valid until its CFG changes
+struct ir_loop **ir_function_loops(struct ir_function *f, int *count);
+
+bool ir_loop_contains(struct ir_loop *l, struct ir_block *b);
+
+// Blocks in the loop with a successor outside it
+bool ir_loop_is_exiting(struct ir_loop *l, struct ir_block *b);
+
+#endif
@@ -0,0 +1,894 @@
+#include "lower.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arg.h"
+#include "ast.h"
+#include "ir.h"
+#include "symbol.h"
+#include "unroll.h"
+#include "vectorize.h"
+
+// Lowering turns the typed, folded AST into three-address IR. Every source
+// variable lives in a stack slot or in global data and is accessed through
+// explicit loads and stores, while every intermediate result gets a fresh
+// temporary.
+
+// The program, function and block currently being lowered into
+static struct ir_program *program = NULL;
+static struct ir_function *function = NULL;
+static struct ir_block *current = NULL;
+
+ir_type_t ir_type_of(struct type *t)
+{
+    if (!t)
+        return IR_INTEGER;
+
+    switch (t->kind)
+    {
+    case TYPE_VOID:
+        return IR_VOID;
+    case TYPE_BOOLEAN:
+        return IR_BOOLEAN;
+    case TYPE_CHARACTER:
+        return IR_CHARACTER;
+    case TYPE_STRING:
+        return IR_STRING;
+    case TYPE_ARRAY:
+        return IR_ADDRESS;
+    default:
+        return IR_INTEGER;
+    }
+}
+
+// Literals made by constant folding carry no type, but their kind decides it
+static ir_type_t expr_ir_type(struct expr *e)
+{
+    switch (e->kind)
+    {
+    case EXPR_INTEGERLITERAL:
+        return IR_INTEGER;
+    case EXPR_BOOLEANLITERAL:
+        return IR_BOOLEAN;
+    case EXPR_CHARLITERAL:
+        return IR_CHARACTER;
+    case EXPR_STRINGLITERAL:
+        return IR_STRING;
+    default:
+        return ir_type_of(e->type);
+    }
+}
+
+// ========
+// Emitting
+// ========
+
+// Code that follows a return has no block to go in, so it starts a new one
+// that nothing jumps to
+static struct ir_instr *emit(ir_op_t op)
+{
+    if (ir_is_terminator(current->last))
+        current = ir_block_create(function);
+
+    struct ir_instr *i = ir_instr_create(function, op);
+    ir_append(current, i);
+
+    return i;
+}
+
+static struct ir_value emit_unary(ir_op_t op, ir_type_t type, struct ir_value a)
+{
+    struct ir_instr *i = emit(op);
+
+    i->dest = ir_temp(function, type);
+    i->a = a;
+
+    return i->dest;
+}
+
+static struct ir_value emit_binary(ir_op_t op, ir_type_t type, struct ir_value a, struct ir_value b)
+{
+    struct ir_instr *i = emit(op);
+
+    i->dest = ir_temp(function, type);
+    i->a = a;
+    i->b = b;
+
+    return i->dest;
+}
+
+static void emit_store(struct ir_value location, struct ir_value value)
+{
+    struct ir_instr *i = emit(IR_STORE);
+
+    i->a = location;
+    i->b = value;
+}
+
+static void emit_jump(struct ir_block *target)
+{
+    emit(IR_JUMP)->target = target;
+}
+
+static void emit_branch(struct ir_value condition, struct ir_block *target, struct ir_block *target_false)
+{
+    struct ir_instr *i = emit(IR_BRANCH);
+
+    i->a = condition;
+    i->target = target;
+    i->target_false = target_false;
+}
+
+static struct ir_value emit_call(const char *callee, ir_type_t type, struct ir_value *args, int arg_count)
+{
+    struct ir_instr *i = emit(IR_CALL);
+
+    i->callee = callee;
+    i->args = args;
+    i->arg_count = arg_count;
+
+    if (type != IR_VOID)
+        i->dest = ir_temp(function, type);
+
+    return i->dest;
+}
+
+// Ends the current block with a jump to b, unless it has already ended
+static void finish_block(struct ir_block *b)
+{
+    if (!ir_is_terminator(current->last))
+        emit_jump(b);
+}
+
+// Ends the current block and continues in b
+static void start_block(struct ir_block *b)
+{
+    finish_block(b);
+    current = b;
+}
+
+// =========
+// Variables
+// =========
+
+// Where a named variable lives. Parameters and locals have been given the
+// number of their slot, while globals are addressed by name
+static struct ir_value symbol_location(struct symbol *s)
+{
+    if (s->kind == SYMBOL_GLOBAL)
+        return ir_global(ir_type_of(s->type), s->name);
+
+    return ir_slot(function, s->which);
+}
+
+// Arrays declared in this function or globally are used by address, while
+// array parameters are pointers held in a slot
+static bool symbol_is_storage(struct symbol *s)
+{
+    return s->type->kind == TYPE_ARRAY && s->kind != SYMBOL_PARAM;
+}
+
+// Something that can be assigned to, either a variable or an array element
+struct lvalue
+{
+    struct ir_value location;
+    struct ir_value base;
+    struct ir_value index;
+    ir_type_t type;
+};
+
+// Under -fbounds-check, indices into arrays are checked before they are used.
+// Array parameters don't say how big they are, so their indices are only
+// checked not to be negative, which a size of 0 stands for
+static void bounds_check_lower(struct expr *array, struct ir_value index)
+{
+    if (!input_arguments.bounds_check || !array->type || array->type->kind != TYPE_ARRAY)
+        return;
+
+    struct ir_instr *i = emit(IR_CHECK);
+
+    i->a = index;
+    i->b = ir_constant(IR_INTEGER, array->type->size);
+}
+
+static struct lvalue lvalue_lower(struct expr *e)
+{
+    struct lvalue lv;
+
+    lv.type = expr_ir_type(e);
+
+    if (e->kind == EXPR_SUBSCRIPT)
+    {
+        lv.location = ir_none();
+        lv.base = expr_lower(e->left);
+        lv.index = expr_lower(e->right);
+        bounds_check_lower(e->left, lv.index);
+    }
+    else
+    {
+        if (symbol_is_storage(e->symbol))
+        {
+            printf("ERROR: Cannot assign to the array '%s' as a whole\n", e->name);
+            exit(1);
+        }
+
+        lv.location = symbol_location(e->symbol);
+        lv.base = ir_none();
+        lv.index = ir_none();
+    }
+
+    return lv;
+}
+
+static struct ir_value lvalue_load(struct lvalue *lv)
+{
+    if (lv->location.kind != IR_VALUE_NONE)
+        return emit_unary(IR_LOAD, lv->type, lv->location);
+
+    return emit_binary(IR_LOAD_ELEMENT, lv->type, lv->base, lv->index);
+}
+
+static void lvalue_store(struct lvalue *lv, struct ir_value value)
+{
+    if (lv->location.kind != IR_VALUE_NONE)
+    {
+        emit_store(lv->location, value);
+        return;
+    }
+
+    struct ir_instr *i = emit(IR_STORE_ELEMENT);
+
+    i->a = lv->base;
+    i->b = lv->index;
+    i->c = value;
+}
+
+// ===========
+// Expressions
+// ===========
+
+static ir_op_t binary_op(expr_t kind)
+{
+    switch (kind)
+    {
+    case EXPR_ADD:
+        return IR_ADD;
+    case EXPR_SUB:
+        return IR_SUB;
+    case EXPR_MUL:
+        return IR_MUL;
+    case EXPR_DIV:
+        return IR_DIV;
+    case EXPR_MOD:
+        return IR_MOD;
+    case EXPR_POW:
+        return IR_POW;
+    case EXPR_LT:
+        return IR_LT;
+    case EXPR_LTE:
+        return IR_LTE;
+    case EXPR_GT:
+        return IR_GT;
+    case EXPR_GTE:
+        return IR_GTE;
+    case EXPR_EQUALITY:
+        return IR_EQ;
+    default:
+        return IR_NE;
+    }
+}
+
+// ==========================
+// Conditions as control flow
+// ==========================
+
+// Conditions are lowered into branches rather than booleans wherever control
+// flow depends on them. && and || become chains of branches that skip the
+// right operand when the left one already decides the result, and ! swaps
+// the targets, so no boolean is computed at all unless one is stored.
+
+static void condition_lower(struct expr *e, struct ir_block *if_true, struct ir_block *if_false)
+{
+    switch (e->kind)
+    {
+    case EXPR_GROUP:
+        condition_lower(e->left, if_true, if_false);
+        return;
+    case EXPR_NOT:
+        condition_lower(e->left, if_false, if_true);
+        return;
+    case EXPR_BOOLEANLITERAL:
+        emit_jump(e->literal_value ? if_true : if_false);
+        return;
+    case EXPR_AND:
+    case EXPR_OR: {
+        struct ir_block *right = ir_block_create(function);
+
+        if (e->kind == EXPR_AND)
+            condition_lower(e->left, right, if_false);
+        else
+            condition_lower(e->left, if_true, right);
+
+        current = right;
+        condition_lower(e->right, if_true, if_false);
+        return;
+    }
+    default:
+        emit_branch(expr_lower(e), if_true, if_false);
+        return;
+    }
+}
+
+// A short-circuit operator used as a value stores which way its condition
+// went into a slot of its own, which becomes a phi once promoted
+static struct ir_value logical_lower(struct expr *e)
+{
+    int slot = ir_slot_create(function, e->kind == EXPR_AND ? "and" : "or", NULL, IR_BOOLEAN, 1, false);
+    struct ir_block *if_true = ir_block_create(function);
+    struct ir_block *if_false = ir_block_create(function);
+    struct ir_block *join = ir_block_create(function);
+
+    condition_lower(e, if_true, if_false);
+
+    current = if_true;
+    emit_store(ir_slot(function, slot), ir_constant(IR_BOOLEAN, 1));
+    emit_jump(join);
+
+    current = if_false;
+    emit_store(ir_slot(function, slot), ir_constant(IR_BOOLEAN, 0));
+    emit_jump(join);
+
+    current = join;
+    return emit_unary(IR_LOAD, IR_BOOLEAN, ir_slot(function, slot));
+}
+
+struct ir_value expr_lower(struct expr *e)
+{
+    switch (e->kind)
+    {
+    case EXPR_NAME:
+        if (symbol_is_storage(e->symbol))
+            return emit_unary(IR_ADDRESS_OF, IR_ADDRESS, symbol_location(e->symbol));
+
+        return emit_unary(IR_LOAD, expr_ir_type(e), symbol_location(e->symbol));
+    case EXPR_INTEGERLITERAL:
+    case EXPR_BOOLEANLITERAL:
+    case EXPR_CHARLITERAL:
+        return ir_constant(expr_ir_type(e), e->literal_value);
+    case EXPR_STRINGLITERAL:
+        return ir_string(e->string_literal);
+    case EXPR_GROUP:
+        return expr_lower(e->left);
+    case EXPR_SUBSCRIPT: {
+        struct ir_value base = expr_lower(e->left);
+        struct ir_value index = expr_lower(e->right);
+
+        bounds_check_lower(e->left, index);
+
+        if (e->type && e->type->kind == TYPE_ARRAY)
+        {
+            // Indexing an array of arrays gives the address of a row
+            struct ir_value offset =
+                emit_binary(IR_MUL, IR_INTEGER, index, ir_constant(IR_INTEGER, type_cells(e->type) * 8));
+            return emit_binary(IR_ADD, IR_ADDRESS, base, offset);
+        }
+
+        return emit_binary(IR_LOAD_ELEMENT, expr_ir_type(e), base, index);
+    }
+    case EXPR_CALL: {
+        struct ir_value *args = ir_alloc(function, sizeof(struct ir_value) * (e->arg_count ? e->arg_count : 1));
+
+        for (int i = 0; i < e->arg_count; i++)
+            args[i] = expr_lower(e->args[i]);
+
+        return emit_call(e->left->name, expr_ir_type(e), args, e->arg_count);
+    }
+    case EXPR_ASSIGNMENT: {
+        struct lvalue lv = lvalue_lower(e->left);
+        struct ir_value value = expr_lower(e->right);
+
+        lvalue_store(&lv, value);
+        return value;
+    }
+    case EXPR_INC:
+    case EXPR_DEC: {
+        // Postfix operators give the value from before the update
+        struct lvalue lv = lvalue_lower(e->left);
+        struct ir_value old = lvalue_load(&lv);
+        struct ir_value updated =
+            emit_binary(e->kind == EXPR_INC ? IR_ADD : IR_SUB, IR_INTEGER, old, ir_constant(IR_INTEGER, 1));
+
+        lvalue_store(&lv, updated);
+        return old;
+    }
+    case EXPR_NEGATE:
+        return emit_unary(IR_NEG, IR_INTEGER, expr_lower(e->left));
+    case EXPR_NOT:
+        return emit_unary(IR_NOT, IR_BOOLEAN, expr_lower(e->left));
+    case EXPR_ADD:
+    case EXPR_SUB:
+    case EXPR_MUL:
+    case EXPR_DIV:
+    case EXPR_MOD:
+    case EXPR_POW:
+    case EXPR_LT:
+    case EXPR_LTE:
+    case EXPR_GT:
+    case EXPR_GTE:
+    case EXPR_EQUALITY:
+    case EXPR_NEQUALITY: {
+        struct ir_value a = expr_lower(e->left);
+        struct ir_value b = expr_lower(e->right);
+
+        return emit_binary(binary_op(e->kind), expr_ir_type(e), a, b);
+    }
+    case EXPR_AND:
+    case EXPR_OR:
+        return logical_lower(e);
+    case EXPR_ARG:
+    case EXPR_INITIALIZER:
+        // Argument lists and initializers are walked by their users
+        break;
+    }
+
+    printf("ERROR: Unexpected expression kind %d while lowering\n", e->kind);
+    exit(1);
+}
+
+// ==========
+// Statements
+// ==========
+
+static const char *print_function(ir_type_t type)
+{
+    switch (type)
+    {
+    case IR_BOOLEAN:
+        return "print_boolean";
+    case IR_CHARACTER:
+        return "print_character";
+    case IR_STRING:
+        return "print_string";
+    default:
+        return "print_integer";
+    }
+}
+
+// Enters an iteration of a partially unrolled loop only if the counter is far
+// enough from the bound for every copy of the body to run. Before the first
+// iteration the loop's own condition is tested as well, since a counter past
+// the bound could be so far past it that the difference overflows. Past the
+// condition it can't overflow into looking far enough, so a counter further
+// away than any integer can hold just leaves the loop to the copy of the
+// original. Once inside, the bound is far enough from the end of the integers
+// for the counter to be compared with the bound less the margin instead,
+// which doesn't change while the loop runs
+static void unrolled_condition_lower(struct stmt *s, struct unroll *u, bool first, struct ir_block *if_true,
+                                     struct ir_block *if_false)
+{
+    struct ir_value margin = ir_constant(IR_INTEGER, u->margin);
+    struct ir_value test;
+
+    if (first)
+    {
+        struct ir_block *room = ir_block_create(function);
+
+        condition_lower(s->expr, room, if_false);
+        current = room;
+    }
+
+    struct ir_value counter = emit_unary(IR_LOAD, IR_INTEGER, symbol_location(u->counter));
+    struct ir_value bound = expr_lower(u->bound);
+
+    if (first)
+    {
+        struct ir_value distance = u->step > 0 ? emit_binary(IR_SUB, IR_INTEGER, bound, counter)
+                                               : emit_binary(IR_SUB, IR_INTEGER, counter, bound);
+
+        test = emit_binary(IR_GT, IR_BOOLEAN, distance, margin);
+    }
+    else if (u->step > 0)
+    {
+        test = emit_binary(IR_LT, IR_BOOLEAN, counter, emit_binary(IR_SUB, IR_INTEGER, bound, margin));
+    }
+    else
+    {
+        test = emit_binary(IR_GT, IR_BOOLEAN, counter, emit_binary(IR_ADD, IR_INTEGER, bound, margin));
+    }
+
+    emit_branch(test, if_true, if_false);
+}
+
+// The condition is tested once before the loop is entered and then at the
+// bottom of each iteration, so every iteration ends in a single branch back
+// to the top
+static void loop_lower(struct stmt *s)
+{
+    struct ir_block *body = ir_block_create(function);
+    struct ir_block *next = ir_block_create(function);
+    struct ir_block *done = ir_block_create(function);
+
+    // A loop without a condition runs until something returns
+    if (s->expr)
+        condition_lower(s->expr, body, done);
+    else
+        emit_jump(body);
+
+    current = body;
+    stmt_lower(s->body);
+
+    start_block(next);
+
+    if (s->next_expr)
+        expr_lower(s->next_expr);
+
+    if (s->expr)
+        condition_lower(s->expr, body, done);
+    else
+        emit_jump(body);
+
+    current = done;
+}
+
+// Under -fbounds-check, the elements a vectorized loop reaches in each array
+// are checked once in front of it, from the lowest offset at the first
+// iteration to the highest at the last. Array parameters only have their
+// lower bound checked. Should any fall outside, the loop is left to the copy
+// of the original, whose own checks stop the program at the element they
+// always would
+static void vectorized_bounds_lower(struct vectorize *v, struct ir_value first, struct ir_value end,
+                                    struct ir_block *rest)
+{
+    for (int n = 0; n < v->array_count; n++)
+    {
+        int64_t lowest = INT64_MAX;
+        int64_t highest = INT64_MIN;
+
+        for (int k = 0; k < v->step_count; k++)
+        {
+            struct ir_vector_step *step = &v->steps[k];
+
+            if ((step->kind != IR_VECTOR_LOAD && step->kind != IR_VECTOR_STORE) || step->arg != n)
+                continue;
+
+            lowest = step->offset < lowest ? step->offset : lowest;
+            highest = step->offset > highest ? step->offset : highest;
+        }
+
+        struct ir_block *low = ir_block_create(function);
+        struct ir_value from = emit_binary(IR_ADD, IR_INTEGER, first, ir_constant(IR_INTEGER, lowest));
+
+        emit_branch(emit_binary(IR_GTE, IR_BOOLEAN, from, ir_constant(IR_INTEGER, 0)), low, rest);
+        current = low;
+
+        int size = v->arrays[n]->type->size;
+
+        if (!size)
+            continue;
+
+        struct ir_block *high = ir_block_create(function);
+        struct ir_value to = emit_binary(IR_ADD, IR_INTEGER, end, ir_constant(IR_INTEGER, highest - 1));
+
+        emit_branch(emit_binary(IR_LT, IR_BOOLEAN, to, ir_constant(IR_INTEGER, size)), high, rest);
+        current = high;
+    }
+}
+
+// A vectorized loop is a single instruction running over as many elements as
+// fill whole vectors, when there are enough for one, while the copy of the
+// original loop that follows takes care of the rest. The distance between the
+// counter and the bound can't overflow into looking far enough once the loop's
+// own condition has passed, as in an unrolled loop
+static void vectorized_lower(struct stmt *s, struct vectorize *v, int width)
+{
+    struct ir_block *room = ir_block_create(function);
+    struct ir_block *vector = ir_block_create(function);
+    struct ir_block *rest = ir_block_create(function);
+    struct ir_value w = ir_constant(IR_INTEGER, width);
+
+    condition_lower(s->expr, room, rest);
+    current = room;
+
+    struct ir_value counter = emit_unary(IR_LOAD, IR_INTEGER, symbol_location(v->loop.counter));
+    struct ir_value distance = emit_binary(IR_SUB, IR_INTEGER, expr_lower(v->loop.bound), counter);
+
+    emit_branch(emit_binary(IR_GTE, IR_BOOLEAN, distance, w), vector, rest);
+    current = vector;
+
+    struct ir_value remainder = emit_binary(IR_MOD, IR_INTEGER, distance, w);
+    struct ir_value end = emit_binary(IR_ADD, IR_INTEGER, counter, emit_binary(IR_SUB, IR_INTEGER, distance, remainder));
+
+    if (input_arguments.bounds_check)
+        vectorized_bounds_lower(v, counter, end, rest);
+
+    int arg_count = v->array_count + v->scalar_count;
+    struct ir_value *args = ir_alloc(function, sizeof(struct ir_value) * (arg_count ? arg_count : 1));
+
+    for (int n = 0; n < v->array_count; n++)
+        args[n] = expr_lower(v->arrays[n]);
+
+    for (int n = 0; n < v->scalar_count; n++)
+        args[v->array_count + n] = expr_lower(v->scalars[n]);
+
+    struct ir_instr *i = emit(IR_VECTOR);
+
+    i->a = counter;
+    i->b = end;
+    i->args = args;
+    i->arg_count = arg_count;
+    i->vector = ir_alloc(function, sizeof(struct ir_vector));
+    i->vector->width = width;
+    i->vector->step_count = v->step_count;
+    i->vector->steps = ir_alloc(function, sizeof(struct ir_vector_step) * v->step_count);
+    memcpy(i->vector->steps, v->steps, sizeof(struct ir_vector_step) * v->step_count);
+
+    if (v->reduction)
+    {
+        struct ir_value location = symbol_location(v->reduction);
+
+        i->dest = ir_temp(function, IR_INTEGER);
+        emit_store(location, emit_binary(v->subtracted ? IR_SUB : IR_ADD, IR_INTEGER,
+                                         emit_unary(IR_LOAD, IR_INTEGER, location), i->dest));
+    }
+
+    emit_store(symbol_location(v->loop.counter), end);
+    emit_jump(rest);
+
+    current = rest;
+    loop_lower(s);
+}
+
+// From -O1 on, counted loops are vectorized or unrolled as they are lowered.
+// A fully unrolled loop becomes its body and update repeated once per
+// iteration. A partially unrolled one repeats them in a loop of its own,
+// which leaves any iterations too few to fill it to a copy of the original
+// loop. When the trip count is a known multiple of the copies, there are none
+// left over, and the loop is entered without testing anything
+static void for_lower(struct stmt *s)
+{
+    struct unroll u;
+
+    if (s->init_expr)
+        expr_lower(s->init_expr);
+
+    if (input_arguments.optimize >= 1 && input_arguments.vectorize)
+    {
+        struct vectorize v;
+        const char *reason;
+        int width = input_arguments.avx2 ? 4 : 2;
+
+        if (vectorize_plan(s, width, &v, &reason))
+        {
+            if (input_arguments.opt_info)
+            {
+                printf("remark: %s: vectorized the loop over %s, %d elements at a time with %s\n", function->name,
+                       v.loop.counter->name, width, input_arguments.avx2 ? "AVX2" : "SSE2");
+            }
+
+            vectorized_lower(s, &v, width);
+            vectorize_free(&v);
+            return;
+        }
+
+        if (input_arguments.opt_info)
+            printf("remark: %s: didn't vectorize a loop: %s\n", function->name, reason);
+    }
+
+    if (input_arguments.optimize < 1 || !unroll_plan(s, input_arguments.unroll_factor, &u))
+    {
+        loop_lower(s);
+        return;
+    }
+
+    if (input_arguments.opt_info)
+    {
+        printf("remark: %s: unrolled the loop over %s %sinto %d cop%s of its body%s\n", function->name,
+               u.counter->name, u.full ? "fully, " : "", u.factor, u.factor == 1 ? "y" : "ies",
+               u.remainder ? ", with a remainder loop" : "");
+    }
+
+    if (u.full)
+    {
+        for (int n = 0; n < u.factor; n++)
+        {
+            stmt_lower(s->body);
+            expr_lower(s->next_expr);
+        }
+
+        return;
+    }
+
+    struct ir_block *body = ir_block_create(function);
+    struct ir_block *rest = ir_block_create(function);
+
+    if (u.remainder)
+        unrolled_condition_lower(s, &u, true, body, rest);
+    else
+        emit_jump(body);
+
+    current = body;
+
+    for (int n = 0; n < u.factor; n++)
+    {
+        stmt_lower(s->body);
+        expr_lower(s->next_expr);
+    }
+
+    unrolled_condition_lower(s, &u, false, body, rest);
+
+    current = rest;
+
+    if (u.remainder)
+        loop_lower(s);
+}
+
+void stmt_lower(struct stmt *s)
+{
+    for (; s; s = s->next)
+    {
+        switch (s->kind)
+        {
+        case STMT_DECL:
+            decl_lower(s->decl);
+            break;
+        case STMT_EXPR:
+            expr_lower(s->expr);
+            break;
+        case STMT_IF: {
+            struct ir_block *then_block = ir_block_create(function);
+            struct ir_block *else_block = s->else_body ? ir_block_create(function) : NULL;
+            struct ir_block *join = ir_block_create(function);
+
+            condition_lower(s->expr, then_block, else_block ? else_block : join);
+
+            current = then_block;
+            stmt_lower(s->body);
+
+            if (else_block)
+            {
+                finish_block(join);
+                current = else_block;
+                stmt_lower(s->else_body);
+            }
+
+            start_block(join);
+            break;
+        }
+        case STMT_FOR:
+            for_lower(s);
+            break;
+        case STMT_PRINT:
+            for (struct expr *a = s->expr; a; a = a->right)
+            {
+                struct expr *item = a->kind == EXPR_ARG ? a->left : a;
+                struct ir_value *args = ir_alloc(function, sizeof(struct ir_value));
+
+                args[0] = expr_lower(item);
+                emit_call(print_function(args[0].type), IR_VOID, args, 1);
+
+                if (a->kind != EXPR_ARG)
+                    break;
+            }
+            break;
+        case STMT_RETURN: {
+            // The value has to be lowered before the return is emitted
+            struct ir_value value = s->expr ? expr_lower(s->expr) : ir_none();
+            emit(IR_RETURN)->a = value;
+            break;
+        }
+        case STMT_BLOCKSTART:
+        case STMT_BLOCKEND:
+            break;
+        }
+    }
+}
+
+// ============
+// Declarations
+// ============
+
+// Stores the elements of an initializer one cell after another, so nested
+// initializers fill the rows of an array of arrays in order
+static void initializer_lower(struct expr *e, struct ir_value base, int *index)
+{
+    for (struct expr *n = e->left; n; n = n->right)
+    {
+        struct expr *element = n->kind == EXPR_ARG ? n->left : n;
+
+        if (element->kind == EXPR_INITIALIZER)
+        {
+            initializer_lower(element, base, index);
+            continue;
+        }
+
+        struct ir_instr *i = emit(IR_STORE_ELEMENT);
+
+        i->a = base;
+        i->b = ir_constant(IR_INTEGER, (*index)++);
+        i->c = expr_lower(element);
+    }
+}
+
+static void local_lower(struct decl *d)
+{
+    bool array = d->type->kind == TYPE_ARRAY;
+    ir_type_t type = ir_type_of(d->type);
+
+    d->symbol->which = ir_slot_create(function, d->name, d->symbol, type, type_cells(d->type), array);
+
+    struct ir_value location = symbol_location(d->symbol);
+
+    if (array)
+    {
+        if (d->value)
+        {
+            int index = 0;
+            initializer_lower(d->value, emit_unary(IR_ADDRESS_OF, IR_ADDRESS, location), &index);
+        }
+
+        return;
+    }
+
+    // Scalars without an initializer start out zeroed, the same as globals
+    emit_store(location, d->value ? expr_lower(d->value) : ir_constant(type, 0));
+}
+
+static void function_lower(struct decl *d)
+{
+    ir_type_t return_type = ir_type_of(d->type->subtype);
+
+    function = ir_function_create(program, d->name, return_type);
+    function->param_count = param_list_count(d->type->params);
+    current = ir_block_create(function);
+
+    // Parameters are copied out of their registers into slots of their own,
+    // so they can be treated the same as any other local
+    for (int i = 0; i < function->param_count; i++)
+    {
+        struct param *p = &d->type->params->items[i];
+        ir_type_t type = ir_type_of(p->type);
+
+        p->symbol->which = ir_slot_create(function, p->name, p->symbol, type, 1, false);
+
+        struct ir_value value = emit_unary(IR_PARAM, type, ir_constant(IR_INTEGER, i));
+        emit_store(symbol_location(p->symbol), value);
+    }
+
+    stmt_lower(d->code);
+
+    // Falling off the end of a function returns
+    if (!ir_is_terminator(current->last))
+        emit(IR_RETURN)->a = return_type == IR_VOID ? ir_none() : ir_constant(return_type, 0);
+
+    ir_function_link(function);
+    function = NULL;
+}
+
+void decl_lower(struct decl *d)
+{
+    for (; d; d = d->next)
+    {
+        if (d->type->kind == TYPE_FUNCTION)
+        {
+            // Prototypes have no code to lower
+            if (d->code)
+                function_lower(d);
+        }
+        else if (d->symbol->kind != SYMBOL_GLOBAL)
+        {
+            local_lower(d);
+        }
+    }
+}
+
+struct ir_program *ast_lower(struct decl *ast)
+{
+    program = ir_program_create(ast);
+    decl_lower(ast);
+
+    return program;
+}
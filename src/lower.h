@@ -0,0 +1,18 @@
+#ifndef LOWER_H
+#define LOWER_H
+
+#include "ir.h"
+
+struct decl;
+struct expr;
+struct stmt;
+struct type;
+
+ir_type_t ir_type_of(struct type *t);
+
+struct ir_program *ast_lower(struct decl *ast);
+void decl_lower(struct decl *d);
+void stmt_lower(struct stmt *s);
+struct ir_value expr_lower(struct expr *e);
+
+#endif
@@ -4,7 +4,13 @@
 #include <string.h>
 
 #include "arg.h"
+#include "callgraph.h"
+#include "codegen.h"
+#include "fold.h"
 #include "graph.h"
+#include "ir.h"
+#include "lower.h"
+#include "optimize.h"
 #include "print.h"
 #include "resolve.h"
 #include "scope.h"
@@ -29,10 +35,10 @@ int main(int argc, char *argv[])
 {
     parse_input_arguments(argc, argv);
 
-    yyin = fopen(argv[2], "r");
+    yyin = fopen(input_arguments.input_file, "r");
     if (!yyin)
     {
-        printf("ERROR: Could not open file %s\n", argv[2]);
+        printf("ERROR: Could not open file %s\n", input_arguments.input_file);
         return 1;
     }
 
@@ -101,5 +107,40 @@ int main(int argc, char *argv[])
     if (input_arguments.typecheck)
         return !typecheck_succeeded;
 
+    // Fold constant expressions and propagate constant locals now that the
+    // program is known to be well typed
+    ast_fold(parser_result);
+
+    if (input_arguments.codegen || input_arguments.emit_ir)
+    {
+        // Only functions reachable from the program's entry points get code
+        parser_result = ast_prune(parser_result);
+
+        codegen_output = stdout;
+
+        if (input_arguments.output_file)
+        {
+            codegen_output = fopen(input_arguments.output_file, "w");
+            if (!codegen_output)
+            {
+                printf("ERROR: Could not open output file %s\n", input_arguments.output_file);
+                return 1;
+            }
+        }
+
+        // Functions are lowered to IR, which is either dumped for inspection or
+        // turned into assembly
+        struct ir_program *program = ast_lower(parser_result);
+        ir_optimize(program, input_arguments.optimize);
+
+        if (input_arguments.emit_ir)
+            ir_program_print(codegen_output, program);
+        else
+            ir_codegen(program);
+
+        ir_program_delete(program);
+        fclose(codegen_output);
+    }
+
     return 0;
 }
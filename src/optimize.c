@@ -0,0 +1,58 @@
+#include "optimize.h"
+
+#include "arg.h"
+#include "bounds.h"
+#include "dce.h"
+#include "gvn.h"
+#include "induction.h"
+#include "inline.h"
+#include "ir.h"
+#include "layout.h"
+#include "licm.h"
+#include "sccp.h"
+#include "ssa.h"
+#include "tailcall.h"
+
+// At -O0 functions are emitted exactly as they were lowered, with every
+// variable kept in memory. From -O1 on, counted loops arrive already vectorized
+// or unrolled by lowering, functions calling themselves in tail position are
+// turned into loops, and small functions are then inlined into their callers.
+// Scalar locals become SSA values next, and constants are propagated through
+// them, including arguments passed to inlined calls. Computations and loads
+// repeating an earlier one are replaced by its result before ranges are
+// analyzed, so the same index is seen as the same value, and the offsets
+// unrolled copies add to their counter are combined. Array bounds checks that
+// can be proven to pass are removed while indices are still written in terms of
+// loop counters. Code that doesn't change inside a loop is then moved out of
+// it, and what is computed from the loop's counter is stepped along with it
+// instead. Whatever that leaves unused is removed, and the blocks left are
+// laid out so the paths guessed likely fall through and cold ones come last.
+void ir_optimize(struct ir_program *p, int level)
+{
+    p->level = level;
+
+    if (level >= 1)
+    {
+        for (struct ir_function *f = p->functions; f; f = f->next)
+            ir_function_tail_recursion(f, input_arguments.opt_info);
+
+        ir_program_inline(p, input_arguments.inline_limit, input_arguments.opt_info);
+    }
+
+    for (struct ir_function *f = p->functions; f; f = f->next)
+    {
+        if (level < 1)
+            continue;
+
+        ir_function_mem2reg(f);
+        ir_function_sccp(f);
+        ir_function_gvn(f, input_arguments.opt_info);
+        ir_function_bounds_eliminate(f, input_arguments.opt_info);
+        ir_function_licm(f, input_arguments.opt_info);
+        ir_function_strength_reduce(f, input_arguments.opt_info);
+        ir_function_dce(f, input_arguments.verbose);
+
+        if (input_arguments.reorder_blocks)
+            ir_function_layout(f, input_arguments.opt_info);
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+struct ir_program;
+
+// Runs the IR passes enabled at the given optimization level over every
+// function in the program
+void ir_optimize(struct ir_program *p, int level);
+
+#endif
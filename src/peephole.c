@@ -0,0 +1,661 @@
+#include "peephole.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The peephole optimizer works on each function's instructions after they
+// have all been generated and before any are written out. A table of patterns
+// is tried at every instruction, and the passes repeat until none apply,
+// since one rewrite often exposes another. Each pattern only looks at a
+// bounded window of instructions, which keeps the pass linear in the size of
+// the function.
+//
+// Operands are the strings the emitter produced, so the patterns match
+// registers and frame cells by name. Flags are never live across a label or
+// a jump in generated code, which lets patterns that change the flags check
+// only the straight-line code that follows them.
+
+// ======
+// Stream
+// ======
+
+static struct asm_instr *asm_add(struct asm_stream *s)
+{
+    if (s->count == s->capacity)
+    {
+        s->capacity = s->capacity ? s->capacity * 2 : 64;
+        s->instrs = realloc(s->instrs, sizeof(struct asm_instr) * s->capacity);
+    }
+
+    struct asm_instr *a = &s->instrs[s->count++];
+    memset(a, 0, sizeof(struct asm_instr));
+
+    return a;
+}
+
+void asm_append(struct asm_stream *s, const char *command, const char *operand_1, const char *operand_2,
+                const char *operand_3)
+{
+    struct asm_instr *a = asm_add(s);
+    const char *operands[3] = {operand_1, operand_2, operand_3};
+
+    a->command = command;
+
+    for (int n = 0; n < 3 && operands[n]; n++)
+        a->operands[a->operand_count++] = operands[n];
+}
+
+void asm_append_label(struct asm_stream *s, const char *label)
+{
+    asm_add(s)->label = label;
+}
+
+void asm_stream_write(struct asm_stream *s, FILE *output)
+{
+    for (int i = 0; i < s->count; i++)
+    {
+        struct asm_instr *a = &s->instrs[i];
+
+        if (a->label)
+        {
+            fprintf(output, "%s:\n", a->label);
+            continue;
+        }
+
+        if (!a->command)
+            continue;
+
+        fprintf(output, "\t%s", a->command);
+
+        for (int n = 0; n < a->operand_count; n++)
+            fprintf(output, n == 0 ? "\t%s" : ", %s", a->operands[n]);
+
+        fprintf(output, "\n");
+    }
+
+    s->count = 0;
+}
+
+// =======
+// Helpers
+// =======
+
+// Removed instructions are left with neither a label nor a command until the
+// stream is compacted
+static void asm_remove(struct asm_instr *a)
+{
+    a->label = NULL;
+    a->command = NULL;
+}
+
+static bool asm_is_removed(struct asm_instr *a)
+{
+    return !a->label && !a->command;
+}
+
+// The next instruction after i that hasn't been removed, or -1
+static int asm_next(struct asm_stream *s, int i)
+{
+    for (i++; i < s->count; i++)
+    {
+        if (!asm_is_removed(&s->instrs[i]))
+            return i;
+    }
+
+    return -1;
+}
+
+static bool is_command(struct asm_instr *a, const char *command)
+{
+    return a->command && strcmp(a->command, command) == 0;
+}
+
+static bool is_register(const char *operand)
+{
+    return operand[0] == '%';
+}
+
+static bool is_jump(struct asm_instr *a)
+{
+    return a->command && a->command[0] == 'j';
+}
+
+// The sizes of general purpose registers the emitter names, each with its
+// full 64 bit register and its lower 32 bits
+static const char *register_sizes[][3] = {
+    {"%rax", "%eax", "%al"}, {"%rbx", "%ebx", "%bl"},   {"%rcx", "%ecx", "%cl"},    {"%rdx", "%edx", "%dl"},
+    {"%rsi", "%esi", NULL},  {"%rdi", "%edi", NULL},    {"%r8", "%r8d", NULL},     {"%r9", "%r9d", NULL},
+    {"%r10", "%r10d", NULL}, {"%r11", "%r11d", NULL},   {"%r12", "%r12d", NULL},   {"%r13", "%r13d", NULL},
+    {"%r14", "%r14d", NULL}, {"%r15", "%r15d", NULL},   {"%rbp", "%ebp", NULL},    {"%rsp", "%esp", NULL},
+};
+
+#define REGISTER_SIZE_COUNT ((int)(sizeof(register_sizes) / sizeof(register_sizes[0])))
+
+// The full register a register operand is part of
+static const char *register_full(const char *operand)
+{
+    for (int r = 0; r < REGISTER_SIZE_COUNT; r++)
+    {
+        for (int size = 0; size < 3; size++)
+        {
+            if (register_sizes[r][size] && strcmp(register_sizes[r][size], operand) == 0)
+                return register_sizes[r][0];
+        }
+    }
+
+    return operand;
+}
+
+static const char *register_32(const char *operand)
+{
+    for (int r = 0; r < REGISTER_SIZE_COUNT; r++)
+    {
+        if (strcmp(register_sizes[r][0], operand) == 0)
+            return register_sizes[r][1];
+    }
+
+    return NULL;
+}
+
+// Whether an operand reads the given full register, directly or to form an
+// address
+static bool mentions(const char *operand, const char *reg)
+{
+    if (is_register(operand))
+        return strcmp(register_full(operand), reg) == 0;
+
+    return strstr(operand, reg) != NULL;
+}
+
+// Instructions whose last operand is only read
+static bool reads_destination_only(struct asm_instr *a)
+{
+    return is_command(a, "cmp") || is_command(a, "cmpq") || is_command(a, "test") || is_command(a, "push") ||
+           is_command(a, "pushq") || is_jump(a);
+}
+
+// Whether an instruction might change a full register
+static bool writes_register(struct asm_instr *a, const char *reg)
+{
+    if (!a->command || is_command(a, "call"))
+        return true;
+
+    if (is_command(a, "cqo"))
+        return strcmp(reg, "%rdx") == 0;
+
+    // Division and the widening multiply write both halves of %rdx:%rax
+    if (is_command(a, "idiv") || is_command(a, "idivq") || (is_command(a, "imul") && a->operand_count == 1))
+        return strcmp(reg, "%rax") == 0 || strcmp(reg, "%rdx") == 0;
+
+    if (is_command(a, "push") || is_command(a, "pushq") || is_command(a, "ret"))
+        return strcmp(reg, "%rsp") == 0;
+
+    // leave copies %rbp into %rsp and then pops %rbp, and pop moves %rsp as
+    // well as writing its operand
+    if (is_command(a, "leave"))
+        return strcmp(reg, "%rbp") == 0 || strcmp(reg, "%rsp") == 0;
+
+    if ((is_command(a, "pop") || is_command(a, "popq")) && strcmp(reg, "%rsp") == 0)
+        return true;
+
+    if (!a->operand_count || reads_destination_only(a))
+        return false;
+
+    const char *dest = a->operands[a->operand_count - 1];
+
+    return is_register(dest) && strcmp(register_full(dest), reg) == 0;
+}
+
+// Cells of the frame are addressed by a constant offset from %rbp or %rsp,
+// and two such cells are the same only if they are named the same way
+static bool is_frame_cell(const char *operand)
+{
+    size_t length = strlen(operand);
+
+    return !strchr(operand, ',') && length > 6 &&
+           (strcmp(operand + length - 6, "(%rbp)") == 0 || strcmp(operand + length - 6, "(%rsp)") == 0);
+}
+
+// Whether an instruction might change a frame cell. Stores through any other
+// address could be to an array in the frame
+static bool writes_cell(struct asm_instr *a, const char *cell)
+{
+    if (!a->command || is_command(a, "call") || is_command(a, "push") || is_command(a, "pushq"))
+        return true;
+
+    if (!a->operand_count || reads_destination_only(a))
+        return false;
+
+    const char *dest = a->operands[a->operand_count - 1];
+
+    if (is_register(dest))
+        return false;
+
+    return !is_frame_cell(dest) || strcmp(dest, cell) == 0;
+}
+
+static bool sets_flags(struct asm_instr *a)
+{
+    static const char *commands[] = {"cmp", "cmpq", "test", "add", "sub", "imul", "and", "or", "xor", "neg", "shl", "shr", "sar"};
+
+    for (size_t c = 0; c < sizeof(commands) / sizeof(commands[0]); c++)
+    {
+        if (is_command(a, commands[c]))
+            return true;
+    }
+
+    return false;
+}
+
+// Whether the flags left by instruction i are never read. Generated code only
+// reads flags set earlier in the same straight line of code
+static bool flags_dead_after(struct asm_stream *s, int i)
+{
+    for (int j = asm_next(s, i); j >= 0; j = asm_next(s, j))
+    {
+        struct asm_instr *a = &s->instrs[j];
+
+        if (a->label || is_command(a, "jmp") || is_command(a, "ret") || is_command(a, "call"))
+            return true;
+
+        if (is_jump(a) || strncmp(a->command, "set", 3) == 0 || strncmp(a->command, "cmov", 4) == 0)
+            return false;
+
+        if (sets_flags(a))
+            return true;
+    }
+
+    return true;
+}
+
+static const char *condition_inverse(const char *condition)
+{
+    static const char *pairs[][2] = {{"e", "ne"}, {"l", "ge"}, {"g", "le"}};
+
+    for (int p = 0; p < 3; p++)
+    {
+        if (strcmp(condition, pairs[p][0]) == 0)
+            return pairs[p][1];
+        if (strcmp(condition, pairs[p][1]) == 0)
+            return pairs[p][0];
+    }
+
+    return NULL;
+}
+
+static const char *jump_command(const char *condition)
+{
+    char *command = malloc(strlen(condition) + 2);
+
+    sprintf(command, "j%s", condition);
+
+    return command;
+}
+
+// ========
+// Patterns
+// ========
+
+// A copy of a register or cell to itself
+static bool self_move(struct asm_stream *s, int i, int window)
+{
+    struct asm_instr *a = &s->instrs[i];
+    (void)window;
+
+    if (!is_command(a, "mov") || strcmp(a->operands[0], a->operands[1]) != 0)
+        return false;
+
+    asm_remove(a);
+    return true;
+}
+
+// Copying a register back from the one it was just copied to changes nothing,
+// as long as neither has been written in between
+static bool copy_back(struct asm_stream *s, int i, int window)
+{
+    struct asm_instr *a = &s->instrs[i];
+
+    if (!is_command(a, "mov") || !is_register(a->operands[0]) || !is_register(a->operands[1]))
+        return false;
+
+    const char *from = a->operands[0];
+    const char *to = a->operands[1];
+
+    // Copies of only part of a register leave the rest of it behind
+    if (strcmp(register_full(from), from) != 0 || strcmp(register_full(to), to) != 0)
+        return false;
+
+    int seen = 1;
+
+    for (int j = asm_next(s, i); j >= 0 && seen < window; j = asm_next(s, j), seen++)
+    {
+        struct asm_instr *b = &s->instrs[j];
+
+        if (b->label || is_jump(b) || is_command(b, "ret"))
+            return false;
+
+        if (is_command(b, "mov") && strcmp(b->operands[0], to) == 0 && strcmp(b->operands[1], from) == 0)
+        {
+            asm_remove(b);
+            return true;
+        }
+
+        if (writes_register(b, from) || writes_register(b, to))
+            return false;
+    }
+
+    return false;
+}
+
+// Zeroing a register with xor is shorter than moving in an immediate zero,
+// but it changes the flags
+static bool zero_xor(struct asm_stream *s, int i, int window)
+{
+    struct asm_instr *a = &s->instrs[i];
+    (void)window;
+
+    if (!is_command(a, "mov") || strcmp(a->operands[0], "$0") != 0 || !register_32(a->operands[1]) ||
+        !flags_dead_after(s, i))
+        return false;
+
+    a->command = "xor";
+    a->operands[0] = a->operands[1] = register_32(a->operands[1]);
+    return true;
+}
+
+// Multiplying by a power of two is a shift
+static bool multiply_shift(struct asm_stream *s, int i, int window)
+{
+    struct asm_instr *a = &s->instrs[i];
+    (void)window;
+
+    if (!is_command(a, "imul") || a->operand_count != 2 || a->operands[0][0] != '$' || !flags_dead_after(s, i))
+        return false;
+
+    long factor = strtol(a->operands[0] + 1, NULL, 10);
+
+    if (factor <= 0 || factor & (factor - 1))
+        return false;
+
+    if (factor == 1)
+    {
+        asm_remove(a);
+        return true;
+    }
+
+    char *shift = malloc(8);
+    sprintf(shift, "$%d", __builtin_ctzl(factor));
+
+    a->command = "shl";
+    a->operands[0] = shift;
+    return true;
+}
+
+// A boolean computed with setcc and then tested by a branch can be branched on
+// straight from the comparison's flags, which the copies in between don't
+// change. The boolean itself is still kept, in case anything else reads it
+static bool setcc_branch(struct asm_stream *s, int i, int window)
+{
+    struct asm_instr *a = &s->instrs[i];
+
+    if (!a->command || strncmp(a->command, "set", 3) != 0 || strcmp(a->operands[0], "%al") != 0)
+        return false;
+
+    // Follow the value through the copies made of it, from %al into %rax
+    // and then wherever else it is moved
+    const char *holders[8] = {"%rax"};
+    int holder_count = 1;
+    int seen = 1;
+    int j = asm_next(s, i);
+
+    if (j < 0 || !is_command(&s->instrs[j], "movzbq") || strcmp(s->instrs[j].operands[1], "%rax") != 0)
+        return false;
+
+    for (j = asm_next(s, j), seen++; j >= 0 && seen < window; j = asm_next(s, j), seen++)
+    {
+        struct asm_instr *b = &s->instrs[j];
+
+        if (!is_command(b, "mov"))
+            break;
+
+        bool from_holder = false;
+
+        for (int h = 0; h < holder_count; h++)
+        {
+            if (strcmp(holders[h], b->operands[0]) == 0)
+                from_holder = true;
+
+            // Overwriting a holder with anything else loses the value there
+            if (strcmp(holders[h], b->operands[1]) == 0)
+                holders[h] = "";
+        }
+
+        if (from_holder && holder_count < 8)
+            holders[holder_count++] = b->operands[1];
+    }
+
+    if (j < 0 || seen >= window)
+        return false;
+
+    struct asm_instr *test = &s->instrs[j];
+    const char *tested = NULL;
+
+    if (is_command(test, "test") && strcmp(test->operands[0], test->operands[1]) == 0)
+        tested = test->operands[0];
+    else if (is_command(test, "cmpq") && strcmp(test->operands[0], "$0") == 0)
+        tested = test->operands[1];
+
+    int k = asm_next(s, j);
+
+    if (!tested || k < 0)
+        return false;
+
+    struct asm_instr *branch = &s->instrs[k];
+    bool jump_if_true = is_command(branch, "jne");
+
+    if (!jump_if_true && !is_command(branch, "je"))
+        return false;
+
+    for (int h = 0; h < holder_count; h++)
+    {
+        if (strcmp(holders[h], tested) != 0)
+            continue;
+
+        const char *condition = a->command + 3;
+
+        branch->command = jump_command(jump_if_true ? condition : condition_inverse(condition));
+        asm_remove(test);
+        return true;
+    }
+
+    return false;
+}
+
+// A register stored to or loaded from a frame cell still holds the cell's
+// value a few instructions later, unless either has been written since, so
+// reloading the cell can become a register copy or go away entirely
+static bool store_reload(struct asm_stream *s, int i, int window)
+{
+    struct asm_instr *a = &s->instrs[i];
+
+    if (!is_command(a, "mov"))
+        return false;
+
+    const char *reg = a->operands[0];
+    const char *cell = a->operands[1];
+
+    if (!is_register(cell))
+    {
+        if (!is_register(reg) || !is_frame_cell(cell))
+            return false;
+    }
+    else
+    {
+        reg = a->operands[1];
+        cell = a->operands[0];
+
+        if (!is_frame_cell(cell))
+            return false;
+    }
+
+    reg = register_full(reg);
+
+    // The cell's address must not depend on the register
+    if (mentions(cell, reg))
+        return false;
+
+    const char *base = strstr(cell, "(%rsp)") ? "%rsp" : "%rbp";
+    int seen = 1;
+
+    for (int j = asm_next(s, i); j >= 0 && seen < window; j = asm_next(s, j), seen++)
+    {
+        struct asm_instr *b = &s->instrs[j];
+
+        if (b->label || is_jump(b) || is_command(b, "ret"))
+            return false;
+
+        if (is_command(b, "mov") && strcmp(b->operands[0], cell) == 0 && is_register(b->operands[1]))
+        {
+            if (strcmp(register_full(b->operands[1]), reg) == 0)
+                asm_remove(b);
+            else
+                b->operands[0] = reg;
+
+            return true;
+        }
+
+        if (writes_register(b, reg) || writes_cell(b, cell) || writes_register(b, base))
+            return false;
+    }
+
+    return false;
+}
+
+// A jump to the very next instruction
+static bool jump_next(struct asm_stream *s, int i, int window)
+{
+    struct asm_instr *a = &s->instrs[i];
+    (void)window;
+
+    if (!is_command(a, "jmp"))
+        return false;
+
+    for (int j = asm_next(s, i); j >= 0 && s->instrs[j].label; j = asm_next(s, j))
+    {
+        if (strcmp(s->instrs[j].label, a->operands[0]) == 0)
+        {
+            asm_remove(a);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// =============
+// Pattern table
+// =============
+
+struct peephole_pattern
+{
+    const char *name;
+
+    // How many instructions the pattern needs to see at once
+    int length;
+
+    // Tries to rewrite the instructions starting at i, returning whether it
+    // did. Patterns that look ahead don't go further than window
+    bool (*apply)(struct asm_stream *s, int i, int window);
+
+    int hits;
+};
+
+static struct peephole_pattern patterns[] = {
+    {"self-move", 1, self_move, 0},
+    {"copy-back", 2, copy_back, 0},
+    {"zero-xor", 1, zero_xor, 0},
+    {"multiply-shift", 1, multiply_shift, 0},
+    {"setcc-branch", 5, setcc_branch, 0},
+    {"store-reload", 2, store_reload, 0},
+    {"jump-next", 2, jump_next, 0},
+};
+
+#define PATTERN_COUNT ((int)(sizeof(patterns) / sizeof(patterns[0])))
+
+// Labels no jump refers to only get in the way of the patterns
+static int label_compare(const void *a, const void *b)
+{
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static void labels_remove_unused(struct asm_stream *s)
+{
+    const char **targets = malloc(sizeof(const char *) * (s->count + 1));
+    int target_count = 0;
+
+    for (int i = 0; i < s->count; i++)
+    {
+        if (is_jump(&s->instrs[i]))
+            targets[target_count++] = s->instrs[i].operands[0];
+    }
+
+    qsort(targets, target_count, sizeof(const char *), label_compare);
+
+    for (int i = 0; i < s->count; i++)
+    {
+        const char *label = s->instrs[i].label;
+
+        if (label && !bsearch(&label, targets, target_count, sizeof(const char *), label_compare))
+            asm_remove(&s->instrs[i]);
+    }
+
+    free(targets);
+}
+
+static void asm_compact(struct asm_stream *s)
+{
+    int kept = 0;
+
+    for (int i = 0; i < s->count; i++)
+    {
+        if (!asm_is_removed(&s->instrs[i]))
+            s->instrs[kept++] = s->instrs[i];
+    }
+
+    s->count = kept;
+}
+
+void peephole_optimize(struct asm_stream *s, int window)
+{
+    bool changed = true;
+
+    while (changed)
+    {
+        changed = false;
+
+        labels_remove_unused(s);
+
+        for (int i = 0; i < s->count; i++)
+        {
+            for (int p = 0; p < PATTERN_COUNT && !asm_is_removed(&s->instrs[i]); p++)
+            {
+                if (patterns[p].length > window || !patterns[p].apply(s, i, window))
+                    continue;
+
+                patterns[p].hits++;
+                changed = true;
+            }
+        }
+
+        asm_compact(s);
+    }
+}
+
+void peephole_print_statistics(FILE *output)
+{
+    for (int p = 0; p < PATTERN_COUNT; p++)
+        fprintf(output, "Peephole pattern '%s' applied %d time%s\n", patterns[p].name, patterns[p].hits,
+                patterns[p].hits == 1 ? "" : "s");
+}
@@ -0,0 +1,40 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// One line of assembly in a function body, kept structured until the whole
+// function has been generated so it can be improved before being written out
+struct asm_instr
+{
+    // Labels have a name and no command
+    const char *label;
+
+    const char *command;
+    const char *operands[3];
+    int operand_count;
+};
+
+struct asm_stream
+{
+    struct asm_instr *instrs;
+    int count;
+    int capacity;
+};
+
+void asm_append(struct asm_stream *s, const char *command, const char *operand_1, const char *operand_2,
+                const char *operand_3);
+void asm_append_label(struct asm_stream *s, const char *label);
+
+// Writes out the stream and empties it
+void asm_stream_write(struct asm_stream *s, FILE *output);
+
+// Rewrites naive instruction sequences in the stream into better ones. No
+// pattern looks at more than window instructions at once
+void peephole_optimize(struct asm_stream *s, int window);
+
+// Prints how many times each pattern was applied over the whole program
+void peephole_print_statistics(FILE *output);
+
+#endif
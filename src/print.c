@@ -45,7 +45,12 @@ void expr_print(struct expr *e)
     case EXPR_CALL:
         expr_print(e->left);
         printf("(");
-        expr_print(e->right);
+        for (int i = 0; i < e->arg_count; i++)
+        {
+            if (i > 0)
+                printf(", ");
+            expr_print(e->args[i]);
+        }
         printf(")");
         break;
     case EXPR_INC:
@@ -334,15 +339,12 @@ void type_print(struct type *t)
 
 void param_list_print(struct param_list *p)
 {
-    if (!p)
-        return;
-
-    printf("%s: ", p->name);
-    type_print(p->type);
-
-    if (p->next)
+    for (int i = 0; i < param_list_count(p); i++)
     {
-        printf(", ");
-        param_list_print(p->next);
+        if (i > 0)
+            printf(", ");
+
+        printf("%s: ", p->items[i].name);
+        type_print(p->items[i].type);
     }
 }
@@ -0,0 +1,1230 @@
+#include "regalloc.h"
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dominance.h"
+#include "ir.h"
+#include "liveness.h"
+
+const char *register_names[] = {
+#define X(r, name, callee_saved) name,
+    REGISTERS
+#undef X
+};
+
+const bool register_callee_saved[] = {
+#define X(r, name, callee_saved) callee_saved,
+    REGISTERS
+#undef X
+};
+
+bool ir_instr_is_call(struct ir_instr *i)
+{
+    return i->op == IR_CALL;
+}
+
+// ==================
+// Interval building
+// ==================
+
+static void interval_cover(struct interval *in, int position)
+{
+    if (in->start < 0 || position < in->start)
+        in->start = position;
+
+    if (position > in->end)
+        in->end = position;
+}
+
+static int interval_compare(const void *a, const void *b)
+{
+    const struct interval *x = a;
+    const struct interval *y = b;
+
+    if (x->start != y->start)
+        return x->start - y->start;
+
+    return x->temp - y->temp;
+}
+
+// The index of the first call after position
+static int calls_after(int *call_positions, int calls, int position)
+{
+    int low = 0;
+    int high = calls;
+
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+
+        if (call_positions[middle] <= position)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return low;
+}
+
+struct interval *ir_function_intervals(struct ir_function *f, int *count)
+{
+    struct interval *intervals = malloc(sizeof(struct interval) * (f->temp_count ? f->temp_count : 1));
+
+    for (int t = 0; t < f->temp_count; t++)
+    {
+        intervals[t].temp = t;
+        intervals[t].start = -1;
+        intervals[t].end = -1;
+        intervals[t].calls = 0;
+        intervals[t].uses = 0;
+    }
+
+    // Instructions are numbered in steps of two from two, leaving room before
+    // the first one for the parameters to arrive
+    int position = 0;
+    int calls = 0;
+    int params_end = 0;
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            i->number = position += 2;
+
+            if (ir_instr_is_call(i))
+                calls++;
+
+            if (i->op == IR_PARAM)
+                params_end = i->number + 1;
+        }
+    }
+
+    int *call_positions = malloc(sizeof(int) * (calls ? calls : 1));
+    calls = 0;
+
+    struct liveness *l = ir_function_liveness(f);
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            if (ir_instr_is_call(i))
+                call_positions[calls++] = i->number;
+
+            for (int n = 0; n < ir_operand_count(i); n++)
+            {
+                struct ir_value *v = ir_operand(i, n);
+
+                if (v->kind == IR_VALUE_TEMP)
+                {
+                    interval_cover(&intervals[v->number], i->number);
+                    intervals[v->number].uses++;
+                }
+            }
+
+            if (i->dest.kind != IR_VALUE_TEMP)
+                continue;
+
+            intervals[i->dest.number].uses++;
+
+            // Parameters all arrive together on entry, so they are live at
+            // once until the last of them has been taken
+            if (i->op == IR_PARAM)
+            {
+                interval_cover(&intervals[i->dest.number], 0);
+                interval_cover(&intervals[i->dest.number], params_end);
+            }
+
+            interval_cover(&intervals[i->dest.number], i->number);
+        }
+
+        // Anything live across a block boundary is live for the whole of the
+        // block on that side. Intervals have no holes, so this also covers
+        // every block between
+        if (!b->first)
+            continue;
+
+        uint64_t *in = liveness_in_set(l, b);
+        uint64_t *out = liveness_out_set(l, b);
+
+        for (int w = 0; w < l->words; w++)
+        {
+            for (uint64_t set = in[w]; set; set &= set - 1)
+                interval_cover(&intervals[w * 64 + __builtin_ctzll(set)], b->first->number);
+
+            for (uint64_t set = out[w]; set; set &= set - 1)
+                interval_cover(&intervals[w * 64 + __builtin_ctzll(set)], b->last->number);
+        }
+    }
+
+    liveness_delete(l);
+
+    // Keep only the temporaries that appear, sorted by where they start
+    int kept = 0;
+
+    for (int t = 0; t < f->temp_count; t++)
+    {
+        if (intervals[t].start >= 0)
+            intervals[kept++] = intervals[t];
+    }
+
+    qsort(intervals, kept, sizeof(struct interval), interval_compare);
+
+    // A call crosses an interval if it falls strictly inside it. The calls
+    // are already in order, so the first and last are found with binary
+    // searches
+    for (int n = 0; n < kept; n++)
+    {
+        int first = calls_after(call_positions, calls, intervals[n].start);
+        int last = calls_after(call_positions, calls, intervals[n].end - 1);
+
+        intervals[n].calls = last - first;
+    }
+
+    free(call_positions);
+
+    *count = kept;
+    return intervals;
+}
+
+// ===========
+// Linear scan
+// ===========
+
+// Poletto and Sarkar's linear scan. Intervals are visited in order of their
+// start, and each takes a register freed by an interval that has ended. When
+// none is free, whichever of the competing intervals ends last is spilled to
+// memory, since it would hold its register the longest.
+//
+// A temporary copied to or from one already given a register is first offered
+// that register, which turns the copy into nothing. Intervals have no holes,
+// so one left by a loop's phi, live around the back edge, covers the whole
+// loop. Liveness itself decides whether the two are ever live at once, and
+// when they aren't, they share the register even while the interval holding
+// it hasn't ended.
+
+// The copies between temporaries, each once from either end
+struct copy_hint
+{
+    int temp;
+    int partner;
+};
+
+static struct copy_hint *hints = NULL;
+static int hint_count = 0;
+
+static void hints_find(struct ir_function *f)
+{
+    hint_count = 0;
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            if (i->op != IR_COPY || i->dest.kind != IR_VALUE_TEMP || i->a.kind != IR_VALUE_TEMP)
+                continue;
+
+            hints = realloc(hints, sizeof(struct copy_hint) * (hint_count + 2));
+            hints[hint_count++] = (struct copy_hint){i->dest.number, i->a.number};
+            hints[hint_count++] = (struct copy_hint){i->a.number, i->dest.number};
+        }
+    }
+}
+
+static bool is_live(uint64_t *live, int temp)
+{
+    return live[temp / 64] >> (temp % 64) & 1;
+}
+
+// Whether one of the temporaries is defined while the other is live, other
+// than by copying it, which is when they would need registers of their own
+static bool temps_interfere(struct ir_function *f, struct liveness *l, uint64_t *live, int x, int y)
+{
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        memcpy(live, liveness_out_set(l, b), sizeof(uint64_t) * l->words);
+
+        for (struct ir_instr *i = b->last; i; i = i->prev)
+        {
+            if (i->dest.kind == IR_VALUE_TEMP)
+            {
+                int d = i->dest.number;
+                int other = d == x ? y : d == y ? x : -1;
+                bool copied = i->op == IR_COPY && i->a.kind == IR_VALUE_TEMP && i->a.number == other;
+
+                if (other >= 0 && !copied && is_live(live, other))
+                    return true;
+
+                live[d / 64] &= ~((uint64_t)1 << (d % 64));
+            }
+
+            for (int n = 0; n < ir_operand_count(i); n++)
+            {
+                struct ir_value *v = ir_operand(i, n);
+
+                if (v->kind == IR_VALUE_TEMP)
+                    live[v->number / 64] |= (uint64_t)1 << (v->number % 64);
+            }
+        }
+    }
+
+    return false;
+}
+
+// Intervals crossing calls want a callee-saved register, while the rest
+// prefer the caller-saved ones that cost nothing to use
+static bool register_allowed(struct interval *in, int r)
+{
+    return !in->calls || register_callee_saved[r];
+}
+
+// Once the callee-saved registers run out, a caller-saved register can still
+// hold a value across calls if the emitter saves it to the frame around each
+// one. That costs a store and a load per call, so it is only worth it when
+// the value is used more often than it would be saved and restored
+static bool register_allowed_saved(struct interval *in, int r)
+{
+    return register_allowed(in, r) || 2 * in->calls <= in->uses;
+}
+
+// The register a copy partner of the interval holds, when the interval can
+// share it with every other interval still in it
+static int hint_register(struct ir_function *f, struct liveness *l, uint64_t *live, struct interval *current,
+                         struct interval **sharing, int *sharing_count, int count)
+{
+    for (int h = 0; h < hint_count; h++)
+    {
+        int r = hints[h].temp == current->temp ? f->registers[hints[h].partner] : -1;
+
+        if (r < 0 || !register_allowed_saved(current, r))
+            continue;
+
+        bool shareable = true;
+
+        for (int k = 0; k < sharing_count[r] && shareable; k++)
+        {
+            struct interval *other = sharing[r * count + k];
+
+            if (other->end > current->start && temps_interfere(f, l, live, current->temp, other->temp))
+                shareable = false;
+        }
+
+        if (shareable)
+            return r;
+    }
+
+    return -1;
+}
+
+int ir_function_linear_scan(struct ir_function *f)
+{
+    int count;
+    struct interval *intervals = ir_function_intervals(f, &count);
+    struct liveness *l = ir_function_liveness(f);
+    uint64_t *live = malloc(sizeof(uint64_t) * (l->words ? l->words : 1));
+
+    hints_find(f);
+
+    f->registers = ir_alloc(f, sizeof(int) * (f->temp_count ? f->temp_count : 1));
+
+    for (int t = 0; t < f->temp_count; t++)
+        f->registers[t] = -1;
+
+    // The interval holding each register that ends last, and every interval
+    // sharing it since it was last free
+    struct interval *active[REGISTER_COUNT] = {0};
+    struct interval **sharing = malloc(sizeof(struct interval *) * REGISTER_COUNT * (count ? count : 1));
+    int sharing_count[REGISTER_COUNT] = {0};
+
+    for (int n = 0; n < count; n++)
+    {
+        struct interval *current = &intervals[n];
+
+        // A register can be reused by a value defined where the last value
+        // in it is used for the last time, since instructions read their
+        // operands before writing their result
+        for (int r = 0; r < REGISTER_COUNT; r++)
+        {
+            if (active[r] && active[r]->end <= current->start)
+            {
+                active[r] = NULL;
+                sharing_count[r] = 0;
+            }
+        }
+
+        int chosen = hint_register(f, l, live, current, sharing, sharing_count, count);
+
+        for (int r = 0; r < REGISTER_COUNT && chosen < 0; r++)
+        {
+            if (!active[r] && register_allowed(current, r))
+                chosen = r;
+        }
+
+        for (int r = 0; r < REGISTER_COUNT && chosen < 0; r++)
+        {
+            if (!active[r] && register_allowed_saved(current, r))
+                chosen = r;
+        }
+
+        if (chosen < 0)
+        {
+            int victim = -1;
+
+            for (int r = 0; r < REGISTER_COUNT; r++)
+            {
+                if (register_allowed(current, r) && (victim < 0 || active[r]->end > active[victim]->end))
+                    victim = r;
+            }
+
+            if (victim < 0 || active[victim]->end <= current->end)
+                continue;
+
+            // Everything sharing the register goes to memory with it
+            for (int k = 0; k < sharing_count[victim]; k++)
+            {
+                if (sharing[victim * count + k]->end > current->start)
+                    f->registers[sharing[victim * count + k]->temp] = -1;
+            }
+
+            active[victim] = NULL;
+            sharing_count[victim] = 0;
+            chosen = victim;
+        }
+
+        if (!active[chosen] || active[chosen]->end < current->end)
+            active[chosen] = current;
+
+        sharing[chosen * count + sharing_count[chosen]++] = current;
+        f->registers[current->temp] = chosen;
+    }
+
+    int spilled = 0;
+
+    for (int n = 0; n < count; n++)
+    {
+        if (f->registers[intervals[n].temp] < 0)
+            spilled++;
+    }
+
+    free(intervals);
+    free(sharing);
+    free(live);
+    free(hints);
+    liveness_delete(l);
+    hints = NULL;
+    hint_count = 0;
+
+    return spilled;
+}
+
+// ============================
+// Iterated register coalescing
+// ============================
+
+// George and Appel's iterated register coalescing, which colors an
+// interference graph in the style of Chaitin and Briggs. Nodes with fewer
+// neighbours than there are registers are removed one at a time, since any
+// such node can always be colored once its neighbours are. Copies between
+// temporaries are coalesced whenever the Briggs or George test shows the
+// combined node is still certain to be colorable, and when nothing can be
+// removed or coalesced, a copy is frozen or the cheapest node is chosen to
+// spill. Colors are then given out in the reverse of the removal order.
+//
+// Each register is a precolored node, numbered before the temporaries. A
+// temporary live across a call interferes with every caller-saved register,
+// and arguments and parameters are moves to and from the registers they are
+// passed in, so coalescing them leaves values where the calling convention
+// wants them. Spilled temporaries are left in memory, where the emitter reads
+// them directly, so the graph never has to be rebuilt.
+
+typedef enum
+{
+    NODE_PRECOLORED,
+    NODE_UNUSED,
+    NODE_INITIAL,
+    NODE_SIMPLIFY,
+    NODE_FREEZE,
+    NODE_SPILL,
+    NODE_SELECTED,
+    NODE_COALESCED,
+    NODE_COLORED,
+    NODE_SPILLED,
+} node_state_t;
+
+typedef enum
+{
+    MOVE_WORKLIST,
+    MOVE_ACTIVE,
+    MOVE_COALESCED,
+    MOVE_CONSTRAINED,
+    MOVE_FROZEN,
+} move_state_t;
+
+struct move
+{
+    int dest;
+    int source;
+    move_state_t state;
+};
+
+// A growable list of node or move numbers
+struct list
+{
+    int *items;
+    int count;
+    int capacity;
+};
+
+struct coloring
+{
+    int nodes;
+
+    // The interference graph, as a hash set of edges for testing whether two
+    // nodes interfere and a list of neighbours for each temporary. Registers
+    // have no list, since they are never simplified
+    uint64_t *edges;
+    size_t edge_count;
+    size_t edge_capacity;
+    struct list *adjacent;
+    int *degree;
+
+    node_state_t *state;
+    int *alias;
+    int *color;
+    double *cost;
+
+    struct move *moves;
+    int move_count;
+    int move_capacity;
+    struct list *node_moves;
+
+    // Worklists are stacks that may hold nodes which have since moved on,
+    // which are skipped by checking the state of each node popped
+    struct list simplify;
+    struct list freeze;
+    struct list work_moves;
+    struct list select;
+
+    // Marks nodes already counted by the Briggs test
+    int *stamp;
+    int stamp_current;
+};
+
+static void list_add(struct list *l, int item)
+{
+    if (l->count == l->capacity)
+    {
+        l->capacity = l->capacity ? l->capacity * 2 : 4;
+        l->items = realloc(l->items, sizeof(int) * l->capacity);
+    }
+
+    l->items[l->count++] = item;
+}
+
+static bool is_precolored(int node)
+{
+    return node < REGISTER_COUNT;
+}
+
+// Edges are keyed by both of their nodes, the smaller first, with zero left
+// to mark empty entries
+static uint64_t edge_key(int u, int v)
+{
+    return u < v ? ((uint64_t)u << 32 | (uint64_t)v) + 1 : ((uint64_t)v << 32 | (uint64_t)u) + 1;
+}
+
+static size_t edge_slot(struct coloring *c, uint64_t key)
+{
+    size_t slot = (key * 0x9E3779B97F4A7C15ull >> 32) & (c->edge_capacity - 1);
+
+    while (c->edges[slot] && c->edges[slot] != key)
+        slot = (slot + 1) & (c->edge_capacity - 1);
+
+    return slot;
+}
+
+static bool edge_test(struct coloring *c, int u, int v)
+{
+    return c->edges[edge_slot(c, edge_key(u, v))] != 0;
+}
+
+static void edge_insert(struct coloring *c, uint64_t key)
+{
+    // Keep the table at most half full
+    if (2 * (c->edge_count + 1) > c->edge_capacity)
+    {
+        uint64_t *old = c->edges;
+        size_t old_capacity = c->edge_capacity;
+
+        c->edge_capacity *= 2;
+        c->edges = calloc(c->edge_capacity, sizeof(uint64_t));
+
+        for (size_t i = 0; i < old_capacity; i++)
+        {
+            if (old[i])
+                c->edges[edge_slot(c, old[i])] = old[i];
+        }
+
+        free(old);
+    }
+
+    c->edges[edge_slot(c, key)] = key;
+    c->edge_count++;
+}
+
+static void edge_add(struct coloring *c, int u, int v)
+{
+    if (u == v || edge_test(c, u, v))
+        return;
+
+    edge_insert(c, edge_key(u, v));
+
+    if (!is_precolored(u))
+    {
+        list_add(&c->adjacent[u], v);
+        c->degree[u]++;
+    }
+
+    if (!is_precolored(v))
+    {
+        list_add(&c->adjacent[v], u);
+        c->degree[v]++;
+    }
+}
+
+static void move_add(struct coloring *c, int dest, int source)
+{
+    if (c->move_count == c->move_capacity)
+    {
+        c->move_capacity = c->move_capacity ? c->move_capacity * 2 : 16;
+        c->moves = realloc(c->moves, sizeof(struct move) * c->move_capacity);
+    }
+
+    c->moves[c->move_count] = (struct move){dest, source, MOVE_WORKLIST};
+
+    list_add(&c->node_moves[dest], c->move_count);
+    list_add(&c->node_moves[source], c->move_count);
+    list_add(&c->work_moves, c->move_count);
+
+    c->move_count++;
+}
+
+// The register each of the first six arguments is passed in, or -1 for %rdx,
+// which is kept out of allocation
+static int argument_register(int n)
+{
+    static const int registers[] = {REGISTER_RDI, REGISTER_RSI, -1, REGISTER_RCX, REGISTER_R8, REGISTER_R9};
+
+    return n < 6 ? registers[n] : -1;
+}
+
+static int temp_node(int temp)
+{
+    return REGISTER_COUNT + temp;
+}
+
+// How much a temporary is worth keeping in a register, counting every
+// definition and use weighted by the depth of the loop it happens in
+static double loop_weight(struct ir_block *b)
+{
+    double weight = 1;
+
+    for (int d = 0; d < b->loop_depth && d < 8; d++)
+        weight *= 10;
+
+    return weight;
+}
+
+// ==================
+// Building the graph
+// ==================
+
+static void coloring_build(struct coloring *c, struct ir_function *f)
+{
+    struct liveness *l = ir_function_liveness(f);
+    uint64_t *live = malloc(sizeof(uint64_t) * (l->words ? l->words : 1));
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        double weight = loop_weight(b);
+
+        memcpy(live, liveness_out_set(l, b), sizeof(uint64_t) * l->words);
+
+        for (struct ir_instr *i = b->last; i; i = i->prev)
+        {
+            int dest = i->dest.kind == IR_VALUE_TEMP ? i->dest.number : -1;
+
+            // A copy doesn't make its source and destination interfere, since
+            // they hold the same value
+            if (i->op == IR_COPY && dest >= 0 && i->a.kind == IR_VALUE_TEMP)
+            {
+                live[i->a.number / 64] &= ~((uint64_t)1 << (i->a.number % 64));
+                move_add(c, temp_node(dest), temp_node(i->a.number));
+            }
+
+            if (dest >= 0)
+            {
+                c->state[temp_node(dest)] = NODE_INITIAL;
+                c->cost[temp_node(dest)] += weight;
+
+                for (int w = 0; w < l->words; w++)
+                {
+                    for (uint64_t set = live[w]; set; set &= set - 1)
+                        edge_add(c, temp_node(dest), temp_node(w * 64 + __builtin_ctzll(set)));
+                }
+
+                live[dest / 64] &= ~((uint64_t)1 << (dest % 64));
+            }
+
+            if (ir_instr_is_call(i))
+            {
+                // Whatever is still live once the call returns has to survive
+                // it in a callee-saved register
+                for (int w = 0; w < l->words; w++)
+                {
+                    for (uint64_t set = live[w]; set; set &= set - 1)
+                    {
+                        for (int r = 0; r < REGISTER_COUNT; r++)
+                        {
+                            if (!register_callee_saved[r])
+                                edge_add(c, temp_node(w * 64 + __builtin_ctzll(set)), r);
+                        }
+                    }
+                }
+
+                // Arguments are moved into the registers they are passed in
+                for (int n = 0; n < i->arg_count; n++)
+                {
+                    if (i->args[n].kind == IR_VALUE_TEMP && argument_register(n) >= 0)
+                        move_add(c, argument_register(n), temp_node(i->args[n].number));
+                }
+            }
+
+            if (i->op == IR_PARAM && dest >= 0 && argument_register(i->a.number) >= 0)
+                move_add(c, temp_node(dest), argument_register(i->a.number));
+
+            for (int n = 0; n < ir_operand_count(i); n++)
+            {
+                struct ir_value *v = ir_operand(i, n);
+
+                if (v->kind != IR_VALUE_TEMP)
+                    continue;
+
+                c->state[temp_node(v->number)] = NODE_INITIAL;
+                c->cost[temp_node(v->number)] += weight;
+                live[v->number / 64] |= (uint64_t)1 << (v->number % 64);
+            }
+        }
+    }
+
+    // Parameters all arrive at once, so none of them can share a register
+    for (struct ir_instr *i = f->entry->first; i && i->op == IR_PARAM; i = i->next)
+    {
+        for (struct ir_instr *j = i->next; j && j->op == IR_PARAM; j = j->next)
+            edge_add(c, temp_node(i->dest.number), temp_node(j->dest.number));
+    }
+
+    free(live);
+    liveness_delete(l);
+}
+
+// =====================
+// Simplifying the graph
+// =====================
+
+static bool move_is_pending(struct coloring *c, int m)
+{
+    return c->moves[m].state == MOVE_ACTIVE || c->moves[m].state == MOVE_WORKLIST;
+}
+
+static bool node_is_move_related(struct coloring *c, int n)
+{
+    for (int m = 0; m < c->node_moves[n].count; m++)
+    {
+        if (move_is_pending(c, c->node_moves[n].items[m]))
+            return true;
+    }
+
+    return false;
+}
+
+// Neighbours that are still in the graph
+static bool node_is_present(struct coloring *c, int n)
+{
+    return c->state[n] != NODE_SELECTED && c->state[n] != NODE_COALESCED;
+}
+
+static void moves_enable(struct coloring *c, int n)
+{
+    for (int m = 0; m < c->node_moves[n].count; m++)
+    {
+        int move = c->node_moves[n].items[m];
+
+        if (c->moves[move].state == MOVE_ACTIVE)
+        {
+            c->moves[move].state = MOVE_WORKLIST;
+            list_add(&c->work_moves, move);
+        }
+    }
+}
+
+static void node_push(struct coloring *c, int n, node_state_t state)
+{
+    c->state[n] = state;
+
+    if (state == NODE_SIMPLIFY)
+        list_add(&c->simplify, n);
+    else if (state == NODE_FREEZE)
+        list_add(&c->freeze, n);
+}
+
+static void degree_decrement(struct coloring *c, int n)
+{
+    if (is_precolored(n))
+        return;
+
+    // Dropping below the number of registers makes the node colorable, and
+    // may let the moves of it and its neighbours be coalesced
+    if (c->degree[n]-- != REGISTER_COUNT)
+        return;
+
+    moves_enable(c, n);
+
+    for (int a = 0; a < c->adjacent[n].count; a++)
+    {
+        if (node_is_present(c, c->adjacent[n].items[a]))
+            moves_enable(c, c->adjacent[n].items[a]);
+    }
+
+    if (c->state[n] == NODE_SPILL)
+        node_push(c, n, node_is_move_related(c, n) ? NODE_FREEZE : NODE_SIMPLIFY);
+}
+
+static void simplify(struct coloring *c, int n)
+{
+    c->state[n] = NODE_SELECTED;
+    list_add(&c->select, n);
+
+    for (int a = 0; a < c->adjacent[n].count; a++)
+    {
+        int m = c->adjacent[n].items[a];
+
+        if (node_is_present(c, m))
+            degree_decrement(c, m);
+    }
+}
+
+// ================
+// Coalescing moves
+// ================
+
+static int alias_of(struct coloring *c, int n)
+{
+    while (c->state[n] == NODE_COALESCED)
+        n = c->alias[n];
+
+    return n;
+}
+
+static void worklist_add(struct coloring *c, int n)
+{
+    if (!is_precolored(n) && c->state[n] == NODE_FREEZE && !node_is_move_related(c, n) &&
+        c->degree[n] < REGISTER_COUNT)
+        node_push(c, n, NODE_SIMPLIFY);
+}
+
+// George's test, used when coalescing with a register: every neighbour of v
+// is harmless to u if it is colorable anyway or already interferes with u
+static bool george(struct coloring *c, int u, int v)
+{
+    for (int a = 0; a < c->adjacent[v].count; a++)
+    {
+        int t = c->adjacent[v].items[a];
+
+        if (node_is_present(c, t) && c->degree[t] >= REGISTER_COUNT && !is_precolored(t) && !edge_test(c, t, u))
+            return false;
+    }
+
+    return true;
+}
+
+// Briggs' test: the combined node is colorable if it would have fewer
+// neighbours of significant degree than there are registers
+static bool briggs(struct coloring *c, int u, int v)
+{
+    int significant = 0;
+    int nodes[2] = {u, v};
+
+    c->stamp_current++;
+
+    for (int n = 0; n < 2; n++)
+    {
+        for (int a = 0; a < c->adjacent[nodes[n]].count; a++)
+        {
+            int t = c->adjacent[nodes[n]].items[a];
+
+            if (!node_is_present(c, t) || c->stamp[t] == c->stamp_current)
+                continue;
+
+            c->stamp[t] = c->stamp_current;
+
+            if (is_precolored(t) || c->degree[t] >= REGISTER_COUNT)
+                significant++;
+        }
+    }
+
+    return significant < REGISTER_COUNT;
+}
+
+static void combine(struct coloring *c, int u, int v)
+{
+    c->state[v] = NODE_COALESCED;
+    c->alias[v] = u;
+    c->cost[u] += c->cost[v];
+
+    for (int m = 0; m < c->node_moves[v].count; m++)
+        list_add(&c->node_moves[u], c->node_moves[v].items[m]);
+
+    moves_enable(c, v);
+
+    for (int a = 0; a < c->adjacent[v].count; a++)
+    {
+        int t = c->adjacent[v].items[a];
+
+        if (!node_is_present(c, t))
+            continue;
+
+        edge_add(c, t, u);
+        degree_decrement(c, t);
+    }
+
+    if (c->degree[u] >= REGISTER_COUNT && c->state[u] == NODE_FREEZE)
+        c->state[u] = NODE_SPILL;
+}
+
+static void coalesce(struct coloring *c, int m)
+{
+    int x = alias_of(c, c->moves[m].dest);
+    int y = alias_of(c, c->moves[m].source);
+
+    // A register is always kept as the node coalesced into
+    int u = is_precolored(y) ? y : x;
+    int v = is_precolored(y) ? x : y;
+
+    if (u == v)
+    {
+        c->moves[m].state = MOVE_COALESCED;
+        worklist_add(c, u);
+    }
+    else if (is_precolored(v) || edge_test(c, u, v))
+    {
+        c->moves[m].state = MOVE_CONSTRAINED;
+        worklist_add(c, u);
+        worklist_add(c, v);
+    }
+    else if (is_precolored(u) ? george(c, u, v) : briggs(c, u, v))
+    {
+        c->moves[m].state = MOVE_COALESCED;
+        combine(c, u, v);
+        worklist_add(c, u);
+    }
+    else
+    {
+        c->moves[m].state = MOVE_ACTIVE;
+    }
+}
+
+// Gives up on coalescing the moves of n, so it can be simplified
+static void moves_freeze(struct coloring *c, int n)
+{
+    for (int i = 0; i < c->node_moves[n].count; i++)
+    {
+        int m = c->node_moves[n].items[i];
+
+        if (!move_is_pending(c, m))
+            continue;
+
+        int x = alias_of(c, c->moves[m].dest);
+        int y = alias_of(c, c->moves[m].source);
+        int v = y == alias_of(c, n) ? x : y;
+
+        c->moves[m].state = MOVE_FROZEN;
+
+        if (!is_precolored(v) && c->state[v] == NODE_FREEZE && !node_is_move_related(c, v) &&
+            c->degree[v] < REGISTER_COUNT)
+            node_push(c, v, NODE_SIMPLIFY);
+    }
+}
+
+// Spills the node that costs least for each neighbour it frees up
+static int spill_select(struct coloring *c)
+{
+    int best = -1;
+
+    for (int n = REGISTER_COUNT; n < c->nodes; n++)
+    {
+        if (c->state[n] != NODE_SPILL)
+            continue;
+
+        if (best < 0 || c->cost[n] * c->degree[best] < c->cost[best] * c->degree[n])
+            best = n;
+    }
+
+    return best;
+}
+
+static int pop(struct coloring *c, struct list *l, node_state_t state)
+{
+    while (l->count)
+    {
+        int n = l->items[--l->count];
+
+        if (c->state[n] == state)
+            return n;
+    }
+
+    return -1;
+}
+
+// ================
+// Assigning colors
+// ================
+
+static void colors_assign(struct coloring *c)
+{
+    while (c->select.count)
+    {
+        int n = c->select.items[--c->select.count];
+        bool taken[REGISTER_COUNT] = {0};
+
+        for (int a = 0; a < c->adjacent[n].count; a++)
+        {
+            int w = alias_of(c, c->adjacent[n].items[a]);
+
+            if (is_precolored(w))
+                taken[w] = true;
+            else if (c->state[w] == NODE_COLORED)
+                taken[c->color[w]] = true;
+        }
+
+        // Prefer the color of something n is copied to or from, so the copy
+        // disappears even though the two could not be coalesced. Otherwise
+        // caller-saved registers come first, since they need no saving
+        int chosen = -1;
+
+        for (int i = 0; i < c->node_moves[n].count && chosen < 0; i++)
+        {
+            struct move *m = &c->moves[c->node_moves[n].items[i]];
+            int other = alias_of(c, m->dest) == n ? alias_of(c, m->source) : alias_of(c, m->dest);
+            int color = is_precolored(other) ? other : c->state[other] == NODE_COLORED ? c->color[other] : -1;
+
+            if (color >= 0 && !taken[color])
+                chosen = color;
+        }
+
+        for (int r = 0; r < REGISTER_COUNT && chosen < 0; r++)
+        {
+            if (!taken[r])
+                chosen = r;
+        }
+
+        c->state[n] = chosen < 0 ? NODE_SPILLED : NODE_COLORED;
+        c->color[n] = chosen;
+    }
+}
+
+// ===============
+// Rematerializing
+// ===============
+
+// A spilled temporary whose only definition copies a constant doesn't need a
+// home in memory at all. Each use takes the constant instead, and the
+// definition goes away
+static int constants_rematerialize(struct ir_function *f)
+{
+    struct ir_instr **definition = calloc(f->temp_count + 1, sizeof(struct ir_instr *));
+    bool *multiple = calloc(f->temp_count + 1, sizeof(bool));
+    int rematerialized = 0;
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            if (i->dest.kind != IR_VALUE_TEMP)
+                continue;
+
+            multiple[i->dest.number] = definition[i->dest.number] != NULL;
+            definition[i->dest.number] = i;
+        }
+    }
+
+    for (int t = 0; t < f->temp_count; t++)
+    {
+        struct ir_instr *d = definition[t];
+
+        if (f->registers[t] >= 0 || !d || multiple[t] || d->op != IR_COPY ||
+            d->a.kind != IR_VALUE_CONSTANT)
+            definition[t] = NULL;
+        else
+            rematerialized++;
+    }
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            for (int n = 0; n < ir_operand_count(i); n++)
+            {
+                struct ir_value *v = ir_operand(i, n);
+
+                if (v->kind == IR_VALUE_TEMP && definition[v->number])
+                    *v = definition[v->number]->a;
+            }
+        }
+    }
+
+    for (int t = 0; t < f->temp_count; t++)
+    {
+        if (definition[t])
+            ir_remove(definition[t]);
+    }
+
+    free(definition);
+    free(multiple);
+
+    return rematerialized;
+}
+
+// A spilled temporary that is rematerialized is only worth its definitions,
+// since its uses become immediates rather than loads
+static void costs_rematerialize(struct coloring *c, struct ir_function *f)
+{
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            if (i->op == IR_COPY && i->dest.kind == IR_VALUE_TEMP && i->a.kind == IR_VALUE_CONSTANT)
+                c->cost[temp_node(i->dest.number)] /= 16;
+        }
+    }
+}
+
+int ir_function_color(struct ir_function *f, int *rematerialized)
+{
+    struct coloring c = {0};
+
+    c.nodes = REGISTER_COUNT + f->temp_count;
+    c.edge_capacity = 1024;
+    c.edges = calloc(c.edge_capacity, sizeof(uint64_t));
+    c.adjacent = calloc(c.nodes, sizeof(struct list));
+    c.node_moves = calloc(c.nodes, sizeof(struct list));
+    c.degree = calloc(c.nodes, sizeof(int));
+    c.state = calloc(c.nodes, sizeof(node_state_t));
+    c.alias = calloc(c.nodes, sizeof(int));
+    c.color = calloc(c.nodes, sizeof(int));
+    c.cost = calloc(c.nodes, sizeof(double));
+    c.stamp = calloc(c.nodes, sizeof(int));
+
+    for (int n = 0; n < c.nodes; n++)
+    {
+        c.state[n] = is_precolored(n) ? NODE_PRECOLORED : NODE_UNUSED;
+        c.color[n] = is_precolored(n) ? n : -1;
+        c.degree[n] = is_precolored(n) ? INT_MAX / 2 : 0;
+    }
+
+    ir_function_link(f);
+    ir_function_dominators(f);
+    ir_function_loop_depths(f);
+
+    coloring_build(&c, f);
+    costs_rematerialize(&c, f);
+
+    for (int n = REGISTER_COUNT; n < c.nodes; n++)
+    {
+        if (c.state[n] != NODE_INITIAL)
+            continue;
+
+        if (c.degree[n] >= REGISTER_COUNT)
+            c.state[n] = NODE_SPILL;
+        else
+            node_push(&c, n, node_is_move_related(&c, n) ? NODE_FREEZE : NODE_SIMPLIFY);
+    }
+
+    while (true)
+    {
+        int n;
+
+        if ((n = pop(&c, &c.simplify, NODE_SIMPLIFY)) >= 0)
+        {
+            simplify(&c, n);
+        }
+        else if (c.work_moves.count)
+        {
+            int m = c.work_moves.items[--c.work_moves.count];
+
+            if (c.moves[m].state == MOVE_WORKLIST)
+                coalesce(&c, m);
+        }
+        else if ((n = pop(&c, &c.freeze, NODE_FREEZE)) >= 0)
+        {
+            node_push(&c, n, NODE_SIMPLIFY);
+            moves_freeze(&c, n);
+        }
+        else if ((n = spill_select(&c)) >= 0)
+        {
+            node_push(&c, n, NODE_SIMPLIFY);
+            moves_freeze(&c, n);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    colors_assign(&c);
+
+    f->registers = ir_alloc(f, sizeof(int) * (f->temp_count ? f->temp_count : 1));
+
+    int spilled = 0;
+
+    for (int t = 0; t < f->temp_count; t++)
+    {
+        // Temporaries coalesced into another take its color, or are spilled
+        // along with it
+        int n = alias_of(&c, temp_node(t));
+
+        f->registers[t] = is_precolored(n) || c.state[n] == NODE_COLORED ? c.color[n] : -1;
+
+        if (c.state[temp_node(t)] != NODE_UNUSED && f->registers[t] < 0)
+            spilled++;
+    }
+
+    *rematerialized = constants_rematerialize(f);
+
+    for (int n = 0; n < c.nodes; n++)
+    {
+        free(c.adjacent[n].items);
+        free(c.node_moves[n].items);
+    }
+
+    free(c.edges);
+    free(c.adjacent);
+    free(c.node_moves);
+    free(c.degree);
+    free(c.state);
+    free(c.alias);
+    free(c.color);
+    free(c.cost);
+    free(c.stamp);
+    free(c.moves);
+    free(c.simplify.items);
+    free(c.freeze.items);
+    free(c.work_moves.items);
+    free(c.select.items);
+
+    return spilled - *rematerialized;
+}
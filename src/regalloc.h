@@ -0,0 +1,68 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include <stdbool.h>
+
+struct ir_function;
+struct ir_instr;
+
+// The registers values can be allocated to. %rax, %rdx and %r11 are kept free
+// as scratch registers for the emitter, and for division and return values
+#define REGISTERS                                                                                                      \
+    X(REGISTER_RCX, "%rcx", false)                                                                                     \
+    X(REGISTER_RSI, "%rsi", false)                                                                                     \
+    X(REGISTER_RDI, "%rdi", false)                                                                                     \
+    X(REGISTER_R8, "%r8", false)                                                                                       \
+    X(REGISTER_R9, "%r9", false)                                                                                       \
+    X(REGISTER_R10, "%r10", false)                                                                                     \
+    X(REGISTER_RBX, "%rbx", true)                                                                                      \
+    X(REGISTER_R12, "%r12", true)                                                                                      \
+    X(REGISTER_R13, "%r13", true)                                                                                      \
+    X(REGISTER_R14, "%r14", true)                                                                                      \
+    X(REGISTER_R15, "%r15", true)
+
+typedef enum
+{
+#define X(r, name, callee_saved) r,
+    REGISTERS
+#undef X
+        REGISTER_COUNT
+} reg_t;
+
+extern const char *register_names[];
+
+// Callee-saved registers survive calls, but must be restored before the
+// function using them returns
+extern const bool register_callee_saved[];
+
+// The positions at which a temporary is live, from its first definition to
+// its last use, in the order given by numbering the function's instructions
+struct interval
+{
+    int temp;
+    int start;
+    int end;
+
+    // How many calls happen while the temporary is live, and how many times
+    // it is defined or used
+    int calls;
+    int uses;
+};
+
+// Instructions emitted as calls, which clobber the caller-saved registers
+bool ir_instr_is_call(struct ir_instr *i);
+
+// Numbers the instructions and returns the interval of every temporary that
+// is used, sorted by start. The function must be out of SSA form
+struct interval *ir_function_intervals(struct ir_function *f, int *count);
+
+// Gives each temporary a register, or leaves it in memory when there are not
+// enough to go around. Returns how many were left in memory
+int ir_function_linear_scan(struct ir_function *f);
+
+// Allocates registers by coloring an interference graph, coalescing copies
+// where it can. Spilled temporaries that only hold a constant are replaced by
+// it, and counted in rematerialized rather than the spills returned
+int ir_function_color(struct ir_function *f, int *rematerialized);
+
+#endif
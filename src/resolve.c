@@ -32,6 +32,13 @@ void decl_resolve(struct decl *d)
 
 void expr_resolve(struct expr *e)
 {
+    // Argument chains are walked iteratively, since they can be very long
+    while (e && e->kind == EXPR_ARG)
+    {
+        expr_resolve(e->left);
+        e = e->right;
+    }
+
     if (!e)
         return;
 
@@ -52,18 +59,22 @@ void expr_resolve(struct expr *e)
     {
         expr_resolve(e->left);
         expr_resolve(e->right);
+
+        for (int i = 0; i < e->arg_count; i++)
+            expr_resolve(e->args[i]);
     }
 }
 
 void param_list_resolve(struct param_list *p)
 {
-    if (!p)
-        return;
-
-    p->symbol = symbol_create(SYMBOL_PARAM, p->type, p->name);
-    scope_bind(p->symbol->name, p->symbol);
+    for (int i = 0; i < param_list_count(p); i++)
+    {
+        struct param *item = &p->items[i];
 
-    param_list_resolve(p->next);
+        item->symbol = symbol_create(SYMBOL_PARAM, item->type, item->name);
+        item->symbol->which = i;
+        scope_bind(item->symbol->name, item->symbol);
+    }
 }
 
 void stmt_resolve(struct stmt *s)
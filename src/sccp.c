@@ -0,0 +1,536 @@
+#include "sccp.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "dominance.h"
+#include "ir.h"
+
+// This is the algorithm of Wegman and Zadeck. Every temporary starts out
+// unknown and only ever moves down the lattice, from unknown to a single
+// constant to varying. Blocks are only visited once an edge into them is
+// found to be executable, so values along paths that cannot be taken never
+// reach the phis they would otherwise spoil.
+
+typedef enum
+{
+    LATTICE_UNKNOWN,
+    LATTICE_CONSTANT,
+    LATTICE_VARYING
+} lattice_t;
+
+struct lattice
+{
+    lattice_t kind;
+    int64_t value;
+};
+
+// The state of the function being propagated through
+static struct ir_function *function = NULL;
+static struct lattice *values = NULL;
+
+// The instructions using each temporary, stored one temporary after another
+static struct ir_instr **uses = NULL;
+static int *use_starts = NULL;
+
+static bool *block_executable = NULL;
+
+// Whether each edge has been found executable, indexed by the destination
+// block and the position of the source among its predecessors
+static bool **edge_executable = NULL;
+
+static struct ir_instr **ssa_worklist = NULL;
+static int ssa_count = 0;
+static int ssa_capacity = 0;
+
+static struct ir_block **flow_worklist = NULL;
+static int flow_count = 0;
+static int flow_capacity = 0;
+
+// ===========
+// Worklists
+// ===========
+
+static void ssa_push(struct ir_instr *i)
+{
+    if (ssa_count == ssa_capacity)
+    {
+        ssa_capacity = ssa_capacity ? ssa_capacity * 2 : 64;
+        ssa_worklist = realloc(ssa_worklist, sizeof(struct ir_instr *) * ssa_capacity);
+    }
+
+    ssa_worklist[ssa_count++] = i;
+}
+
+// Edges are pushed as a pair of blocks
+static void flow_push(struct ir_block *from, struct ir_block *to)
+{
+    if (flow_count + 2 > flow_capacity)
+    {
+        flow_capacity = flow_capacity ? flow_capacity * 2 : 64;
+        flow_worklist = realloc(flow_worklist, sizeof(struct ir_block *) * flow_capacity);
+    }
+
+    flow_worklist[flow_count++] = from;
+    flow_worklist[flow_count++] = to;
+}
+
+// =========
+// Lattice
+// =========
+
+static struct lattice lattice_of(struct ir_value v)
+{
+    struct lattice l = {LATTICE_VARYING, 0};
+
+    if (v.kind == IR_VALUE_CONSTANT)
+    {
+        l.kind = LATTICE_CONSTANT;
+        l.value = v.number;
+    }
+    else if (v.kind == IR_VALUE_TEMP)
+    {
+        l = values[v.number];
+    }
+
+    return l;
+}
+
+static struct lattice lattice_constant(int64_t value)
+{
+    struct lattice l = {LATTICE_CONSTANT, value};
+    return l;
+}
+
+static struct lattice lattice_meet(struct lattice a, struct lattice b)
+{
+    if (a.kind == LATTICE_UNKNOWN)
+        return b;
+
+    if (b.kind == LATTICE_UNKNOWN)
+        return a;
+
+    if (a.kind == LATTICE_CONSTANT && b.kind == LATTICE_CONSTANT && a.value == b.value)
+        return a;
+
+    struct lattice varying = {LATTICE_VARYING, 0};
+    return varying;
+}
+
+// Integers wrap around at 64 bits, the same as the generated code, which is
+// computed on unsigned values to stay clear of signed overflow
+static int64_t wrap(uint64_t v)
+{
+    return (int64_t)v;
+}
+
+static int64_t power(int64_t base, int64_t exponent)
+{
+    uint64_t result = 1;
+    uint64_t b = base;
+
+    // Matches integer_power in the runtime library, where anything to a
+    // negative power is one
+    while (exponent > 0)
+    {
+        if (exponent & 1)
+            result *= b;
+
+        b *= b;
+        exponent >>= 1;
+    }
+
+    return wrap(result);
+}
+
+static bool is_zero(struct lattice l)
+{
+    return l.kind == LATTICE_CONSTANT && l.value == 0;
+}
+
+static struct lattice evaluate(struct ir_instr *i)
+{
+    struct lattice varying = {LATTICE_VARYING, 0};
+    struct lattice unknown = {LATTICE_UNKNOWN, 0};
+
+    switch (i->op)
+    {
+    case IR_COPY:
+        return lattice_of(i->a);
+    case IR_PHI: {
+        struct lattice result = unknown;
+
+        for (int n = 0; n < i->arg_count; n++)
+        {
+            int p;
+
+            // Only values arriving over executable edges count
+            for (p = 0; p < i->block->pred_count; p++)
+            {
+                if (i->block->preds[p] == i->sources[n])
+                    break;
+            }
+
+            if (p < i->block->pred_count && edge_executable[i->block->id][p])
+                result = lattice_meet(result, lattice_of(i->args[n]));
+        }
+
+        return result;
+    }
+    case IR_NEG:
+    case IR_NOT: {
+        struct lattice a = lattice_of(i->a);
+
+        if (a.kind != LATTICE_CONSTANT)
+            return a;
+
+        return lattice_constant(i->op == IR_NEG ? wrap(-(uint64_t)a.value) : a.value ^ 1);
+    }
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_DIV:
+    case IR_MOD:
+    case IR_POW:
+    case IR_AND:
+    case IR_OR:
+    case IR_LT:
+    case IR_LTE:
+    case IR_GT:
+    case IR_GTE:
+    case IR_EQ:
+    case IR_NE: {
+        struct lattice a = lattice_of(i->a);
+        struct lattice b = lattice_of(i->b);
+
+        if (a.kind == LATTICE_UNKNOWN || b.kind == LATTICE_UNKNOWN)
+            return unknown;
+
+        // Multiplying by zero gives zero whatever the other operand is, as in
+        // the first copy of a fully unrolled loop's body
+        if (i->op == IR_MUL && (is_zero(a) || is_zero(b)))
+            return lattice_constant(0);
+
+        if (a.kind == LATTICE_VARYING || b.kind == LATTICE_VARYING)
+            return varying;
+
+        int64_t l = a.value;
+        int64_t r = b.value;
+
+        switch (i->op)
+        {
+        case IR_ADD:
+            return lattice_constant(wrap((uint64_t)l + (uint64_t)r));
+        case IR_SUB:
+            return lattice_constant(wrap((uint64_t)l - (uint64_t)r));
+        case IR_MUL:
+            return lattice_constant(wrap((uint64_t)l * (uint64_t)r));
+        case IR_DIV:
+        case IR_MOD:
+            // Leave traps to happen at runtime
+            if (r == 0 || (l == INT64_MIN && r == -1))
+                return varying;
+            return lattice_constant(i->op == IR_DIV ? l / r : l % r);
+        case IR_POW:
+            return lattice_constant(power(l, r));
+        case IR_AND:
+            return lattice_constant(l & r);
+        case IR_OR:
+            return lattice_constant(l | r);
+        case IR_LT:
+            return lattice_constant(l < r);
+        case IR_LTE:
+            return lattice_constant(l <= r);
+        case IR_GT:
+            return lattice_constant(l > r);
+        case IR_GTE:
+            return lattice_constant(l >= r);
+        case IR_EQ:
+            return lattice_constant(l == r);
+        default:
+            return lattice_constant(l != r);
+        }
+    }
+    default:
+        // Memory, parameters and calls could hold anything
+        return varying;
+    }
+}
+
+// ===========
+// Propagation
+// ===========
+
+static void edge_mark(struct ir_block *from, struct ir_block *to)
+{
+    for (int p = 0; p < to->pred_count; p++)
+    {
+        if (to->preds[p] == from && !edge_executable[to->id][p])
+            flow_push(from, to);
+    }
+}
+
+static void instr_visit(struct ir_instr *i)
+{
+    if (i->op == IR_JUMP)
+    {
+        edge_mark(i->block, i->target);
+        return;
+    }
+
+    if (i->op == IR_BRANCH)
+    {
+        struct lattice condition = lattice_of(i->a);
+
+        if (condition.kind == LATTICE_CONSTANT)
+        {
+            edge_mark(i->block, condition.value ? i->target : i->target_false);
+        }
+        else if (condition.kind == LATTICE_VARYING)
+        {
+            edge_mark(i->block, i->target);
+            edge_mark(i->block, i->target_false);
+        }
+
+        return;
+    }
+
+    if (i->dest.kind != IR_VALUE_TEMP)
+        return;
+
+    struct lattice old = values[i->dest.number];
+    struct lattice result = evaluate(i);
+
+    // Values only ever move down the lattice
+    if (old.kind == LATTICE_VARYING || (old.kind == result.kind && old.value == result.value))
+        return;
+
+    if (old.kind == LATTICE_CONSTANT && result.kind != LATTICE_VARYING)
+        result.kind = LATTICE_VARYING;
+
+    values[i->dest.number] = result;
+
+    for (int u = use_starts[i->dest.number]; u < use_starts[i->dest.number + 1]; u++)
+        ssa_push(uses[u]);
+}
+
+static void edge_visit(struct ir_block *from, struct ir_block *to)
+{
+    int p;
+
+    for (p = 0; p < to->pred_count; p++)
+    {
+        if (to->preds[p] == from)
+            break;
+    }
+
+    if (edge_executable[to->id][p])
+        return;
+
+    edge_executable[to->id][p] = true;
+
+    // Later visits only have new phi arguments to take into account
+    if (block_executable[to->id])
+    {
+        for (struct ir_instr *i = to->first; i && i->op == IR_PHI; i = i->next)
+            instr_visit(i);
+        return;
+    }
+
+    block_executable[to->id] = true;
+
+    for (struct ir_instr *i = to->first; i; i = i->next)
+        instr_visit(i);
+}
+
+// Builds the list of instructions using each temporary, counting the uses
+// first so they can be stored in a single array
+static void uses_build(struct ir_function *f)
+{
+    use_starts = calloc(f->temp_count + 1, sizeof(int));
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            for (int n = 0; n < ir_operand_count(i); n++)
+            {
+                if (ir_operand(i, n)->kind == IR_VALUE_TEMP)
+                    use_starts[ir_operand(i, n)->number + 1]++;
+            }
+        }
+    }
+
+    for (int t = 0; t < f->temp_count; t++)
+        use_starts[t + 1] += use_starts[t];
+
+    int *filled = calloc(f->temp_count + 1, sizeof(int));
+    uses = malloc(sizeof(struct ir_instr *) * (use_starts[f->temp_count] + 1));
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            for (int n = 0; n < ir_operand_count(i); n++)
+            {
+                struct ir_value *v = ir_operand(i, n);
+
+                if (v->kind == IR_VALUE_TEMP)
+                    uses[use_starts[v->number] + filled[v->number]++] = i;
+            }
+        }
+    }
+
+    free(filled);
+}
+
+// ===========
+// Rewriting
+// ===========
+
+// The operand an addition of zero, a subtraction of zero or a multiplication
+// by one leaves unchanged, or none
+static struct ir_value identity_operand(struct ir_instr *i)
+{
+    bool a_constant = i->a.kind == IR_VALUE_CONSTANT;
+    bool b_constant = i->b.kind == IR_VALUE_CONSTANT;
+    int64_t unit = i->op == IR_MUL ? 1 : 0;
+
+    if (i->op != IR_ADD && i->op != IR_SUB && i->op != IR_MUL)
+        return ir_none();
+
+    if (b_constant && i->b.number == unit && i->a.type == i->dest.type)
+        return i->a;
+
+    if (i->op != IR_SUB && a_constant && i->a.number == unit && i->b.type == i->dest.type)
+        return i->b;
+
+    return ir_none();
+}
+
+static void function_rewrite(struct ir_function *f)
+{
+    // Replace every constant temporary and remove what computed it
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        if (!block_executable[b->id])
+            continue;
+
+        struct ir_instr *next;
+
+        for (struct ir_instr *i = b->first; i; i = next)
+        {
+            next = i->next;
+
+            for (int n = 0; n < ir_operand_count(i); n++)
+            {
+                struct ir_value *v = ir_operand(i, n);
+
+                if (v->kind == IR_VALUE_TEMP && values[v->number].kind == LATTICE_CONSTANT)
+                    *v = ir_constant(v->type, values[v->number].value);
+            }
+
+            if (i->op == IR_BRANCH && i->a.kind == IR_VALUE_CONSTANT)
+            {
+                i->op = IR_JUMP;
+                i->target = i->a.number ? i->target : i->target_false;
+                i->target_false = NULL;
+                i->a = ir_none();
+            }
+            else if (i->dest.kind == IR_VALUE_TEMP && values[i->dest.number].kind == LATTICE_CONSTANT &&
+                     !ir_has_side_effects(i))
+            {
+                ir_remove(i);
+            }
+            else if (identity_operand(i).kind != IR_VALUE_NONE)
+            {
+                // Left for redundancy elimination to replace with its operand
+                i->a = identity_operand(i);
+                i->b = ir_none();
+                i->op = IR_COPY;
+            }
+        }
+    }
+
+    // Drop the phi arguments arriving over edges that are never taken, while
+    // the old predecessor lists are still around to say which those are
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        if (!block_executable[b->id])
+            continue;
+
+        for (struct ir_instr *phi = b->first; phi && phi->op == IR_PHI; phi = phi->next)
+        {
+            for (int p = 0; p < b->pred_count; p++)
+            {
+                if (!edge_executable[b->id][p])
+                    ir_phi_remove_source(phi, b->preds[p]);
+            }
+        }
+    }
+
+    ir_function_link(f);
+    ir_function_remove_unreachable(f);
+}
+
+void ir_function_sccp(struct ir_function *f)
+{
+    function = f;
+    values = calloc(f->temp_count ? f->temp_count : 1, sizeof(struct lattice));
+    block_executable = calloc(f->block_count, sizeof(bool));
+    edge_executable = calloc(f->block_count, sizeof(bool *));
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+        edge_executable[b->id] = calloc(b->pred_count ? b->pred_count : 1, sizeof(bool));
+
+    uses_build(f);
+
+    block_executable[f->entry->id] = true;
+
+    for (struct ir_instr *i = f->entry->first; i; i = i->next)
+        instr_visit(i);
+
+    while (flow_count || ssa_count)
+    {
+        while (flow_count)
+        {
+            struct ir_block *to = flow_worklist[--flow_count];
+            struct ir_block *from = flow_worklist[--flow_count];
+
+            edge_visit(from, to);
+        }
+
+        while (ssa_count)
+        {
+            struct ir_instr *i = ssa_worklist[--ssa_count];
+
+            if (i->block && block_executable[i->block->id])
+                instr_visit(i);
+        }
+    }
+
+    function_rewrite(f);
+
+    for (int b = 0; b < f->block_count; b++)
+        free(edge_executable[b]);
+
+    free(values);
+    free(block_executable);
+    free(edge_executable);
+    free(uses);
+    free(use_starts);
+    free(ssa_worklist);
+    free(flow_worklist);
+
+    values = NULL;
+    block_executable = NULL;
+    edge_executable = NULL;
+    uses = NULL;
+    use_starts = NULL;
+    ssa_worklist = NULL;
+    flow_worklist = NULL;
+    ssa_count = ssa_capacity = 0;
+    flow_count = flow_capacity = 0;
+    function = NULL;
+}
@@ -0,0 +1,11 @@
+#ifndef SCCP_H
+#define SCCP_H
+
+struct ir_function;
+
+// Sparse conditional constant propagation over a function in SSA form.
+// Temporaries proven constant are replaced by their values, branches on
+// constants become jumps, and blocks that can never run are removed
+void ir_function_sccp(struct ir_function *f);
+
+#endif
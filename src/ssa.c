@@ -0,0 +1,377 @@
+#include "ssa.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "dominance.h"
+#include "ir.h"
+
+// SSA construction follows Cytron et al. Phis for each promoted slot are
+// placed on the iterated dominance frontier of the blocks that store to it,
+// and a walk of the dominator tree then renames every load to the value most
+// recently stored on the way down.
+
+// Loads are removed during renaming, and the temporaries they defined are
+// replaced by the values that reached them
+static struct ir_value *replacement = NULL;
+
+// ==============
+// Phi placement
+// ==============
+
+static bool slot_promotable(struct ir_function *f, struct ir_value v)
+{
+    return v.kind == IR_VALUE_SLOT && !f->slots[v.number].array;
+}
+
+static struct ir_instr *phi_create(struct ir_function *f, struct ir_block *b, int slot)
+{
+    struct ir_instr *phi = ir_instr_create(f, IR_PHI);
+
+    phi->dest = ir_temp(f, f->slots[slot].type);
+
+    // The slot is remembered while renaming and cleared afterwards
+    phi->a = ir_slot(f, slot);
+
+    phi->arg_count = b->pred_count;
+    phi->args = ir_alloc(f, sizeof(struct ir_value) * (b->pred_count ? b->pred_count : 1));
+    phi->sources = ir_alloc(f, sizeof(struct ir_block *) * (b->pred_count ? b->pred_count : 1));
+
+    for (int p = 0; p < b->pred_count; p++)
+    {
+        phi->args[p] = ir_constant(f->slots[slot].type, 0);
+        phi->sources[p] = b->preds[p];
+    }
+
+    if (b->first)
+        ir_insert_before(b->first, phi);
+    else
+        ir_append(b, phi);
+
+    return phi;
+}
+
+static void phis_place(struct ir_function *f)
+{
+    // Blocks are marked with the slot they last received a phi or were queued
+    // for, so the marks never need clearing between slots
+    int *has_phi = malloc(sizeof(int) * f->block_count);
+    int *queued = malloc(sizeof(int) * f->block_count);
+    struct ir_block **worklist = malloc(sizeof(struct ir_block *) * f->block_count);
+
+    // The blocks storing to each slot
+    int *store_counts = calloc(f->slot_count, sizeof(int));
+    struct ir_block ***stores = malloc(sizeof(struct ir_block **) * (f->slot_count ? f->slot_count : 1));
+
+    for (int i = 0; i < f->block_count; i++)
+    {
+        has_phi[i] = -1;
+        queued[i] = -1;
+    }
+
+    // Counted first so each list can be sized exactly. A block storing to a
+    // slot more than once is listed more than once, which is harmless
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int s = 0; s < f->slot_count; s++)
+        {
+            if (pass == 1)
+                stores[s] = malloc(sizeof(struct ir_block *) * (store_counts[s] ? store_counts[s] : 1));
+            store_counts[s] = 0;
+        }
+
+        for (int n = 0; n < f->rpo_count; n++)
+        {
+            struct ir_block *b = f->rpo[n];
+
+            for (struct ir_instr *i = b->first; i; i = i->next)
+            {
+                if (i->op != IR_STORE || !slot_promotable(f, i->a))
+                    continue;
+
+                if (pass == 1)
+                    stores[i->a.number][store_counts[i->a.number]] = b;
+
+                store_counts[i->a.number]++;
+            }
+        }
+    }
+
+    for (int s = 0; s < f->slot_count; s++)
+    {
+        if (f->slots[s].array)
+            continue;
+
+        int count = 0;
+
+        for (int n = 0; n < store_counts[s]; n++)
+        {
+            if (queued[stores[s][n]->id] == s)
+                continue;
+
+            queued[stores[s][n]->id] = s;
+            worklist[count++] = stores[s][n];
+        }
+
+        while (count)
+        {
+            struct ir_block *b = worklist[--count];
+
+            for (int d = 0; d < b->frontier_count; d++)
+            {
+                struct ir_block *join = b->frontier[d];
+
+                if (has_phi[join->id] == s)
+                    continue;
+
+                has_phi[join->id] = s;
+                phi_create(f, join, s);
+
+                // The phi is itself a new definition of the slot
+                if (queued[join->id] != s)
+                {
+                    queued[join->id] = s;
+                    worklist[count++] = join;
+                }
+            }
+        }
+
+        free(stores[s]);
+    }
+
+    free(has_phi);
+    free(queued);
+    free(worklist);
+    free(store_counts);
+    free(stores);
+}
+
+// ========
+// Renaming
+// ========
+
+// The value of each slot on the current path down the dominator tree. The
+// values pushed in a block are popped again when the walk leaves it
+static struct ir_value **stacks = NULL;
+static int *stack_sizes = NULL;
+static int *stack_capacities = NULL;
+
+static void stack_push_value(int slot, struct ir_value v)
+{
+    if (stack_sizes[slot] == stack_capacities[slot])
+    {
+        stack_capacities[slot] = stack_capacities[slot] ? stack_capacities[slot] * 2 : 8;
+        stacks[slot] = realloc(stacks[slot], sizeof(struct ir_value) * stack_capacities[slot]);
+    }
+
+    stacks[slot][stack_sizes[slot]++] = v;
+}
+
+static struct ir_value current_value(struct ir_function *f, int slot)
+{
+    // A slot read before anything is stored holds zero, the same as a
+    // freshly declared local
+    if (!stack_sizes[slot])
+        return ir_constant(f->slots[slot].type, 0);
+
+    return stacks[slot][stack_sizes[slot] - 1];
+}
+
+static void block_rename(struct ir_function *f, struct ir_block *b)
+{
+    int *pushed = calloc(f->slot_count ? f->slot_count : 1, sizeof(int));
+    struct ir_instr *next;
+
+    for (struct ir_instr *i = b->first; i; i = next)
+    {
+        next = i->next;
+
+        if (i->op == IR_PHI)
+        {
+            if (i->a.kind == IR_VALUE_SLOT)
+            {
+                stack_push_value(i->a.number, i->dest);
+                pushed[i->a.number]++;
+            }
+            continue;
+        }
+
+        ir_operands_resolve(replacement, i);
+
+        if (i->op == IR_LOAD && slot_promotable(f, i->a))
+        {
+            replacement[i->dest.number] = current_value(f, i->a.number);
+            ir_remove(i);
+        }
+        else if (i->op == IR_STORE && slot_promotable(f, i->a))
+        {
+            stack_push_value(i->a.number, i->b);
+            pushed[i->a.number]++;
+            ir_remove(i);
+        }
+    }
+
+    // Fill in the arguments this block passes to its successors' phis
+    for (int s = 0; s < b->succ_count; s++)
+    {
+        for (struct ir_instr *phi = b->succs[s]->first; phi && phi->op == IR_PHI; phi = phi->next)
+        {
+            if (phi->a.kind != IR_VALUE_SLOT)
+                continue;
+
+            for (int n = 0; n < phi->arg_count; n++)
+            {
+                if (phi->sources[n] == b)
+                    phi->args[n] = current_value(f, phi->a.number);
+            }
+        }
+    }
+
+    for (int c = 0; c < b->child_count; c++)
+        block_rename(f, b->children[c]);
+
+    for (int s = 0; s < f->slot_count; s++)
+        stack_sizes[s] -= pushed[s];
+
+    free(pushed);
+}
+
+// Phis are placed wherever a slot's definitions meet, even where the slot is
+// never read again. Those are removed along with any phis only they used
+static void phis_remove_dead(struct ir_function *f)
+{
+    int *uses = calloc(f->temp_count ? f->temp_count : 1, sizeof(int));
+    struct ir_instr **defs = calloc(f->temp_count ? f->temp_count : 1, sizeof(struct ir_instr *));
+    struct ir_instr **worklist = malloc(sizeof(struct ir_instr *) * (f->temp_count ? f->temp_count : 1));
+    int count = 0;
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            if (i->op == IR_PHI)
+                defs[i->dest.number] = i;
+
+            for (int n = 0; n < ir_operand_count(i); n++)
+            {
+                struct ir_value *v = ir_operand(i, n);
+
+                // A phi that only feeds itself is still dead
+                if (v->kind == IR_VALUE_TEMP && !(i->op == IR_PHI && v->number == i->dest.number))
+                    uses[v->number]++;
+            }
+        }
+    }
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i && i->op == IR_PHI; i = i->next)
+        {
+            if (!uses[i->dest.number])
+                worklist[count++] = i;
+        }
+    }
+
+    while (count)
+    {
+        struct ir_instr *phi = worklist[--count];
+
+        for (int n = 0; n < phi->arg_count; n++)
+        {
+            struct ir_value v = phi->args[n];
+
+            if (v.kind != IR_VALUE_TEMP || v.number == phi->dest.number)
+                continue;
+
+            if (--uses[v.number] == 0 && defs[v.number] && defs[v.number]->block)
+                worklist[count++] = defs[v.number];
+        }
+
+        ir_remove(phi);
+    }
+
+    free(uses);
+    free(defs);
+    free(worklist);
+}
+
+void ir_function_mem2reg(struct ir_function *f)
+{
+    // Code after a return can never run, and has no dominators to place phis
+    // by, so it is dropped first
+    ir_function_remove_unreachable(f);
+    ir_function_dominators(f);
+
+    phis_place(f);
+
+    replacement = calloc(f->temp_count ? f->temp_count : 1, sizeof(struct ir_value));
+    stacks = calloc(f->slot_count ? f->slot_count : 1, sizeof(struct ir_value *));
+    stack_sizes = calloc(f->slot_count ? f->slot_count : 1, sizeof(int));
+    stack_capacities = calloc(f->slot_count ? f->slot_count : 1, sizeof(int));
+
+    block_rename(f, f->entry);
+
+    // Phi arguments may name loads from blocks renamed after them
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i && i->op == IR_PHI; i = i->next)
+        {
+            for (int n = 0; n < i->arg_count; n++)
+                i->args[n] = ir_value_resolve(replacement, i->args[n]);
+
+            i->a = ir_none();
+        }
+    }
+
+    for (int s = 0; s < f->slot_count; s++)
+    {
+        if (!f->slots[s].array)
+            f->slots[s].promoted = true;
+
+        free(stacks[s]);
+    }
+
+    free(replacement);
+    free(stacks);
+    free(stack_sizes);
+    free(stack_capacities);
+    replacement = NULL;
+    stacks = NULL;
+
+    phis_remove_dead(f);
+}
+
+// ==================
+// Leaving SSA form
+// ==================
+
+// Each phi gets a temporary of its own. Every predecessor copies its argument
+// into that temporary just before leaving, and the phi becomes a copy out of
+// it. Since no two phis share a temporary, phis that swap values between
+// themselves still read what they were given.
+void ir_function_leave_ssa(struct ir_function *f)
+{
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *phi = b->first; phi && phi->op == IR_PHI; phi = phi->next)
+        {
+            struct ir_value incoming = ir_temp(f, phi->dest.type);
+
+            for (int n = 0; n < phi->arg_count; n++)
+            {
+                struct ir_instr *copy = ir_instr_create(f, IR_COPY);
+
+                copy->dest = incoming;
+                copy->a = phi->args[n];
+
+                ir_insert_before(phi->sources[n]->last, copy);
+            }
+
+            phi->op = IR_COPY;
+            phi->a = incoming;
+            phi->args = NULL;
+            phi->arg_count = 0;
+            phi->sources = NULL;
+        }
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef SSA_H
+#define SSA_H
+
+struct ir_function;
+
+// Promotes every scalar slot to SSA temporaries, placing phis where values
+// from different paths meet. Array slots stay in memory
+void ir_function_mem2reg(struct ir_function *f);
+
+// Replaces every phi with copies, so the function can be emitted
+void ir_function_leave_ssa(struct ir_function *f);
+
+#endif
@@ -16,6 +16,9 @@ struct symbol *symbol_create(symbol_t kind, struct type *type, const char *name)
     s->kind = kind;
     s->type = type;
     s->name = name;
+    s->which = 0;
+    s->reassigned = false;
+    s->constant = NULL;
 
     return s;
 }
@@ -2,6 +2,9 @@
 #ifndef SYMBOL_H
 #define SYMBOL_H
 
+#include <stdbool.h>
+
+struct expr;
 struct type;
 
 #define SYMBOLS                                                                                                        \
@@ -22,6 +25,12 @@ struct symbol
     struct type *type;
     const char *name;
     int which;
+
+    // Set during constant folding. Locals that are never reassigned have
+    // their literal declared value recorded as a constant. For arrays,
+    // reassigned means any element may be modified
+    bool reassigned;
+    struct expr *constant;
 };
 
 struct symbol *symbol_create(symbol_t kind, struct type *type, const char *name);
@@ -0,0 +1,129 @@
+#include "tailcall.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir.h"
+
+// Runs on functions as they were lowered, where each parameter is taken into
+// a temporary and stored to its own slot at the top of the entry block.
+// Everything after those stores is split off into a block of its own, which
+// becomes the head of the loop: a call the function makes to itself in tail
+// position stores its arguments to the parameters' slots and jumps back
+// there. The arguments were all loaded into temporaries before the call, so
+// storing them one after another can't overwrite one still to be read.
+
+static bool is_self_tail_call(struct ir_function *f, struct ir_instr *i)
+{
+    return i->op == IR_CALL && strcmp(i->callee, f->name) == 0 && ir_tail_return(i);
+}
+
+// Finds the slot each parameter is stored to, returning the last of those
+// stores, or NULL if the entry block doesn't start with them
+static struct ir_instr *params_find(struct ir_function *f, struct ir_value *slots)
+{
+    struct ir_instr *i = f->entry->first;
+    struct ir_instr *last = NULL;
+
+    for (int n = 0; n < f->param_count; n++)
+    {
+        if (!i || i->op != IR_PARAM || i->a.number != n || !i->next)
+            return NULL;
+
+        struct ir_instr *store = i->next;
+
+        if (store->op != IR_STORE || !ir_value_equals(store->b, i->dest) || store->a.kind != IR_VALUE_SLOT)
+            return NULL;
+
+        slots[n] = store->a;
+        last = store;
+        i = store->next;
+    }
+
+    return last;
+}
+
+int ir_function_tail_recursion(struct ir_function *f, bool remarks)
+{
+    struct ir_value *slots = malloc(sizeof(struct ir_value) * (f->param_count ? f->param_count : 1));
+    struct ir_instr *last = params_find(f, slots);
+    int count = 0;
+
+    if (!last && f->param_count)
+    {
+        free(slots);
+        return 0;
+    }
+
+    for (struct ir_block *b = f->entry; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            if (is_self_tail_call(f, i))
+                count++;
+        }
+    }
+
+    if (!count)
+    {
+        free(slots);
+        return 0;
+    }
+
+    // The head of the loop takes everything in the entry after the stores
+    struct ir_block *head = f->entry->next ? ir_block_create_before(f, f->entry->next) : ir_block_create(f);
+    struct ir_instr *rest = last ? last->next : f->entry->first;
+
+    while (rest)
+    {
+        struct ir_instr *next = rest->next;
+
+        ir_remove(rest);
+        ir_append(head, rest);
+        rest = next;
+    }
+
+    struct ir_instr *jump = ir_instr_create(f, IR_JUMP);
+    jump->target = head;
+    ir_append(f->entry, jump);
+
+    for (struct ir_block *b = head; b; b = b->next)
+    {
+        for (struct ir_instr *i = b->first; i; i = i->next)
+        {
+            if (!is_self_tail_call(f, i))
+                continue;
+
+            for (int n = 0; n < f->param_count; n++)
+            {
+                struct ir_instr *store = ir_instr_create(f, IR_STORE);
+
+                store->a = slots[n];
+                store->b = i->args[n];
+                ir_insert_before(i, store);
+            }
+
+            if (remarks)
+                printf("remark: %s: turned the tail call at B%d into a loop\n", f->name, b->id);
+
+            // The call and whatever returned its result give way to the jump
+            while (i->next)
+                ir_remove(i->next);
+
+            i->op = IR_JUMP;
+            i->dest = ir_none();
+            i->callee = NULL;
+            i->args = NULL;
+            i->arg_count = 0;
+            i->target = head;
+            break;
+        }
+    }
+
+    ir_function_link(f);
+    free(slots);
+
+    return count;
+}
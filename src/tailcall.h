@@ -0,0 +1,15 @@
+#ifndef TAILCALL_H
+#define TAILCALL_H
+
+#include <stdbool.h>
+
+struct ir_function;
+
+// Turns the calls a function makes to itself in tail position into a loop,
+// before the function is put into SSA form. The arguments are stored to the
+// parameters and the function starts over without growing the stack. Each
+// call turned into a jump is reported when remarks is set. Returns how many
+// there were
+int ir_function_tail_recursion(struct ir_function *f, bool remarks);
+
+#endif
@@ -12,25 +12,6 @@
 // Global typechecking variable that gets set to false if a typechecking error was found
 bool typecheck_succeeded = true;
 
-// A function used to make sure that array literals fit into the container
-bool array_fits(struct symbol *storage, struct type *value)
-{
-    struct type *storage_type = storage->type;
-    struct type *value_type = value;
-
-    while (storage_type != NULL && storage_type->kind == TYPE_ARRAY)
-    {
-        printf("Storage size: %d\tValue size: %d\n", storage_type->size, value_type->size);
-        if (storage_type->size != 0 && storage_type->size < value_type->size)
-            return false;
-
-        storage_type = storage_type->subtype;
-        value_type = value_type->subtype;
-    }
-
-    return true;
-}
-
 // Global variable that we use to verify the return type of functions
 struct type *function_return_type;
 
@@ -42,8 +23,14 @@ void decl_typecheck(struct decl *d)
     // For decls with declared values
     if (d->value)
     {
-        // Evaluate the expression's type...
-        struct type *t = expr_typecheck(d->value);
+        // Evaluate the expression's type... Initializers are checked directly
+        // against the declared array type, element by element
+        struct type *t;
+
+        if (d->value->kind == EXPR_INITIALIZER)
+            t = initializer_typecheck(d->value, d->type);
+        else
+            t = expr_typecheck(d->value);
 
         // If it doesn't match the declared type
         if (!type_equals(t, d->symbol->type))
@@ -63,12 +50,7 @@ void decl_typecheck(struct decl *d)
         type_print(t);
         printf("\n");
 
-        // If the declared type is an array, we need to make sure the declared variable has enough space for the
-        // if (!array_fits(d->symbol, t))
-        // {
-        //     printf("ERROR: Symbol declaration for '%s' does not fufill storage required by literal assignment\n",
-        //     d->name); typecheck_succeeded = false;
-        // }
+        type_delete(t);
     }
 
     // Function parameter and return type verification
@@ -191,6 +173,131 @@ void stmt_typecheck(struct stmt *s)
     stmt_typecheck(s->next);
 }
 
+// Checks a single array initializer element against the array's subtype
+static bool element_typecheck(struct expr *e, struct type *subtype)
+{
+    if (!subtype)
+        return false;
+
+    // Literals make up the bulk of large initializers, so compare their kinds
+    // directly rather than building and deleting a type for every element
+    switch (e->kind)
+    {
+    case EXPR_INTEGERLITERAL:
+        return subtype->kind == TYPE_INTEGER;
+    case EXPR_CHARLITERAL:
+        return subtype->kind == TYPE_CHARACTER;
+    case EXPR_BOOLEANLITERAL:
+        return subtype->kind == TYPE_BOOLEAN;
+    case EXPR_STRINGLITERAL:
+        return subtype->kind == TYPE_STRING;
+    default:
+        break;
+    }
+
+    struct type *t = e->kind == EXPR_INITIALIZER ? initializer_typecheck(e, subtype) : expr_typecheck(e);
+    bool matches = type_equals(t, subtype);
+    type_delete(t);
+
+    return matches;
+}
+
+// Note: Like expr_typecheck, this function returns a new type struct on the heap
+struct type *initializer_typecheck(struct expr *e, struct type *array_type)
+{
+    struct expr *n = e->left;
+
+    // An array literal cannot be empty, there must be at least 1 element
+    if (!n)
+    {
+        printf("ERROR: array literal has no elements\n");
+        typecheck_succeeded = false;
+        return type_create(TYPE_ARRAY, 0, 0);
+    }
+
+    // Without a declared array type to check against, the element type is
+    // taken from the first element of the literal
+    struct type *inferred = NULL;
+
+    if (!array_type || array_type->kind != TYPE_ARRAY)
+    {
+        struct expr *first = initializer_element(n);
+        struct type *subtype =
+            first->kind == EXPR_INITIALIZER ? initializer_typecheck(first, NULL) : expr_typecheck(first);
+
+        array_type = inferred = type_create(TYPE_ARRAY, subtype, 0);
+    }
+
+    // Check every element against the subtype in a single pass, only
+    // reporting the first mismatch so huge tables don't flood the output
+    unsigned int count = 0;
+    bool reported = false;
+
+    for (; n; n = n->right, count++)
+    {
+        if (!element_typecheck(initializer_element(n), array_type->subtype) && !reported)
+        {
+            printf("ERROR: array literal element %u does not match the array's element type '", count);
+            type_print(array_type->subtype);
+            printf("'\n");
+
+            typecheck_succeeded = false;
+            reported = true;
+        }
+    }
+
+    // Arrays declared without a size take the size of their initializer
+    if (array_type->size == 0)
+    {
+        array_type->size = count;
+    }
+    else if (array_type->size != count)
+    {
+        printf("ERROR: array literal has %u elements, but the array was declared with size %u\n", count,
+               array_type->size);
+        typecheck_succeeded = false;
+    }
+
+    if (inferred)
+        return inferred;
+
+    return type_copy(array_type);
+}
+
+// Checks a call's arguments against the called function's parameters
+static void call_typecheck(struct expr *e, struct type *ft)
+{
+    int expected = param_list_count(ft->params);
+
+    if (e->arg_count != expected)
+    {
+        printf("ERROR: Called function '%s' with %d arguments, but it expects %d\n", e->left->name, e->arg_count,
+               expected);
+        printf("\tArgument types expected, '");
+        param_list_print(ft->params);
+        printf("'\n");
+        typecheck_succeeded = false;
+    }
+
+    for (int i = 0; i < e->arg_count; i++)
+    {
+        struct type *t = expr_typecheck(e->args[i]);
+
+        if (i < expected && !type_equals(t, ft->params->items[i].type))
+        {
+            printf("ERROR: Called function '%s' with incompatible argument types\n", e->left->name);
+            printf("\tArgument %d expected type '", i);
+            type_print(ft->params->items[i].type);
+            printf("', argument type recieved, '");
+            type_print(t);
+            printf("'\n");
+            typecheck_succeeded = false;
+        }
+
+        type_delete(t);
+    }
+}
+
 // Note: This function will always return a new type struct on the heap
 //       The returned struct type will need to be destroyed after use
 struct type *expr_typecheck(struct expr *e)
@@ -198,6 +305,19 @@ struct type *expr_typecheck(struct expr *e)
     if (!e)
         return 0;
 
+    // Argument lists and initializers can be hundreds of thousands of elements
+    // long, so they walk their own chains rather than recursing down them
+    if (e->kind == EXPR_ARG)
+    {
+        for (struct expr *a = e; a; a = a->right)
+            type_delete(expr_typecheck(a->left));
+
+        return type_create(TYPE_VOID, 0, 0);
+    }
+
+    if (e->kind == EXPR_INITIALIZER)
+        return initializer_typecheck(e, NULL);
+
     struct type *lt = expr_typecheck(e->left);
     struct type *rt = expr_typecheck(e->right);
     struct type *result = NULL;
@@ -242,63 +362,10 @@ struct type *expr_typecheck(struct expr *e)
         result = type_copy(lt);
         break;
 
-        // Argument lists
-    case EXPR_ARG: {
-        struct param_list *p = param_list_create(e->left->name, type_copy(lt), 0);
-
-        if (rt)
-            p->next = param_list_copy(rt->params);
-
-        result = type_create(TYPE_VOID, 0, p);
+        // Argument lists and initializers are handled before the switch
+    case EXPR_ARG:
+    case EXPR_INITIALIZER:
         break;
-    }
-
-    case EXPR_INITIALIZER: {
-
-        // Since initializers are just a wrapper around arg chains, we just have
-        // to check that the types of the param lists all match, and that if
-        // there is a number associated with the size of the array, we have the
-        // correct number of elements
-
-        struct param_list *pl = lt->params;
-        struct type *subtype = pl->type;
-
-        // An array literal cannot be empty, there must be at least 1 element
-        if (!pl || !lt)
-        {
-            printf("ERROR: array literal has no elements\n");
-            typecheck_succeeded = false;
-            return type_create(TYPE_ARRAY, 0, 0);
-        }
-
-        // Ensure all types from the array correspond to one another
-        int size = 1;
-
-        while (pl->next != NULL)
-        {
-            if (!type_equals(subtype, pl->next->type))
-            {
-                printf("ERROR: array literal has conflicting types. Encountered type'");
-                type_print(subtype);
-                printf("' beside type '");
-                type_print(pl->next->type);
-                printf("'.\n");
-
-                typecheck_succeeded = false;
-                break;
-            }
-
-            size++;
-            pl = pl->next;
-        }
-
-        // Also encode size infoermation for the array literal. This will be
-        // used to ensure that the array literal's size corresponds to the size
-        // of its declaration
-        result = type_create(TYPE_ARRAY, subtype, 0);
-        result->size = size;
-        break;
-    }
 
         // Function calls
         // f(argument list)
@@ -306,28 +373,21 @@ struct type *expr_typecheck(struct expr *e)
         if (lt->kind != TYPE_FUNCTION)
         {
             printf("ERROR: Attempted to call a non-function symbol\n");
-            printf("\tTypes were '");
+            printf("\tType was '");
             type_print(lt);
-            printf("', and '");
-            type_print(rt);
             printf("'\n");
             typecheck_succeeded = false;
+
+            // Still check the arguments themselves
+            for (int i = 0; i < e->arg_count; i++)
+                type_delete(expr_typecheck(e->args[i]));
+
             // As a failsafe, just copy whatever the type of the left item
             result = type_copy(lt);
         }
         else
         {
-            // In the case of no params, lt->params should be null and rt should be null
-            if (!(!lt->params && !rt) && !param_list_equals(lt->params, rt->params))
-            {
-                printf("ERROR: Called function '%s' with incompatible argument types\n", e->left->name);
-                printf("\tArgument types expected, '");
-                param_list_print(lt->params);
-                printf("', argument types recieved, '");
-                param_list_print(rt->params);
-                printf("'\n");
-                typecheck_succeeded = false;
-            }
+            call_typecheck(e, lt);
             result = type_copy(lt->subtype);
         }
         break;
@@ -498,5 +558,9 @@ struct type *expr_typecheck(struct expr *e)
     type_delete(lt);
     type_delete(rt);
 
+    // Record the type on the expression for the later phases
+    type_delete(e->type);
+    e->type = type_copy(result);
+
     return result;
 }
@@ -5,6 +5,7 @@
 struct decl;
 struct expr;
 struct stmt;
+struct type;
 
 void decl_typecheck(struct decl *d);
 
@@ -12,4 +13,8 @@ void stmt_typecheck(struct stmt *s);
 
 struct type *expr_typecheck(struct expr *e);
 
+// Typechecks an array initializer against the array type it initializes. If
+// array_type is NULL, the element type is inferred from the first element
+struct type *initializer_typecheck(struct expr *e, struct type *array_type);
+
 #endif
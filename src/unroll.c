@@ -0,0 +1,291 @@
+#include "unroll.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ast.h"
+#include "symbol.h"
+
+// Only innermost loops are unrolled, and only when their trip count can be
+// worked out as they run: the counter is an integer local or parameter that
+// the initializer assigns, the update steps by a constant and nothing else in
+// the loop assigns, and the condition compares it against a bound made of
+// literals and of integers the loop never assigns. Globals only count as long
+// as the loop makes no calls, which could change them.
+
+// Loops running at most this many times are unrolled fully
+#define FULL_UNROLL_TRIPS 16
+
+// The most AST nodes unrolling one loop may add to a function
+#define GROWTH_LIMIT 160
+
+// Partial unrolling only pays while the compare, branch and update are a
+// large share of each iteration, so loops with larger bodies are left alone
+#define PARTIAL_UNROLL_SIZE 40
+
+// What a loop's statements contain
+struct contents
+{
+    int size;
+    bool calls;
+    bool loops;
+
+    // The scalars assigned, incremented or decremented
+    struct symbol **assigned;
+    int assigned_count;
+};
+
+// ========
+// Contents
+// ========
+
+static void assigned_add(struct contents *c, struct symbol *s)
+{
+    c->assigned = realloc(c->assigned, sizeof(struct symbol *) * (c->assigned_count + 1));
+    c->assigned[c->assigned_count++] = s;
+}
+
+static bool is_assigned(struct contents *c, struct symbol *s)
+{
+    for (int n = 0; n < c->assigned_count; n++)
+    {
+        if (c->assigned[n] == s)
+            return true;
+    }
+
+    return false;
+}
+
+static void expr_scan(struct expr *e, struct contents *c)
+{
+    // Argument chains are walked iteratively, since they can be very long
+    while (e && e->kind == EXPR_ARG)
+    {
+        expr_scan(e->left, c);
+        e = e->right;
+    }
+
+    if (!e)
+        return;
+
+    c->size++;
+
+    if ((e->kind == EXPR_ASSIGNMENT || e->kind == EXPR_INC || e->kind == EXPR_DEC) && e->left->kind == EXPR_NAME)
+        assigned_add(c, e->left->symbol);
+
+    if (e->kind == EXPR_CALL)
+        c->calls = true;
+
+    expr_scan(e->left, c);
+    expr_scan(e->right, c);
+
+    for (int i = 0; i < e->arg_count; i++)
+        expr_scan(e->args[i], c);
+}
+
+static void stmt_scan(struct stmt *s, struct contents *c)
+{
+    for (; s; s = s->next)
+    {
+        c->size++;
+
+        if (s->kind == STMT_FOR)
+            c->loops = true;
+
+        for (struct decl *d = s->decl; d; d = d->next)
+            expr_scan(d->value, c);
+
+        expr_scan(s->init_expr, c);
+        expr_scan(s->expr, c);
+        expr_scan(s->next_expr, c);
+        stmt_scan(s->body, c);
+        stmt_scan(s->else_body, c);
+    }
+}
+
+// ===========
+// Recognizing
+// ===========
+
+static bool is_invariant(struct expr *e, struct contents *c, struct symbol *counter)
+{
+    e = expr_ungroup(e);
+
+    switch (e->kind)
+    {
+    case EXPR_INTEGERLITERAL:
+        return true;
+    case EXPR_NAME:
+        return e->symbol != counter && e->symbol->type->kind == TYPE_INTEGER && !is_assigned(c, e->symbol) &&
+               (e->symbol->kind != SYMBOL_GLOBAL || !c->calls);
+    case EXPR_NEGATE:
+        return is_invariant(e->left, c, counter);
+    case EXPR_ADD:
+    case EXPR_SUB:
+    case EXPR_MUL:
+        return is_invariant(e->left, c, counter) && is_invariant(e->right, c, counter);
+    default:
+        return false;
+    }
+}
+
+// The constant the update adds to the counter, or 0 if it does anything else
+static int64_t step_of(struct expr *e, struct symbol *counter)
+{
+    e = expr_ungroup(e);
+
+    if (!e || !expr_is_name_of(e->left, counter))
+        return 0;
+
+    if (e->kind == EXPR_INC)
+        return 1;
+
+    if (e->kind == EXPR_DEC)
+        return -1;
+
+    struct expr *update = e->kind == EXPR_ASSIGNMENT ? expr_ungroup(e->right) : NULL;
+
+    if (!update || (update->kind != EXPR_ADD && update->kind != EXPR_SUB))
+        return 0;
+
+    struct expr *left = expr_ungroup(update->left);
+    struct expr *right = expr_ungroup(update->right);
+
+    if (expr_is_name_of(left, counter) && right->kind == EXPR_INTEGERLITERAL)
+        return update->kind == EXPR_ADD ? right->literal_value : -(int64_t)right->literal_value;
+
+    if (update->kind == EXPR_ADD && expr_is_name_of(right, counter) && left->kind == EXPR_INTEGERLITERAL)
+        return left->literal_value;
+
+    return 0;
+}
+
+// Whether the loop goes on running with the counter at value
+static bool runs_at(struct unroll *u, int64_t value, int64_t bound)
+{
+    if (u->step > 0)
+        return u->inclusive ? value <= bound : value < bound;
+
+    return u->inclusive ? value >= bound : value > bound;
+}
+
+// How many times the loop runs, when its first value and bound are integer
+// literals, or -1. The count is worked out rather than stepped through, since
+// it only has to be small for the loop to be fully unrolled. An inclusive loop
+// whose counter would overflow past the bound never stops, and isn't counted
+static int64_t trips_of(struct stmt *s, struct unroll *u)
+{
+    struct expr *first = expr_ungroup(s->init_expr->right);
+    struct expr *bound = expr_ungroup(u->bound);
+
+    if (first->kind != EXPR_INTEGERLITERAL || bound->kind != EXPR_INTEGERLITERAL)
+        return -1;
+
+    int64_t value = first->literal_value;
+    int64_t last = bound->literal_value;
+
+    if (!runs_at(u, value, last))
+        return 0;
+
+    if (u->inclusive && (u->step > 0 ? last > INT64_MAX - u->step : last < INT64_MIN - u->step))
+        return -1;
+
+    uint64_t distance = u->step > 0 ? (uint64_t)last - (uint64_t)value : (uint64_t)value - (uint64_t)last;
+    uint64_t stride = u->step > 0 ? (uint64_t)u->step : -(uint64_t)u->step;
+    uint64_t trips = u->inclusive ? distance / stride + 1 : (distance - 1) / stride + 1;
+
+    return trips > INT64_MAX ? -1 : (int64_t)trips;
+}
+
+static bool loop_recognize(struct stmt *s, struct contents *c, struct unroll *u)
+{
+    struct expr *init = expr_ungroup(s->init_expr);
+    struct expr *test = expr_ungroup(s->expr);
+
+    if (!init || !test || init->kind != EXPR_ASSIGNMENT || init->left->kind != EXPR_NAME)
+        return false;
+
+    u->counter = init->left->symbol;
+
+    if (u->counter->kind == SYMBOL_GLOBAL || u->counter->type->kind != TYPE_INTEGER || is_assigned(c, u->counter))
+        return false;
+
+    if (!(u->step = step_of(s->next_expr, u->counter)))
+        return false;
+
+    // With the counter on the right, the comparison is turned around
+    bool ascending;
+
+    if (expr_is_name_of(test->left, u->counter))
+    {
+        u->bound = test->right;
+        ascending = test->kind == EXPR_LT || test->kind == EXPR_LTE;
+    }
+    else if (expr_is_name_of(test->right, u->counter))
+    {
+        u->bound = test->left;
+        ascending = test->kind == EXPR_GT || test->kind == EXPR_GTE;
+    }
+    else
+    {
+        return false;
+    }
+
+    if (test->kind != EXPR_LT && test->kind != EXPR_LTE && test->kind != EXPR_GT && test->kind != EXPR_GTE)
+        return false;
+
+    u->inclusive = test->kind == EXPR_LTE || test->kind == EXPR_GTE;
+
+    // A loop stepping away from its bound runs until the counter overflows
+    return ascending == (u->step > 0) && is_invariant(u->bound, c, u->counter);
+}
+
+bool unroll_recognize(struct stmt *s, struct unroll *u)
+{
+    struct contents c = {0, false, false, NULL, 0};
+
+    stmt_scan(s->body, &c);
+
+    bool recognized = !c.loops && loop_recognize(s, &c, u);
+
+    expr_scan(s->next_expr, &c);
+    free(c.assigned);
+
+    u->size = c.size;
+
+    return recognized;
+}
+
+bool unroll_plan(struct stmt *s, int factor, struct unroll *u)
+{
+    if (factor < 2 || !unroll_recognize(s, u))
+        return false;
+
+    int64_t trips = trips_of(s, u);
+
+    if (trips >= 0 && trips <= FULL_UNROLL_TRIPS && trips * u->size <= GROWTH_LIMIT)
+    {
+        u->full = true;
+        u->remainder = false;
+        u->factor = trips;
+        u->margin = 0;
+        return true;
+    }
+
+    if (u->size > PARTIAL_UNROLL_SIZE)
+        return false;
+
+    while (factor > 1 && factor * u->size > GROWTH_LIMIT)
+        factor--;
+
+    if (factor < 2)
+        return false;
+
+    u->full = false;
+    u->remainder = trips < factor || trips % factor != 0;
+    u->factor = factor;
+    u->margin = (factor - 1) * (u->step > 0 ? u->step : -u->step) - (u->inclusive ? 1 : 0);
+
+    return true;
+}
@@ -0,0 +1,48 @@
+#ifndef UNROLL_H
+#define UNROLL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ast.h"
+
+struct symbol;
+
+// How a counted for loop is unrolled. The loop steps an integer local by a
+// constant on each iteration, and runs while the counter is on one side of a
+// bound nothing in the loop changes
+struct unroll
+{
+    struct symbol *counter;
+    struct expr *bound;
+    int64_t step;
+
+    // Whether the loop runs while the counter is equal to the bound as well
+    bool inclusive;
+
+    // Copies of the body to make. A fully unrolled loop has one for each of
+    // its iterations and nothing else, while a partially unrolled one runs
+    // them as one iteration and finishes with a copy of the original loop,
+    // unless its trip count is known to be a multiple of the copies
+    int factor;
+    bool full;
+    bool remainder;
+
+    // How far the counter must be from the bound for every copy in an
+    // iteration of a partially unrolled loop to run
+    int64_t margin;
+
+    // The loop's body and update together, counted in AST nodes
+    int size;
+};
+
+// Recognizes a counted for loop with no other loop inside, filling in its
+// counter, bound, step and size
+bool unroll_recognize(struct stmt *s, struct unroll *u);
+
+// Decides how to unroll a for loop, unrolling partially by at most factor.
+// Returns false for loops that aren't counted, that contain other loops, or
+// that would grow too large
+bool unroll_plan(struct stmt *s, int factor, struct unroll *u);
+
+#endif
@@ -0,0 +1,392 @@
+#include "vectorize.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ast.h"
+#include "ir.h"
+#include "symbol.h"
+#include "unroll.h"
+
+// A loop is vectorized when its counter steps up by one and every iteration
+// does the same to the elements at fixed distances from it. The body may only
+// assign to array elements and sum into one variable, using additions,
+// subtractions and negations, which is all SSE2 and AVX2 can do to 64-bit
+// integers. Anything else it reads must stay the same while it runs.
+//
+// A vectorized loop runs each statement for width iterations at once, so the
+// accesses of nearby iterations change order. Two accesses to the same
+// element, at least one of them a write, only swap when the later one in the
+// body reaches an element the earlier one reaches up to width - 1 iterations
+// after it, which is a dependence carried across iterations. Arrays that may
+// be the same one without being the same name are never at a known distance.
+
+// Vector registers, of which the sum, the scalars and the stack all take some
+#define VECTOR_REGISTERS 16
+
+// An element read or written, in the order the body reaches them
+struct access
+{
+    struct symbol *array;
+    int64_t offset;
+    bool write;
+};
+
+// The state of the loop being planned
+static struct vectorize *plan = NULL;
+static struct symbol *assigned = NULL;
+static struct access *accesses = NULL;
+static int access_count = 0;
+static int depth = 0;
+static int max_depth = 0;
+
+static char reason_text[160];
+
+// =====
+// Steps
+// =====
+
+static bool fail(const char **reason, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(reason_text, sizeof(reason_text), format, args);
+    va_end(args);
+
+    *reason = reason_text;
+    return false;
+}
+
+static void step_add(ir_vector_step_t kind, int arg, int64_t offset, int pushed)
+{
+    plan->steps = realloc(plan->steps, sizeof(struct ir_vector_step) * (plan->step_count + 1));
+    plan->steps[plan->step_count++] = (struct ir_vector_step){kind, arg, offset};
+
+    depth += pushed;
+
+    if (depth > max_depth)
+        max_depth = depth;
+}
+
+static void access_add(struct symbol *array, int64_t offset, bool write)
+{
+    accesses = realloc(accesses, sizeof(struct access) * (access_count + 1));
+    accesses[access_count++] = (struct access){array, offset, write};
+}
+
+static int array_find(struct expr *name)
+{
+    for (int n = 0; n < plan->array_count; n++)
+    {
+        if (plan->arrays[n]->symbol == name->symbol)
+            return n;
+    }
+
+    plan->arrays = realloc(plan->arrays, sizeof(struct expr *) * (plan->array_count + 1));
+    plan->arrays[plan->array_count] = name;
+
+    return plan->array_count++;
+}
+
+// Scalars named the same, or the same literal, share an argument. Their
+// positions are counted from the first scalar until every array is known
+static int scalar_find(struct expr *e)
+{
+    for (int n = 0; n < plan->scalar_count; n++)
+    {
+        struct expr *s = plan->scalars[n];
+
+        if (s->kind == e->kind && ((e->kind == EXPR_NAME && s->symbol == e->symbol) ||
+                                   (e->kind == EXPR_INTEGERLITERAL && s->literal_value == e->literal_value)))
+            return n;
+    }
+
+    plan->scalars = realloc(plan->scalars, sizeof(struct expr *) * (plan->scalar_count + 1));
+    plan->scalars[plan->scalar_count] = e;
+
+    return plan->scalar_count++;
+}
+
+// ===========
+// Expressions
+// ===========
+
+// Whether the expression is the same on every iteration. Only the counter
+// and the scalar assigned change, since assigning more than one is refused
+// and there are no calls to change globals
+static bool is_scalar(struct expr *e)
+{
+    e = expr_ungroup(e);
+
+    switch (e->kind)
+    {
+    case EXPR_INTEGERLITERAL:
+        return true;
+    case EXPR_NAME:
+        return e->symbol->type->kind == TYPE_INTEGER && e->symbol != plan->loop.counter && e->symbol != assigned;
+    case EXPR_NEGATE:
+        return is_scalar(e->left);
+    case EXPR_ADD:
+    case EXPR_SUB:
+    case EXPR_MUL:
+        return is_scalar(e->left) && is_scalar(e->right);
+    default:
+        return false;
+    }
+}
+
+// The distance of an index from the counter, when it is the counter plus or
+// minus a constant
+static bool offset_of(struct expr *index, int64_t *offset)
+{
+    struct symbol *counter = plan->loop.counter;
+
+    index = expr_ungroup(index);
+    *offset = 0;
+
+    if (expr_is_name_of(index, counter))
+        return true;
+
+    if (index->kind != EXPR_ADD && index->kind != EXPR_SUB)
+        return false;
+
+    struct expr *left = expr_ungroup(index->left);
+    struct expr *right = expr_ungroup(index->right);
+
+    if (expr_is_name_of(left, counter) && right->kind == EXPR_INTEGERLITERAL)
+        *offset = index->kind == EXPR_ADD ? right->literal_value : -(int64_t)right->literal_value;
+    else if (index->kind == EXPR_ADD && expr_is_name_of(right, counter) && left->kind == EXPR_INTEGERLITERAL)
+        *offset = left->literal_value;
+    else
+        return false;
+
+    return true;
+}
+
+// An element of an array of integers at a distance from the counter
+static bool element_plan(struct expr *e, bool write, const char **reason)
+{
+    int64_t offset;
+
+    if (e->left->kind != EXPR_NAME || !e->type || e->type->kind != TYPE_INTEGER)
+        return fail(reason, "it indexes something other than an array of integers");
+
+    if (!offset_of(e->right, &offset))
+        return fail(reason, "an index into %s isn't the counter plus a constant", e->left->name);
+
+    access_add(e->left->symbol, offset, write);
+    step_add(write ? IR_VECTOR_STORE : IR_VECTOR_LOAD, array_find(e->left), offset, write ? -1 : 1);
+
+    return true;
+}
+
+static bool expr_plan(struct expr *e, const char **reason)
+{
+    e = expr_ungroup(e);
+
+    if (is_scalar(e))
+    {
+        step_add(IR_VECTOR_SPLAT, scalar_find(e), 0, 1);
+        return true;
+    }
+
+    switch (e->kind)
+    {
+    case EXPR_SUBSCRIPT:
+        return element_plan(e, false, reason);
+    case EXPR_ADD:
+    case EXPR_SUB:
+        if (!expr_plan(e->left, reason) || !expr_plan(e->right, reason))
+            return false;
+
+        step_add(e->kind == EXPR_ADD ? IR_VECTOR_ADD : IR_VECTOR_SUB, 0, 0, -1);
+        return true;
+    case EXPR_NEGATE:
+        if (!expr_plan(e->left, reason))
+            return false;
+
+        step_add(IR_VECTOR_NEG, 0, 0, 0);
+        return true;
+    case EXPR_NAME:
+        if (e->symbol == plan->loop.counter)
+            return fail(reason, "it uses the counter as a value");
+
+        if (e->symbol == assigned)
+            return fail(reason, "it reads %s, which it also assigns", e->name);
+
+        return fail(reason, "it reads %s, which isn't an integer", e->name);
+    case EXPR_MUL:
+        return fail(reason, "it multiplies, which SSE2 and AVX2 can't do to 64-bit integers");
+    case EXPR_CALL:
+        return fail(reason, "it calls %s", e->left->name);
+    default:
+        return fail(reason, "it computes something other than sums and differences");
+    }
+}
+
+// ==========
+// Statements
+// ==========
+
+// A sum into a scalar adds or subtracts the rest of the expression from it
+static bool reduction_plan(struct expr *e, const char **reason)
+{
+    struct expr *value = expr_ungroup(e->right);
+    struct expr *rest = NULL;
+
+    if (plan->reduction)
+        return fail(reason, "it assigns more than one scalar, or the same one twice");
+
+    plan->reduction = e->left->symbol;
+
+    if (plan->reduction->type->kind != TYPE_INTEGER)
+        return fail(reason, "it assigns %s, which isn't an integer", e->left->name);
+
+    if (value->kind == EXPR_ADD && expr_is_name_of(value->left, plan->reduction))
+        rest = value->right;
+    else if (value->kind == EXPR_ADD && expr_is_name_of(value->right, plan->reduction))
+        rest = value->left;
+    else if (value->kind == EXPR_SUB && expr_is_name_of(value->left, plan->reduction))
+        rest = value->right;
+    else
+        return fail(reason, "it assigns %s something other than a sum", e->left->name);
+
+    plan->subtracted = value->kind == EXPR_SUB;
+
+    if (!expr_plan(rest, reason))
+        return false;
+
+    step_add(IR_VECTOR_SUM, 0, 0, -1);
+    return true;
+}
+
+static bool stmt_plan(struct stmt *s, const char **reason)
+{
+    for (; s; s = s->next)
+    {
+        struct expr *e = expr_ungroup(s->expr);
+
+        if (s->kind == STMT_BLOCKSTART || s->kind == STMT_BLOCKEND)
+            continue;
+
+        if (s->kind != STMT_EXPR)
+            return fail(reason, "its body has a statement other than an assignment");
+
+        if (e->kind != EXPR_ASSIGNMENT)
+            return fail(reason, "its body has an expression other than an assignment");
+
+        if (e->left->kind == EXPR_NAME)
+        {
+            if (!reduction_plan(e, reason))
+                return false;
+        }
+        else if (!expr_plan(e->right, reason) || !element_plan(e->left, true, reason))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Arrays passed as parameters may be any other array but this function's own
+static bool may_overlap(struct symbol *a, struct symbol *b)
+{
+    if (a == b)
+        return true;
+
+    return (a->kind == SYMBOL_PARAM && b->kind != SYMBOL_LOCAL) || (b->kind == SYMBOL_PARAM && a->kind != SYMBOL_LOCAL);
+}
+
+static bool dependences_check(int width, const char **reason)
+{
+    for (int x = 0; x < access_count; x++)
+    {
+        for (int y = x + 1; y < access_count; y++)
+        {
+            struct access *a = &accesses[x];
+            struct access *b = &accesses[y];
+            int64_t distance;
+
+            if ((!a->write && !b->write) || !may_overlap(a->array, b->array))
+                continue;
+
+            if (a->array != b->array)
+                return fail(reason, "%s and %s may be the same array", a->array->name, b->array->name);
+
+            if (__builtin_sub_overflow(b->offset, a->offset, &distance) || (distance > 0 && distance < width))
+                return fail(reason, "it carries a dependence on %s across iterations", a->array->name);
+        }
+    }
+
+    return true;
+}
+
+bool vectorize_plan(struct stmt *s, int width, struct vectorize *v, const char **reason)
+{
+    struct vectorize empty = {{0}, NULL, 0, NULL, 0, NULL, 0, NULL, false};
+    bool planned;
+
+    *v = empty;
+
+    if (!unroll_recognize(s, &v->loop))
+        return fail(reason, "it isn't a counted loop, or has another loop inside");
+
+    if (v->loop.step != 1)
+        return fail(reason, "its counter steps by %ld instead of 1", (long)v->loop.step);
+
+    plan = v;
+    depth = 0;
+    max_depth = 0;
+
+    // The scalar summed into is found first, so reading it anywhere else is
+    // caught
+    for (struct stmt *b = s->body; b; b = b->next)
+    {
+        struct expr *e = b->kind == STMT_EXPR ? expr_ungroup(b->expr) : NULL;
+
+        if (e && e->kind == EXPR_ASSIGNMENT && e->left->kind == EXPR_NAME && !assigned)
+            assigned = e->left->symbol;
+    }
+
+    planned = stmt_plan(s->body, reason) && dependences_check(width, reason);
+
+    // The sum, the scalars and a zeroed register to negate with come on top
+    // of the stack
+    if (planned && 1 + v->scalar_count + max_depth + 1 > VECTOR_REGISTERS)
+        planned = fail(reason, "it needs more than %d vector registers", VECTOR_REGISTERS);
+
+    if (planned && !v->step_count)
+        planned = fail(reason, "its body is empty");
+
+    for (int n = 0; n < v->step_count; n++)
+    {
+        if (v->steps[n].kind == IR_VECTOR_SPLAT)
+            v->steps[n].arg += v->array_count;
+    }
+
+    free(accesses);
+    accesses = NULL;
+    access_count = 0;
+    assigned = NULL;
+    plan = NULL;
+
+    if (!planned)
+        vectorize_free(v);
+
+    return planned;
+}
+
+void vectorize_free(struct vectorize *v)
+{
+    free(v->arrays);
+    free(v->scalars);
+    free(v->steps);
+    v->arrays = NULL;
+    v->scalars = NULL;
+    v->steps = NULL;
+}
@@ -0,0 +1,39 @@
+#ifndef VECTORIZE_H
+#define VECTORIZE_H
+
+#include <stdbool.h>
+
+#include "ast.h"
+#include "ir.h"
+#include "unroll.h"
+
+struct symbol;
+
+// How a counted for loop runs width elements at a time. The arrays it indexes
+// and the scalars it reads are each computed once before it starts, and the
+// steps name them by their position, arrays first
+struct vectorize
+{
+    struct unroll loop;
+
+    struct expr **arrays;
+    int array_count;
+    struct expr **scalars;
+    int scalar_count;
+
+    struct ir_vector_step *steps;
+    int step_count;
+
+    // The variable the loop sums into, if any, and whether the sum is
+    // subtracted from it instead
+    struct symbol *reduction;
+    bool subtracted;
+};
+
+// Decides whether a for loop can be vectorized. When it can't, returns false
+// with reason saying why
+bool vectorize_plan(struct stmt *s, int width, struct vectorize *v, const char **reason);
+
+void vectorize_free(struct vectorize *v);
+
+#endif
@@ -0,0 +1,66 @@
+#!/bin/sh
+
+# Checks that each of the peephole optimizer's patterns rewrites the code it is
+# meant to, and leaves alone the code it must not touch.
+
+# Each NAME.bminor is compiled with the options on the first line of
+# NAME.expected, and verbose output, which counts how often each pattern was
+# applied. Every other line of NAME.expected is a pattern for grep -E that has
+# to match a line of that output or of the assembly written, or that must not
+# match any line when it starts with "! ".
+
+# For example:
+#     tests/peephole/peephole.sh ./bminor
+
+SCRIPT_DIR=$(dirname "$0")
+COMPILER=${1:-$SCRIPT_DIR/../../bminor}
+
+LINES=-------------------------------------------
+
+EXIT_CODE=0
+
+for FILENAME in $SCRIPT_DIR/*.bminor; do
+    NAME=${FILENAME%.bminor}
+    OPTIONS=$(head -n 1 "${NAME}.expected")
+
+    $COMPILER --codegen $OPTIONS -v -o "${NAME}.s" "${FILENAME}" > "${NAME}.out" 2>&1
+    cat "${NAME}.s" >> "${NAME}.out"
+
+    FAILED=0
+
+    tail -n +2 "${NAME}.expected" > "${NAME}.patterns"
+
+    while IFS= read -r PATTERN; do
+        case "$PATTERN" in
+        "! "*)
+            if grep -E -q -e "${PATTERN#! }" "${NAME}.out"; then
+                echo "${FILENAME} has a line matching '${PATTERN#! }'"
+                FAILED=1
+            fi
+            ;;
+        *)
+            if ! grep -E -q -e "$PATTERN" "${NAME}.out"; then
+                echo "${FILENAME} has no line matching '${PATTERN}'"
+                FAILED=1
+            fi
+            ;;
+        esac
+    done < "${NAME}.patterns"
+
+    if [ "$FAILED" -eq 0 ]; then
+        echo "${FILENAME} success (as expected)"
+    else
+        echo ${LINES}
+        cat "${NAME}.out"
+        echo ${LINES}
+        EXIT_CODE=1
+    fi
+
+    rm -f "${NAME}.patterns"
+done
+
+if [ "$EXIT_CODE" -eq 1 ]; then
+    echo "=== Peephole optimizer test FAILED ==="
+fi
+
+return $EXIT_CODE